@@ -31,17 +31,43 @@ using PFN_vkCmdCopyBuffer = decltype(vkCmdCopyBuffer);
 
 #include "arcball.hpp"
 #include "camera.hpp"
+#include "deletion_queue.hpp"
+#include "dynamic_resolution.hpp"
 #include "expected.hpp"
+#include "frame_ring.hpp"
 #include "glm/common.hpp"
 #include "glm/mat4x4.hpp"
 #include "glm/gtc/matrix_transform.hpp"
-#include "glm/gtc/type_ptr.hpp"
 #include "gsl/gsl-lite.hpp"
+#include "instance_culling.hpp"
+#include "memory_accounting.hpp"
+#include "mesh_instancing.hpp"
+#include "obj_loader.hpp"
+#include "present_barriers.hpp"
+#include "queue_selection.hpp"
+#include "render_server.hpp"
+#include "sample_tables.hpp"
+#include "scene_file.hpp"
+#include "scene_generator.hpp"
 #include "shader_binding_table_generator.hpp"
+#include "shader_binding_table_layout.hpp"
+#include "shared_frame_ring.hpp"
+#include "sphere_shader.hpp"
+#include "sphere_store.hpp"
+#include "submit_graph.hpp"
+#include "tonemap.hpp"
+#include "triangle_mesh.hpp"
+#include "video_stream.hpp"
 #include "vk_result.hpp"
+#include <algorithm>
 #include <array>
+#include <cinttypes>
 #include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
 #include <system_error>
+#include <thread>
 #include <vector>
 
 #ifdef NDEBUG
@@ -90,6 +116,7 @@ static std::array<gsl::czstring, 5> sDeviceExtensions = {
 
 static GLFWwindow* sWindow = nullptr;
 static bool sFramebufferResized = false;
+static bool sDumpMemoryReport = false;
 
 static VkInstance sInstance = VK_NULL_HANDLE;
 static VkDebugUtilsMessengerEXT sDebugUtilsMessenger = VK_NULL_HANDLE;
@@ -99,7 +126,21 @@ static std::uint32_t sQueueFamilyIndex = UINT32_MAX;
 static VkDevice sDevice = VK_NULL_HANDLE;
 static VkQueue sQueue = VK_NULL_HANDLE;
 static VkCommandPool sCommandPool = VK_NULL_HANDLE;
+
+// Acceleration structure builds are submitted here. When the device has no
+// separate compute family these alias the graphics family and sQueue.
+static QueueFamilySelection sQueueFamilies;
+static std::uint32_t sComputeQueueFamilyIndex = UINT32_MAX;
+static VkQueue sComputeQueue = VK_NULL_HANDLE;
+static VkCommandPool sComputeCommandPool = VK_NULL_HANDLE;
+
+// In debug builds every queue submit and present is recorded here and
+// checked for semaphore and ownership transfer errors.
+#ifndef NDEBUG
+static SubmitGraph sSubmitGraph;
+#endif
 static VmaAllocator sAllocator = VK_NULL_HANDLE;
+static MemoryAccounting sMemoryAccounting;
 
 static VkSurfaceFormatKHR sSurfaceColorFormat = {
   VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
@@ -112,76 +153,371 @@ static VkExtent2D sSwapchainExtent;
 static std::vector<VkImage> sSwapchainImages;
 static std::vector<VkImageView> sSwapchainImageViews;
 
+// Whether the tonemap pass writes the swapchain images through
+// sSwapchainImageViews or writes sOutputImage to be copied into them.
+// CreateSwapchain chooses from what the surface supports.
+static PresentPath sPresentPath = PresentPath::kCopy;
+
+// What a frame records into, one per sFrameRing slot, whichever swapchain
+// image the frame renders to. Its camera is at the slot's offset in
+// sUniformBuffer.
+//
+// When frames are exported or recorded, the frame also copies sOutputImage
+// into its readback buffer, and the copy is published to sFrameExport and
+// written to sVideoStream once the frame is seen complete, when its slot
+// comes round again. Reading back through the ring never waits on the GPU.
+//
+// Each slot also has a TLAS of its own, which only its frames build and
+// trace, so the rebuild for frame N+1 can run on sComputeQueue while frame
+// N still traces its TLAS. See RecordTopLevelRebuild.
 struct Frame {
   VkSemaphore imageAvailable{VK_NULL_HANDLE};
   VkCommandPool commandPool{VK_NULL_HANDLE};
   VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
-  VkFramebuffer framebuffer{VK_NULL_HANDLE};
+  VkFence complete{VK_NULL_HANDLE};
+  double inputTime{0.0}; // glfwGetTime() when the camera was sampled
+
+  VkBuffer readback{VK_NULL_HANDLE};
+  VmaAllocation readbackAllocation{VK_NULL_HANDLE};
+  VkDeviceSize readbackSize{0};
+  VkExtent2D readbackExtent{0, 0};
+  bool readbackPending{false}; // recorded, not yet published
+
+  // The frame wrote its slot's range of sQueryPool, not yet read, and
+  // rebuilt the TLAS with this many instances, if any.
+  bool queriesPending{false};
+  std::uint32_t topLevelBuildInstances{0};
+
+  // The frame whose present the acquire this frame waits on finishes, or 0.
+  std::uint64_t releasedPresent{0};
+
+  // The slot's TLAS and build scratch, holding builtInstances over the
+  // sphere BLAS as of its builtRefit'th refit. A rebuild on sComputeQueue
+  // is recorded into topLevelBuild and signals topLevelBuilt, which the
+  // frame's trace waits on if topLevelBuildPending.
+  VkAccelerationStructureNV topLevel{VK_NULL_HANDLE};
+  VmaAllocation topLevelAllocation{VK_NULL_HANDLE};
+  VkBuffer topLevelScratch{VK_NULL_HANDLE};
+  VmaAllocation topLevelScratchAllocation{VK_NULL_HANDLE};
+  std::vector<std::uint32_t> builtInstances{};
+  std::uint64_t builtRefit{0};
+  VkCommandPool computeCommandPool{VK_NULL_HANDLE};
+  VkCommandBuffer topLevelBuild{VK_NULL_HANDLE};
+  VkSemaphore topLevelBuilt{VK_NULL_HANDLE};
+  bool topLevelBuildPending{false};
 }; // struct Frame
 
-static std::uint32_t sCurrentFrame = 0;
+static FrameRing sFrameRing;
 static std::vector<Frame> sFrames;
-static std::vector<VkFence> sFramesComplete;
-static VkSemaphore sRenderFinished = VK_NULL_HANDLE;
+
+// Frames published to other processes with --export, in RGBA8.
+static std::string sExportName;
+static SharedFrameWriter sFrameExport;
+static constexpr std::uint32_t const kExportSlots = 4;
+
+// Frames recorded with --video, at the size the window opened with; frames
+// of any other size, after a resize, are dropped. The stream writes on a
+// thread of its own, so Draw only converts.
+static std::string sVideoPath;
+static VideoFormat sVideoFormat{VideoFormat::kY4M};
+static VideoStream sVideoStream;
+static std::vector<std::uint8_t> sVideoPixels;
+static std::uint64_t sVideoDropped{0};
+static constexpr std::uint32_t const kVideoFramesPerSecond = 60;
+
+// Where the renderer's reports go: stderr once --video - makes stdout the
+// stream an encoder reads.
+static std::FILE* sReports = stdout;
+
+// --serve: the address the render server listens on instead of drawing to
+// the window, which stays hidden. A batch of views is traced as the layers
+// of one launch into sServeHDRImage, stacked top to bottom, tonemapped into
+// sServeOutputImage and read back into sServeReadback, all of which grow to
+// the largest batch yet.
+static std::string sServeAddress;
+static VkExtent2D sServeExtent{0, 0};
+static VkImage sServeHDRImage = VK_NULL_HANDLE;
+static VmaAllocation sServeHDRImageAllocation = VK_NULL_HANDLE;
+static VkImageView sServeHDRImageView = VK_NULL_HANDLE;
+static VkImage sServeOutputImage = VK_NULL_HANDLE;
+static VmaAllocation sServeOutputImageAllocation = VK_NULL_HANDLE;
+static VkImageView sServeOutputImageView = VK_NULL_HANDLE;
+static VkBuffer sServeReadback = VK_NULL_HANDLE;
+static VmaAllocation sServeReadbackAllocation = VK_NULL_HANDLE;
+static VkDescriptorPool sServeDescriptorPool = VK_NULL_HANDLE;
+static VkDescriptorSet sServeDescriptorSet = VK_NULL_HANDLE;
+static VkDescriptorSet sServeTonemapDescriptorSet = VK_NULL_HANDLE;
+
+// Per swapchain image, indexed by sImageIndex. Present waits on the image's
+// sRenderFinished, which is not signaled again until the image has been
+// presented and acquired again. sRenderFinished only grows, as a semaphore
+// a present may still wait on is never destroyed.
+static std::uint32_t sImageIndex = 0;
+static std::vector<VkFramebuffer> sFramebuffers;
+static std::vector<VkSemaphore> sRenderFinished;
+
+// Serial of the last submitted frame and of the newest frame known to have
+// completed, as sFrameRing numbers them. Resources retired to sDeletionQueue
+// are stamped with sSubmittedFrame.
+static std::uint64_t sSubmittedFrame = 0;
+static std::uint64_t sCompletedFrame = 0;
+static DeletionQueue sDeletionQueue;
+
+// A present signals no fence, so a frame's fence completing says nothing of
+// its present. A present is known done once its image is acquired again
+// and the frame waiting on that acquire completes, and as presents are
+// shown in order, so is every present before it, those to a retired
+// swapchain included. sImagePresentedFrame is the frame last presented
+// from each image of sSwapchain, and sPresentedFrameDone the newest frame
+// whose present is known done. Retired swapchains go to
+// sPresentDeletionQueue stamped with the last frame presented to them.
+static std::vector<std::uint64_t> sImagePresentedFrame;
+static std::uint64_t sPresentedFrameDone = 0;
+static DeletionQueue sPresentDeletionQueue;
+
+// Seconds from sampling the camera to seeing the frame complete, summed
+// over the frames seen complete since the last report.
+static double sInputLatencySum = 0.0;
+static std::uint64_t sInputLatencyCount = 0;
 
 static VkDescriptorPool sDescriptorPool = VK_NULL_HANDLE;
 static VkQueryPool sQueryPool = VK_NULL_HANDLE;
+static float sTimestampPeriod = 1.f; // nanoseconds per timestamp tick
 
 static VkDescriptorSetLayout sDescriptorSetLayout = VK_NULL_HANDLE;
 static VkPipelineLayout sPipelineLayout = VK_NULL_HANDLE;
 static VkPipeline sPipeline = VK_NULL_HANDLE;
 
+// The Camera block of 01_sphere.rgen, a camera per layer of the launch.
 struct UniformBuffer {
-  glm::vec4 Eye;
-  glm::vec4 U;
-  glm::vec4 V;
-  glm::vec4 W;
+  glm::vec4 Eye[shader::kMaxLaunchViews];
+  glm::vec4 U[shader::kMaxLaunchViews];
+  glm::vec4 V[shader::kMaxLaunchViews];
+  glm::vec4 W[shader::kMaxLaunchViews];
+  std::uint32_t SampleCount; // per pixel, 1 for the pixel center
 }; // struct UniformBuffer
 
+// One UniformBuffer per sFrameRing slot, sUniformBufferStride bytes apart
+// and bound with a dynamic offset, so the camera of a frame still in flight
+// is never overwritten.
 static VkBuffer sUniformBuffer = VK_NULL_HANDLE;
 static VmaAllocation sUniformBufferAllocation = VK_NULL_HANDLE;
+static VkDeviceSize sUniformBufferStride = 0;
 
+// Only created on PresentPath::kCopy.
 static VkImage sOutputImage = VK_NULL_HANDLE;
 static VmaAllocation sOutputImageAllocation = VK_NULL_HANDLE;
 static VkImageView sOutputImageView = VK_NULL_HANDLE;
 
-struct Sphere {
-  glm::vec3 aabbMin;
-  glm::vec3 aabbMax;
-
-  Sphere(glm::vec3 center, float radius) noexcept
-    : aabbMin(center - glm::vec3(radius))
-    , aabbMax(center + glm::vec3(radius)) {}
-
-  glm::vec3 center() const noexcept {
-    return (aabbMax + aabbMin) / glm::vec3(2.f);
-  }
-
-  float radius() const noexcept { return (aabbMax.x - aabbMin.x) / 2.f; }
-}; // struct Spheres
+// Traced radiance, tonemapped and upscaled into sOutputImage. It is allocated
+// at the swapchain extent and only the top left RenderExtent() pixels are
+// traced, so changing sRenderScale does not reallocate anything.
+static VkImage sHDRImage = VK_NULL_HANDLE;
+static VmaAllocation sHDRImageAllocation = VK_NULL_HANDLE;
+static VkImageView sHDRImageView = VK_NULL_HANDLE;
+
+static constexpr float const kMinRenderScale = .25f;
+static constexpr float const kMaxRenderScale = 1.f;
+static float sRenderScale = kMaxRenderScale;
+static TonemapParams sTonemapParams;
+
+// Drives sRenderScale from the measured trace time unless the scale is set
+// by hand.
+static bool sDynamicResolutionEnabled = true;
+static DynamicResolutionController sDynamicResolution(
+  DynamicResolutionController::Config{8.f /* targetMs */, kMinRenderScale,
+                                      kMaxRenderScale});
+
+struct TonemapPushConstants {
+  std::int32_t renderExtent[2];
+  std::int32_t outputExtent[2];
+  float exposure;
+  std::uint32_t filterMode;
+}; // struct TonemapPushConstants
+
+static VkDescriptorSetLayout sTonemapDescriptorSetLayout = VK_NULL_HANDLE;
+static VkPipelineLayout sTonemapPipelineLayout = VK_NULL_HANDLE;
+static VkPipeline sTonemapPipeline = VK_NULL_HANDLE;
+// One writing each swapchain image on PresentPath::kDirect, indexed by
+// sImageIndex; one writing sOutputImage on PresentPath::kCopy.
+static std::vector<VkDescriptorSet> sTonemapDescriptorSets;
+
+// Declared in sphere_shader.hpp, with the shaders that read it.
+using shader::Sphere;
+
+static_assert(sizeof(Sphere) == sizeof(SceneSphere));
+static_assert(offsetof(Sphere, aabbMin) == offsetof(SceneSphere, aabbMin));
+static_assert(offsetof(Sphere, aabbMax) == offsetof(SceneSphere, aabbMax));
 
 static std::array<Sphere, 2> sSpheres = {
-  Sphere(glm::vec3(0.f, 0.f, 0.f), .5f),
-  Sphere(glm::vec3(0.f, -100.5f, 0.f), 100.f),
+  shader::MakeSphere(glm::vec3(0.f, 0.f, 0.f), .5f),
+  shader::MakeSphere(glm::vec3(0.f, -100.5f, 0.f), 100.f),
 };
 
+// The scene file named on the command line, if any, or the procedural
+// scene requested with --generate. sSceneSpheres points into the file's
+// mapping, at sGeneratedSpheres or at sSpheres.
+static gsl::czstring sSceneFilename = nullptr;
+static SceneFile sSceneFile;
+static bool sGenerateScene = false;
+static SceneGeneratorParams sSceneGeneratorParams;
+static std::vector<SceneSphere> sGeneratedSpheres;
+static gsl::span<Sphere const> sSceneSpheres = sSpheres;
+
+// World bounds of sSceneSpheres, taken by CreateSpheresBuffer as it copies
+// them.
+static InstanceBounds sSceneSphereBounds;
+
 static VkBuffer sSpheresBuffer = VK_NULL_HANDLE;
 static VmaAllocation sSpheresBufferAllocation = VK_NULL_HANDLE;
 
+// The spheres --animate moves, a fraction of them each frame (see
+// AnimateSpheres). Each frame copies just the ranges of them that changed
+// into sSpheresBuffer, with one region a range, and refits the sphere BLAS
+// in place using sSpheresUpdateScratch; a frame that changes none does
+// neither. Merging ranges across a gap of two spheres trades a few bytes
+// for fewer regions (see scene_tool updates).
+static double sAnimateFraction = 0.0;
+static SphereStore sSphereStore;
+static std::uint64_t sAnimationFrame = 0;
+static std::vector<DirtyRange> sSphereRanges;
+static std::vector<VkBufferCopy> sSphereRegions;
+static SphereUpdateStats sSphereUpdateStats; // of the last update
+static std::uint64_t sSphereRefitCount = 0;
+static std::uint64_t sSphereRefitFrame = 0; // of the last refit
+static VkBuffer sSpheresUpdateScratch = VK_NULL_HANDLE;
+static VmaAllocation sSpheresUpdateScratchAllocation = VK_NULL_HANDLE;
+static constexpr std::uint64_t kSphereUpdateMaxGap = 2;
+
+// The triangle meshes named with --mesh, and sMeshCopies instances of
+// each. Meshes with identical encoded geometry share one sMeshLibrary entry
+// and so one BLAS, which every instance of them references.
+struct MeshFile {
+  gsl::czstring filename;
+  VertexFormat format;
+};
+
+static std::vector<MeshFile> sMeshFiles;
+static std::uint64_t sMeshCopies = 1;
+static MeshLibrary sMeshLibrary;
+static TransformStream sMeshInstanceTransforms;
+static std::vector<std::uint32_t> sMeshInstanceMeshes; // sMeshLibrary ids
+
+// The device side of an sMeshLibrary mesh. Its face normals start at
+// firstNormal in sMeshNormalsBuffer, which its instances pass to the hit
+// shader as their custom index.
+struct MeshBuffers {
+  VkBuffer vertexBuffer{VK_NULL_HANDLE};
+  VmaAllocation vertexBufferAllocation{VK_NULL_HANDLE};
+  VkBuffer indexBuffer{VK_NULL_HANDLE};
+  VmaAllocation indexBufferAllocation{VK_NULL_HANDLE};
+  VkAccelerationStructureNV bottomLevelAccelerationStructure{VK_NULL_HANDLE};
+  VmaAllocation bottomLevelAccelerationStructureAllocation{VK_NULL_HANDLE};
+  VkDeviceSize bottomLevelAccelerationStructureSize{0};
+  std::uint32_t firstNormal{0};
+};
+
+static std::vector<MeshBuffers> sMeshes; // indexed by sMeshLibrary id
+
+// The face normals of every mesh. It exists even without a mesh, holding
+// one normal, because the triangle hit shader statically uses it.
+static VkBuffer sMeshNormalsBuffer = VK_NULL_HANDLE;
+static VmaAllocation sMeshNormalsBufferAllocation = VK_NULL_HANDLE;
+
+// The ray generation shader's sampler tables (see sampling_shader.hpp), and
+// the samples per pixel set with --samples.
+static VkBuffer sSampleTablesBuffer = VK_NULL_HANDLE;
+static VmaAllocation sSampleTablesBufferAllocation = VK_NULL_HANDLE;
+static std::uint32_t sSamplesPerPixel = 1;
+static constexpr std::uint32_t const kMaxSamplesPerPixel = 1024;
+
 static VkAccelerationStructureNV sBottomLevelAccelerationStructure =
   VK_NULL_HANDLE;
 static VmaAllocation sBottomLevelAccelerationStructureAllocation =
   VK_NULL_HANDLE;
 
-static VkAccelerationStructureNV sTopLevelAccelerationStructure =
-  VK_NULL_HANDLE;
-static VmaAllocation sTopLevelAccelerationStructureAllocation = VK_NULL_HANDLE;
+// Command buffer the BLAS and TLAS builds are recorded into, and the semaphore
+// the first frame that traces them waits on. sAccelerationStructuresPending
+// is set until a frame has waited on the semaphore and taken back ownership
+// of sSpheresBuffer.
+static VkCommandBuffer sAccelerationStructureBuild = VK_NULL_HANDLE;
+static VkSemaphore sAccelerationStructuresBuilt = VK_NULL_HANDLE;
+static bool sAccelerationStructuresPending = false;
+
+struct VkGeometryInstanceNV {
+  float transform[12];
+  std::uint32_t instanceCustomIndex : 24;
+  std::uint32_t mask : 8;
+  std::uint32_t instanceOffset : 24;
+  std::uint32_t flags : 8;
+  std::uint64_t accelerationStructureHandle;
+};
+
+// Every instance of the scene, with its world bounds. Each frame slot's TLAS
+// is created for all of them; each frame only the instances within
+// sInstanceCullMargin of the view frustum are built into it, and it is
+// rebuilt whenever that set changes or the sphere BLAS has been refit since
+// the slot's last build.
+static std::vector<VkGeometryInstanceNV> sTopLevelInstances;
+static std::vector<InstanceBounds> sTopLevelInstanceBounds;
+static InstanceCuller sInstanceCuller;
+static bool sInstanceCullingEnabled = true;
+static float sInstanceCullMargin = 0.f;
+static std::vector<std::uint32_t> sCulledInstances;
+static InstanceCullStats sInstanceCullStats;
+static double sInstanceCullMs = 0.0;
+
+// Whether the compute family writes timestamps, so TLAS rebuilds on it can
+// be timed.
+static bool sComputeTimestamps = false;
+
+// sQueryPool queries of each ring slot, starting at slot.index *
+// kFrameQueryCount: the frame's begin and end, the begin and end of its
+// trace, and the pair around its TLAS rebuild, if it rebuilt the TLAS. A
+// slot's queries are read once its fence has signaled, so they are never
+// read while their reset may still be pending.
+static constexpr std::uint32_t kFrameQueryCount = 6;
+static constexpr std::uint32_t kTraceQuery = 2;
+static constexpr std::uint32_t kTopLevelBuildQuery = 4;
+
+// Timings of the newest frame seen complete, and of the newest TLAS rebuild
+// seen complete.
+static double sFramePipeMs = 0.0;
+static double sFrameTraceMs = 0.0;
+static double sTopLevelBuildMs = 0.0;
+static std::uint32_t sTopLevelBuildInstanceCount = 0;
+
+// The SBT for the groups created in CreatePipeline, for devices with 16 byte
+// shader group handles and 64 byte shaderGroupBaseAlignment. Instances pick
+// their hit group with instanceOffset: 0 for spheres, 1 for triangles.
+using SphereShaderBindingTableLayout = ShaderBindingTableLayout<
+  16, 64, SBTSection<SBTRecord<0>>, SBTSection<SBTRecord<1>>,
+  SBTSection<SBTRecord<2, shader::SphereMaterial>, SBTRecord<3>>>;
 
 static std::uint32_t sShaderGroupHandleSize = 0;
+static std::uint32_t sShaderGroupBaseAlignment = 0;
 static ShaderBindingTableGenerator sShaderBindingTableGenerator;
 static VkBuffer sShaderBindingTable = VK_NULL_HANDLE;
 static VmaAllocation sShaderBindingTableAllocation = VK_NULL_HANDLE;
 
+// Dirty records are patched in sShaderBindingTableHost, which always holds
+// the whole table, and only the regions to copy are written to the frame
+// slot's slice of the mapped staging buffer, so a patch never touches bytes
+// an earlier frame's copy may still be reading. Draw's wait on the slot's
+// fence retires its slice.
+static std::vector<std::byte> sShaderBindingTableHost;
+static VkBuffer sShaderBindingTableStaging = VK_NULL_HANDLE;
+static VmaAllocation sShaderBindingTableStagingAllocation = VK_NULL_HANDLE;
+static std::byte* sShaderBindingTableStagingData = nullptr;
+static std::vector<VkBufferCopy> sShaderBindingTableRegions;
+
+// The sphere hit group's inline data; T cycles through kSphereTints by
+// patching that one record.
+static constexpr std::array<shader::SphereMaterial, 3> const kSphereTints = {
+  {{{1.f, 1.f, 1.f}}, {{1.f, .6f, .3f}}, {{.4f, .7f, 1.f}}}};
+static std::size_t sSphereTint = 0;
+static std::size_t sSphereHitRecord = 0;
+
 static std::vector<VkDescriptorSet> sDescriptorSets;
 
 static void MouseButtonChanged(GLFWwindow*, int button, int action, int) {
@@ -240,6 +576,170 @@ static void FramebufferResized(GLFWwindow*, int, int) noexcept {
   sFramebufferResized = true;
 }
 
+static VkExtent2D RenderExtent() noexcept {
+  auto scaled = [](std::uint32_t size) {
+    return std::max(1u, static_cast<std::uint32_t>(size * sRenderScale + .5f));
+  };
+  return {scaled(sSwapchainExtent.width), scaled(sSwapchainExtent.height)};
+}
+
+static void KeyChanged(GLFWwindow*, int key, int, int action, int) noexcept {
+  if (action != GLFW_PRESS) return;
+
+  switch (key) {
+  case GLFW_KEY_M: sDumpMemoryReport = true; break;
+  case GLFW_KEY_MINUS:
+    sDynamicResolutionEnabled = false;
+    sRenderScale = std::max(sRenderScale - .125f, kMinRenderScale);
+    break;
+  case GLFW_KEY_EQUAL:
+    sDynamicResolutionEnabled = false;
+    sRenderScale = std::min(sRenderScale + .125f, kMaxRenderScale);
+    break;
+  case GLFW_KEY_D:
+    sDynamicResolutionEnabled = !sDynamicResolutionEnabled;
+    if (sDynamicResolutionEnabled) sDynamicResolution.Reset(sRenderScale);
+    std::fprintf(sReports, "dynamic resolution: %s\n",
+                 sDynamicResolutionEnabled ? "on" : "off");
+    return;
+  case GLFW_KEY_C:
+    sInstanceCullingEnabled = !sInstanceCullingEnabled;
+    std::fprintf(sReports, "instance culling: %s\n",
+                 sInstanceCullingEnabled ? "on" : "off");
+    return;
+  case GLFW_KEY_L:
+    sFrameRing.SetMode(sFrameRing.Mode() == LatencyMode::kThroughput
+                         ? LatencyMode::kLowLatency
+                         : LatencyMode::kThroughput);
+    std::fprintf(sReports, "latency mode: %s, %u frames in flight\n",
+                 to_string(sFrameRing.Mode()), sFrameRing.Size());
+    return;
+  case GLFW_KEY_T:
+    sSphereTint = (sSphereTint + 1) % kSphereTints.size();
+    sShaderBindingTableGenerator.UpdateInlineData(
+      ShaderBindingTableGenerator::Section::kHitGroup, sSphereHitRecord,
+      gsl::as_bytes(gsl::make_span(&kSphereTints[sSphereTint], 1)));
+    std::fprintf(sReports, "sphere tint: %zu of %zu\n", sSphereTint + 1,
+                 kSphereTints.size());
+    return;
+  case GLFW_KEY_F:
+    sTonemapParams.filter = sTonemapParams.filter == UpscaleFilter::kBilinear
+                              ? UpscaleFilter::kBicubic
+                              : UpscaleFilter::kBilinear;
+    break;
+  default: return;
+  }
+
+  if (key != GLFW_KEY_M) {
+    VkExtent2D const extent = RenderExtent();
+    std::fprintf(sReports, "render scale: %g (%ux%u) %s\n", sRenderScale,
+                 extent.width, extent.height,
+                 to_string(sTonemapParams.filter));
+  }
+} // KeyChanged
+
+// Names the allocation "Category/objectName" so the allocator's JSON dump
+// groups allocations the same way as sMemoryAccounting, and records its size.
+// The allocation must have been created with
+// VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT.
+static void TrackAllocation(VmaAllocation allocation, MemoryCategory category,
+                            gsl::czstring objectName) noexcept {
+  std::string name = to_string(category);
+  name += '/';
+  name += objectName;
+  vmaSetAllocationUserData(sAllocator, allocation, name.data());
+
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(sAllocator, allocation, &info);
+  sMemoryAccounting.Allocated(category, info.size);
+} // TrackAllocation
+
+static void DestroyTrackedBuffer(VkBuffer buffer, VmaAllocation allocation,
+                                 MemoryCategory category) noexcept {
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(sAllocator, allocation, &info);
+  sMemoryAccounting.Freed(category, info.size);
+  vmaDestroyBuffer(sAllocator, buffer, allocation);
+} // DestroyTrackedBuffer
+
+static void DestroyTrackedImage(VkImage image, VmaAllocation allocation,
+                                MemoryCategory category) noexcept {
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(sAllocator, allocation, &info);
+  sMemoryAccounting.Freed(category, info.size);
+  vmaDestroyImage(sAllocator, image, allocation);
+} // DestroyTrackedImage
+
+// Print per-category totals and peaks along with the allocator's own
+// per-heap statistics and allocation list as one JSON document.
+static void DumpMemoryReport(std::FILE* stream) noexcept {
+  char* allocatorJson = nullptr;
+  vmaBuildStatsString(sAllocator, &allocatorJson, VK_TRUE);
+  std::fputs(sMemoryAccounting.ToJson(allocatorJson).c_str(), stream);
+  vmaFreeStatsString(sAllocator, allocatorJson);
+} // DumpMemoryReport
+
+template <class T>
+[[nodiscard]] std::uint64_t HandleId(T handle) noexcept {
+  return reinterpret_cast<std::uint64_t>(handle);
+} // HandleId
+
+#ifndef NDEBUG
+static void ReportSubmitGraphError(std::string const& error) noexcept {
+  if (!error.empty()) std::fprintf(stderr, "submit graph: %s\n", error.c_str());
+} // ReportSubmitGraphError
+#endif
+
+// Record submitInfo in sSubmitGraph in debug builds, then submit it to the
+// queue for role. releases and acquires name the buffers whose queue family
+// ownership the command buffers release or acquire.
+static VkResult QueueSubmit(
+  QueueRole role, [[maybe_unused]] gsl::czstring name,
+  VkSubmitInfo const& submitInfo, VkFence fence,
+  [[maybe_unused]] std::vector<std::uint64_t> releases = {},
+  [[maybe_unused]] std::vector<std::uint64_t> acquires = {}) noexcept {
+#ifndef NDEBUG
+  SubmitGraph::Submit submit{role, name};
+  for (std::uint32_t i = 0; i < submitInfo.waitSemaphoreCount; ++i) {
+    submit.waits.push_back({HandleId(submitInfo.pWaitSemaphores[i]),
+                            submitInfo.pWaitDstStageMask[i]});
+  }
+  for (std::uint32_t i = 0; i < submitInfo.signalSemaphoreCount; ++i) {
+    submit.signals.push_back(HandleId(submitInfo.pSignalSemaphores[i]));
+  }
+  submit.releases = std::move(releases);
+  submit.acquires = std::move(acquires);
+  ReportSubmitGraphError(sSubmitGraph.Record(std::move(submit)));
+#endif
+
+  VkQueue queue = role == QueueRole::kCompute ? sComputeQueue : sQueue;
+  return vkQueueSubmit(queue, 1, &submitInfo, fence);
+} // QueueSubmit
+
+// A barrier that transfers ownership of buffer from srcFamily to dstFamily,
+// or a plain memory barrier if they are the same family. Recorded once on
+// each queue: the release with dstAccess 0, the acquire with srcAccess 0.
+[[nodiscard]] static VkBufferMemoryBarrier
+OwnershipTransfer(VkBuffer buffer, VkAccessFlags srcAccess,
+                  VkAccessFlags dstAccess, std::uint32_t srcFamily,
+                  std::uint32_t dstFamily) noexcept {
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = srcAccess;
+  barrier.dstAccessMask = dstAccess;
+  if (srcFamily == dstFamily) {
+    barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex =
+      VK_QUEUE_FAMILY_IGNORED;
+  } else {
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+  }
+  barrier.buffer = buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  return barrier;
+} // OwnershipTransfer
+
 static int sErrorCode;
 static std::string sErrorMessage;
 
@@ -255,6 +755,7 @@ static tl::expected<void, std::system_error> InitWindow() noexcept {
   glfwSetErrorCallback(ErrorCallback);
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+  if (!sServeAddress.empty()) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
   sWindow = glfwCreateWindow(kWindowWidth, kWindowHeight, "01_sphere", nullptr,
                              nullptr);
 
@@ -267,6 +768,7 @@ static tl::expected<void, std::system_error> InitWindow() noexcept {
   glfwSetMouseButtonCallback(sWindow, MouseButtonChanged);
   glfwSetCursorPosCallback(sWindow, CursorMoved);
   glfwSetFramebufferSizeCallback(sWindow, FramebufferResized);
+  glfwSetKeyCallback(sWindow, KeyChanged);
 
   Ensures(sWindow != nullptr);
 
@@ -607,6 +1109,33 @@ ComparePhysicalDeviceFeatures(VkPhysicalDeviceFeatures2 a,
   return true;
 } // IsPhysicalDeviceGood
 
+// The queue families of device to draw and present to sSurface with and to
+// build acceleration structures with.
+static tl::expected<QueueFamilySelection, std::system_error>
+GetQueueFamilies(VkPhysicalDevice device) noexcept {
+  Expects(device != VK_NULL_HANDLE);
+  Expects(sSurface != VK_NULL_HANDLE);
+
+  std::uint32_t count;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(count);
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &count, families.data());
+
+  std::vector<VkBool32> presentSupport(count, VK_FALSE);
+  for (std::uint32_t i = 0; i < count; ++i) {
+    if (auto result = vkGetPhysicalDeviceSurfaceSupportKHR(
+          device, i, sSurface, &presentSupport[i]);
+        result != VK_SUCCESS) {
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result),
+                          "vkGetPhysicalDeviceSurfaceSupportKHR"));
+    }
+  }
+
+  return SelectQueueFamilies(families, presentSupport,
+                             VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+} // GetQueueFamilies
+
 static tl::expected<void, std::system_error> ChoosePhysicalDevice() noexcept {
   LOG_ENTER();
   Expects(sInstance != VK_NULL_HANDLE);
@@ -626,6 +1155,9 @@ static tl::expected<void, std::system_error> ChoosePhysicalDevice() noexcept {
   sDeviceFeatures.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
   sDeviceFeatures.features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
   sDeviceFeatures.features.shaderStorageImageArrayDynamicIndexing = VK_TRUE;
+  // 01_sphere_tonemap.comp writes the surface format, which need not be one
+  // a storage image can be declared with.
+  sDeviceFeatures.features.shaderStorageImageWriteWithoutFormat = VK_TRUE;
   sDeviceFeatures.features.shaderClipDistance = VK_TRUE;
   sDeviceFeatures.features.shaderCullDistance = VK_TRUE;
   sDeviceFeatures.features.shaderFloat64 = VK_TRUE;
@@ -649,19 +1181,40 @@ static tl::expected<void, std::system_error> ChoosePhysicalDevice() noexcept {
   }
 
   for (auto&& device : devices) {
-    if (auto good =
-          IsPhysicalDeviceGood(device, sDeviceFeatures, sDeviceExtensions,
-                               VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) {
+    auto good =
+      IsPhysicalDeviceGood(device, sDeviceFeatures, sDeviceExtensions,
+                           VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    if (!good || !*good) continue;
+
+    auto families = GetQueueFamilies(device);
+    if (!families) {
+      LOG_LEAVE();
+      return tl::unexpected(families.error());
+    }
+    if (families->Valid()) {
       sPhysicalDevice = device;
+      sQueueFamilies = *families;
       break;
     }
   }
 
-  sQueueFamilyIndex = GetQueueFamilyIndex(
-    sPhysicalDevice, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+  if (sPhysicalDevice == VK_NULL_HANDLE) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(
+      vk::make_error_code(VK_ERROR_INITIALIZATION_FAILED),
+      "No physical device with the required features that can present"));
+  }
+
+  sQueueFamilyIndex = sQueueFamilies.graphics;
+  sComputeQueueFamilyIndex = sQueueFamilies.compute;
+
+  std::fprintf(stderr, "Queue families: graphics %u, compute %u%s\n",
+               sQueueFamilyIndex, sComputeQueueFamilyIndex,
+               sQueueFamilies.AsyncCompute() ? " (async)" : "");
 
   Ensures(sPhysicalDevice != VK_NULL_HANDLE);
   Ensures(sQueueFamilyIndex != UINT32_MAX);
+  Ensures(sComputeQueueFamilyIndex != UINT32_MAX);
 
   LOG_LEAVE();
   return {};
@@ -675,17 +1228,20 @@ static tl::expected<void, std::system_error> CreateDevice() noexcept {
 
   float priority = 1.f;
 
-  VkDeviceQueueCreateInfo deviceQueueCI = {};
-  deviceQueueCI.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-  deviceQueueCI.queueFamilyIndex = sQueueFamilyIndex;
-  deviceQueueCI.queueCount = 1;
-  deviceQueueCI.pQueuePriorities = &priority;
+  std::array<VkDeviceQueueCreateInfo, 2> deviceQueueCIs = {};
+  deviceQueueCIs[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  deviceQueueCIs[0].queueFamilyIndex = sQueueFamilyIndex;
+  deviceQueueCIs[0].queueCount = 1;
+  deviceQueueCIs[0].pQueuePriorities = &priority;
+
+  deviceQueueCIs[1] = deviceQueueCIs[0];
+  deviceQueueCIs[1].queueFamilyIndex = sComputeQueueFamilyIndex;
 
   VkDeviceCreateInfo deviceCI = {};
   deviceCI.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   deviceCI.pNext = &sDeviceFeatures;
-  deviceCI.queueCreateInfoCount = 1;
-  deviceCI.pQueueCreateInfos = &deviceQueueCI;
+  deviceCI.queueCreateInfoCount = sQueueFamilies.AsyncCompute() ? 2 : 1;
+  deviceCI.pQueueCreateInfos = deviceQueueCIs.data();
   deviceCI.enabledExtensionCount =
     gsl::narrow_cast<std::uint32_t>(std::size(sDeviceExtensions));
   deviceCI.ppEnabledExtensionNames = sDeviceExtensions.data();
@@ -706,6 +1262,7 @@ static tl::expected<void, std::system_error> CreateDevice() noexcept {
   NameObject(sDevice, VK_OBJECT_TYPE_PHYSICAL_DEVICE, sPhysicalDevice,
              "sPhysicalDevice");
   NameObject(sDevice, VK_OBJECT_TYPE_DEVICE, sDevice, "sDevice");
+  NameObject(sDevice, VK_OBJECT_TYPE_SURFACE_KHR, sSurface, "sSurface");
 
   VkDeviceQueueInfo2 deviceQueueInfo = {};
   deviceQueueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_INFO_2;
@@ -716,8 +1273,17 @@ static tl::expected<void, std::system_error> CreateDevice() noexcept {
 
   NameObject(sDevice, VK_OBJECT_TYPE_QUEUE, sQueue, "sQueue");
 
+  if (sQueueFamilies.AsyncCompute()) {
+    deviceQueueInfo.queueFamilyIndex = sComputeQueueFamilyIndex;
+    vkGetDeviceQueue2(sDevice, &deviceQueueInfo, &sComputeQueue);
+    NameObject(sDevice, VK_OBJECT_TYPE_QUEUE, sComputeQueue, "sComputeQueue");
+  } else {
+    sComputeQueue = sQueue;
+  }
+
   Ensures(sDevice != VK_NULL_HANDLE);
   Ensures(sQueue != VK_NULL_HANDLE);
+  Ensures(sComputeQueue != VK_NULL_HANDLE);
 
   LOG_LEAVE();
   return {};
@@ -739,7 +1305,23 @@ static tl::expected<void, std::system_error> CreateCommandPool() noexcept {
       std::system_error(vk::make_error_code(result), "vkCreateCommandPool"));
   }
 
+  commandPoolCI.queueFamilyIndex = sComputeQueueFamilyIndex;
+
+  if (auto result = vkCreateCommandPool(sDevice, &commandPoolCI, nullptr,
+                                        &sComputeCommandPool);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkCreateCommandPool"));
+  }
+
+  NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_POOL, sCommandPool,
+             "sCommandPool");
+  NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_POOL, sComputeCommandPool,
+             "sComputeCommandPool");
+
   Ensures(sCommandPool != VK_NULL_HANDLE);
+  Ensures(sComputeCommandPool != VK_NULL_HANDLE);
 
   LOG_LEAVE();
   return {};
@@ -782,8 +1364,15 @@ BeginOneTimeSubmit() noexcept {
   return commandBuffer;
 } // BeginOneTimeSubmit
 
+// Submit commandBuffer to sQueue and wait for it. releases names the buffers
+// whose ownership commandBuffer releases to the compute queue, and acquires
+// those it acquires from it once its ray tracing has waited on
+// waitSemaphore.
 static tl::expected<void, std::system_error>
-EndOneTimeSubmit(VkCommandBuffer commandBuffer) noexcept {
+EndOneTimeSubmit(VkCommandBuffer commandBuffer,
+                 std::vector<std::uint64_t> releases = {},
+                 VkSemaphore waitSemaphore = VK_NULL_HANDLE,
+                 std::vector<std::uint64_t> acquires = {}) noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
   Expects(sCommandPool != VK_NULL_HANDLE);
@@ -809,12 +1398,22 @@ EndOneTimeSubmit(VkCommandBuffer commandBuffer) noexcept {
       std::system_error(vk::make_error_code(result), "vkCreateFence"));
   }
 
+  VkPipelineStageFlags const waitDstStageMask =
+    VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  if (waitSemaphore != VK_NULL_HANDLE) {
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &waitSemaphore;
+    submitInfo.pWaitDstStageMask = &waitDstStageMask;
+  }
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &commandBuffer;
 
-  if (auto result = vkQueueSubmit(sQueue, 1, &submitInfo, fence);
+  if (auto result =
+        QueueSubmit(QueueRole::kGraphics, "EndOneTimeSubmit", submitInfo,
+                    fence, std::move(releases), std::move(acquires));
       result != VK_SUCCESS) {
     vkDestroyFence(sDevice, fence, nullptr);
     vkFreeCommandBuffers(sDevice, sCommandPool, 1, &commandBuffer);
@@ -832,6 +1431,10 @@ EndOneTimeSubmit(VkCommandBuffer commandBuffer) noexcept {
       std::system_error(vk::make_error_code(result), "vkWaitForFences"));
   }
 
+#ifndef NDEBUG
+  sSubmitGraph.RecordHostWait(QueueRole::kGraphics);
+#endif
+
   vkDestroyFence(sDevice, fence, nullptr);
   vkFreeCommandBuffers(sDevice, sCommandPool, 1, &commandBuffer);
 
@@ -945,8 +1548,6 @@ static tl::expected<void, std::system_error> CreateSurface() noexcept {
   LOG_ENTER();
   Expects(sWindow != nullptr);
   Expects(sInstance != VK_NULL_HANDLE);
-  Expects(sPhysicalDevice != VK_NULL_HANDLE);
-  Expects(sQueueFamilyIndex != UINT32_MAX);
 
   if (auto result =
         glfwCreateWindowSurface(sInstance, sWindow, nullptr, &sSurface);
@@ -956,17 +1557,6 @@ static tl::expected<void, std::system_error> CreateSurface() noexcept {
                                             "glfwCreateWindowSurface"));
   }
 
-  NameObject(sDevice, VK_OBJECT_TYPE_SURFACE_KHR, sSurface, "sSurface");
-
-  VkBool32 surfaceSupported = VK_FALSE;
-  if (auto result = vkGetPhysicalDeviceSurfaceSupportKHR(
-        sPhysicalDevice, sQueueFamilyIndex, sSurface, &surfaceSupported);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(std::system_error(
-      vk::make_error_code(result), "vkGetPhysicalDeviceSurfaceSupportKHR"));
-  }
-
   Ensures(sSurface != VK_NULL_HANDLE);
 
   LOG_LEAVE();
@@ -1029,34 +1619,18 @@ static tl::expected<void, std::system_error> VerifySurfaceFormat() noexcept {
 static tl::expected<void, std::system_error> CreateFrames() noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
-  Expects(sSurface != VK_NULL_HANDLE);
-
-  VkPhysicalDeviceSurfaceInfo2KHR surfaceInfo = {};
-  surfaceInfo.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SURFACE_INFO_2_KHR;
-  surfaceInfo.surface = sSurface;
-
-  VkSurfaceCapabilities2KHR surfaceCapabilities = {};
-  surfaceCapabilities.sType = VK_STRUCTURE_TYPE_SURFACE_CAPABILITIES_2_KHR;
-
-  if (auto result = vkGetPhysicalDeviceSurfaceCapabilities2KHR(
-        sPhysicalDevice, &surfaceInfo, &surfaceCapabilities);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(
-      std::system_error(vk::make_error_code(result),
-                        "vkGetPhysicalDeviceSurfaceCapabilities2KHR"));
-  }
-
-  std::uint32_t imageCount =
-    glm::clamp(surfaceCapabilities.surfaceCapabilities.minImageCount + 1,
-               surfaceCapabilities.surfaceCapabilities.minImageCount,
-               surfaceCapabilities.surfaceCapabilities.maxImageCount);
+  Expects(sComputeQueueFamilyIndex != UINT32_MAX);
 
-  sFrames.resize(imageCount);
+  sFrames.resize(sFrameRing.Size());
 
   VkSemaphoreCreateInfo semaphoreCI = {};
   semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
+  // Signaled, as no frame is in flight yet.
+  VkFenceCreateInfo fenceCI = {};
+  fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+  fenceCI.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
   VkCommandPoolCreateInfo commandPoolCI = {};
   commandPoolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   commandPoolCI.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
@@ -1094,9 +1668,51 @@ static tl::expected<void, std::system_error> CreateFrames() noexcept {
                                               "vkAllocateCommandBuffers"));
     }
 
+    if (auto result = vkCreateFence(sDevice, &fenceCI, nullptr,
+                                    &frame.complete);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkCreateFence"));
+    }
+
+    // TLAS rebuilds on the compute queue.
+    commandPoolCI.queueFamilyIndex = sComputeQueueFamilyIndex;
+
+    if (auto result = vkCreateCommandPool(sDevice, &commandPoolCI, nullptr,
+                                          &frame.computeCommandPool);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkCreateCommandPool"));
+    }
+
+    commandPoolCI.queueFamilyIndex = sQueueFamilyIndex;
+    commandBufferAI.commandPool = frame.computeCommandPool;
+
+    if (auto result = vkAllocateCommandBuffers(sDevice, &commandBufferAI,
+                                               &frame.topLevelBuild);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                              "vkAllocateCommandBuffers"));
+    }
+
+    if (auto result = vkCreateSemaphore(sDevice, &semaphoreCI, nullptr,
+                                        &frame.topLevelBuilt);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkCreateSemaphore"));
+    }
+
     Ensures(frame.imageAvailable != VK_NULL_HANDLE);
     Ensures(frame.commandPool != VK_NULL_HANDLE);
     Ensures(frame.commandBuffer != VK_NULL_HANDLE);
+    Ensures(frame.complete != VK_NULL_HANDLE);
+    Ensures(frame.computeCommandPool != VK_NULL_HANDLE);
+    Ensures(frame.topLevelBuild != VK_NULL_HANDLE);
+    Ensures(frame.topLevelBuilt != VK_NULL_HANDLE);
 
     NameObject(sDevice, VK_OBJECT_TYPE_SEMAPHORE, frame.imageAvailable,
                "sFrames.imageAvailable");
@@ -1104,6 +1720,14 @@ static tl::expected<void, std::system_error> CreateFrames() noexcept {
                "sFrames.commandPool");
     NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_BUFFER, frame.commandBuffer,
                "sFrames.commandBuffer");
+    NameObject(sDevice, VK_OBJECT_TYPE_FENCE, frame.complete,
+               "sFrames.complete");
+    NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_POOL, frame.computeCommandPool,
+               "sFrames.computeCommandPool");
+    NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_BUFFER, frame.topLevelBuild,
+               "sFrames.topLevelBuild");
+    NameObject(sDevice, VK_OBJECT_TYPE_SEMAPHORE, frame.topLevelBuilt,
+               "sFrames.topLevelBuilt");
   }
 
   LOG_LEAVE();
@@ -1149,30 +1773,60 @@ static tl::expected<void, std::system_error> CreateSwapchain() noexcept {
           surfaceCapabilities.surfaceCapabilities.maxImageExtent.height)
       : surfaceCapabilities.surfaceCapabilities.currentExtent.height;
 
+  // One more image than the presentation engine needs, so acquiring does
+  // not wait for a present. A maxImageCount of 0 means there is no limit.
+  std::uint32_t imageCount =
+    surfaceCapabilities.surfaceCapabilities.minImageCount + 1;
+  if (surfaceCapabilities.surfaceCapabilities.maxImageCount > 0) {
+    imageCount = std::min(
+      imageCount, surfaceCapabilities.surfaceCapabilities.maxImageCount);
+  }
+
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(
+    sPhysicalDevice, sSurfaceColorFormat.format, &formatProperties);
+  // Exported and recorded frames are read back from sOutputImage.
+  sPresentPath = sExportName.empty() && sVideoPath.empty()
+                   ? SelectPresentPath(
+                       surfaceCapabilities.surfaceCapabilities
+                         .supportedUsageFlags,
+                       formatProperties.optimalTilingFeatures)
+                   : PresentPath::kCopy;
+
   VkSwapchainCreateInfoKHR swapchainCI = {};
   swapchainCI.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
   swapchainCI.surface = sSurface;
-  swapchainCI.minImageCount = gsl::narrow_cast<std::uint32_t>(sFrames.size());
+  swapchainCI.minImageCount = imageCount;
   swapchainCI.imageFormat = sSurfaceColorFormat.format;
   swapchainCI.imageColorSpace = sSurfaceColorFormat.colorSpace;
   swapchainCI.imageExtent = sSwapchainExtent;
   swapchainCI.imageArrayLayers = 1;
-  swapchainCI.imageUsage =
-    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  swapchainCI.imageUsage = SwapchainUsage(sPresentPath);
   swapchainCI.preTransform =
     surfaceCapabilities.surfaceCapabilities.currentTransform;
   swapchainCI.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   swapchainCI.presentMode = VK_PRESENT_MODE_FIFO_KHR;
   swapchainCI.clipped = VK_TRUE;
+  swapchainCI.oldSwapchain = sSwapchain;
 
+  VkSwapchainKHR swapchain;
   if (auto result =
-        vkCreateSwapchainKHR(sDevice, &swapchainCI, nullptr, &sSwapchain);
+        vkCreateSwapchainKHR(sDevice, &swapchainCI, nullptr, &swapchain);
       result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkCreateSwapchainKHR"));
   }
 
+  // Presents of frames up to sSubmittedFrame may still read its images.
+  if (sSwapchain != VK_NULL_HANDLE) {
+    sPresentDeletionQueue.Retire(sSubmittedFrame, [oldSwapchain = sSwapchain] {
+      vkDestroySwapchainKHR(sDevice, oldSwapchain, nullptr);
+    });
+  }
+
+  sSwapchain = swapchain;
+
   NameObject(sDevice, VK_OBJECT_TYPE_SWAPCHAIN_KHR, sSwapchain, "sSwapchain");
 
   Ensures(sSwapchain != VK_NULL_HANDLE);
@@ -1198,6 +1852,7 @@ CreateSwapchainImagesAndViews() noexcept {
   }
 
   sSwapchainImages.resize(count);
+  sImagePresentedFrame.assign(count, 0);
 
   if (auto result = vkGetSwapchainImagesKHR(sDevice, sSwapchain, &count,
                                             sSwapchainImages.data());
@@ -1235,6 +1890,24 @@ CreateSwapchainImagesAndViews() noexcept {
     Ensures(sSwapchainImageViews[i] != VK_NULL_HANDLE);
   }
 
+  VkSemaphoreCreateInfo semaphoreCI = {};
+  semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  while (sRenderFinished.size() < sSwapchainImages.size()) {
+    VkSemaphore semaphore;
+    if (auto result =
+          vkCreateSemaphore(sDevice, &semaphoreCI, nullptr, &semaphore);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkCreateSemaphore"));
+    }
+
+    NameObject(sDevice, VK_OBJECT_TYPE_SEMAPHORE, semaphore,
+               "sRenderFinished");
+    sRenderFinished.push_back(semaphore);
+  }
+
   Ensures(!sSwapchainImages.empty());
 
   LOG_LEAVE();
@@ -1246,7 +1919,6 @@ static tl::expected<void, std::system_error> CreateFramebuffers() noexcept {
   Expects(sDevice != VK_NULL_HANDLE);
   Expects(sRenderPass != VK_NULL_HANDLE);
   Expects(!sSwapchainImageViews.empty());
-  Expects(sSwapchainImageViews.size() == sFrames.size());
 
   VkFramebufferCreateInfo framebufferCI = {};
   framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
@@ -1256,11 +1928,12 @@ static tl::expected<void, std::system_error> CreateFramebuffers() noexcept {
   framebufferCI.height = sSwapchainExtent.height;
   framebufferCI.layers = 1;
 
+  sFramebuffers.resize(sSwapchainImageViews.size());
   for (std::size_t i = 0; i < sSwapchainImageViews.size(); ++i) {
     framebufferCI.pAttachments = &sSwapchainImageViews[i];
 
     if (auto result = vkCreateFramebuffer(sDevice, &framebufferCI, nullptr,
-                                          &sFrames[i].framebuffer);
+                                          &sFramebuffers[i]);
         result != VK_SUCCESS) {
       LOG_LEAVE();
       return tl::unexpected(
@@ -1268,32 +1941,117 @@ static tl::expected<void, std::system_error> CreateFramebuffers() noexcept {
     }
   }
 
-  for (auto&& frame : sFrames) {
-    Ensures(frame.framebuffer != VK_NULL_HANDLE);
-    NameObject(sDevice, VK_OBJECT_TYPE_FRAMEBUFFER, frame.framebuffer,
-               "sFrames.framebuffer");
+  for (auto&& framebuffer : sFramebuffers) {
+    Ensures(framebuffer != VK_NULL_HANDLE);
+    NameObject(sDevice, VK_OBJECT_TYPE_FRAMEBUFFER, framebuffer,
+               "sFramebuffers");
   }
 
   LOG_LEAVE();
   return {};
 } // CreateFramebuffers
 
+// The ring is sized for the primary monitor, which bounds how large the
+// window gets in practice; larger frames are dropped.
+static tl::expected<void, std::system_error> CreateFrameExport() noexcept {
+  LOG_ENTER();
+  if (sExportName.empty()) {
+    LOG_LEAVE();
+    return {};
+  }
+
+  std::uint32_t maxWidth = sSwapchainExtent.width;
+  std::uint32_t maxHeight = sSwapchainExtent.height;
+  if (GLFWmonitor* monitor = glfwGetPrimaryMonitor()) {
+    if (GLFWvidmode const* mode = glfwGetVideoMode(monitor)) {
+      maxWidth = std::max(maxWidth, static_cast<std::uint32_t>(mode->width));
+      maxHeight =
+        std::max(maxHeight, static_cast<std::uint32_t>(mode->height));
+    }
+  }
+
+  auto writer = SharedFrameWriter::Create(sExportName.c_str(), kExportSlots,
+                                          maxWidth, maxHeight);
+  if (!writer) {
+    LOG_LEAVE();
+    return tl::unexpected(writer.error());
+  }
+  sFrameExport = std::move(*writer);
+  std::fprintf(sReports, "exporting frames up to %ux%u to %s\n", maxWidth,
+               maxHeight, sExportName.c_str());
+
+  LOG_LEAVE();
+  return {};
+} // CreateFrameExport
+
+static tl::expected<void, std::system_error> CreateVideoStream() noexcept {
+  LOG_ENTER();
+  if (sVideoPath.empty()) {
+    LOG_LEAVE();
+    return {};
+  }
+
+  VideoStreamParams params;
+  params.format = sVideoFormat;
+  params.width = sSwapchainExtent.width;
+  params.height = sSwapchainExtent.height;
+  params.framesPerSecond = kVideoFramesPerSecond;
+  // The render loop's own thread converts alongside the others.
+  params.threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+  auto stream = VideoStream::Open(sVideoPath.c_str(), params);
+  if (!stream) {
+    LOG_LEAVE();
+    return tl::unexpected(stream.error());
+  }
+  sVideoStream = std::move(*stream);
+  std::fprintf(sReports, "recording %ux%u %s video to %s\n", params.width,
+               params.height, to_string(sVideoFormat), sVideoPath.c_str());
+
+  LOG_LEAVE();
+  return {};
+} // CreateVideoStream
+
 static tl::expected<void, std::system_error> CreateDescriptorPool() noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
 
+  Expects(!sFrames.empty());
+
+  // The descriptor sets are reallocated when the swapchain is recreated and
+  // the old ones are freed once the frames using them complete, so there is
+  // room for one generation per frame in flight plus the current one.
+  std::uint32_t const generations =
+    gsl::narrow_cast<std::uint32_t>(sFrames.size()) + 1;
+
+  // A generation is a trace set per frame slot, for the slot's TLAS, and
+  // the tonemap sets. The surface's image count limits do not change with
+  // its size, so neither does the number of swapchain images and tonemap
+  // sets on PresentPath::kDirect.
+  std::uint32_t const traceSets =
+    gsl::narrow_cast<std::uint32_t>(sFrames.size());
+  std::uint32_t const tonemapSets =
+    sPresentPath == PresentPath::kDirect
+      ? gsl::narrow_cast<std::uint32_t>(sSwapchainImages.size())
+      : 1;
+
   std::array<VkDescriptorPoolSize, 4> poolSizes = {
-    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, 1},
-    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
-    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1}};
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV,
+                         traceSets * generations},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                         traceSets * generations},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                         (traceSets + 2 * tonemapSets) * generations},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         3 * traceSets * generations}};
 
   VkDescriptorPoolCreateInfo descriptorPoolCI = {};
   descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptorPoolCI.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
   descriptorPoolCI.poolSizeCount =
     gsl::narrow_cast<std::uint32_t>(poolSizes.size());
   descriptorPoolCI.pPoolSizes = poolSizes.data();
-  descriptorPoolCI.maxSets = 1;
+  descriptorPoolCI.maxSets = (traceSets + tonemapSets) * generations;
 
   if (auto result = vkCreateDescriptorPool(sDevice, &descriptorPoolCI, nullptr,
                                            &sDescriptorPool);
@@ -1319,7 +2077,7 @@ static tl::expected<void, std::system_error> CreateQueryPool() noexcept {
   VkQueryPoolCreateInfo queryPoolCI = {};
   queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
   queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
-  queryPoolCI.queryCount = 32;
+  queryPoolCI.queryCount = kMaxFramesInFlight * kFrameQueryCount;
 
   if (auto result =
         vkCreateQueryPool(sDevice, &queryPoolCI, nullptr, &sQueryPool);
@@ -1331,6 +2089,19 @@ static tl::expected<void, std::system_error> CreateQueryPool() noexcept {
 
   NameObject(sDevice, VK_OBJECT_TYPE_QUERY_POOL, sQueryPool, "sQueryPool");
 
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(sPhysicalDevice, &props);
+  sTimestampPeriod = props.limits.timestampPeriod;
+
+  std::uint32_t familyCount;
+  vkGetPhysicalDeviceQueueFamilyProperties(sPhysicalDevice, &familyCount,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(sPhysicalDevice, &familyCount,
+                                           families.data());
+  sComputeTimestamps =
+    families[sComputeQueueFamilyIndex].timestampValidBits > 0;
+
   Ensures(sQueryPool != VK_NULL_HANDLE);
 
   LOG_LEAVE();
@@ -1350,16 +2121,16 @@ CreateDescriptorSetLayout() noexcept {
   accelerationStructureLB.stageFlags =
     VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
 
-  VkDescriptorSetLayoutBinding outputImageLB = {};
-  outputImageLB.binding = 1;
-  outputImageLB.descriptorCount = 1;
-  outputImageLB.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-  outputImageLB.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+  VkDescriptorSetLayoutBinding hdrImageLB = {};
+  hdrImageLB.binding = 1;
+  hdrImageLB.descriptorCount = 1;
+  hdrImageLB.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  hdrImageLB.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
 
   VkDescriptorSetLayoutBinding uniformBufferLB = {};
   uniformBufferLB.binding = 2;
   uniformBufferLB.descriptorCount = 1;
-  uniformBufferLB.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  uniformBufferLB.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
   uniformBufferLB.stageFlags =
     VK_SHADER_STAGE_RAYGEN_BIT_NV | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
 
@@ -1370,8 +2141,21 @@ CreateDescriptorSetLayout() noexcept {
   spheresBufferLB.stageFlags =
     VK_SHADER_STAGE_INTERSECTION_BIT_NV | VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
 
-  std::array<VkDescriptorSetLayoutBinding, 4> bindings = {
-    accelerationStructureLB, outputImageLB, uniformBufferLB, spheresBufferLB};
+  VkDescriptorSetLayoutBinding meshNormalsBufferLB = {};
+  meshNormalsBufferLB.binding = 4;
+  meshNormalsBufferLB.descriptorCount = 1;
+  meshNormalsBufferLB.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  meshNormalsBufferLB.stageFlags = VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV;
+
+  VkDescriptorSetLayoutBinding sampleTablesBufferLB = {};
+  sampleTablesBufferLB.binding = 5;
+  sampleTablesBufferLB.descriptorCount = 1;
+  sampleTablesBufferLB.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  sampleTablesBufferLB.stageFlags = VK_SHADER_STAGE_RAYGEN_BIT_NV;
+
+  std::array<VkDescriptorSetLayoutBinding, 6> bindings = {
+    accelerationStructureLB, hdrImageLB,          uniformBufferLB,
+    spheresBufferLB,         meshNormalsBufferLB, sampleTablesBufferLB};
 
   VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = {};
   descriptorSetLayoutCI.sType =
@@ -1484,7 +2268,13 @@ static tl::expected<void, std::system_error> CreatePipeline() noexcept {
     return tl::unexpected(rintSM.error());
   }
 
-  std::array<VkPipelineShaderStageCreateInfo, 4> stages = {
+  auto triangleRchitSM = CreateShaderModule("01_sphere_triangle_rchit.spv");
+  if (!triangleRchitSM) {
+    LOG_LEAVE();
+    return tl::unexpected(triangleRchitSM.error());
+  }
+
+  std::array<VkPipelineShaderStageCreateInfo, 5> stages = {
     VkPipelineShaderStageCreateInfo{
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0,
       VK_SHADER_STAGE_RAYGEN_BIT_NV, *rgenSM, "main", nullptr},
@@ -1496,9 +2286,12 @@ static tl::expected<void, std::system_error> CreatePipeline() noexcept {
       VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV, *rchitSM, "main", nullptr},
     VkPipelineShaderStageCreateInfo{
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0,
-      VK_SHADER_STAGE_INTERSECTION_BIT_NV, *rintSM, "main", nullptr}};
+      VK_SHADER_STAGE_INTERSECTION_BIT_NV, *rintSM, "main", nullptr},
+    VkPipelineShaderStageCreateInfo{
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0,
+      VK_SHADER_STAGE_CLOSEST_HIT_BIT_NV, *triangleRchitSM, "main", nullptr}};
 
-  std::array<VkRayTracingShaderGroupCreateInfoNV, 3> groups = {
+  std::array<VkRayTracingShaderGroupCreateInfoNV, 4> groups = {
     VkRayTracingShaderGroupCreateInfoNV{
       VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_NV, nullptr,
       VK_RAY_TRACING_SHADER_GROUP_TYPE_GENERAL_NV, 0, VK_SHADER_UNUSED_NV,
@@ -1510,7 +2303,11 @@ static tl::expected<void, std::system_error> CreatePipeline() noexcept {
     VkRayTracingShaderGroupCreateInfoNV{
       VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_NV, nullptr,
       VK_RAY_TRACING_SHADER_GROUP_TYPE_PROCEDURAL_HIT_GROUP_NV,
-      VK_SHADER_UNUSED_NV, 2, VK_SHADER_UNUSED_NV, 3}};
+      VK_SHADER_UNUSED_NV, 2, VK_SHADER_UNUSED_NV, 3},
+    VkRayTracingShaderGroupCreateInfoNV{
+      VK_STRUCTURE_TYPE_RAY_TRACING_SHADER_GROUP_CREATE_INFO_NV, nullptr,
+      VK_RAY_TRACING_SHADER_GROUP_TYPE_TRIANGLES_HIT_GROUP_NV,
+      VK_SHADER_UNUSED_NV, 4, VK_SHADER_UNUSED_NV, VK_SHADER_UNUSED_NV}};
 
   VkRayTracingPipelineCreateInfoNV pipelineCI = {};
   pipelineCI.sType = VK_STRUCTURE_TYPE_RAY_TRACING_PIPELINE_CREATE_INFO_NV;
@@ -1540,54 +2337,159 @@ static tl::expected<void, std::system_error> CreatePipeline() noexcept {
   vkDestroyShaderModule(sDevice, *rmissSM, nullptr);
   vkDestroyShaderModule(sDevice, *rchitSM, nullptr);
   vkDestroyShaderModule(sDevice, *rintSM, nullptr);
+  vkDestroyShaderModule(sDevice, *triangleRchitSM, nullptr);
 
   LOG_LEAVE();
   return {};
 } // CreatePipeline
 
-static tl::expected<void, std::system_error> CreateUniformBuffer() noexcept {
+static tl::expected<void, std::system_error> CreateTonemapPipeline() noexcept {
   LOG_ENTER();
-  Expects(sAllocator != VK_NULL_HANDLE);
-
-  char objectName[] = "sUniformBuffer";
+  Expects(sDevice != VK_NULL_HANDLE);
 
-  VkBufferCreateInfo bufferCI = {};
-  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCI.size = sizeof(UniformBuffer);
-  bufferCI.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+  for (std::uint32_t i = 0; i < bindings.size(); ++i) {
+    bindings[i].binding = i; // 0: sHDRImage, 1: sOutputImage or swapchain
+    bindings[i].descriptorCount = 1;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  }
 
-  VmaAllocationCreateInfo allocationCI = {};
-  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
-  allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-  allocationCI.pUserData = objectName;
+  VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI = {};
+  descriptorSetLayoutCI.sType =
+    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptorSetLayoutCI.bindingCount =
+    gsl::narrow_cast<std::uint32_t>(bindings.size());
+  descriptorSetLayoutCI.pBindings = bindings.data();
 
   if (auto result =
-        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &sUniformBuffer,
-                        &sUniformBufferAllocation, nullptr);
+        vkCreateDescriptorSetLayout(sDevice, &descriptorSetLayoutCI, nullptr,
+                                    &sTonemapDescriptorSetLayout);
       result != VK_SUCCESS) {
     LOG_LEAVE();
-    return tl::unexpected(
-      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+    return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                            "vkCreateDescriptorSetLayout"));
   }
 
-  Ensures(sUniformBuffer != VK_NULL_HANDLE);
-  Ensures(sUniformBufferAllocation != VK_NULL_HANDLE);
+  NameObject(sDevice, VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+             sTonemapDescriptorSetLayout, "sTonemapDescriptorSetLayout");
 
-  LOG_LEAVE();
-  return {};
-} // CreateUniformBuffer
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(TonemapPushConstants);
 
-static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
-  LOG_ENTER();
-  Expects(sDevice != VK_NULL_HANDLE);
-  Expects(sAllocator != VK_NULL_HANDLE);
-  Expects(sSwapchain != VK_NULL_HANDLE); // Ensures sSwapchainExtent is valid
+  VkPipelineLayoutCreateInfo pipelineLayoutCI = {};
+  pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutCI.setLayoutCount = 1;
+  pipelineLayoutCI.pSetLayouts = &sTonemapDescriptorSetLayout;
+  pipelineLayoutCI.pushConstantRangeCount = 1;
+  pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
 
-  char objectName[] = "sOutputImage";
+  if (auto result = vkCreatePipelineLayout(sDevice, &pipelineLayoutCI, nullptr,
+                                           &sTonemapPipelineLayout);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkCreatePipelineLayout"));
+  }
 
-  VkImageCreateInfo imageCI = {};
-  imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageCI.imageType = VK_IMAGE_TYPE_2D;
+  auto compSM = CreateShaderModule("01_sphere_tonemap.spv");
+  if (!compSM) {
+    LOG_LEAVE();
+    return tl::unexpected(compSM.error());
+  }
+
+  VkComputePipelineCreateInfo pipelineCI = {};
+  pipelineCI.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineCI.stage = VkPipelineShaderStageCreateInfo{
+    VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0,
+    VK_SHADER_STAGE_COMPUTE_BIT, *compSM, "main", nullptr};
+  pipelineCI.layout = sTonemapPipelineLayout;
+
+  if (auto result = vkCreateComputePipelines(sDevice, VK_NULL_HANDLE, 1,
+                                             &pipelineCI, nullptr,
+                                             &sTonemapPipeline);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                            "vkCreateComputePipelines"));
+  }
+
+  NameObject(sDevice, VK_OBJECT_TYPE_PIPELINE_LAYOUT, sTonemapPipelineLayout,
+             "sTonemapPipelineLayout");
+  NameObject(sDevice, VK_OBJECT_TYPE_PIPELINE, sTonemapPipeline,
+             "sTonemapPipeline");
+
+  Ensures(sTonemapDescriptorSetLayout != VK_NULL_HANDLE);
+  Ensures(sTonemapPipelineLayout != VK_NULL_HANDLE);
+  Ensures(sTonemapPipeline != VK_NULL_HANDLE);
+
+  vkDestroyShaderModule(sDevice, *compSM, nullptr);
+
+  LOG_LEAVE();
+  return {};
+} // CreateTonemapPipeline
+
+static tl::expected<void, std::system_error> CreateUniformBuffer() noexcept {
+  LOG_ENTER();
+  Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(!sFrames.empty());
+
+  char objectName[] = "sUniformBuffer";
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(sPhysicalDevice, &props);
+  VkDeviceSize const alignment =
+    std::max<VkDeviceSize>(props.limits.minUniformBufferOffsetAlignment, 1);
+  sUniformBufferStride =
+    (sizeof(UniformBuffer) + alignment - 1) / alignment * alignment;
+
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = sUniformBufferStride * sFrames.size();
+  bufferCI.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &sUniformBuffer,
+                        &sUniformBufferAllocation, nullptr);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(sUniformBufferAllocation, MemoryCategory::kUniform,
+                  objectName);
+
+  Ensures(sUniformBuffer != VK_NULL_HANDLE);
+  Ensures(sUniformBufferAllocation != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // CreateUniformBuffer
+
+static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(sSwapchain != VK_NULL_HANDLE); // Ensures sSwapchainExtent is valid
+
+  // The tonemap pass writes the swapchain images themselves.
+  if (sPresentPath == PresentPath::kDirect) {
+    LOG_LEAVE();
+    return {};
+  }
+
+  char objectName[] = "sOutputImage";
+
+  VkImageCreateInfo imageCI = {};
+  imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageCI.imageType = VK_IMAGE_TYPE_2D;
   imageCI.format = sSurfaceColorFormat.format;
   imageCI.extent = {sSwapchainExtent.width, sSwapchainExtent.height, 1};
   imageCI.mipLevels = 1;
@@ -1600,7 +2502,6 @@ static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
   VmaAllocationCreateInfo allocationCI = {};
   allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-  allocationCI.pUserData = objectName;
 
   if (auto result =
         vmaCreateImage(sAllocator, &imageCI, &allocationCI, &sOutputImage,
@@ -1611,6 +2512,9 @@ static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
       std::system_error(vk::make_error_code(result), "vmaCreateImage"));
   }
 
+  TrackAllocation(sOutputImageAllocation, MemoryCategory::kOutputImage,
+                  objectName);
+
   VkImageViewCreateInfo imageViewCI = {};
   imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
   imageViewCI.image = sOutputImage;
@@ -1623,7 +2527,7 @@ static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
 
   if (auto result =
         vkCreateImageView(sDevice, &imageViewCI, nullptr, &sOutputImageView);
-      result != VK_NULL_HANDLE) {
+      result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkCreateImageView"));
@@ -1637,6 +2541,226 @@ static tl::expected<void, std::system_error> CreateOutputImage() noexcept {
   return {};
 } // CreateOutputImage
 
+static tl::expected<void, std::system_error> CreateHDRImage() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(sSwapchain != VK_NULL_HANDLE); // Ensures sSwapchainExtent is valid
+
+  char objectName[] = "sHDRImage";
+
+  VkImageCreateInfo imageCI = {};
+  imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageCI.imageType = VK_IMAGE_TYPE_2D;
+  imageCI.format = VK_FORMAT_R16G16B16A16_SFLOAT;
+  imageCI.extent = {sSwapchainExtent.width, sSwapchainExtent.height, 1};
+  imageCI.mipLevels = 1;
+  imageCI.arrayLayers = 1;
+  imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageCI.usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (auto result =
+        vmaCreateImage(sAllocator, &imageCI, &allocationCI, &sHDRImage,
+                       &sHDRImageAllocation, nullptr);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateImage"));
+  }
+
+  TrackAllocation(sHDRImageAllocation, MemoryCategory::kOutputImage,
+                  objectName);
+
+  VkImageViewCreateInfo imageViewCI = {};
+  imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  imageViewCI.image = sHDRImage;
+  imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  imageViewCI.format = imageCI.format;
+  imageViewCI.components = {
+    VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+    VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
+  imageViewCI.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  if (auto result =
+        vkCreateImageView(sDevice, &imageViewCI, nullptr, &sHDRImageView);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkCreateImageView"));
+  }
+
+  Ensures(sHDRImage != VK_NULL_HANDLE);
+  Ensures(sHDRImageAllocation != VK_NULL_HANDLE);
+  Ensures(sHDRImageView != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // CreateHDRImage
+
+static tl::expected<void, std::system_error> GenerateScene() noexcept {
+  LOG_ENTER();
+  auto const count = sSceneGeneratorParams.sphereCount;
+
+  try {
+    sGeneratedSpheres.resize(static_cast<std::size_t>(count));
+  } catch (std::bad_alloc const&) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "GenerateScene"));
+  }
+  sMemoryAccounting.Allocated(MemoryCategory::kHostScene,
+                              count * sizeof(SceneSphere));
+
+  // SceneSphere has Sphere's layout, so this is the layout uploaded.
+  double const start = glfwGetTime();
+  GenerateSpheres(sSceneGeneratorParams, 0, sGeneratedSpheres);
+  double const seconds = glfwGetTime() - start;
+
+  sSceneSpheres = {reinterpret_cast<Sphere const*>(sGeneratedSpheres.data()),
+                   static_cast<gsl::index>(sGeneratedSpheres.size())};
+
+  std::fprintf(stderr, "Generated %td %s spheres (seed %llu) in %.3f ms\n",
+               sSceneSpheres.size(),
+               to_string(sSceneGeneratorParams.distribution),
+               static_cast<unsigned long long>(sSceneGeneratorParams.seed),
+               seconds * 1e3);
+
+  LOG_LEAVE();
+  return {};
+} // GenerateScene
+
+static tl::expected<void, std::system_error> LoadScene() noexcept {
+  LOG_ENTER();
+  if (sGenerateScene) {
+    LOG_LEAVE();
+    return GenerateScene();
+  }
+
+  if (sSceneFilename == nullptr) {
+    LOG_LEAVE();
+    return {};
+  }
+
+  auto scene = SceneFile::Open(sSceneFilename);
+  if (!scene) {
+    LOG_LEAVE();
+    return tl::unexpected(scene.error());
+  }
+
+  if (scene->Spheres().empty()) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(std::make_error_code(std::errc::invalid_argument),
+                        std::string(sSceneFilename) + " has no spheres"));
+  }
+
+  sSceneFile = std::move(*scene);
+  sMemoryAccounting.Allocated(MemoryCategory::kHostScene,
+                              sSceneFile.Mapping().size());
+
+  // The sphere section has Sphere's layout; it is read once, by the copy
+  // into the staging buffer.
+  auto const spheres = sSceneFile.Spheres();
+  sSceneSpheres = {reinterpret_cast<Sphere const*>(spheres.data()),
+                   spheres.size()};
+  sSceneFile.Mapping().AdviseSequential();
+
+  std::fprintf(stderr, "Loaded %td spheres from %s\n", sSceneSpheres.size(),
+               sSceneFilename);
+
+  LOG_LEAVE();
+  return {};
+} // LoadScene
+
+// Load every --mesh file into sMeshLibrary, which keeps one copy of each
+// distinct mesh, and place sMeshCopies instances of each file.
+static tl::expected<void, std::system_error> LoadMeshes() noexcept {
+  LOG_ENTER();
+
+  std::uint64_t normalCount = 0;
+  for (std::size_t f = 0; f < sMeshFiles.size(); ++f) {
+    MeshFile const& file = sMeshFiles[f];
+
+    ObjLoadStats stats;
+    auto mesh = LoadObj(file.filename, 0, &stats);
+    if (!mesh) {
+      LOG_LEAVE();
+      return tl::unexpected(mesh.error());
+    }
+
+    if (mesh->TriangleCount() == 0) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(std::make_error_code(std::errc::invalid_argument),
+                          std::string(file.filename) + " has no triangles"));
+    }
+
+    // VkGeometryTrianglesNV counts indices in 32 bits.
+    if (mesh->indices.size() > std::numeric_limits<std::uint32_t>::max()) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(std::make_error_code(std::errc::value_too_large),
+                          file.filename));
+    }
+
+    try {
+      auto const added = sMeshLibrary.Add(EncodeMesh(*mesh, file.format));
+      EncodedMesh const& encoded = sMeshLibrary[added.id];
+
+      if (added.added) {
+        // The first normal of each mesh is an instance custom index, which
+        // has 24 bits.
+        if (normalCount > 0xFF'FFFF) {
+          LOG_LEAVE();
+          return tl::unexpected(
+            std::system_error(std::make_error_code(std::errc::value_too_large),
+                              std::string(file.filename) +
+                                ": too many triangles before this mesh"));
+        }
+        normalCount += encoded.triangleCount;
+        sMemoryAccounting.Allocated(MemoryCategory::kHostScene,
+                                    encoded.SizeBytes());
+      }
+
+      std::fprintf(stderr,
+                   "Loaded %llu triangles from %s in %.3f ms (%.0f MB/s, %u "
+                   "threads): %s vertices, %.2f bytes/triangle%s\n",
+                   static_cast<unsigned long long>(encoded.triangleCount),
+                   file.filename, stats.totalMs, stats.MegabytesPerSecond(),
+                   stats.threadCount, to_string(encoded.format),
+                   encoded.BytesPerTriangle(),
+                   added.added ? "" : ", shared with an earlier mesh");
+
+      // Copies one and a half mesh sizes apart, turned about their center.
+      float pivot[3], extent = 0.f;
+      for (int c = 0; c < 3; ++c) {
+        pivot[c] = .5f * (encoded.boundsMin[c] + encoded.boundsMax[c]);
+        extent = std::max(extent, encoded.boundsMax[c] - encoded.boundsMin[c]);
+      }
+      AppendInstanceGrid(sMeshInstanceTransforms, sMeshCopies, pivot,
+                         1.5f * extent, f);
+      sMeshInstanceMeshes.insert(sMeshInstanceMeshes.end(),
+                                 static_cast<std::size_t>(sMeshCopies),
+                                 added.id);
+    } catch (std::bad_alloc const&) {
+      LOG_LEAVE();
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::not_enough_memory), "LoadMeshes"));
+    }
+  }
+
+  Ensures(sMeshInstanceMeshes.size() == sMeshInstanceTransforms.size());
+
+  LOG_LEAVE();
+  return {};
+} // LoadMeshes
+
 static tl::expected<void, std::system_error>
 CreateSpheresBuffer() noexcept {
   LOG_ENTER();
@@ -1645,10 +2769,11 @@ CreateSpheresBuffer() noexcept {
 
   VkBufferCreateInfo bufferCI = {};
   bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCI.size = sSpheres.size() * sizeof(Sphere);
+  bufferCI.size = static_cast<VkDeviceSize>(sSceneSpheres.size_bytes());
   bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
   VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 
   VkBuffer stagingBuffer;
@@ -1663,6 +2788,9 @@ CreateSpheresBuffer() noexcept {
       std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
   }
 
+  TrackAllocation(stagingAllocation, MemoryCategory::kStaging,
+                  "sSpheresBufferStaging");
+
   Sphere* pStaging;
   if (auto ptr = MapMemory<Sphere*>(sAllocator, stagingAllocation)) {
     pStaging = *ptr;
@@ -1671,71 +2799,381 @@ CreateSpheresBuffer() noexcept {
     return tl::unexpected(ptr.error());
   }
 
-  std::memcpy(pStaging, sSpheres.data(), sSpheres.size() * sizeof(Sphere));
-  vmaUnmapMemory(sAllocator, stagingAllocation);
+  // This copy is the one read of a scene file's spheres, so their bounds are
+  // taken on the way.
+  InstanceBounds& bounds = sSceneSphereBounds;
+  std::fill_n(bounds.boundsMin, 3, std::numeric_limits<float>::max());
+  std::fill_n(bounds.boundsMax, 3, std::numeric_limits<float>::lowest());
+  for (auto&& sphere : sSceneSpheres) {
+    for (int c = 0; c < 3; ++c) {
+      bounds.boundsMin[c] = std::min(bounds.boundsMin[c], sphere.aabbMin[c]);
+      bounds.boundsMax[c] = std::max(bounds.boundsMax[c], sphere.aabbMax[c]);
+    }
+    *pStaging++ = sphere;
+  }
+  vmaUnmapMemory(sAllocator, stagingAllocation);
+
+  char objectName[] = "sSpheresBuffer";
+
+  bufferCI.usage =
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &sSpheresBuffer,
+                        &sSpheresBufferAllocation, nullptr);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(sSpheresBufferAllocation, MemoryCategory::kSpheres,
+                  objectName);
+
+  auto commandBuffer = BeginOneTimeSubmit();
+  if (!commandBuffer) {
+    LOG_LEAVE();
+    return tl::unexpected(commandBuffer.error());
+  }
+
+  VkBufferCopy region = {};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = bufferCI.size;
+
+  vkCmdCopyBuffer(*commandBuffer, stagingBuffer, sSpheresBuffer, 1, &region);
+
+  // The acceleration structure builds read the spheres on the compute queue;
+  // BeginAccelerationStructureBuild records the matching acquire.
+  std::vector<std::uint64_t> releases;
+  if (sQueueFamilies.AsyncCompute()) {
+    VkBufferMemoryBarrier release = OwnershipTransfer(
+      sSpheresBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, 0, sQueueFamilyIndex,
+      sComputeQueueFamilyIndex);
+
+    vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         1, &release, 0, nullptr);
+    releases.push_back(HandleId(sSpheresBuffer));
+  }
+
+  if (auto result = EndOneTimeSubmit(*commandBuffer, std::move(releases));
+      !result) {
+    LOG_LEAVE();
+    return tl::unexpected(result.error());
+  }
+
+  // EndOneTimeSubmit waits for the copy to complete.
+  DestroyTrackedBuffer(stagingBuffer, stagingAllocation,
+                       MemoryCategory::kStaging);
+
+  LOG_LEAVE();
+  return {};
+} // CreateSpheresBuffer
+
+// Copy the spheres into sSphereStore for --animate to move.
+static tl::expected<void, std::system_error> CreateSphereStore() noexcept {
+  LOG_ENTER();
+  if (sAnimateFraction <= 0.0) {
+    LOG_LEAVE();
+    return {};
+  }
+
+  try {
+    sSphereStore.Assign(
+      {reinterpret_cast<SceneSphere const*>(sSceneSpheres.data()),
+       sSceneSpheres.size()},
+      kSphereUpdateMaxGap);
+  } catch (std::bad_alloc const&) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "sSphereStore"));
+  }
+  sMemoryAccounting.Allocated(
+    MemoryCategory::kHostScene,
+    static_cast<std::uint64_t>(sSceneSpheres.size_bytes()));
+
+  LOG_LEAVE();
+  return {};
+} // CreateSphereStore
+
+// Create a device local buffer holding data, for the meshes and the sample
+// tables. Nothing writes these buffers after this copy, so rather than
+// transferring ownership like sSpheresBuffer they are shared concurrently
+// between the graphics family, where the shaders read the normals and
+// tables, and the compute family, where the BLAS build reads the vertices
+// and indices.
+static tl::expected<void, std::system_error>
+UploadStaticBuffer(gsl::span<std::byte const> data, VkBufferUsageFlags usage,
+                   MemoryCategory category, gsl::czstring name,
+                   VkBuffer& buffer, VmaAllocation& allocation) noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(!data.empty());
+
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = static_cast<VkDeviceSize>(data.size());
+  bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+  VkBuffer stagingBuffer;
+  VmaAllocation stagingAllocation;
+
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &stagingBuffer,
+                        &stagingAllocation, nullptr);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  std::string const stagingName = std::string(name) + "Staging";
+  TrackAllocation(stagingAllocation, MemoryCategory::kStaging,
+                  stagingName.c_str());
+
+  if (auto ptr = MapMemory<std::byte*>(sAllocator, stagingAllocation)) {
+    std::memcpy(*ptr, data.data(), static_cast<std::size_t>(data.size()));
+    vmaUnmapMemory(sAllocator, stagingAllocation);
+  } else {
+    LOG_LEAVE();
+    return tl::unexpected(ptr.error());
+  }
+
+  std::array<std::uint32_t, 2> const queueFamilyIndices = {
+    sQueueFamilyIndex, sComputeQueueFamilyIndex};
+
+  bufferCI.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  if (sQueueFamilies.AsyncCompute()) {
+    bufferCI.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferCI.queueFamilyIndexCount =
+      gsl::narrow_cast<std::uint32_t>(queueFamilyIndices.size());
+    bufferCI.pQueueFamilyIndices = queueFamilyIndices.data();
+  }
+
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (auto result = vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI,
+                                    &buffer, &allocation, nullptr);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(allocation, category, name);
+
+  auto commandBuffer = BeginOneTimeSubmit();
+  if (!commandBuffer) {
+    LOG_LEAVE();
+    return tl::unexpected(commandBuffer.error());
+  }
+
+  VkBufferCopy region = {};
+  region.srcOffset = 0;
+  region.dstOffset = 0;
+  region.size = bufferCI.size;
+
+  vkCmdCopyBuffer(*commandBuffer, stagingBuffer, buffer, 1, &region);
+
+  if (auto result = EndOneTimeSubmit(*commandBuffer); !result) {
+    LOG_LEAVE();
+    return tl::unexpected(result.error());
+  }
+
+  // EndOneTimeSubmit waits for the copy to complete.
+  DestroyTrackedBuffer(stagingBuffer, stagingAllocation,
+                       MemoryCategory::kStaging);
+
+  Ensures(buffer != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // UploadStaticBuffer
+
+static tl::expected<void, std::system_error> CreateMeshBuffers() noexcept {
+  LOG_ENTER();
+
+  std::vector<std::uint32_t> normals;
+  std::uint64_t hostBytes = 0;
+
+  try {
+    sMeshes.resize(sMeshLibrary.size());
+    for (std::uint32_t id = 0; id < sMeshLibrary.size(); ++id) {
+      EncodedMesh const& mesh = sMeshLibrary[id];
+      MeshBuffers& buffers = sMeshes[id];
+      std::string const name = "sMeshes[" + std::to_string(id) + "]";
+
+      if (auto result = UploadStaticBuffer(
+            mesh.vertices, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
+            MemoryCategory::kMeshes, (name + ".vertexBuffer").c_str(),
+            buffers.vertexBuffer, buffers.vertexBufferAllocation);
+          !result) {
+        LOG_LEAVE();
+        return tl::unexpected(result.error());
+      }
+
+      if (auto result = UploadStaticBuffer(
+            mesh.indices, VK_BUFFER_USAGE_RAY_TRACING_BIT_NV,
+            MemoryCategory::kMeshes, (name + ".indexBuffer").c_str(),
+            buffers.indexBuffer, buffers.indexBufferAllocation);
+          !result) {
+        LOG_LEAVE();
+        return tl::unexpected(result.error());
+      }
+
+      buffers.firstNormal = gsl::narrow_cast<std::uint32_t>(normals.size());
+      normals.insert(normals.end(), mesh.normals.begin(), mesh.normals.end());
+      hostBytes += mesh.SizeBytes();
+    }
+    if (normals.empty()) normals.push_back(0);
+  } catch (std::bad_alloc const&) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "CreateMeshBuffers"));
+  }
+
+  if (auto result = UploadStaticBuffer(
+        gsl::as_bytes(gsl::make_span(normals)),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryCategory::kMeshes,
+        "sMeshNormalsBuffer", sMeshNormalsBuffer, sMeshNormalsBufferAllocation);
+      !result) {
+    LOG_LEAVE();
+    return tl::unexpected(result.error());
+  }
+
+  // Only the device copies are traced; keep the counts, bounds and encoding
+  // transforms and drop the rest.
+  if (hostBytes > 0) {
+    sMemoryAccounting.Freed(MemoryCategory::kHostScene, hostBytes);
+  }
+  sMeshLibrary.ReleaseGeometry();
+
+  Ensures(sMeshNormalsBuffer != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // CreateMeshBuffers
+
+// The tables are built on the CPU at startup, where the CPU renderer builds
+// the same ones, and never change.
+static tl::expected<void, std::system_error>
+CreateSampleTablesBuffer() noexcept {
+  LOG_ENTER();
+
+  shader::SampleTables const& tables = GetSampleTables();
+  if (auto result = UploadStaticBuffer(
+        gsl::as_bytes(gsl::make_span(&tables, 1)),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemoryCategory::kSampleTables,
+        "sSampleTablesBuffer", sSampleTablesBuffer,
+        sSampleTablesBufferAllocation);
+      !result) {
+    LOG_LEAVE();
+    return tl::unexpected(result.error());
+  }
+
+  Ensures(sSampleTablesBuffer != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // CreateSampleTablesBuffer
+
+// Start recording the acceleration structure builds on the compute queue.
+// The builds are submitted by SubmitAccelerationStructureBuild without a
+// host wait; the first frame waits on sAccelerationStructuresBuilt instead.
+static tl::expected<void, std::system_error>
+BeginAccelerationStructureBuild() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sComputeCommandPool != VK_NULL_HANDLE);
+  Expects(sSpheresBuffer != VK_NULL_HANDLE);
+
+  VkSemaphoreCreateInfo semaphoreCI = {};
+  semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  if (sAccelerationStructuresBuilt == VK_NULL_HANDLE) {
+    if (auto result = vkCreateSemaphore(sDevice, &semaphoreCI, nullptr,
+                                        &sAccelerationStructuresBuilt);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkCreateSemaphore"));
+    }
+
+    NameObject(sDevice, VK_OBJECT_TYPE_SEMAPHORE, sAccelerationStructuresBuilt,
+               "sAccelerationStructuresBuilt");
+  }
+
+  VkCommandBufferAllocateInfo commandBufferAI = {};
+  commandBufferAI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  commandBufferAI.commandPool = sComputeCommandPool;
+  commandBufferAI.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  commandBufferAI.commandBufferCount = 1;
 
-  char objectName[] = "sSpheresBuffer";
+  if (auto result = vkAllocateCommandBuffers(sDevice, &commandBufferAI,
+                                             &sAccelerationStructureBuild);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                            "vkAllocateCommandBuffers"));
+  }
 
-  bufferCI.usage =
-    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  NameObject(sDevice, VK_OBJECT_TYPE_COMMAND_BUFFER,
+             sAccelerationStructureBuild, "sAccelerationStructureBuild");
 
-  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
-  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-  allocationCI.pUserData = objectName;
+  VkCommandBufferBeginInfo commandBufferBI = {};
+  commandBufferBI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  commandBufferBI.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
   if (auto result =
-        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &sSpheresBuffer,
-                        &sSpheresBufferAllocation, nullptr);
+        vkBeginCommandBuffer(sAccelerationStructureBuild, &commandBufferBI);
       result != VK_SUCCESS) {
+    vkFreeCommandBuffers(sDevice, sComputeCommandPool, 1,
+                         &sAccelerationStructureBuild);
+    sAccelerationStructureBuild = VK_NULL_HANDLE;
     LOG_LEAVE();
     return tl::unexpected(
-      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
-  }
-
-  auto commandBuffer = BeginOneTimeSubmit();
-  if (!commandBuffer) {
-    LOG_LEAVE();
-    return tl::unexpected(commandBuffer.error());
+      std::system_error(vk::make_error_code(result), "vkBeginCommandBuffer"));
   }
 
-  VkBufferCopy region = {};
-  region.srcOffset = 0;
-  region.dstOffset = 0;
-  region.size = bufferCI.size;
+  // Acquire the spheres released by CreateSpheresBuffer, or on a shared
+  // family make its copy visible to the BLAS build.
+  bool const async = sQueueFamilies.AsyncCompute();
+  VkBufferMemoryBarrier acquire = OwnershipTransfer(
+    sSpheresBuffer, async ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT,
+    VK_ACCESS_SHADER_READ_BIT, sQueueFamilyIndex, sComputeQueueFamilyIndex);
 
-  vkCmdCopyBuffer(*commandBuffer, stagingBuffer, sSpheresBuffer, 1, &region);
+  vkCmdPipelineBarrier(
+    sAccelerationStructureBuild,
+    async ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0, 0, nullptr, 1,
+    &acquire, 0, nullptr);
 
-  if (auto result = EndOneTimeSubmit(*commandBuffer); !result) {
-    LOG_LEAVE();
-    return tl::unexpected(result.error());
-  }
+  Ensures(sAccelerationStructureBuild != VK_NULL_HANDLE);
+  Ensures(sAccelerationStructuresBuilt != VK_NULL_HANDLE);
 
   LOG_LEAVE();
   return {};
-} // CreateSpheresBuffer
-
-static tl::expected<void, std::system_error>
-CreateBottomLevelAccelerationStructure() noexcept {
+} // BeginAccelerationStructureBuild
+
+// Create structure for geometry, bind its memory and record its build into
+// sAccelerationStructureBuild. Returns the size of the structure.
+static tl::expected<VkDeviceSize, std::system_error>
+BuildBottomLevelAccelerationStructure(
+  VkGeometryNV const& geometry, VkBuildAccelerationStructureFlagsNV flags,
+  std::string const& name, VkAccelerationStructureNV& structure,
+  VmaAllocation& allocation) noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
   Expects(sAllocator != VK_NULL_HANDLE);
-
-  VkGeometryTrianglesNV triangles = {};
-  triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
-
-  VkGeometryAABBNV spheres = {};
-  spheres.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
-  spheres.aabbData = sSpheresBuffer;
-  spheres.numAABBs = gsl::narrow_cast<std::uint32_t>(sSpheres.size());
-  spheres.stride = sizeof(Sphere);
-  spheres.offset = offsetof(Sphere, aabbMin);
-
-  VkGeometryNV geometry = {};
-  geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
-  geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_NV;
-  geometry.geometry.triangles = triangles;
-  geometry.geometry.aabbs = spheres;
-  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_NV;
+  Expects(sAccelerationStructureBuild != VK_NULL_HANDLE);
 
   VkAccelerationStructureCreateInfoNV accelerationStructureCI = {};
   accelerationStructureCI.sType =
@@ -1745,28 +3183,26 @@ CreateBottomLevelAccelerationStructure() noexcept {
     VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
   accelerationStructureCI.info.type =
     VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
-  accelerationStructureCI.info.flags = 0;
+  accelerationStructureCI.info.flags = flags;
   accelerationStructureCI.info.instanceCount = 0;
   accelerationStructureCI.info.geometryCount = 1;
   accelerationStructureCI.info.pGeometries = &geometry;
 
   if (auto result = vkCreateAccelerationStructureNV(
-        sDevice, &accelerationStructureCI, nullptr,
-        &sBottomLevelAccelerationStructure);
+        sDevice, &accelerationStructureCI, nullptr, &structure);
       result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(std::system_error(vk::make_error_code(result),
                                             "vkCreateAccelerationStructureNV"));
   }
 
-  NameObject(sDevice, VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_NV,
-             sBottomLevelAccelerationStructure,
-             "sBottomLevelAccelerationStructure");
+  NameObject(sDevice, VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_NV, structure,
+             name.c_str());
 
   VkAccelerationStructureMemoryRequirementsInfoNV memReqInfo = {};
   memReqInfo.sType =
     VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-  memReqInfo.accelerationStructure = sBottomLevelAccelerationStructure;
+  memReqInfo.accelerationStructure = structure;
   memReqInfo.type =
     VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_NV;
 
@@ -1775,29 +3211,30 @@ CreateBottomLevelAccelerationStructure() noexcept {
 
   vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo, &memReq);
 
-  char objectName[] = "sBottomLevelAccelerationStructureAllocation";
+  std::string const objectName = name + "Allocation";
 
   VmaAllocationCreateInfo allocationCI = {};
   allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_UNKNOWN;
-  allocationCI.pUserData = objectName;
 
   if (auto result = vmaAllocateMemory(
         sAllocator, &memReq.memoryRequirements, &allocationCI,
-        &sBottomLevelAccelerationStructureAllocation, nullptr);
+        &allocation, nullptr);
       result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vmaAllocateMemory"));
   }
 
+  TrackAllocation(allocation, MemoryCategory::kAccelerationStructure,
+                  objectName.c_str());
+
   VmaAllocationInfo info;
-  vmaGetAllocationInfo(sAllocator, sBottomLevelAccelerationStructureAllocation,
-                       &info);
+  vmaGetAllocationInfo(sAllocator, allocation, &info);
 
   VkBindAccelerationStructureMemoryInfoNV bindInfo = {};
   bindInfo.sType = VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
-  bindInfo.accelerationStructure = sBottomLevelAccelerationStructure;
+  bindInfo.accelerationStructure = structure;
   bindInfo.memory = info.deviceMemory;
   bindInfo.memoryOffset = info.offset;
 
@@ -1814,7 +3251,7 @@ CreateBottomLevelAccelerationStructure() noexcept {
   VkMemoryRequirements2 bottomLevelMemReq = {};
   bottomLevelMemReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
 
-  memReqInfo.accelerationStructure = sBottomLevelAccelerationStructure;
+  memReqInfo.accelerationStructure = structure;
   vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo,
                                                  &bottomLevelMemReq);
 
@@ -1827,6 +3264,7 @@ CreateBottomLevelAccelerationStructure() noexcept {
   bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
 
   allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 
   if (auto result =
@@ -1838,35 +3276,298 @@ CreateBottomLevelAccelerationStructure() noexcept {
       std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
   }
 
-  auto commandBuffer = BeginOneTimeSubmit();
-  if (!commandBuffer) {
-    LOG_LEAVE();
-    return tl::unexpected(commandBuffer.error());
-  }
+  std::string const scratchName = name + "Scratch";
+  TrackAllocation(scratchAllocation, MemoryCategory::kScratch,
+                  scratchName.c_str());
 
   vkCmdBuildAccelerationStructureNV(
-    *commandBuffer, &accelerationStructureCI.info,
+    sAccelerationStructureBuild, &accelerationStructureCI.info,
     VK_NULL_HANDLE /* instanceData */, 0 /* instanceOffset */,
-    VK_FALSE /* update */, sBottomLevelAccelerationStructure /* dst */,
-    VK_NULL_HANDLE /* src */, scratchBuffer, 0 /* scratchOffset */);
+    VK_FALSE /* update */, structure /* dst */, VK_NULL_HANDLE /* src */,
+    scratchBuffer, 0 /* scratchOffset */);
+
+  // The TLAS build reads the BLAS.
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+
+  vkCmdPipelineBarrier(sAccelerationStructureBuild,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0,
+                       1, &barrier, 0, nullptr, 0, nullptr);
+
+  // The first frame waits for the build, so the scratch buffer is free once
+  // that frame completes.
+  sDeletionQueue.Retire(sSubmittedFrame + 1, [=] {
+    DestroyTrackedBuffer(scratchBuffer, scratchAllocation,
+                         MemoryCategory::kScratch);
+  });
+
+  Ensures(structure != VK_NULL_HANDLE);
+  Ensures(allocation != VK_NULL_HANDLE);
 
-  if (auto result = EndOneTimeSubmit(*commandBuffer); !result) {
+  LOG_LEAVE();
+  return memReq.memoryRequirements.size;
+} // BuildBottomLevelAccelerationStructure
+
+// The geometry of the sphere BLAS: the boxes in sSpheresBuffer.
+static VkGeometryNV SpheresGeometry() noexcept {
+  VkGeometryNV geometry = {};
+  geometry.sType = VK_STRUCTURE_TYPE_GEOMETRY_NV;
+  geometry.geometryType = VK_GEOMETRY_TYPE_AABBS_NV;
+  geometry.geometry.triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
+
+  VkGeometryAABBNV& spheres = geometry.geometry.aabbs;
+  spheres.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
+  spheres.aabbData = sSpheresBuffer;
+  spheres.numAABBs = gsl::narrow_cast<std::uint32_t>(sSceneSpheres.size());
+  spheres.stride = sizeof(Sphere);
+  spheres.offset = offsetof(Sphere, aabbMin);
+
+  geometry.flags = VK_GEOMETRY_OPAQUE_BIT_NV;
+  return geometry;
+} // SpheresGeometry
+
+// Create the scratch buffer refits of the sphere BLAS use, for --animate.
+static tl::expected<void, std::system_error>
+CreateSpheresUpdateScratch() noexcept {
+  VkAccelerationStructureMemoryRequirementsInfoNV memReqInfo = {};
+  memReqInfo.sType =
+    VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
+  memReqInfo.accelerationStructure = sBottomLevelAccelerationStructure;
+  memReqInfo.type =
+    VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_UPDATE_SCRATCH_NV;
+
+  VkMemoryRequirements2 memReq = {};
+  memReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+
+  vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo, &memReq);
+
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = memReq.memoryRequirements.size;
+  bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (auto result = vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI,
+                                    &sSpheresUpdateScratch,
+                                    &sSpheresUpdateScratchAllocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(sSpheresUpdateScratchAllocation, MemoryCategory::kScratch,
+                  "sSpheresUpdateScratch");
+  return {};
+} // CreateSpheresUpdateScratch
+
+static tl::expected<void, std::system_error>
+CreateBottomLevelAccelerationStructure() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(sAccelerationStructureBuild != VK_NULL_HANDLE);
+
+  VkGeometryTrianglesNV triangles = {};
+  triangles.sType = VK_STRUCTURE_TYPE_GEOMETRY_TRIANGLES_NV;
+
+  // Animated spheres are refit, which the build has to allow.
+  bool const animate = sAnimateFraction > 0.0;
+  VkGeometryNV geometry = SpheresGeometry();
+  auto spheresSize = BuildBottomLevelAccelerationStructure(
+    geometry, animate ? VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV : 0,
+    "sBottomLevelAccelerationStructure", sBottomLevelAccelerationStructure,
+    sBottomLevelAccelerationStructureAllocation);
+  if (!spheresSize) {
     LOG_LEAVE();
-    return tl::unexpected(result.error());
+    return tl::unexpected(spheresSize.error());
+  }
+
+  if (animate) {
+    if (auto result = CreateSpheresUpdateScratch(); !result) {
+      LOG_LEAVE();
+      return result;
+    }
+  }
+
+  // Each mesh BLAS is built in its encoded vertices' space; its instance
+  // transforms map it back.
+  geometry.geometryType = VK_GEOMETRY_TYPE_TRIANGLES_NV;
+  geometry.geometry.aabbs = {};
+  geometry.geometry.aabbs.sType = VK_STRUCTURE_TYPE_GEOMETRY_AABB_NV;
+
+  for (std::uint32_t id = 0; id < sMeshes.size(); ++id) {
+    EncodedMesh const& mesh = sMeshLibrary[id];
+    MeshBuffers& buffers = sMeshes[id];
+
+    triangles.vertexData = buffers.vertexBuffer;
+    triangles.vertexOffset = 0;
+    triangles.vertexCount = gsl::narrow_cast<std::uint32_t>(mesh.vertexCount);
+    triangles.vertexStride = mesh.vertexStride;
+    switch (mesh.format) {
+    case VertexFormat::kFloat32:
+      triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+      break;
+    case VertexFormat::kFloat16:
+      triangles.vertexFormat = VK_FORMAT_R16G16B16_SFLOAT;
+      break;
+    case VertexFormat::kSnorm16:
+      triangles.vertexFormat = VK_FORMAT_R16G16B16_SNORM;
+      break;
+    }
+    triangles.indexData = buffers.indexBuffer;
+    triangles.indexOffset = 0;
+    triangles.indexCount =
+      gsl::narrow_cast<std::uint32_t>(3 * mesh.triangleCount);
+    triangles.indexType =
+      mesh.index16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    geometry.geometry.triangles = triangles;
+
+    auto meshSize = BuildBottomLevelAccelerationStructure(
+      geometry, 0,
+      "sMeshes[" + std::to_string(id) + "].bottomLevelAccelerationStructure",
+      buffers.bottomLevelAccelerationStructure,
+      buffers.bottomLevelAccelerationStructureAllocation);
+    if (!meshSize) {
+      LOG_LEAVE();
+      return tl::unexpected(meshSize.error());
+    }
+    buffers.bottomLevelAccelerationStructureSize = *meshSize;
+
+    std::fprintf(stderr, "Mesh %u BLAS: %.1f MiB, %.1f bytes/triangle\n", id,
+                 static_cast<double>(*meshSize) / (1 << 20),
+                 static_cast<double>(*meshSize) / mesh.triangleCount);
+    Ensures(buffers.bottomLevelAccelerationStructure != VK_NULL_HANDLE);
+  }
+
+  if (!sMeshes.empty()) {
+    std::vector<std::uint64_t> meshBytes;
+    for (auto&& buffers : sMeshes) {
+      meshBytes.push_back(buffers.bottomLevelAccelerationStructureSize);
+    }
+    InstancingStats const stats =
+      ComputeInstancingStats(sMeshLibrary, sMeshInstanceMeshes, meshBytes);
+    std::fprintf(stderr,
+                 "Mesh instancing: %llu instances of %llu BLASes from %llu "
+                 "meshes, %.1f MiB of BLAS against %.1f MiB flattened (%.1f "
+                 "%% saved)\n",
+                 static_cast<unsigned long long>(stats.instances),
+                 static_cast<unsigned long long>(stats.uniqueMeshes),
+                 static_cast<unsigned long long>(stats.meshesAdded),
+                 static_cast<double>(stats.sharedBytes) / (1 << 20),
+                 static_cast<double>(stats.flattenedBytes) / (1 << 20),
+                 100.0 * stats.SavedFraction());
   }
 
   Ensures(sBottomLevelAccelerationStructure != VK_NULL_HANDLE);
-  Ensures(sBottomLevelAccelerationStructureAllocation != VK_NULL_HANDLE);
 
   LOG_LEAVE();
   return {};
 } // CreateBottomLevelAccelerationStructure
 
+// Fill sTopLevelInstances and sInstanceCuller. The scene is one instance of
+// the sphere BLAS and one per sMeshInstanceTransforms entry, referencing
+// the BLAS of its mesh.
+static tl::expected<void, std::system_error>
+GatherTopLevelInstances() noexcept {
+  std::uint64_t bottomLevelHandle;
+  if (auto result = vkGetAccelerationStructureHandleNV(
+        sDevice, sBottomLevelAccelerationStructure, sizeof(bottomLevelHandle),
+        &bottomLevelHandle);
+      result != VK_SUCCESS) {
+    return tl::unexpected(std::system_error(
+      vk::make_error_code(result), "vkGetAccelerationStructureHandleNV"));
+  }
+
+  float const identity[3][4] = {
+    {1.f, 0.f, 0.f, 0.f}, {0.f, 1.f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}};
+  InstanceBounds const sphereBounds = sSceneSphereBounds;
+
+  VkGeometryInstanceNV instance = {};
+  std::memcpy(instance.transform, identity, sizeof(instance.transform));
+  instance.instanceCustomIndex = 0;
+  instance.mask = 0xF;
+  instance.instanceOffset = 0;
+  instance.accelerationStructureHandle = bottomLevelHandle;
+
+  sTopLevelInstances = {instance};
+  std::vector<InstanceBounds> bounds = {TransformBounds(
+    identity, sphereBounds.boundsMin, sphereBounds.boundsMax)};
+
+  try {
+    std::vector<std::uint64_t> meshHandles(sMeshes.size());
+    for (std::size_t id = 0; id < sMeshes.size(); ++id) {
+      if (auto result = vkGetAccelerationStructureHandleNV(
+            sDevice, sMeshes[id].bottomLevelAccelerationStructure,
+            sizeof(meshHandles[id]), &meshHandles[id]);
+          result != VK_SUCCESS) {
+        return tl::unexpected(std::system_error(
+          vk::make_error_code(result), "vkGetAccelerationStructureHandleNV"));
+      }
+    }
+
+    std::vector<Transform3x4> transforms(sMeshInstanceTransforms.size());
+    PackInstanceTransforms(sMeshInstanceTransforms, 0, transforms);
+
+    sTopLevelInstances.reserve(1 + transforms.size());
+    bounds.reserve(1 + transforms.size());
+    for (std::size_t i = 0; i < transforms.size(); ++i) {
+      std::uint32_t const id = sMeshInstanceMeshes[i];
+      EncodedMesh const& mesh = sMeshLibrary[id];
+
+      // The encoding transform maps the mesh's vertices back to the loaded
+      // positions, which its bounds bound, and the instance's moves them.
+      Transform3x4 const transform =
+        Multiply(transforms[i], EncodingTransform(mesh));
+      std::memcpy(instance.transform, transform.m,
+                  sizeof(instance.transform));
+      instance.instanceCustomIndex = sMeshes[id].firstNormal;
+      instance.instanceOffset = 1; // the triangle hit group
+      instance.accelerationStructureHandle = meshHandles[id];
+
+      sTopLevelInstances.push_back(instance);
+      bounds.push_back(
+        TransformBounds(transforms[i].m, mesh.boundsMin, mesh.boundsMax));
+    }
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(
+      std::system_error(std::make_error_code(std::errc::not_enough_memory),
+                        "GatherTopLevelInstances"));
+  }
+
+  sInstanceCuller.Assign(bounds);
+  sTopLevelInstanceBounds = std::move(bounds);
+
+  // Keep instances a tenth of the scene size outside the view, which
+  // secondary rays are likely to reach.
+  float extent = 0.f;
+  for (auto&& b : sTopLevelInstanceBounds) {
+    for (int c = 0; c < 3; ++c) {
+      extent = std::max(extent, b.boundsMax[c] - b.boundsMin[c]);
+    }
+  }
+  sInstanceCullMargin = .1f * extent;
+
+  return {};
+} // GatherTopLevelInstances
+
 static tl::expected<void, std::system_error>
 CreateTopLevelAccelerationStructure() noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
   Expects(sAllocator != VK_NULL_HANDLE);
+  Expects(sAccelerationStructureBuild != VK_NULL_HANDLE);
+  Expects(!sFrames.empty());
+
+  if (auto result = GatherTopLevelInstances(); !result) {
+    LOG_LEAVE();
+    return result;
+  }
 
   VkAccelerationStructureCreateInfoNV accelerationStructureCI = {};
   accelerationStructureCI.sType =
@@ -1877,94 +3578,113 @@ CreateTopLevelAccelerationStructure() noexcept {
   accelerationStructureCI.info.type =
     VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV;
   accelerationStructureCI.info.flags = 0;
-  accelerationStructureCI.info.instanceCount = 1;
+  accelerationStructureCI.info.instanceCount =
+    gsl::narrow_cast<std::uint32_t>(sTopLevelInstances.size());
   accelerationStructureCI.info.geometryCount = 0;
 
-  if (auto result = vkCreateAccelerationStructureNV(
-        sDevice, &accelerationStructureCI, nullptr,
-        &sTopLevelAccelerationStructure);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(std::system_error(vk::make_error_code(result),
-                                            "vkCreateAccelerationStructureNV"));
-  }
+  // Each frame slot gets a TLAS sized for every instance and the scratch
+  // its rebuilds use, on whichever queue they run.
+  for (auto& frame : sFrames) {
+    if (auto result = vkCreateAccelerationStructureNV(
+          sDevice, &accelerationStructureCI, nullptr, &frame.topLevel);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(std::system_error(
+        vk::make_error_code(result), "vkCreateAccelerationStructureNV"));
+    }
 
-  NameObject(sDevice, VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_NV,
-             sTopLevelAccelerationStructure, "sTopLevelAccelerationStructure");
+    NameObject(sDevice, VK_OBJECT_TYPE_ACCELERATION_STRUCTURE_NV,
+               frame.topLevel, "sFrames.topLevel");
 
-  VkAccelerationStructureMemoryRequirementsInfoNV memReqInfo = {};
-  memReqInfo.sType =
-    VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
-  memReqInfo.accelerationStructure = sTopLevelAccelerationStructure;
-  memReqInfo.type =
-    VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_NV;
+    VkAccelerationStructureMemoryRequirementsInfoNV memReqInfo = {};
+    memReqInfo.sType =
+      VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_INFO_NV;
+    memReqInfo.accelerationStructure = frame.topLevel;
+    memReqInfo.type =
+      VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_OBJECT_NV;
 
-  VkMemoryRequirements2 memReq = {};
-  memReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    VkMemoryRequirements2 memReq = {};
+    memReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
 
-  vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo, &memReq);
+    vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo,
+                                                   &memReq);
 
-  char objectName[] = "sTopLevelAccelerationStructureAllocation";
+    char objectName[] = "sFrames.topLevelAllocation";
 
-  VmaAllocationCreateInfo allocationCI = {};
-  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
-  allocationCI.usage = VMA_MEMORY_USAGE_UNKNOWN;
-  allocationCI.pUserData = objectName;
+    VmaAllocationCreateInfo allocationCI = {};
+    allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+    allocationCI.usage = VMA_MEMORY_USAGE_UNKNOWN;
 
-  if (auto result =
-        vmaAllocateMemory(sAllocator, &memReq.memoryRequirements, &allocationCI,
-                          &sTopLevelAccelerationStructureAllocation, nullptr);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(
-      std::system_error(vk::make_error_code(result), "vmaAllocateMemory"));
-  }
+    if (auto result =
+          vmaAllocateMemory(sAllocator, &memReq.memoryRequirements,
+                            &allocationCI, &frame.topLevelAllocation, nullptr);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vmaAllocateMemory"));
+    }
 
-  VmaAllocationInfo info;
-  vmaGetAllocationInfo(sAllocator, sTopLevelAccelerationStructureAllocation,
-                       &info);
+    TrackAllocation(frame.topLevelAllocation,
+                    MemoryCategory::kAccelerationStructure, objectName);
 
-  VkBindAccelerationStructureMemoryInfoNV bindInfo = {};
-  bindInfo.sType = VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
-  bindInfo.accelerationStructure = sTopLevelAccelerationStructure;
-  bindInfo.memory = info.deviceMemory;
-  bindInfo.memoryOffset = info.offset;
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(sAllocator, frame.topLevelAllocation, &info);
 
-  if (auto result = vkBindAccelerationStructureMemoryNV(sDevice, 1, &bindInfo);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(std::system_error(
-      vk::make_error_code(result), "vkBindAccelerationStructureMemoryNV"));
-  }
+    VkBindAccelerationStructureMemoryInfoNV bindInfo = {};
+    bindInfo.sType =
+      VK_STRUCTURE_TYPE_BIND_ACCELERATION_STRUCTURE_MEMORY_INFO_NV;
+    bindInfo.accelerationStructure = frame.topLevel;
+    bindInfo.memory = info.deviceMemory;
+    bindInfo.memoryOffset = info.offset;
 
-  std::uint64_t bottomLevelHandle;
-  if (auto result = vkGetAccelerationStructureHandleNV(
-        sDevice, sBottomLevelAccelerationStructure, sizeof(bottomLevelHandle),
-        &bottomLevelHandle);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(std::system_error(
-      vk::make_error_code(result), "vkGetAccelerationStructureHandleNV"));
-  }
+    if (auto result =
+          vkBindAccelerationStructureMemoryNV(sDevice, 1, &bindInfo);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(std::system_error(
+        vk::make_error_code(result), "vkBindAccelerationStructureMemoryNV"));
+    }
 
-  struct VkGeometryInstanceNV {
-    float transform[12];
-    std::uint32_t instanceCustomIndex : 24;
-    std::uint32_t mask : 8;
-    std::uint32_t instanceOffset : 24;
-    std::uint32_t flags : 8;
-    std::uint64_t accelerationStructureHandle;
-  };
+    memReqInfo.type =
+      VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
+    vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo,
+                                                   &memReq);
+
+    // The scratch is never shared between queue families: a rebuild only
+    // needs its size, not what an earlier build left in it.
+    VkBufferCreateInfo bufferCI = {};
+    bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCI.size = memReq.memoryRequirements.size;
+    bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+
+    allocationCI = {};
+    allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+    allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+    if (auto result = vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI,
+                                      &frame.topLevelScratch,
+                                      &frame.topLevelScratchAllocation,
+                                      nullptr);
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+    }
+
+    TrackAllocation(frame.topLevelScratchAllocation, MemoryCategory::kScratch,
+                    "sFrames.topLevelScratch");
+  }
 
   VkBuffer instanceBuffer;
   VmaAllocation instanceAllocation;
 
   VkBufferCreateInfo bufferCI = {};
   bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCI.size = sizeof(VkGeometryInstanceNV);
+  bufferCI.size = sTopLevelInstances.size() * sizeof(VkGeometryInstanceNV);
   bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
 
-  allocationCI = {};
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 
   if (auto result =
@@ -1976,6 +3696,9 @@ CreateTopLevelAccelerationStructure() noexcept {
       std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
   }
 
+  TrackAllocation(instanceAllocation, MemoryCategory::kStaging,
+                  "sTopLevelAccelerationStructureInstances");
+
   VkGeometryInstanceNV* instanceData;
   if (auto ptr =
         MapMemory<VkGeometryInstanceNV*>(sAllocator, instanceAllocation)) {
@@ -1985,70 +3708,110 @@ CreateTopLevelAccelerationStructure() noexcept {
     return tl::unexpected(ptr.error());
   }
 
-  glm::mat4 transform = glm::mat4(1.f);
-
-  std::memcpy(instanceData->transform, glm::value_ptr(transform),
-              sizeof(transform));
-  instanceData->instanceCustomIndex = 0;
-  instanceData->mask = 0xF;
-  instanceData->instanceOffset = 0;
-  instanceData->accelerationStructureHandle = bottomLevelHandle;
+  // The first builds have every instance; frames cull from there.
+  std::copy(sTopLevelInstances.begin(), sTopLevelInstances.end(),
+            instanceData);
 
   vmaUnmapMemory(sAllocator, instanceAllocation);
 
-  memReqInfo.type =
-    VK_ACCELERATION_STRUCTURE_MEMORY_REQUIREMENTS_TYPE_BUILD_SCRATCH_NV;
-
-  VkMemoryRequirements2 topLevelMemReq = {};
-  topLevelMemReq.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  std::vector<std::uint32_t> allInstances(sTopLevelInstances.size());
+  for (std::uint32_t i = 0; i < allInstances.size(); ++i) allInstances[i] = i;
 
-  memReqInfo.accelerationStructure = sTopLevelAccelerationStructure;
-  vkGetAccelerationStructureMemoryRequirementsNV(sDevice, &memReqInfo,
-                                                 &topLevelMemReq);
+  // The builds read the same instances and write nothing in common, so
+  // they need no barriers between them.
+  for (auto& frame : sFrames) {
+    vkCmdBuildAccelerationStructureNV(
+      sAccelerationStructureBuild, &accelerationStructureCI.info,
+      instanceBuffer /* instanceData */, 0 /* instanceOffset */,
+      VK_FALSE /* update */, frame.topLevel /* dst */,
+      VK_NULL_HANDLE /* src */, frame.topLevelScratch, 0 /* scratchOffset */);
+
+    frame.builtInstances = allInstances;
+    frame.builtRefit = sSphereRefitCount;
+  }
 
-  VkBuffer scratchBuffer;
-  VmaAllocation scratchAllocation;
+  sDeletionQueue.Retire(sSubmittedFrame + 1, [=] {
+    DestroyTrackedBuffer(instanceBuffer, instanceAllocation,
+                         MemoryCategory::kStaging);
+  });
 
-  bufferCI = {};
-  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCI.size = topLevelMemReq.memoryRequirements.size;
-  bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+  for (auto&& frame : sFrames) {
+    Ensures(frame.topLevel != VK_NULL_HANDLE);
+    Ensures(frame.topLevelAllocation != VK_NULL_HANDLE);
+    Ensures(frame.topLevelScratch != VK_NULL_HANDLE);
+  }
 
-  allocationCI = {};
-  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  LOG_LEAVE();
+  return {};
+} // CreateTopLevelAccelerationStructure
 
-  if (auto result =
-        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &scratchBuffer,
-                        &scratchAllocation, nullptr);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(
-      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+// Release the spheres back to the graphics queue and submit the builds
+// recorded since BeginAccelerationStructureBuild to sComputeQueue.
+//
+// Later, RecordTopLevelRebuild submits a frame's TLAS rebuild to
+// sComputeQueue as well, so it can overlap the previous frame's trace. The
+// BLAS refits of animated spheres stay in the frame's graphics command
+// buffer, ahead of its trace.
+static tl::expected<void, std::system_error>
+SubmitAccelerationStructureBuild() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(sAccelerationStructureBuild != VK_NULL_HANDLE);
+  Expects(sAccelerationStructuresBuilt != VK_NULL_HANDLE);
+  Expects(!sAccelerationStructuresPending);
+
+  VkCommandBuffer commandBuffer = sAccelerationStructureBuild;
+  sAccelerationStructureBuild = VK_NULL_HANDLE;
+
+  // BeginAccelerationStructureBuild acquired the spheres.
+  std::vector<std::uint64_t> releases, acquires;
+  if (sQueueFamilies.AsyncCompute()) {
+    acquires.push_back(HandleId(sSpheresBuffer));
+
+    VkBufferMemoryBarrier release =
+      OwnershipTransfer(sSpheresBuffer, 0, 0, sComputeQueueFamilyIndex,
+                        sQueueFamilyIndex);
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         1, &release, 0, nullptr);
+    releases.push_back(HandleId(sSpheresBuffer));
   }
 
-  auto commandBuffer = BeginOneTimeSubmit();
-  if (!commandBuffer) {
+  if (auto result = vkEndCommandBuffer(commandBuffer); result != VK_SUCCESS) {
+    vkFreeCommandBuffers(sDevice, sComputeCommandPool, 1, &commandBuffer);
     LOG_LEAVE();
-    return tl::unexpected(commandBuffer.error());
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkEndCommandBuffer"));
   }
 
-  vkCmdBuildAccelerationStructureNV(
-    *commandBuffer, &accelerationStructureCI.info,
-    instanceBuffer /* instanceData */, 0 /* instanceOffset */,
-    VK_FALSE /* update */, sTopLevelAccelerationStructure /* dst */,
-    VK_NULL_HANDLE /* src */, scratchBuffer, 0 /* scratchOffset */);
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = &sAccelerationStructuresBuilt;
 
-  if (auto result = EndOneTimeSubmit(*commandBuffer); !result) {
+  if (auto result =
+        QueueSubmit(QueueRole::kCompute, "AccelerationStructureBuild",
+                    submitInfo, VK_NULL_HANDLE, std::move(releases),
+                    std::move(acquires));
+      result != VK_SUCCESS) {
+    vkFreeCommandBuffers(sDevice, sComputeCommandPool, 1, &commandBuffer);
     LOG_LEAVE();
-    return tl::unexpected(result.error());
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkQueueSubmit"));
   }
 
-  Ensures(sTopLevelAccelerationStructure != VK_NULL_HANDLE);
-  Ensures(sTopLevelAccelerationStructureAllocation != VK_NULL_HANDLE);
+  sAccelerationStructuresPending = true;
+  sDeletionQueue.Retire(sSubmittedFrame + 1, [commandBuffer]() mutable {
+    vkFreeCommandBuffers(sDevice, sComputeCommandPool, 1, &commandBuffer);
+  });
 
   LOG_LEAVE();
   return {};
-} // CreateTopLevelAccelerationStructure
+} // SubmitAccelerationStructureBuild
 
 static tl::expected<void, std::system_error> CreateShaderBindingTable() noexcept {
   LOG_ENTER();
@@ -2056,7 +3819,7 @@ static tl::expected<void, std::system_error> CreateShaderBindingTable() noexcept
   Expects(sPipeline != VK_NULL_HANDLE);
   Expects(sAllocator != VK_NULL_HANDLE);
   Expects(sBottomLevelAccelerationStructure != VK_NULL_HANDLE);
-  Expects(sTopLevelAccelerationStructure != VK_NULL_HANDLE);
+  Expects(!sFrames.empty() && sFrames[0].topLevel != VK_NULL_HANDLE);
 
   VkPhysicalDeviceRayTracingPropertiesNV rtProps = {};
   rtProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PROPERTIES_NV;
@@ -2067,67 +3830,101 @@ static tl::expected<void, std::system_error> CreateShaderBindingTable() noexcept
 
   vkGetPhysicalDeviceProperties2(sPhysicalDevice, &props);
   sShaderGroupHandleSize = rtProps.shaderGroupHandleSize;
+  sShaderGroupBaseAlignment = rtProps.shaderGroupBaseAlignment;
 #ifndef NDEBUG
   std::fprintf(stderr, "sShaderGroupHandleSize: %d\n", sShaderGroupHandleSize);
+  std::fprintf(stderr, "sShaderGroupBaseAlignment: %d\n",
+               sShaderGroupBaseAlignment);
 #endif
 
+  shader::SphereMaterial const& sphereMaterial = kSphereTints[sSphereTint];
   sShaderBindingTableGenerator.AddRayGen(0);
   sShaderBindingTableGenerator.AddMiss(1);
-  sShaderBindingTableGenerator.AddHitGroup(2);
+  sSphereHitRecord = sShaderBindingTableGenerator.AddHitGroup(
+    2, gsl::as_bytes(gsl::make_span(&sphereMaterial, 1)));
+  sShaderBindingTableGenerator.AddHitGroup(3);
 
+  VkDeviceSize const size = sShaderBindingTableGenerator.ComputeSize(
+    sShaderGroupHandleSize, sShaderGroupBaseAlignment);
+  sShaderBindingTableHost.resize(static_cast<std::size_t>(size));
+
+  // A slice per frame slot; slice 0 also carries the initial upload.
   VkBufferCreateInfo bufferCI = {};
   bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCI.size =
-    sShaderBindingTableGenerator.ComputeSize(sShaderGroupHandleSize);
+  bufferCI.size = size * kMaxFramesInFlight;
   bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
+  char stagingObjectName[] = "sShaderBindingTableStaging";
+
   VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 
-  VkBuffer stagingBuffer;
-  VmaAllocation stagingAllocation;
-
-  if (auto result =
-        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &stagingBuffer,
-                        &stagingAllocation, nullptr);
+  if (auto result = vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI,
+                                    &sShaderBindingTableStaging,
+                                    &sShaderBindingTableStagingAllocation,
+                                    nullptr);
       result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
   }
 
-  std::byte* pStaging;
-  if (auto ptr = MapMemory<std::byte*>(sAllocator, stagingAllocation)) {
-    pStaging = *ptr;
+  TrackAllocation(sShaderBindingTableStagingAllocation,
+                  MemoryCategory::kStaging, stagingObjectName);
+
+  if (auto ptr = MapMemory<std::byte*>(sAllocator,
+                                       sShaderBindingTableStagingAllocation)) {
+    sShaderBindingTableStagingData = *ptr;
   } else {
     LOG_LEAVE();
     return tl::unexpected(ptr.error());
   }
 
-  VmaAllocationInfo info;
-  vmaGetAllocationInfo(sAllocator, stagingAllocation, &info);
+  using Layout = SphereShaderBindingTableLayout;
 
-  if (auto result =
-        sShaderBindingTableGenerator.Generate(sDevice, sPipeline, pStaging);
-      result != VK_SUCCESS) {
+  if (sShaderGroupHandleSize == Layout::kHandleSize &&
+      sShaderGroupBaseAlignment == Layout::kBaseAlignment) {
+    // Same rules as the generator, so the offsets used in Draw still apply.
+    Expects(size == Layout::kSize);
+    Expects(sShaderBindingTableGenerator.HitGroupOffset() ==
+            Layout::kHitGroupOffset);
+
+    std::array<std::byte, Layout::kGroupCount * Layout::kHandleSize> handles;
+    if (auto result = vkGetRayTracingShaderGroupHandlesNV(
+          sDevice, sPipeline, 0, Layout::kGroupCount, handles.size(),
+          handles.data());
+        result != VK_SUCCESS) {
+      LOG_LEAVE();
+      return tl::unexpected(std::system_error(
+        vk::make_error_code(result), "vkGetRayTracingShaderGroupHandlesNV"));
+    }
+
+    Layout::Fill(handles.data(), sShaderBindingTableHost.data(), {}, {},
+                 std::make_tuple(sphereMaterial, SBTNoInlineData{}));
+  } else if (auto result = sShaderBindingTableGenerator.Generate(
+               sDevice, sPipeline, sShaderBindingTableHost.data());
+             result != VK_SUCCESS) {
     LOG_LEAVE();
     return tl::unexpected(std::system_error(
       vk::make_error_code(result), "ShaderBindingTableGenerator::Generate"));
   }
 
-  vmaUnmapMemory(sAllocator, stagingAllocation);
+  std::memcpy(sShaderBindingTableStagingData, sShaderBindingTableHost.data(),
+              sShaderBindingTableHost.size());
+  vmaFlushAllocation(sAllocator, sShaderBindingTableStagingAllocation, 0,
+                     size);
 
   char objectName[] = "sShaderBindingTable";
 
+  bufferCI.size = size;
   bufferCI.usage =
     VK_BUFFER_USAGE_RAY_TRACING_BIT_NV | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
 #ifndef NDEBUG
   std::fprintf(stderr, "sShaderBindingTable size: %zu\n", bufferCI.size);
 #endif
 
-  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
   allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-  allocationCI.pUserData = objectName;
 
   if (auto result = vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI,
                                     &sShaderBindingTable,
@@ -2138,6 +3935,9 @@ static tl::expected<void, std::system_error> CreateShaderBindingTable() noexcept
       std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
   }
 
+  TrackAllocation(sShaderBindingTableAllocation,
+                  MemoryCategory::kShaderBindingTable, objectName);
+
   auto commandBuffer = BeginOneTimeSubmit();
   if (!commandBuffer) {
     LOG_LEAVE();
@@ -2147,43 +3947,129 @@ static tl::expected<void, std::system_error> CreateShaderBindingTable() noexcept
   VkBufferCopy region = {};
   region.srcOffset = 0;
   region.dstOffset = 0;
-  region.size = bufferCI.size;
+  region.size = size;
 
-  vkCmdCopyBuffer(*commandBuffer, stagingBuffer, sShaderBindingTable, 1,
-                  &region);
+  vkCmdCopyBuffer(*commandBuffer, sShaderBindingTableStaging,
+                  sShaderBindingTable, 1, &region);
 
   if (auto result = EndOneTimeSubmit(*commandBuffer); !result) {
     LOG_LEAVE();
     return tl::unexpected(result.error());
   }
 
-  vmaDestroyBuffer(sAllocator, stagingBuffer, stagingAllocation);
-
   Ensures(sShaderBindingTable != VK_NULL_HANDLE);
   Ensures(sShaderBindingTableAllocation != VK_NULL_HANDLE);
+  Ensures(sShaderBindingTableStaging != VK_NULL_HANDLE);
+  Ensures(sShaderBindingTableStagingData != nullptr);
 
   LOG_LEAVE();
   return {};
 } // CreateShaderBindingTable
 
+// Patch the dirty SBT records in sShaderBindingTableHost, stage just the
+// regions that changed in slot's slice of the staging buffer and record
+// their copies into sShaderBindingTable.
+static void UpdateShaderBindingTable(VkCommandBuffer commandBuffer,
+                                     std::uint32_t slot) noexcept {
+  Expects(sShaderBindingTableStagingData != nullptr);
+  Expects(slot < kMaxFramesInFlight);
+  if (!sShaderBindingTableGenerator.HasDirtyRecords()) return;
+
+  [[maybe_unused]] auto const stats =
+    sShaderBindingTableGenerator.WriteDirtyRecords(
+      sShaderBindingTableHost.data(), sShaderBindingTableRegions);
+#ifndef NDEBUG
+  std::fprintf(stderr,
+               "SBT update: %u records, %zu bytes written, %zu bytes copied "
+               "in %zu regions\n",
+               stats.recordCount, stats.bytesWritten, stats.bytesCopied,
+               sShaderBindingTableRegions.size());
+#endif
+  if (sShaderBindingTableRegions.empty()) return;
+
+  // Regions merged across a gap copy bytes of other records too, which
+  // only the host copy is sure to hold current.
+  VkDeviceSize const sliceOffset = slot * sShaderBindingTableHost.size();
+  for (auto&& region : sShaderBindingTableRegions) {
+    region.srcOffset += sliceOffset;
+    std::memcpy(sShaderBindingTableStagingData + region.srcOffset,
+                sShaderBindingTableHost.data() + region.dstOffset,
+                static_cast<std::size_t>(region.size));
+    vmaFlushAllocation(sAllocator, sShaderBindingTableStagingAllocation,
+                       region.srcOffset, region.size);
+  }
+
+  VkBufferMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex =
+    VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = sShaderBindingTable;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+
+  // Previous frames' traces must be done reading before the copy writes.
+  barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  vkCmdCopyBuffer(
+    commandBuffer, sShaderBindingTableStaging, sShaderBindingTable,
+    gsl::narrow_cast<std::uint32_t>(sShaderBindingTableRegions.size()),
+    sShaderBindingTableRegions.data());
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 0,
+                       nullptr, 1, &barrier, 0, nullptr);
+} // UpdateShaderBindingTable
+
+// At shutdown, once the device is idle.
+static void DestroyShaderBindingTable() noexcept {
+  Expects(sShaderBindingTableStagingData != nullptr);
+
+  vmaUnmapMemory(sAllocator, sShaderBindingTableStagingAllocation);
+  sShaderBindingTableStagingData = nullptr;
+  DestroyTrackedBuffer(sShaderBindingTableStaging,
+                       sShaderBindingTableStagingAllocation,
+                       MemoryCategory::kStaging);
+  sShaderBindingTableStaging = VK_NULL_HANDLE;
+  sShaderBindingTableStagingAllocation = VK_NULL_HANDLE;
+
+  DestroyTrackedBuffer(sShaderBindingTable, sShaderBindingTableAllocation,
+                       MemoryCategory::kShaderBindingTable);
+  sShaderBindingTable = VK_NULL_HANDLE;
+  sShaderBindingTableAllocation = VK_NULL_HANDLE;
+} // DestroyShaderBindingTable
+
 static tl::expected<void, std::system_error> CreateDescriptorSets() noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
   Expects(sDescriptorPool != VK_NULL_HANDLE);
   Expects(sBottomLevelAccelerationStructure != VK_NULL_HANDLE);
-  Expects(sTopLevelAccelerationStructure != VK_NULL_HANDLE);
+  Expects(!sFrames.empty() && sFrames[0].topLevel != VK_NULL_HANDLE);
   Expects(sUniformBuffer != VK_NULL_HANDLE);
-  Expects(sOutputImage != VK_NULL_HANDLE);
+  Expects(sTonemapDescriptorSetLayout != VK_NULL_HANDLE);
   Expects(sSpheresBuffer != VK_NULL_HANDLE);
+  Expects(sMeshNormalsBuffer != VK_NULL_HANDLE);
+  Expects(sSampleTablesBuffer != VK_NULL_HANDLE);
 
-  sDescriptorSets.resize(1);
+  // One per frame slot, differing only in the slot's TLAS.
+  sDescriptorSets.resize(sFrames.size());
+  std::vector<VkDescriptorSetLayout> const layouts(sDescriptorSets.size(),
+                                                   sDescriptorSetLayout);
 
   VkDescriptorSetAllocateInfo descriptorSetAI = {};
   descriptorSetAI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
   descriptorSetAI.descriptorPool = sDescriptorPool;
   descriptorSetAI.descriptorSetCount =
     gsl::narrow_cast<std::uint32_t>(sDescriptorSets.size());
-  descriptorSetAI.pSetLayouts = &sDescriptorSetLayout;
+  descriptorSetAI.pSetLayouts = layouts.data();
 
   if (auto result = vkAllocateDescriptorSets(sDevice, &descriptorSetAI,
                                              sDescriptorSets.data());
@@ -2193,16 +4079,22 @@ static tl::expected<void, std::system_error> CreateDescriptorSets() noexcept {
                                             "vkAllocateDescriptorSets"));
   }
 
-  VkWriteDescriptorSetAccelerationStructureNV accelerationStructureInfo = {};
-  accelerationStructureInfo.sType =
-    VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_NV;
-  accelerationStructureInfo.accelerationStructureCount = 1;
-  accelerationStructureInfo.pAccelerationStructures =
-    &sTopLevelAccelerationStructure;
+  sTonemapDescriptorSets.resize(
+    sPresentPath == PresentPath::kDirect ? sSwapchainImages.size() : 1);
+  std::vector<VkDescriptorSetLayout> const tonemapLayouts(
+    sTonemapDescriptorSets.size(), sTonemapDescriptorSetLayout);
 
-  VkDescriptorImageInfo outputImageInfo = {};
-  outputImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-  outputImageInfo.imageView = sOutputImageView;
+  descriptorSetAI.descriptorSetCount =
+    gsl::narrow_cast<std::uint32_t>(sTonemapDescriptorSets.size());
+  descriptorSetAI.pSetLayouts = tonemapLayouts.data();
+
+  if (auto result = vkAllocateDescriptorSets(sDevice, &descriptorSetAI,
+                                             sTonemapDescriptorSets.data());
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                            "vkAllocateDescriptorSets"));
+  }
 
   VkDescriptorBufferInfo uniformBufferInfo = {};
   uniformBufferInfo.buffer = sUniformBuffer;
@@ -2212,96 +4104,161 @@ static tl::expected<void, std::system_error> CreateDescriptorSets() noexcept {
   VkDescriptorBufferInfo spheresBufferInfo = {};
   spheresBufferInfo.buffer = sSpheresBuffer;
   spheresBufferInfo.offset = 0;
-  spheresBufferInfo.range = sizeof(Sphere) * sSpheres.size();
-
-  std::array<VkWriteDescriptorSet, 4> writeDescriptorSets;
-
-  writeDescriptorSets[0] = {};
-  writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  writeDescriptorSets[0].pNext = &accelerationStructureInfo;
-  writeDescriptorSets[0].dstSet = sDescriptorSets[0];
-  writeDescriptorSets[0].dstBinding = 0;
-  writeDescriptorSets[0].descriptorCount = 1;
-  writeDescriptorSets[0].descriptorType =
-    VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
-
-  writeDescriptorSets[1] = {};
-  writeDescriptorSets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  writeDescriptorSets[1].dstSet = sDescriptorSets[0];
-  writeDescriptorSets[1].dstBinding = 1;
-  writeDescriptorSets[1].descriptorCount = 1;
-  writeDescriptorSets[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-  writeDescriptorSets[1].pImageInfo = &outputImageInfo;
-
-  writeDescriptorSets[2] = {};
-  writeDescriptorSets[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  writeDescriptorSets[2].dstSet = sDescriptorSets[0];
-  writeDescriptorSets[2].dstBinding = 2;
-  writeDescriptorSets[2].descriptorCount = 1;
-  writeDescriptorSets[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-  writeDescriptorSets[2].pBufferInfo = &uniformBufferInfo;
-
-  writeDescriptorSets[3] = {};
-  writeDescriptorSets[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-  writeDescriptorSets[3].dstSet = sDescriptorSets[0];
-  writeDescriptorSets[3].dstBinding = 3;
-  writeDescriptorSets[3].descriptorCount = 1;
-  writeDescriptorSets[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-  writeDescriptorSets[3].pBufferInfo = &spheresBufferInfo;
+  spheresBufferInfo.range =
+    static_cast<VkDeviceSize>(sSceneSpheres.size_bytes());
+
+  VkDescriptorBufferInfo meshNormalsBufferInfo = {};
+  meshNormalsBufferInfo.buffer = sMeshNormalsBuffer;
+  meshNormalsBufferInfo.offset = 0;
+  meshNormalsBufferInfo.range = VK_WHOLE_SIZE;
+
+  VkDescriptorBufferInfo sampleTablesBufferInfo = {};
+  sampleTablesBufferInfo.buffer = sSampleTablesBuffer;
+  sampleTablesBufferInfo.offset = 0;
+  sampleTablesBufferInfo.range = VK_WHOLE_SIZE;
+
+  std::vector<VkWriteDescriptorSetAccelerationStructureNV>
+    accelerationStructureInfos(sDescriptorSets.size());
+  std::vector<VkWriteDescriptorSet> writeDescriptorSets(
+    5 * sDescriptorSets.size());
+
+  for (std::size_t i = 0; i < sDescriptorSets.size(); ++i) {
+    auto& accelerationStructureInfo = accelerationStructureInfos[i];
+    accelerationStructureInfo = {};
+    accelerationStructureInfo.sType =
+      VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_NV;
+    accelerationStructureInfo.accelerationStructureCount = 1;
+    accelerationStructureInfo.pAccelerationStructures = &sFrames[i].topLevel;
+
+    auto* writes = &writeDescriptorSets[5 * i];
+
+    writes[0] = {};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].pNext = &accelerationStructureInfo;
+    writes[0].dstSet = sDescriptorSets[i];
+    writes[0].dstBinding = 0;
+    writes[0].descriptorCount = 1;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV;
+
+    writes[1] = {};
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = sDescriptorSets[i];
+    writes[1].dstBinding = 2;
+    writes[1].descriptorCount = 1;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    writes[1].pBufferInfo = &uniformBufferInfo;
+
+    writes[2] = {};
+    writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[2].dstSet = sDescriptorSets[i];
+    writes[2].dstBinding = 3;
+    writes[2].descriptorCount = 1;
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[2].pBufferInfo = &spheresBufferInfo;
+
+    writes[3] = {};
+    writes[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[3].dstSet = sDescriptorSets[i];
+    writes[3].dstBinding = 4;
+    writes[3].descriptorCount = 1;
+    writes[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[3].pBufferInfo = &meshNormalsBufferInfo;
+
+    writes[4] = {};
+    writes[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[4].dstSet = sDescriptorSets[i];
+    writes[4].dstBinding = 5;
+    writes[4].descriptorCount = 1;
+    writes[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[4].pBufferInfo = &sampleTablesBufferInfo;
+  }
 
   vkUpdateDescriptorSets(
     sDevice, gsl::narrow_cast<std::uint32_t>(writeDescriptorSets.size()),
     writeDescriptorSets.data(), 0, nullptr);
 
   Ensures(!sDescriptorSets.empty());
+  Ensures(!sTonemapDescriptorSets.empty());
 
   LOG_LEAVE();
   return {};
 } // CreateDescriptorSets
 
-static tl::expected<void, std::system_error> CreateSyncObjects() noexcept {
+// Point the trace and tonemap descriptor sets at the current sHDRImage and
+// sOutputImage or swapchain images, which are recreated along with the
+// swapchain.
+static tl::expected<void, std::system_error> UpdateImageDescriptors() noexcept {
   LOG_ENTER();
   Expects(sDevice != VK_NULL_HANDLE);
-  Expects(!sFrames.empty());
+  Expects(!sDescriptorSets.empty());
+  Expects(!sTonemapDescriptorSets.empty());
+  Expects(sHDRImageView != VK_NULL_HANDLE);
+  Expects(sPresentPath == PresentPath::kDirect
+            ? sTonemapDescriptorSets.size() == sSwapchainImageViews.size()
+            : sOutputImageView != VK_NULL_HANDLE);
+
+  VkDescriptorImageInfo hdrImageInfo = {};
+  hdrImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  hdrImageInfo.imageView = sHDRImageView;
+
+  std::vector<VkDescriptorImageInfo> outputImageInfos(
+    sTonemapDescriptorSets.size());
+  for (std::size_t i = 0; i < outputImageInfos.size(); ++i) {
+    outputImageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    outputImageInfos[i].imageView = sPresentPath == PresentPath::kDirect
+                                      ? sSwapchainImageViews[i]
+                                      : sOutputImageView;
+  }
 
-  VkFenceCreateInfo fenceCI = {};
-  fenceCI.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCI.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  std::size_t const traceSets = sDescriptorSets.size();
+  std::vector<VkWriteDescriptorSet> writeDescriptorSets(
+    traceSets + 2 * sTonemapDescriptorSets.size());
 
-  sFramesComplete.resize(sFrames.size());
-  for (std::size_t i = 0; i < sFramesComplete.size(); ++i) {
-    if (auto result =
-          vkCreateFence(sDevice, &fenceCI, nullptr, &sFramesComplete[i]);
-        result != VK_SUCCESS) {
-      LOG_LEAVE();
-      return tl::unexpected(
-        std::system_error(vk::make_error_code(result), "vkCreateFence"));
-    }
+  writeDescriptorSets[0] = {};
+  writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writeDescriptorSets[0].dstSet = sDescriptorSets[0];
+  writeDescriptorSets[0].dstBinding = 1;
+  writeDescriptorSets[0].descriptorCount = 1;
+  writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writeDescriptorSets[0].pImageInfo = &hdrImageInfo;
 
-    NameObject(sDevice, VK_OBJECT_TYPE_FENCE, sFramesComplete[i],
-               "sFramesComplete");
+  for (std::size_t i = 1; i < traceSets; ++i) {
+    writeDescriptorSets[i] = writeDescriptorSets[0];
+    writeDescriptorSets[i].dstSet = sDescriptorSets[i];
   }
 
-  VkSemaphoreCreateInfo semaphoreCI = {};
-  semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  for (std::size_t i = 0; i < sTonemapDescriptorSets.size(); ++i) {
+    auto& hdrWrite = writeDescriptorSets[traceSets + 2 * i];
+    hdrWrite = writeDescriptorSets[0];
+    hdrWrite.dstSet = sTonemapDescriptorSets[i];
+    hdrWrite.dstBinding = 0;
 
-  if (auto result =
-        vkCreateSemaphore(sDevice, &semaphoreCI, nullptr, &sRenderFinished);
-      result != VK_SUCCESS) {
-    LOG_LEAVE();
-    return tl::unexpected(
-      std::system_error(vk::make_error_code(result), "vkCreateSemaphore"));
+    auto& outputWrite = writeDescriptorSets[traceSets + 2 * i + 1];
+    outputWrite = hdrWrite;
+    outputWrite.dstBinding = 1;
+    outputWrite.pImageInfo = &outputImageInfos[i];
   }
 
-  NameObject(sDevice, VK_OBJECT_TYPE_SEMAPHORE, sRenderFinished,
-             "sRenderFinished");
-
-  Ensures(!sFramesComplete.empty());
-  Ensures(sRenderFinished != VK_NULL_HANDLE);
+  vkUpdateDescriptorSets(
+    sDevice, gsl::narrow_cast<std::uint32_t>(writeDescriptorSets.size()),
+    writeDescriptorSets.data(), 0, nullptr);
 
   LOG_LEAVE();
   return {};
-} // CreateSyncObjects
+} // UpdateImageDescriptors
+
+// Feed the trace time of a frame seen complete to sDynamicResolution.
+static void UpdateDynamicResolution(double traceMs) noexcept {
+  if (!sDynamicResolution.Update(static_cast<float>(traceMs))) return;
+
+  sRenderScale = sDynamicResolution.Scale();
+  VkExtent2D const extent = RenderExtent();
+  std::fprintf(sReports, "dynamic resolution: scale %g (%ux%u) trace %2.5g ms "
+               "target %g ms\n",
+               sRenderScale, extent.width, extent.height,
+               sDynamicResolution.SmoothedMs(),
+               sDynamicResolution.GetConfig().targetMs);
+} // UpdateDynamicResolution
 
 static tl::expected<void, std::system_error> RecreateSwapchain() noexcept {
   int width = 0, height = 0;
@@ -2310,40 +4267,636 @@ static tl::expected<void, std::system_error> RecreateSwapchain() noexcept {
     glfwWaitEvents();
   }
 
-  vkDeviceWaitIdle(sDevice);
+  // Frames already submitted may still use the current resources, so they
+  // are retired instead of destroyed and the device is not waited on.
+  // CreateSwapchain retires the old swapchain to sPresentDeletionQueue
+  // after passing it as oldSwapchain.
+  for (auto&& framebuffer : sFramebuffers) {
+    sDeletionQueue.Retire(sSubmittedFrame, [framebuffer] {
+      vkDestroyFramebuffer(sDevice, framebuffer, nullptr);
+    });
+  }
+  sFramebuffers.clear();
 
-  // TODO: Clean up swapchain, swapchain image views, framebuffers
+  for (auto&& imageView : sSwapchainImageViews) {
+    sDeletionQueue.Retire(sSubmittedFrame, [imageView] {
+      vkDestroyImageView(sDevice, imageView, nullptr);
+    });
+  }
+  sSwapchainImageViews.clear();
+  sSwapchainImages.clear();
+
+  if (sOutputImage != VK_NULL_HANDLE) {
+    sDeletionQueue.Retire(
+      sSubmittedFrame,
+      [image = sOutputImage, allocation = sOutputImageAllocation,
+       imageView = sOutputImageView] {
+        vkDestroyImageView(sDevice, imageView, nullptr);
+        DestroyTrackedImage(image, allocation, MemoryCategory::kOutputImage);
+      });
+  }
+  sOutputImage = VK_NULL_HANDLE;
+  sOutputImageAllocation = VK_NULL_HANDLE;
+  sOutputImageView = VK_NULL_HANDLE;
+
+  sDeletionQueue.Retire(
+    sSubmittedFrame, [image = sHDRImage, allocation = sHDRImageAllocation,
+                      imageView = sHDRImageView] {
+      vkDestroyImageView(sDevice, imageView, nullptr);
+      DestroyTrackedImage(image, allocation, MemoryCategory::kOutputImage);
+    });
+  sHDRImage = VK_NULL_HANDLE;
+  sHDRImageAllocation = VK_NULL_HANDLE;
+  sHDRImageView = VK_NULL_HANDLE;
+
+  // Descriptor sets referenced by pending command buffers must not be
+  // updated, so the image descriptors go into freshly allocated sets.
+  sDeletionQueue.Retire(
+    sSubmittedFrame,
+    [descriptorSets = std::move(sDescriptorSets),
+     tonemapDescriptorSets = std::move(sTonemapDescriptorSets)] {
+      vkFreeDescriptorSets(
+        sDevice, sDescriptorPool,
+        gsl::narrow_cast<std::uint32_t>(descriptorSets.size()),
+        descriptorSets.data());
+      vkFreeDescriptorSets(
+        sDevice, sDescriptorPool,
+        gsl::narrow_cast<std::uint32_t>(tonemapDescriptorSets.size()),
+        tonemapDescriptorSets.data());
+    });
+  sDescriptorSets.clear();
+  sTonemapDescriptorSets.clear();
 
   // clang-format off
   auto result = CreateSwapchain()
     .and_then(CreateSwapchainImagesAndViews)
     .and_then(CreateFramebuffers)
     .and_then(CreateOutputImage)
+    .and_then(CreateHDRImage)
+    .and_then(CreateDescriptorSets)
+    .and_then(UpdateImageDescriptors)
     ;
   // clang-format on
 
+  sFramebufferResized = false;
+
   sCamera.aspectRatio(static_cast<float>(sSwapchainExtent.width) /
                       static_cast<float>(sSwapchainExtent.height));
   return result;
 } // RecreateSwapchain
 
+// Move the --animate spheres, then record the copies of the ranges of them
+// that changed into sSpheresBuffer and a refit of the sphere BLAS. Returns
+// whether it recorded a refit, which the TLAS has to be rebuilt after.
+static tl::expected<bool, std::system_error>
+RecordSpheresUpdate(VkCommandBuffer commandBuffer) noexcept {
+  if (sAnimateFraction <= 0.0) return false;
+
+  // Until the first frame takes the spheres back from the acceleration
+  // structure build on the compute queue, they stay as they are.
+  if (sAccelerationStructuresPending) return false;
+
+  try {
+    AnimateSpheres({reinterpret_cast<SceneSphere const*>(sSceneSpheres.data()),
+                    sSceneSpheres.size()},
+                   sAnimateFraction, sAnimationFrame++, sSphereStore);
+    sSphereUpdateStats = sSphereStore.TakeChanges(sSphereRanges);
+    sSphereRegions.resize(sSphereRanges.size());
+
+    // The sphere instance has the identity transform, so its bounds are the
+    // spheres'.
+    if (sSphereUpdateStats.boundsGrew) {
+      SceneSphere const& bounds = sSphereStore.Bounds();
+      std::copy_n(bounds.aabbMin, 3, sTopLevelInstanceBounds[0].boundsMin);
+      std::copy_n(bounds.aabbMax, 3, sTopLevelInstanceBounds[0].boundsMax);
+      sInstanceCuller.Assign(sTopLevelInstanceBounds);
+    }
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory),
+      "RecordSpheresUpdate"));
+  }
+  if (sSphereRanges.empty()) return false;
+
+  // The changed spheres packed one range after another, in a staging buffer
+  // retired once the frame completes.
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = sSphereUpdateStats.copied * sizeof(Sphere);
+  bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+  VkBuffer stagingBuffer;
+  VmaAllocation stagingAllocation;
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &stagingBuffer,
+                        &stagingAllocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(stagingAllocation, MemoryCategory::kStaging,
+                  "sSpheresUpdateStaging");
+  sDeletionQueue.Retire(sSubmittedFrame + 1, [=] {
+    DestroyTrackedBuffer(stagingBuffer, stagingAllocation,
+                         MemoryCategory::kStaging);
+  });
+
+  if (auto ptr = MapMemory<SceneSphere*>(sAllocator, stagingAllocation)) {
+    SceneSphere* staging = *ptr;
+    VkDeviceSize srcOffset = 0;
+    for (std::size_t i = 0; i < sSphereRanges.size(); ++i) {
+      DirtyRange const& range = sSphereRanges[i];
+      staging = std::copy_n(sSphereStore.Spheres().begin() +
+                              static_cast<gsl::index>(range.first),
+                            range.count, staging);
+      sSphereRegions[i].srcOffset = srcOffset;
+      sSphereRegions[i].dstOffset = range.first * sizeof(Sphere);
+      sSphereRegions[i].size = range.count * sizeof(Sphere);
+      srcOffset += sSphereRegions[i].size;
+    }
+    vmaFlushAllocation(sAllocator, stagingAllocation, 0, VK_WHOLE_SIZE);
+    vmaUnmapMemory(sAllocator, stagingAllocation);
+  } else {
+    return tl::unexpected(ptr.error());
+  }
+
+  // Earlier frames' traces and refits must be done reading the spheres
+  // before the copy writes them.
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV |
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 0, nullptr);
+
+  vkCmdCopyBuffer(commandBuffer, stagingBuffer, sSpheresBuffer,
+                  gsl::narrow_cast<std::uint32_t>(sSphereRegions.size()),
+                  sSphereRegions.data());
+
+  // The refit and this frame's trace read the copied spheres, and the refit
+  // overwrites the BLAS earlier traces and TLAS builds read, and the scratch
+  // the last refit wrote.
+  VkBufferMemoryBarrier spheresBarrier = {};
+  spheresBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  spheresBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  spheresBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  spheresBarrier.srcQueueFamilyIndex = spheresBarrier.dstQueueFamilyIndex =
+    VK_QUEUE_FAMILY_IGNORED;
+  spheresBarrier.buffer = sSpheresBuffer;
+  spheresBarrier.offset = 0;
+  spheresBarrier.size = VK_WHOLE_SIZE;
+
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT |
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV |
+                         VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV |
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV,
+                       0, 1, &barrier, 1, &spheresBarrier, 0, nullptr);
+
+  VkGeometryNV const geometry = SpheresGeometry();
+
+  VkAccelerationStructureInfoNV info = {};
+  info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+  info.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_NV;
+  info.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_NV;
+  info.geometryCount = 1;
+  info.pGeometries = &geometry;
+
+  vkCmdBuildAccelerationStructureNV(
+    commandBuffer, &info, VK_NULL_HANDLE /* instanceData */,
+    0 /* instanceOffset */, VK_TRUE /* update */,
+    sBottomLevelAccelerationStructure /* dst */,
+    sBottomLevelAccelerationStructure /* src */, sSpheresUpdateScratch,
+    0 /* scratchOffset */);
+  sSphereRefitCount += 1;
+  sSphereRefitFrame = sSubmittedFrame + 1;
+
+  // The TLAS rebuild reads the BLAS.
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0,
+                       1, &barrier, 0, nullptr, 0, nullptr);
+
+  return true;
+} // RecordSpheresUpdate
+
+// Cull sTopLevelInstances against the camera and, if the survivors differ
+// from the instances in frame's TLAS or the sphere BLAS was refit since it
+// was built, record a rebuild of it with just them, timed by the slot's
+// queries from firstQuery.
+//
+// The rebuild goes to frame.topLevelBuild, for Draw to submit to
+// sComputeQueue ahead of the frame, unless the frame refits the BLAS or
+// the last frame to refit it may still be running: the refit is recorded
+// on the graphics queue, and only a completed frame's fence orders it
+// before work on another queue. A rebuild on the graphics queue follows
+// the frame's refit in frame.commandBuffer.
+static tl::expected<void, std::system_error>
+RecordTopLevelRebuild(Frame& frame, std::uint32_t firstQuery,
+                      bool refit) noexcept {
+  // The first frame traces the full TLAS built by
+  // SubmitAccelerationStructureBuild, which it only waits for at the ray
+  // tracing stage.
+  if (sAccelerationStructuresPending) return {};
+
+  glm::vec3 const eye = sCamera.eye(), u = sCamera.u(), v = sCamera.v(),
+                  w = sCamera.w();
+  Frustum const frustum =
+    Frustum::FromPinhole({eye.x, eye.y, eye.z}, {u.x, u.y, u.z},
+                         {v.x, v.y, v.z}, {w.x, w.y, w.z})
+      .Expanded(sInstanceCullMargin);
+
+  double const start = glfwGetTime();
+  if (sInstanceCullingEnabled) {
+    sInstanceCullStats = sInstanceCuller.Cull(frustum, sCulledInstances);
+  } else {
+    sCulledInstances.resize(sTopLevelInstances.size());
+    for (std::uint32_t i = 0; i < sCulledInstances.size(); ++i) {
+      sCulledInstances[i] = i;
+    }
+    sInstanceCullStats = {sCulledInstances.size(), sCulledInstances.size()};
+  }
+  sInstanceCullMs = (glfwGetTime() - start) * 1e3;
+
+  if (sCulledInstances == frame.builtInstances &&
+      frame.builtRefit == sSphereRefitCount) {
+    return {};
+  }
+  frame.builtInstances = sCulledInstances;
+  frame.builtRefit = sSphereRefitCount;
+
+  bool const onCompute = !refit && sSphereRefitFrame <= sCompletedFrame;
+  VkCommandBuffer const commandBuffer =
+    onCompute ? frame.topLevelBuild : frame.commandBuffer;
+
+  if (onCompute) {
+    if (auto result = vkResetCommandPool(sDevice, frame.computeCommandPool, 0);
+        result != VK_SUCCESS) {
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkResetCommandPool"));
+    }
+
+    VkCommandBufferBeginInfo commandBufferBI = {};
+    commandBufferBI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBI.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (auto result = vkBeginCommandBuffer(commandBuffer, &commandBufferBI);
+        result != VK_SUCCESS) {
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkBeginCommandBuffer"));
+    }
+  }
+
+  auto const instanceCount =
+    gsl::narrow_cast<std::uint32_t>(frame.builtInstances.size());
+
+  // A new instance buffer per rebuild, retired once the frame completes, so
+  // frames in flight keep theirs.
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = std::max(instanceCount, 1u) * sizeof(VkGeometryInstanceNV);
+  bufferCI.usage = VK_BUFFER_USAGE_RAY_TRACING_BIT_NV;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+
+  VkBuffer instanceBuffer;
+  VmaAllocation instanceAllocation;
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &instanceBuffer,
+                        &instanceAllocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(instanceAllocation, MemoryCategory::kStaging,
+                  "sTopLevelAccelerationStructureInstances");
+  sDeletionQueue.Retire(sSubmittedFrame + 1, [=] {
+    DestroyTrackedBuffer(instanceBuffer, instanceAllocation,
+                         MemoryCategory::kStaging);
+  });
+
+  if (auto ptr =
+        MapMemory<VkGeometryInstanceNV*>(sAllocator, instanceAllocation)) {
+    VkGeometryInstanceNV* instanceData = *ptr;
+    for (auto index : frame.builtInstances) {
+      *instanceData++ = sTopLevelInstances[index];
+    }
+    vmaUnmapMemory(sAllocator, instanceAllocation);
+  } else {
+    return tl::unexpected(ptr.error());
+  }
+
+  VkAccelerationStructureInfoNV info = {};
+  info.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_INFO_NV;
+  info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_NV;
+  info.instanceCount = instanceCount;
+
+  // The slot's last trace of the TLAS this overwrites completed before its
+  // fence signaled, but the last build into it, and into its scratch, may
+  // have been on this queue. On the graphics queue, this frame's refit
+  // wrote the BLAS the build reads.
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV |
+                          VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+
+  VkPipelineStageFlags srcStageMask =
+    VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV;
+  if (!onCompute) {
+    barrier.srcAccessMask |= VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+    srcStageMask |= VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, srcStageMask,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV, 0,
+                       1, &barrier, 0, nullptr, 0, nullptr);
+
+  // Draw resets the graphics queue's queries only, so the build resets its
+  // own pair on whichever queue times it.
+  bool const timed = !onCompute || sComputeTimestamps;
+  if (timed) {
+    vkCmdResetQueryPool(commandBuffer, sQueryPool,
+                        firstQuery + kTopLevelBuildQuery, 2);
+    vkCmdWriteTimestamp(commandBuffer,
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                        sQueryPool, firstQuery + kTopLevelBuildQuery);
+  }
+
+  vkCmdBuildAccelerationStructureNV(
+    commandBuffer, &info, instanceBuffer /* instanceData */,
+    0 /* instanceOffset */, VK_FALSE /* update */, frame.topLevel /* dst */,
+    VK_NULL_HANDLE /* src */, frame.topLevelScratch, 0 /* scratchOffset */);
+
+  if (timed) {
+    vkCmdWriteTimestamp(commandBuffer,
+                        VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                        sQueryPool, firstQuery + kTopLevelBuildQuery + 1);
+    frame.topLevelBuildInstances = instanceCount;
+  }
+
+  // On sComputeQueue, the topLevelBuilt semaphore the trace waits on orders
+  // it after the build.
+  if (onCompute) {
+    if (auto result = vkEndCommandBuffer(commandBuffer); result != VK_SUCCESS) {
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkEndCommandBuffer"));
+    }
+    frame.topLevelBuildPending = true;
+    return {};
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_NV;
+  barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_NV;
+
+  vkCmdPipelineBarrier(commandBuffer,
+                       VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_NV,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 1,
+                       &barrier, 0, nullptr, 0, nullptr);
+
+  return {};
+} // RecordTopLevelRebuild
+
+// Make frame's readback buffer hold at least size bytes. Its contents are
+// not kept.
+static tl::expected<void, std::system_error>
+ReserveReadback(Frame& frame, VkDeviceSize size) noexcept {
+  if (frame.readbackSize >= size) return {};
+
+  if (frame.readback != VK_NULL_HANDLE) {
+    sDeletionQueue.Retire(
+      sSubmittedFrame,
+      [buffer = frame.readback, allocation = frame.readbackAllocation] {
+        DestroyTrackedBuffer(buffer, allocation, MemoryCategory::kStaging);
+      });
+    frame.readback = VK_NULL_HANDLE;
+    frame.readbackAllocation = VK_NULL_HANDLE;
+    frame.readbackSize = 0;
+  }
+
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size = size;
+  bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &frame.readback,
+                        &frame.readbackAllocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(frame.readbackAllocation, MemoryCategory::kStaging,
+                  "sFrames.readback");
+  frame.readbackSize = size;
+  return {};
+} // ReserveReadback
+
+// Publish the image frame read back, now that it has completed, converting
+// it to RGBA8 on the way into the shared ring, and record it. The video
+// stream reads the RGBA8 pixels from the ring's slot when there is one.
+static tl::expected<void, std::system_error>
+ExportReadback(Frame& frame) noexcept {
+  if (!frame.readbackPending) return {};
+  frame.readbackPending = false;
+
+  VkExtent2D const extent = frame.readbackExtent;
+  bool const record = sVideoStream.IsOpen() &&
+                      extent.width == sVideoStream.Width() &&
+                      extent.height == sVideoStream.Height();
+  if (sVideoStream.IsOpen() && !record) sVideoDropped += 1;
+  if (!sFrameExport.IsOpen() && !record) return {};
+
+  vmaInvalidateAllocation(sAllocator, frame.readbackAllocation, 0,
+                          VK_WHOLE_SIZE);
+  std::uint8_t const* src;
+  if (auto ptr = MapMemory<std::uint8_t const*>(sAllocator,
+                                                frame.readbackAllocation)) {
+    src = *ptr;
+  } else {
+    return tl::unexpected(ptr.error());
+  }
+
+  gsl::span<std::uint8_t> pixels;
+  if (sFrameExport.IsOpen()) {
+    pixels =
+      sFrameExport.BeginFrame(extent.width, extent.height, frame.inputTime);
+  }
+  if (pixels.empty() && record) {
+    try {
+      sVideoPixels.resize(std::size_t{4} * extent.width * extent.height);
+    } catch (std::bad_alloc const&) {
+      vmaUnmapMemory(sAllocator, frame.readbackAllocation);
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::not_enough_memory), "sVideoPixels"));
+    }
+    pixels = sVideoPixels;
+  }
+  if (pixels.empty()) {
+    vmaUnmapMemory(sAllocator, frame.readbackAllocation);
+    return {};
+  }
+
+  if (sSurfaceColorFormat.format == VK_FORMAT_B8G8R8A8_UNORM) {
+    for (gsl::index i = 0; i < pixels.size(); i += 4) {
+      pixels[i + 0] = src[i + 2];
+      pixels[i + 1] = src[i + 1];
+      pixels[i + 2] = src[i + 0];
+      pixels[i + 3] = src[i + 3];
+    }
+  } else {
+    std::memcpy(pixels.data(), src, static_cast<std::size_t>(pixels.size()));
+  }
+
+  vmaUnmapMemory(sAllocator, frame.readbackAllocation);
+
+  if (record) {
+    auto written = sVideoStream.Write(
+      {pixels.data(), extent.width, extent.height, extent.width});
+    if (!written) return written;
+  }
+  if (sFrameExport.IsOpen() && pixels.data() != sVideoPixels.data()) {
+    sFrameExport.Publish();
+  }
+  return {};
+} // ExportReadback
+
+// Read the queries frame wrote to its slot's range, from firstQuery, now
+// that its fence has signaled, and feed its trace time to
+// sDynamicResolution, once per frame.
+static void ReadFrameQueries(Frame& frame, std::uint32_t firstQuery) noexcept {
+  if (!frame.queriesPending) return;
+  frame.queriesPending = false;
+
+  std::uint32_t const queryCount =
+    frame.topLevelBuildInstances > 0 ? kFrameQueryCount : kTopLevelBuildQuery;
+  std::array<std::uint64_t, kFrameQueryCount> queries;
+  if (auto result = vkGetQueryPoolResults(
+        sDevice, sQueryPool, firstQuery, queryCount,
+        queryCount * sizeof(std::uint64_t), queries.data(),
+        sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT);
+      result != VK_SUCCESS) {
+    std::fprintf(stderr, "Cannot get query results: %s\n",
+                 vk::to_string(result));
+    return;
+  }
+
+  double const tickMs = sTimestampPeriod * 1e-06;
+  sFramePipeMs = (queries[1] - queries[0]) * tickMs;
+  sFrameTraceMs = (queries[kTraceQuery + 1] - queries[kTraceQuery]) * tickMs;
+  if (frame.topLevelBuildInstances > 0) {
+    sTopLevelBuildMs =
+      (queries[kTopLevelBuildQuery + 1] - queries[kTopLevelBuildQuery]) *
+      tickMs;
+    sTopLevelBuildInstanceCount = frame.topLevelBuildInstances;
+  }
+
+  if (sDynamicResolutionEnabled) UpdateDynamicResolution(sFrameTraceMs);
+} // ReadFrameQueries
+
+// Trace a width by height launch through sShaderBindingTable, depth views
+// deep.
+static void RecordTraceRays(VkCommandBuffer commandBuffer, std::uint32_t width,
+                            std::uint32_t height,
+                            std::uint32_t depth) noexcept {
+  VkBuffer const callableShaderBindingTable =
+    sShaderBindingTableGenerator.CallableSize() > 0 ? sShaderBindingTable
+                                                    : VK_NULL_HANDLE;
+
+  vkCmdTraceRaysNV(
+    commandBuffer,
+    sShaderBindingTable,                       // raygenShaderBindingTableBuffer
+    0,                                         // raygenShaderBindingOffset
+    sShaderBindingTable,                       // missShaderBindingTableBuffer
+    sShaderBindingTableGenerator.MissOffset(), // missShaderBindingOffset
+    sShaderBindingTableGenerator.MissStride(), // missShaderBindingStride
+    sShaderBindingTable,                       // hitShaderBindingTableBuffer
+    sShaderBindingTableGenerator.HitGroupOffset(), // hitShaderBindingOffset
+    sShaderBindingTableGenerator.HitGroupStride(), // hitShaderBindingStride
+    callableShaderBindingTable, // callableShaderBindingTableBuffer
+    sShaderBindingTableGenerator.CallableOffset(), // callableShaderBindingOffset
+    sShaderBindingTableGenerator.CallableStride(), // callableShaderBindingStride
+    width,  // width
+    height, // height
+    depth   // depth
+  );
+} // RecordTraceRays
+
 static tl::expected<void, std::system_error> Draw() noexcept {
-  VkFence frameComplete = sFramesComplete[sCurrentFrame];
+#ifndef NDEBUG
+  sSubmitGraph.ClearLog();
+#endif
 
-  if (auto result =
-        vkWaitForFences(sDevice, 1, &frameComplete, VK_TRUE, UINT64_MAX);
+  // The slot is free once the frame that used it last has completed, and
+  // in low latency mode input is not sampled until the previous frame has.
+  FrameSlot const slot = sFrameRing.Begin();
+  Frame& frame = sFrames[slot.index];
+  std::uint32_t const firstQuery = slot.index * kFrameQueryCount;
+
+  std::array<VkFence, 2> waitFences = {frame.complete, VK_NULL_HANDLE};
+  std::uint32_t waitFenceCount = 1;
+  if (slot.waitSerial > 0 &&
+      sFrameRing.SlotOf(slot.waitSerial) != slot.index) {
+    waitFences[waitFenceCount++] =
+      sFrames[sFrameRing.SlotOf(slot.waitSerial)].complete;
+  }
+
+  if (auto result = vkWaitForFences(sDevice, waitFenceCount, waitFences.data(),
+                                    VK_TRUE, UINT64_MAX);
       result != VK_SUCCESS) {
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkWaitForFences"));
   }
 
-  if (auto result = vkResetFences(sDevice, 1, &frameComplete);
+  if (slot.waitSerial > sCompletedFrame) {
+    sInputLatencySum +=
+      glfwGetTime() - sFrames[sFrameRing.SlotOf(slot.waitSerial)].inputTime;
+    sInputLatencyCount += 1;
+    sCompletedFrame = slot.waitSerial;
+  }
+  sDeletionQueue.Collect(sCompletedFrame);
+
+  // Both frames waited for are complete, and so are the presents their
+  // acquires waited on.
+  sPresentedFrameDone = std::max(sPresentedFrameDone, frame.releasedPresent);
+  if (slot.waitSerial > 0) {
+    sPresentedFrameDone =
+      std::max(sPresentedFrameDone,
+               sFrames[sFrameRing.SlotOf(slot.waitSerial)].releasedPresent);
+  }
+  sPresentDeletionQueue.Collect(sPresentedFrameDone);
+
+  ReadFrameQueries(frame, firstQuery);
+  if (auto result = ExportReadback(frame); !result) return result;
+
+  if (auto result = vkResetFences(sDevice, 1, &frame.complete);
       result != VK_SUCCESS) {
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkResetFences"));
   }
 
-  auto&& frame = sFrames[sCurrentFrame];
   VkSemaphore submitWaitSemaphore = frame.imageAvailable;
 
   VkAcquireNextImageInfoKHR nextInfo = {};
@@ -2352,19 +4905,26 @@ static tl::expected<void, std::system_error> Draw() noexcept {
   nextInfo.timeout = UINT64_MAX;
   nextInfo.semaphore = frame.imageAvailable;
 
-  VkResult result = vkAcquireNextImage2KHR(sDevice, &nextInfo, &sCurrentFrame);
+  VkResult result = vkAcquireNextImage2KHR(sDevice, &nextInfo, &sImageIndex);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
     if (auto recreated = RecreateSwapchain(); !recreated) {
       return tl::unexpected(recreated.error());
     }
-    result = vkAcquireNextImage2KHR(sDevice, &nextInfo, &sCurrentFrame);
+    nextInfo.swapchain = sSwapchain;
+    result = vkAcquireNextImage2KHR(sDevice, &nextInfo, &sImageIndex);
   }
 
   if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkAcquireNextImage2KHR"));
   }
+  frame.releasedPresent = sImagePresentedFrame[sImageIndex];
+
+#ifndef NDEBUG
+  ReportSubmitGraphError(sSubmitGraph.RecordSignal(
+    HandleId(submitWaitSemaphore), "vkAcquireNextImage2KHR"));
+#endif
 
   if (auto result = vkResetCommandPool(sDevice, frame.commandPool, 0);
       result != VK_SUCCESS) {
@@ -2372,20 +4932,22 @@ static tl::expected<void, std::system_error> Draw() noexcept {
       std::system_error(vk::make_error_code(result), "vkResetCommandPool"));
   }
 
-  frame = sFrames[sCurrentFrame];
-
+  VkDeviceSize const uniformOffset = sUniformBufferStride * slot.index;
   UniformBuffer* uniformBufferData;
-  if (auto ptr =
-        MapMemory<UniformBuffer*>(sAllocator, sUniformBufferAllocation)) {
-    uniformBufferData = *ptr;
+  if (auto ptr = MapMemory<std::byte*>(sAllocator, sUniformBufferAllocation)) {
+    uniformBufferData =
+      reinterpret_cast<UniformBuffer*>(*ptr + uniformOffset);
   } else {
     return tl::unexpected(ptr.error());
   }
 
-  uniformBufferData->Eye = glm::vec4(sCamera.eye(), 1.f);
-  uniformBufferData->U = glm::vec4(sCamera.u(), 0.f);
-  uniformBufferData->V = glm::vec4(sCamera.v(), 0.f);
-  uniformBufferData->W = glm::vec4(sCamera.w(), 0.f);
+  frame.inputTime = glfwGetTime();
+
+  uniformBufferData->Eye[0] = glm::vec4(sCamera.eye(), 1.f);
+  uniformBufferData->U[0] = glm::vec4(sCamera.u(), 0.f);
+  uniformBufferData->V[0] = glm::vec4(sCamera.v(), 0.f);
+  uniformBufferData->W[0] = glm::vec4(sCamera.w(), 0.f);
+  uniformBufferData->SampleCount = sSamplesPerPixel;
 
   vmaUnmapMemory(sAllocator, sUniformBufferAllocation);
 
@@ -2395,143 +4957,235 @@ static tl::expected<void, std::system_error> Draw() noexcept {
 
   vkBeginCommandBuffer(frame.commandBuffer, &commandBufferBI);
 
-  vkCmdResetQueryPool(frame.commandBuffer, sQueryPool, 0, 32);
+  vkCmdResetQueryPool(frame.commandBuffer, sQueryPool, firstQuery,
+                      kTopLevelBuildQuery);
   vkCmdWriteTimestamp(frame.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-                      sQueryPool, 0);
+                      sQueryPool, firstQuery);
+
+  PresentImages const presentImages = {sHDRImage, sOutputImage,
+                                       sSwapchainImages[sImageIndex]};
+  BarrierSink const recordBarriers =
+    [commandBuffer = frame.commandBuffer](
+      VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+      gsl::span<VkImageMemoryBarrier const> barriers) {
+      vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0,
+                           nullptr, 0, nullptr,
+                           gsl::narrow_cast<std::uint32_t>(barriers.size()),
+                           barriers.data());
+    };
+
+  RecordPresentBarriers(FrameStep::kBeforeTrace, sPresentPath, presentImages,
+                        recordBarriers);
+
+  // The first frame after an acceleration structure build takes back the
+  // spheres released by SubmitAccelerationStructureBuild.
+  bool const acquireSpheres =
+    sAccelerationStructuresPending && sQueueFamilies.AsyncCompute();
+  if (acquireSpheres) {
+    VkBufferMemoryBarrier acquire = OwnershipTransfer(
+      sSpheresBuffer, 0, VK_ACCESS_SHADER_READ_BIT, sComputeQueueFamilyIndex,
+      sQueueFamilyIndex);
+
+    vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 0,
+                         nullptr, 1, &acquire, 0, nullptr);
+  }
 
-  VkImageSubresourceRange sr = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  auto const refit = RecordSpheresUpdate(frame.commandBuffer);
+  if (!refit) return tl::unexpected(refit.error());
 
-  VkImageMemoryBarrier readyBarrier = {};
-  readyBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  readyBarrier.srcAccessMask = 0;
-  readyBarrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-  readyBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  readyBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-  readyBarrier.srcQueueFamilyIndex = readyBarrier.dstQueueFamilyIndex =
-    VK_QUEUE_FAMILY_IGNORED;
-  readyBarrier.image = sOutputImage;
-  readyBarrier.subresourceRange = sr;
+  frame.topLevelBuildInstances = 0;
+  if (auto result = RecordTopLevelRebuild(frame, firstQuery, *refit);
+      !result) {
+    return result;
+  }
 
-  vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &readyBarrier);
+  UpdateShaderBindingTable(frame.commandBuffer, slot.index);
 
   vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
                     sPipeline);
+  std::uint32_t const dynamicOffset =
+    gsl::narrow_cast<std::uint32_t>(uniformOffset);
   vkCmdBindDescriptorSets(
     frame.commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV, sPipelineLayout,
-    0, gsl::narrow_cast<std::uint32_t>(sDescriptorSets.size()),
-    sDescriptorSets.data(), 0, nullptr);
+    0, 1, &sDescriptorSets[slot.index], 1, &dynamicOffset);
 
   vkCmdWriteTimestamp(frame.commandBuffer,
                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, sQueryPool,
-                      2);
+                      firstQuery + kTraceQuery);
 
-  vkCmdTraceRaysNV(
-    frame.commandBuffer,
-    sShaderBindingTable,                       // raygenShaderBindingTableBuffer
-    0,                                         // raygenShaderBindingOffset
-    sShaderBindingTable,                       // missShaderBindingTableBuffer
-    sShaderBindingTableGenerator.MissOffset(), // missShaderBindingOffset
-    sShaderBindingTableGenerator.MissStride(), // missShaderBindingStride
-    sShaderBindingTable,                       // hitShaderBindingTableBuffer
-    sShaderBindingTableGenerator.HitGroupOffset(), // hitShaderBindingOffset
-    sShaderBindingTableGenerator.HitGroupStride(), // hitShaderBindingStride
-    VK_NULL_HANDLE,          // callableShaderBindingTableBuffer
-    0,                       // callableShaderBindingOffset
-    0,                       // callableShaderBindingStride
-    sSwapchainExtent.width,  // width
-    sSwapchainExtent.height, // height
-    1                        // depth
-  );
+  VkExtent2D const renderExtent = RenderExtent();
+
+  RecordTraceRays(frame.commandBuffer, renderExtent.width, renderExtent.height,
+                  1);
 
   vkCmdWriteTimestamp(frame.commandBuffer,
                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, sQueryPool,
-                      3);
-
-  VkImageMemoryBarrier tracedBarrier = {};
-  tracedBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  tracedBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-  tracedBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-  tracedBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-  tracedBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-  tracedBarrier.srcQueueFamilyIndex = tracedBarrier.dstQueueFamilyIndex =
-    VK_QUEUE_FAMILY_IGNORED;
-  tracedBarrier.image = sOutputImage;
-  tracedBarrier.subresourceRange = sr;
-
-  vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &tracedBarrier);
-
-  VkImageMemoryBarrier barrier = {};
-  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-  barrier.srcAccessMask = 0;
-  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex =
-    VK_QUEUE_FAMILY_IGNORED;
-  barrier.image = sSwapchainImages[sCurrentFrame];
-  barrier.subresourceRange = sr;
-
-  vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
-
-  VkImageCopy copy = {};
-  copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
-  copy.srcOffset = {0, 0, 0};
-  copy.dstSubresource = copy.srcSubresource;
-  copy.dstOffset = {0, 0, 0};
-  copy.extent = {sSwapchainExtent.width, sSwapchainExtent.height, 1};
-
-  vkCmdCopyImage(frame.commandBuffer, sOutputImage,
-                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                 sSwapchainImages[sCurrentFrame],
-                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+                      firstQuery + kTraceQuery + 1);
+
+  RecordPresentBarriers(FrameStep::kBeforeTonemap, sPresentPath,
+                        presentImages, recordBarriers);
+
+  TonemapPushConstants tonemapPC = {};
+  tonemapPC.renderExtent[0] = static_cast<std::int32_t>(renderExtent.width);
+  tonemapPC.renderExtent[1] = static_cast<std::int32_t>(renderExtent.height);
+  tonemapPC.outputExtent[0] = static_cast<std::int32_t>(sSwapchainExtent.width);
+  tonemapPC.outputExtent[1] =
+    static_cast<std::int32_t>(sSwapchainExtent.height);
+  tonemapPC.exposure = sTonemapParams.exposure;
+  tonemapPC.filterMode = static_cast<std::uint32_t>(sTonemapParams.filter);
+
+  vkCmdBindPipeline(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    sTonemapPipeline);
+  VkDescriptorSet const tonemapDescriptorSet =
+    sTonemapDescriptorSets[sPresentPath == PresentPath::kDirect ? sImageIndex
+                                                                : 0];
+  vkCmdBindDescriptorSets(frame.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          sTonemapPipelineLayout, 0, 1, &tonemapDescriptorSet,
+                          0, nullptr);
+  vkCmdPushConstants(frame.commandBuffer, sTonemapPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(tonemapPC),
+                     &tonemapPC);
+  vkCmdDispatch(frame.commandBuffer, (sSwapchainExtent.width + 7) / 8,
+                (sSwapchainExtent.height + 7) / 8, 1);
+
+  RecordPresentBarriers(FrameStep::kAfterTonemap, sPresentPath,
+                        presentImages, recordBarriers);
+
+  if (sPresentPath == PresentPath::kCopy) {
+    VkImageCopy copy = {};
+    copy.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    copy.srcOffset = {0, 0, 0};
+    copy.dstSubresource = copy.srcSubresource;
+    copy.dstOffset = {0, 0, 0};
+    copy.extent = {sSwapchainExtent.width, sSwapchainExtent.height, 1};
+
+    vkCmdCopyImage(frame.commandBuffer, sOutputImage,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   sSwapchainImages[sImageIndex],
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+
+    if (sFrameExport.IsOpen() || sVideoStream.IsOpen()) {
+      VkDeviceSize const readbackSize =
+        VkDeviceSize{4} * sSwapchainExtent.width * sSwapchainExtent.height;
+      if (auto result = ReserveReadback(frame, readbackSize); !result) {
+        return result;
+      }
 
-  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  barrier.dstAccessMask = 0;
-  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+      VkBufferImageCopy readback = {};
+      readback.imageSubresource = copy.srcSubresource;
+      readback.imageExtent = copy.extent;
+
+      vkCmdCopyImageToBuffer(frame.commandBuffer, sOutputImage,
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             frame.readback, 1, &readback);
+
+      VkBufferMemoryBarrier hostBarrier = {};
+      hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+      hostBarrier.srcQueueFamilyIndex = hostBarrier.dstQueueFamilyIndex =
+        VK_QUEUE_FAMILY_IGNORED;
+      hostBarrier.buffer = frame.readback;
+      hostBarrier.offset = 0;
+      hostBarrier.size = readbackSize;
+
+      vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                           &hostBarrier, 0, nullptr);
+
+      frame.readbackExtent = sSwapchainExtent;
+      frame.readbackPending = true;
+    }
 
-  vkCmdPipelineBarrier(frame.commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
-                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
+    RecordPresentBarriers(FrameStep::kAfterCopy, sPresentPath, presentImages,
+                          recordBarriers);
+  }
 
   vkCmdWriteTimestamp(frame.commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                      sQueryPool, 1);
+                      sQueryPool, firstQuery + 1);
 
   vkEndCommandBuffer(frame.commandBuffer);
 
-  VkPipelineStageFlags waitDstStageMask =
-    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  std::array<VkSemaphore, 2> waitSemaphores = {submitWaitSemaphore};
+  std::array<VkPipelineStageFlags, 2> waitDstStageMasks = {
+    PresentWaitStage(sPresentPath)};
+  std::uint32_t waitSemaphoreCount = 1;
+
+  // The first frame waits for the initial builds, which cover every slot's
+  // TLAS, and later frames for their slot's rebuild on sComputeQueue, which
+  // can run while the frames before them still trace their own TLAS.
+  if (sAccelerationStructuresPending) {
+    waitSemaphores[waitSemaphoreCount] = sAccelerationStructuresBuilt;
+    waitDstStageMasks[waitSemaphoreCount++] =
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+  } else if (frame.topLevelBuildPending) {
+    VkSubmitInfo buildSubmitInfo = {};
+    buildSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    buildSubmitInfo.commandBufferCount = 1;
+    buildSubmitInfo.pCommandBuffers = &frame.topLevelBuild;
+    buildSubmitInfo.signalSemaphoreCount = 1;
+    buildSubmitInfo.pSignalSemaphores = &frame.topLevelBuilt;
+
+    if (result = QueueSubmit(QueueRole::kCompute, "TopLevelBuild",
+                             buildSubmitInfo, VK_NULL_HANDLE);
+        result != VK_SUCCESS) {
+      return tl::unexpected(
+        std::system_error(vk::make_error_code(result), "vkQueueSubmit"));
+    }
+    frame.topLevelBuildPending = false;
+
+    waitSemaphores[waitSemaphoreCount] = frame.topLevelBuilt;
+    waitDstStageMasks[waitSemaphoreCount++] =
+      VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+  }
+
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = &submitWaitSemaphore;
-  submitInfo.pWaitDstStageMask = &waitDstStageMask;
+  submitInfo.waitSemaphoreCount = waitSemaphoreCount;
+  submitInfo.pWaitSemaphores = waitSemaphores.data();
+  submitInfo.pWaitDstStageMask = waitDstStageMasks.data();
   submitInfo.commandBufferCount = 1;
   submitInfo.pCommandBuffers = &frame.commandBuffer;
   submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = &sRenderFinished;
+  submitInfo.pSignalSemaphores = &sRenderFinished[sImageIndex];
 
-  if (result = vkQueueSubmit(sQueue, 1, &submitInfo, frameComplete);
+  std::vector<std::uint64_t> acquires;
+  if (acquireSpheres) acquires.push_back(HandleId(sSpheresBuffer));
+
+  if (result = QueueSubmit(QueueRole::kGraphics, "Draw", submitInfo,
+                           frame.complete, {}, std::move(acquires));
       result != VK_SUCCESS) {
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkQueueSubmit"));
   }
 
+  Ensures(slot.serial == sSubmittedFrame + 1);
+  sSubmittedFrame = slot.serial;
+  frame.queriesPending = true;
+  sAccelerationStructuresPending = false;
+
   VkPresentInfoKHR presentInfo = {};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = &sRenderFinished;
+  presentInfo.pWaitSemaphores = &sRenderFinished[sImageIndex];
   presentInfo.swapchainCount = 1;
   presentInfo.pSwapchains = &sSwapchain;
-  presentInfo.pImageIndices = &sCurrentFrame;
+  presentInfo.pImageIndices = &sImageIndex;
 
-  if (result = vkQueuePresentKHR(sQueue, &presentInfo); result != VK_SUCCESS) {
+#ifndef NDEBUG
+  ReportSubmitGraphError(sSubmitGraph.RecordWait(
+    HandleId(sRenderFinished[sImageIndex]), "vkQueuePresentKHR"));
+#endif
+  result = vkQueuePresentKHR(sQueue, &presentInfo);
+  sImagePresentedFrame[sImageIndex] = sSubmittedFrame;
+
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
+      sFramebufferResized) {
+    if (auto recreated = RecreateSwapchain(); !recreated) {
+      return tl::unexpected(recreated.error());
+    }
+  } else if (result != VK_SUCCESS) {
     return tl::unexpected(
       std::system_error(vk::make_error_code(result), "vkQueuePresentKHR"));
   }
@@ -2539,34 +5193,591 @@ static tl::expected<void, std::system_error> Draw() noexcept {
   return {};
 } // Draw
 
-int main() {
+// Create a 2D image of format for usage, and a view of it, named name.
+static tl::expected<void, std::system_error>
+CreateServeImage(VkFormat format, VkImageUsageFlags usage, VkExtent2D extent,
+                 char const* name, VkImage& image, VmaAllocation& allocation,
+                 VkImageView& imageView) noexcept {
+  VkImageCreateInfo imageCI = {};
+  imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageCI.imageType = VK_IMAGE_TYPE_2D;
+  imageCI.format = format;
+  imageCI.extent = {extent.width, extent.height, 1};
+  imageCI.mipLevels = 1;
+  imageCI.arrayLayers = 1;
+  imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageCI.usage = usage;
+  imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  if (auto result = vmaCreateImage(sAllocator, &imageCI, &allocationCI,
+                                   &image, &allocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateImage"));
+  }
+
+  TrackAllocation(allocation, MemoryCategory::kOutputImage, name);
+
+  VkImageViewCreateInfo imageViewCI = {};
+  imageViewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  imageViewCI.image = image;
+  imageViewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  imageViewCI.format = format;
+  imageViewCI.components = {
+    VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+    VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY};
+  imageViewCI.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  if (auto result = vkCreateImageView(sDevice, &imageViewCI, nullptr,
+                                      &imageView);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkCreateImageView"));
+  }
+
+  NameObject(sDevice, VK_OBJECT_TYPE_IMAGE, image, name);
+  return {};
+} // CreateServeImage
+
+// A trace set that shares everything but its image with the first frame
+// slot's, whose TLAS holds every instance as no frame is drawn to cull it,
+// and a tonemap set, both pointed at the serve images by
+// ReserveServeTarget.
+static tl::expected<void, std::system_error>
+CreateServeDescriptorSets() noexcept {
+  LOG_ENTER();
+  Expects(sDevice != VK_NULL_HANDLE);
+  Expects(!sDescriptorSets.empty());
+
+  std::array<VkDescriptorPoolSize, 4> const poolSizes = {
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_NV, 1},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
+    VkDescriptorPoolSize{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3}};
+
+  VkDescriptorPoolCreateInfo descriptorPoolCI = {};
+  descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptorPoolCI.poolSizeCount =
+    gsl::narrow_cast<std::uint32_t>(poolSizes.size());
+  descriptorPoolCI.pPoolSizes = poolSizes.data();
+  descriptorPoolCI.maxSets = 2;
+
+  if (auto result = vkCreateDescriptorPool(sDevice, &descriptorPoolCI,
+                                           nullptr, &sServeDescriptorPool);
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vkCreateDescriptorPool"));
+  }
+
+  std::array<VkDescriptorSetLayout, 2> const layouts = {
+    sDescriptorSetLayout, sTonemapDescriptorSetLayout};
+  std::array<VkDescriptorSet, 2> sets;
+
+  VkDescriptorSetAllocateInfo descriptorSetAI = {};
+  descriptorSetAI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  descriptorSetAI.descriptorPool = sServeDescriptorPool;
+  descriptorSetAI.descriptorSetCount =
+    gsl::narrow_cast<std::uint32_t>(layouts.size());
+  descriptorSetAI.pSetLayouts = layouts.data();
+
+  if (auto result =
+        vkAllocateDescriptorSets(sDevice, &descriptorSetAI, sets.data());
+      result != VK_SUCCESS) {
+    LOG_LEAVE();
+    return tl::unexpected(std::system_error(vk::make_error_code(result),
+                                            "vkAllocateDescriptorSets"));
+  }
+  sServeDescriptorSet = sets[0];
+  sServeTonemapDescriptorSet = sets[1];
+
+  static constexpr std::array<std::uint32_t, 5> kSharedBindings = {0, 2, 3, 4,
+                                                                   5};
+  std::array<VkCopyDescriptorSet, kSharedBindings.size()> copies;
+  for (std::size_t i = 0; i < copies.size(); ++i) {
+    copies[i] = {};
+    copies[i].sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+    copies[i].srcSet = sDescriptorSets[0];
+    copies[i].srcBinding = kSharedBindings[i];
+    copies[i].dstSet = sServeDescriptorSet;
+    copies[i].dstBinding = kSharedBindings[i];
+    copies[i].descriptorCount = 1;
+  }
+
+  vkUpdateDescriptorSets(sDevice, 0, nullptr,
+                         gsl::narrow_cast<std::uint32_t>(copies.size()),
+                         copies.data());
+
+  Ensures(sServeDescriptorSet != VK_NULL_HANDLE);
+  Ensures(sServeTonemapDescriptorSet != VK_NULL_HANDLE);
+
+  LOG_LEAVE();
+  return {};
+} // CreateServeDescriptorSets
+
+// Make the serve images and readback hold at least extent. Every batch is
+// waited for, so the old ones are no longer in use.
+static tl::expected<void, std::system_error>
+ReserveServeTarget(VkExtent2D extent) noexcept {
+  if (extent.width <= sServeExtent.width &&
+      extent.height <= sServeExtent.height) {
+    return {};
+  }
+
+  if (sServeReadback != VK_NULL_HANDLE) {
+    vkDestroyImageView(sDevice, sServeHDRImageView, nullptr);
+    DestroyTrackedImage(sServeHDRImage, sServeHDRImageAllocation,
+                        MemoryCategory::kOutputImage);
+    vkDestroyImageView(sDevice, sServeOutputImageView, nullptr);
+    DestroyTrackedImage(sServeOutputImage, sServeOutputImageAllocation,
+                        MemoryCategory::kOutputImage);
+    DestroyTrackedBuffer(sServeReadback, sServeReadbackAllocation,
+                         MemoryCategory::kStaging);
+    sServeReadback = VK_NULL_HANDLE;
+  }
+
+  sServeExtent.width = std::max(sServeExtent.width, extent.width);
+  sServeExtent.height = std::max(sServeExtent.height, extent.height);
+
+  if (auto result = CreateServeImage(
+        VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT,
+        sServeExtent, "sServeHDRImage", sServeHDRImage,
+        sServeHDRImageAllocation, sServeHDRImageView);
+      !result) {
+    return result;
+  }
+
+  // RGBA8, as RenderBackend returns it, which the tonemap pass stores to
+  // without a format qualifier.
+  if (auto result = CreateServeImage(
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        sServeExtent, "sServeOutputImage", sServeOutputImage,
+        sServeOutputImageAllocation, sServeOutputImageView);
+      !result) {
+    return result;
+  }
+
+  VkBufferCreateInfo bufferCI = {};
+  bufferCI.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCI.size =
+    VkDeviceSize{4} * sServeExtent.width * sServeExtent.height;
+  bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+  VmaAllocationCreateInfo allocationCI = {};
+  allocationCI.flags = VMA_ALLOCATION_CREATE_USER_DATA_COPY_STRING_BIT;
+  allocationCI.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+
+  if (auto result =
+        vmaCreateBuffer(sAllocator, &bufferCI, &allocationCI, &sServeReadback,
+                        &sServeReadbackAllocation, nullptr);
+      result != VK_SUCCESS) {
+    return tl::unexpected(
+      std::system_error(vk::make_error_code(result), "vmaCreateBuffer"));
+  }
+
+  TrackAllocation(sServeReadbackAllocation, MemoryCategory::kStaging,
+                  "sServeReadback");
+
+  VkDescriptorImageInfo hdrImageInfo = {};
+  hdrImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  hdrImageInfo.imageView = sServeHDRImageView;
+
+  VkDescriptorImageInfo outputImageInfo = {};
+  outputImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+  outputImageInfo.imageView = sServeOutputImageView;
+
+  std::array<VkWriteDescriptorSet, 3> writeDescriptorSets;
+
+  writeDescriptorSets[0] = {};
+  writeDescriptorSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  writeDescriptorSets[0].dstSet = sServeDescriptorSet;
+  writeDescriptorSets[0].dstBinding = 1;
+  writeDescriptorSets[0].descriptorCount = 1;
+  writeDescriptorSets[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  writeDescriptorSets[0].pImageInfo = &hdrImageInfo;
+
+  writeDescriptorSets[1] = writeDescriptorSets[0];
+  writeDescriptorSets[1].dstSet = sServeTonemapDescriptorSet;
+  writeDescriptorSets[1].dstBinding = 0;
+
+  writeDescriptorSets[2] = writeDescriptorSets[1];
+  writeDescriptorSets[2].dstBinding = 1;
+  writeDescriptorSets[2].pImageInfo = &outputImageInfo;
+
+  vkUpdateDescriptorSets(
+    sDevice, gsl::narrow_cast<std::uint32_t>(writeDescriptorSets.size()),
+    writeDescriptorSets.data(), 0, nullptr);
+
+  return {};
+} // ReserveServeTarget
+
+// The RenderBackend of --serve: trace cameras as the layers of one launch,
+// tonemap them all in one dispatch and read them back to rgba, view after
+// view as they are stacked. Waits for the batch to complete.
+static tl::expected<void, std::system_error>
+RenderServeBatch(gsl::span<RenderCamera const> cameras, std::uint32_t width,
+                 std::uint32_t height, gsl::span<std::uint8_t> rgba) noexcept {
+  Expects(!cameras.empty() && cameras.size() <= shader::kMaxLaunchViews);
+  auto const views = gsl::narrow_cast<std::uint32_t>(cameras.size());
+  VkExtent2D const extent = {width, height * views};
+  Expects(static_cast<std::size_t>(rgba.size()) ==
+          std::size_t{4} * extent.width * extent.height);
+
+  if (auto result = ReserveServeTarget(extent); !result) return result;
+
+  // No frame is drawn, so the first slot's uniforms are free.
+  UniformBuffer* uniformBufferData;
+  if (auto ptr =
+        MapMemory<UniformBuffer*>(sAllocator, sUniformBufferAllocation)) {
+    uniformBufferData = *ptr;
+  } else {
+    return tl::unexpected(ptr.error());
+  }
+
+  for (std::uint32_t i = 0; i < views; ++i) {
+    RenderCamera const& camera = cameras[i];
+    uniformBufferData->Eye[i] =
+      glm::vec4(camera.eye[0], camera.eye[1], camera.eye[2], 1.f);
+    uniformBufferData->U[i] =
+      glm::vec4(camera.u[0], camera.u[1], camera.u[2], 0.f);
+    uniformBufferData->V[i] =
+      glm::vec4(camera.v[0], camera.v[1], camera.v[2], 0.f);
+    uniformBufferData->W[i] =
+      glm::vec4(camera.w[0], camera.w[1], camera.w[2], 0.f);
+  }
+  uniformBufferData->SampleCount = sSamplesPerPixel;
+
+  vmaUnmapMemory(sAllocator, sUniformBufferAllocation);
+
+  auto commandBuffer = BeginOneTimeSubmit();
+  if (!commandBuffer) return tl::unexpected(commandBuffer.error());
+
+  // The first batch takes back the spheres released by
+  // SubmitAccelerationStructureBuild, as the first frame would.
+  std::vector<std::uint64_t> acquires;
+  if (sAccelerationStructuresPending && sQueueFamilies.AsyncCompute()) {
+    VkBufferMemoryBarrier acquire = OwnershipTransfer(
+      sSpheresBuffer, 0, VK_ACCESS_SHADER_READ_BIT, sComputeQueueFamilyIndex,
+      sQueueFamilyIndex);
+
+    vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, 0, 0,
+                         nullptr, 1, &acquire, 0, nullptr);
+    acquires.push_back(HandleId(sSpheresBuffer));
+  }
+
+  std::array<VkImageMemoryBarrier, 2> imageBarriers;
+  imageBarriers[0] = {};
+  imageBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  imageBarriers[0].srcAccessMask = 0;
+  imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageBarriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarriers[0].image = sServeHDRImage;
+  imageBarriers[0].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+  imageBarriers[1] = imageBarriers[0];
+  imageBarriers[1].image = sServeOutputImage;
+
+  vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV |
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr,
+                       gsl::narrow_cast<std::uint32_t>(imageBarriers.size()),
+                       imageBarriers.data());
+
+  vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
+                    sPipeline);
+  std::uint32_t const dynamicOffset = 0;
+  vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_RAY_TRACING_NV,
+                          sPipelineLayout, 0, 1, &sServeDescriptorSet, 1,
+                          &dynamicOffset);
+
+  RecordTraceRays(*commandBuffer, width, height, views);
+
+  imageBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  imageBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  imageBarriers[0].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  vkCmdPipelineBarrier(*commandBuffer,
+                       VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &imageBarriers[0]);
+
+  // The whole stack at once; at equal extents the filter takes each pixel
+  // as it is, so no view bleeds into the next.
+  TonemapPushConstants tonemapPC = {};
+  tonemapPC.renderExtent[0] = static_cast<std::int32_t>(extent.width);
+  tonemapPC.renderExtent[1] = static_cast<std::int32_t>(extent.height);
+  tonemapPC.outputExtent[0] = tonemapPC.renderExtent[0];
+  tonemapPC.outputExtent[1] = tonemapPC.renderExtent[1];
+  tonemapPC.exposure = sTonemapParams.exposure;
+  tonemapPC.filterMode = static_cast<std::uint32_t>(sTonemapParams.filter);
+
+  vkCmdBindPipeline(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    sTonemapPipeline);
+  vkCmdBindDescriptorSets(*commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          sTonemapPipelineLayout, 0, 1,
+                          &sServeTonemapDescriptorSet, 0, nullptr);
+  vkCmdPushConstants(*commandBuffer, sTonemapPipelineLayout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(tonemapPC),
+                     &tonemapPC);
+  vkCmdDispatch(*commandBuffer, (extent.width + 7) / 8,
+                (extent.height + 7) / 8, 1);
+
+  imageBarriers[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  imageBarriers[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &imageBarriers[1]);
+
+  VkBufferImageCopy readback = {};
+  readback.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  readback.imageExtent = {extent.width, extent.height, 1};
+
+  vkCmdCopyImageToBuffer(*commandBuffer, sServeOutputImage,
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, sServeReadback,
+                         1, &readback);
+
+  VkBufferMemoryBarrier hostBarrier = {};
+  hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  hostBarrier.srcQueueFamilyIndex = hostBarrier.dstQueueFamilyIndex =
+    VK_QUEUE_FAMILY_IGNORED;
+  hostBarrier.buffer = sServeReadback;
+  hostBarrier.offset = 0;
+  hostBarrier.size = VK_WHOLE_SIZE;
+
+  vkCmdPipelineBarrier(*commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                       &hostBarrier, 0, nullptr);
+
+  if (auto result = EndOneTimeSubmit(
+        *commandBuffer, {},
+        sAccelerationStructuresPending ? sAccelerationStructuresBuilt
+                                       : VK_NULL_HANDLE,
+        std::move(acquires));
+      !result) {
+    return result;
+  }
+  sAccelerationStructuresPending = false;
+
+  vmaInvalidateAllocation(sAllocator, sServeReadbackAllocation, 0,
+                          VK_WHOLE_SIZE);
+  if (auto ptr = MapMemory<std::uint8_t const*>(sAllocator,
+                                                sServeReadbackAllocation)) {
+    std::memcpy(rgba.data(), *ptr, static_cast<std::size_t>(rgba.size()));
+    vmaUnmapMemory(sAllocator, sServeReadbackAllocation);
+  } else {
+    return tl::unexpected(ptr.error());
+  }
+
+  return {};
+} // RenderServeBatch
+
+// Serve views of the scene on sServeAddress until a client asks to stop.
+// A batch is at most a launch deep, and its stacked views must fit an
+// image.
+static tl::expected<void, std::system_error> Serve() noexcept {
+  LOG_ENTER();
+
+  auto address = ParseSocketAddress(sServeAddress.c_str());
+  if (!address) {
+    LOG_LEAVE();
+    return tl::unexpected(address.error());
+  }
+
+  if (auto result = CreateServeDescriptorSets(); !result) {
+    LOG_LEAVE();
+    return result;
+  }
+
+  VkPhysicalDeviceProperties props;
+  vkGetPhysicalDeviceProperties(sPhysicalDevice, &props);
+  std::uint32_t const maxDimension = props.limits.maxImageDimension2D;
+
+  RenderServerParams params;
+  params.maxBatch = static_cast<std::uint32_t>(shader::kMaxLaunchViews);
+  params.maxWidth = std::min(params.maxWidth, maxDimension);
+  params.maxHeight =
+    std::min(params.maxHeight, maxDimension / params.maxBatch);
+
+  auto server = RenderServer::Listen(*address, RenderServeBatch, params);
+  if (!server) {
+    LOG_LEAVE();
+    return tl::unexpected(server.error());
+  }
+  std::fprintf(sReports, "serving on %s, up to %u views of %ux%u a batch\n",
+               to_string(*address).c_str(), params.maxBatch, params.maxWidth,
+               params.maxHeight);
+  std::fflush(sReports);
+
+  auto const served = server->Run();
+  RenderServerStats const& stats = server->Stats();
+  std::fprintf(sReports,
+               "served %" PRIu64 " views in %" PRIu64 " batches, refused %"
+               PRIu64 ", latency p50 %.2f ms p99 %.2f ms\n",
+               stats.requests, stats.batches, stats.refused,
+               Percentile(stats.latencyMs, .5),
+               Percentile(stats.latencyMs, .99));
+
+  LOG_LEAVE();
+  return served;
+} // Serve
+
+int main(int argc, char** argv) {
+  auto usage = [argv]() {
+    std::fprintf(stderr,
+                 "usage: %s [scene.bin | --generate "
+                 "<weekend|uniform|clustered> <spheres> [seed]]\n"
+                 "         [--mesh <mesh.obj> [float32|float16|snorm16]]...\n"
+                 "         [--instances <copies of each mesh>]\n"
+                 "         [--frames-in-flight <1-%u>] "
+                 "[--latency <throughput|low>]\n"
+                 "         [--export <shared memory name>]\n"
+                 "         [--video <file, fifo or - for stdout> [y4m|rgb24]]\n"
+                 "         [--samples <1-%u per pixel>]\n"
+                 "         [--animate <percent of spheres moving>]\n"
+                 "         [--serve <unix:path or tcp:host:port>]\n",
+                 argv[0], kMaxFramesInFlight, kMaxSamplesPerPixel);
+    std::exit(EXIT_FAILURE);
+  };
+
+  auto isOption = [](gsl::czstring arg) {
+    return std::strcmp(arg, "--mesh") == 0 ||
+           std::strcmp(arg, "--instances") == 0 ||
+           std::strcmp(arg, "--frames-in-flight") == 0 ||
+           std::strcmp(arg, "--latency") == 0 ||
+           std::strcmp(arg, "--export") == 0 ||
+           std::strcmp(arg, "--video") == 0 ||
+           std::strcmp(arg, "--samples") == 0 ||
+           std::strcmp(arg, "--animate") == 0 ||
+           std::strcmp(arg, "--serve") == 0;
+  };
+
+  // --mesh, which may be repeated, and the other options come last.
+  std::uint32_t framesInFlight = 2;
+  LatencyMode latencyMode = LatencyMode::kThroughput;
+  for (int i = 1; i < argc; ++i) {
+    if (!isOption(argv[i])) continue;
+    for (int j = i; j < argc;) {
+      if (j + 1 == argc) usage();
+      if (std::strcmp(argv[j], "--instances") == 0) {
+        sMeshCopies = std::strtoull(argv[j + 1], nullptr, 10);
+        if (sMeshCopies == 0) usage();
+        j += 2;
+      } else if (std::strcmp(argv[j], "--frames-in-flight") == 0) {
+        framesInFlight =
+          static_cast<std::uint32_t>(std::strtoul(argv[j + 1], nullptr, 10));
+        if (framesInFlight < 1 || framesInFlight > kMaxFramesInFlight) {
+          usage();
+        }
+        j += 2;
+      } else if (std::strcmp(argv[j], "--latency") == 0) {
+        if (!FromString(argv[j + 1], latencyMode)) usage();
+        j += 2;
+      } else if (std::strcmp(argv[j], "--export") == 0) {
+        sExportName = argv[j + 1];
+        j += 2;
+      } else if (std::strcmp(argv[j], "--samples") == 0) {
+        sSamplesPerPixel =
+          static_cast<std::uint32_t>(std::strtoul(argv[j + 1], nullptr, 10));
+        if (sSamplesPerPixel < 1 || sSamplesPerPixel > kMaxSamplesPerPixel) {
+          usage();
+        }
+        j += 2;
+      } else if (std::strcmp(argv[j], "--animate") == 0) {
+        double const percent = std::strtod(argv[j + 1], nullptr);
+        if (!(percent > 0.0 && percent <= 100.0)) usage();
+        sAnimateFraction = percent / 100.0;
+        j += 2;
+      } else if (std::strcmp(argv[j], "--video") == 0) {
+        sVideoPath = argv[j + 1];
+        if (sVideoPath == "-") sReports = stderr;
+        j += 2;
+        if (j < argc && FromString(argv[j], sVideoFormat)) ++j;
+      } else if (std::strcmp(argv[j], "--serve") == 0) {
+        sServeAddress = argv[j + 1];
+        j += 2;
+      } else if (std::strcmp(argv[j], "--mesh") == 0) {
+        MeshFile file = {argv[j + 1], VertexFormat::kFloat32};
+        j += 2;
+        if (j < argc && FromString(argv[j], file.format)) ++j;
+        sMeshFiles.push_back(file);
+      } else {
+        usage();
+      }
+    }
+    argc = i;
+  }
+
+  if (argc > 1 && std::strcmp(argv[1], "--generate") == 0) {
+    auto& params = sSceneGeneratorParams;
+    if (argc == 4 || argc == 5) {
+      params.sphereCount = std::strtoull(argv[3], nullptr, 10);
+    }
+    if (argc < 4 || argc > 5 || !FromString(argv[2], params.distribution) ||
+        params.sphereCount == 0) {
+      usage();
+    }
+    if (argc == 5) params.seed = std::strtoull(argv[4], nullptr, 10);
+    sGenerateScene = true;
+  } else if (argc > 1) {
+    sSceneFilename = argv[1];
+  }
+
+  sFrameRing = FrameRing(framesInFlight, latencyMode);
+
   // clang-format off
   auto result = InitWindow()
     .and_then(InitVulkan)
     .and_then(CreateDebugUtilsMessenger)
+    .and_then(CreateSurface)
     .and_then(ChoosePhysicalDevice)
     .and_then(CreateDevice)
     .and_then(CreateCommandPool)
     .and_then(CreateAllocator)
     .and_then(CreateRenderPass)
-    .and_then(CreateSurface)
     .and_then(VerifySurfaceFormat)
     .and_then(CreateFrames)
     .and_then(CreateSwapchain)
     .and_then(CreateSwapchainImagesAndViews)
     .and_then(CreateFramebuffers)
+    .and_then(CreateFrameExport)
+    .and_then(CreateVideoStream)
     .and_then(CreateDescriptorPool)
     .and_then(CreateQueryPool)
     .and_then(CreateDescriptorSetLayout)
     .and_then(CreatePipeline)
+    .and_then(CreateTonemapPipeline)
     .and_then(CreateUniformBuffer)
     .and_then(CreateOutputImage)
+    .and_then(CreateHDRImage)
+    .and_then(LoadScene)
+    .and_then(LoadMeshes)
     .and_then(CreateSpheresBuffer)
+    .and_then(CreateSphereStore)
+    .and_then(CreateMeshBuffers)
+    .and_then(CreateSampleTablesBuffer)
+    .and_then(BeginAccelerationStructureBuild)
     .and_then(CreateBottomLevelAccelerationStructure)
     .and_then(CreateTopLevelAccelerationStructure)
+    .and_then(SubmitAccelerationStructureBuild)
     .and_then(CreateShaderBindingTable)
     .and_then(CreateDescriptorSets)
-    .and_then(CreateSyncObjects)
+    .and_then(UpdateImageDescriptors)
     ;
   // clang-format on
 
@@ -2575,11 +5786,29 @@ int main() {
     std::exit(EXIT_FAILURE);
   }
 
+#ifndef NDEBUG
+  std::fprintf(stderr, "%s", sSubmitGraph.Describe().c_str());
+#endif
+
+  if (!sServeAddress.empty()) {
+    auto const served = Serve();
+    vkDeviceWaitIdle(sDevice);
+    sDeletionQueue.Flush();
+    sPresentDeletionQueue.Flush();
+    DestroyShaderBindingTable();
+    if (!served) {
+      std::fprintf(stderr, "%s: %s\n", sServeAddress.c_str(),
+                   served.error().what());
+      std::exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+  }
+
   sCamera.aspectRatio(static_cast<float>(sSwapchainExtent.width) /
                       static_cast<float>(sSwapchainExtent.height));
 
   std::uint64_t frameCount = 0;
-  double now = glfwGetTime(), last = now;
+  double now = glfwGetTime(), last = now, reportStart = now;
 
   while (!glfwWindowShouldClose(sWindow)) {
     glfwPollEvents();
@@ -2589,6 +5818,11 @@ int main() {
       continue;
     }
 
+    if (sDumpMemoryReport) {
+      DumpMemoryReport(sReports);
+      sDumpMemoryReport = false;
+    }
+
     if (result = Draw(); !result) {
       std::fprintf(stderr, "%s\n", result.error().what());
       std::exit(EXIT_FAILURE);
@@ -2598,27 +5832,98 @@ int main() {
     now = glfwGetTime();
 
     if (frameCount % 100 == 0) {
-      std::array<std::uint64_t, 4> queries;
-      if (auto result = vkGetQueryPoolResults(
-            sDevice, sQueryPool, 0,
-            gsl::narrow_cast<std::uint32_t>(queries.size()),
-            queries.size() * sizeof(std::uint64_t), queries.data(),
-            sizeof(std::uint64_t),
-            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-          result != VK_SUCCESS) {
-        std::fprintf(stderr, "Cannot get query results: %s\n",
-                     vk::to_string(result));
+      std::fprintf(sReports, "last frame complete:\n");
+      std::fprintf(sReports, "  pipe : %2.5g ms, %s present\n", sFramePipeMs,
+                   to_string(sPresentPath));
+      std::fprintf(sReports, "  trace: %2.5g ms, %u samples per pixel\n",
+                   sFrameTraceMs, sSamplesPerPixel);
+
+      double const delta = now - last;
+      std::fprintf(sReports, "  delta: %2.5g ms\n", delta * 1000.0);
+      std::fprintf(sReports, "  rate : %.1f frames/s\n",
+                   100.0 / (now - reportStart));
+      reportStart = now;
+
+      // From sampling the camera to the CPU seeing the frame complete, which
+      // in throughput mode is when its ring slot comes round again.
+      if (sInputLatencyCount > 0) {
+        std::fprintf(sReports,
+                     "  input: %2.5g ms, %s latency, %u frames in flight\n",
+                     sInputLatencySum / sInputLatencyCount * 1000.0,
+                     to_string(sFrameRing.Mode()), sFrameRing.Size());
+        sInputLatencySum = 0.0;
+        sInputLatencyCount = 0;
       }
 
-      std::printf("current frame:\n");
-      std::printf("  pipe : %2.5g ms\n",
-                  (queries[1] - queries[0]) * 1e-06);
-      std::printf("  trace: %2.5g ms\n", (queries[3] - queries[2]) * 1e-06);
+      if (sFrameExport.IsOpen()) {
+        std::fprintf(sReports, "  shm  : %" PRIu64 " frames exported, %" PRIu64
+                     " dropped\n",
+                     sFrameExport.Published(), sFrameExport.Dropped());
+      }
 
-      double const delta = now - last;
-      std::printf("  delta: %2.5g ms\n", delta * 1000.0);
+      if (sVideoStream.IsOpen()) {
+        VideoStreamStats const stats = sVideoStream.Stats();
+        std::fprintf(sReports, "  video: %" PRIu64 " frames, %.1f frames/s, "
+                     "%.1f MB/s, %.1f ms waited in all, %" PRIu64 " dropped\n",
+                     stats.frames, stats.frames / stats.seconds,
+                     stats.bytes / stats.seconds / 1e6,
+                     stats.waitSeconds * 1e3, sVideoDropped);
+      }
+
+      VkExtent2D const renderExtent = RenderExtent();
+      std::fprintf(sReports, "  scale: %g (%ux%u)\n", sRenderScale,
+                   renderExtent.width, renderExtent.height);
+
+      if (sAnimateFraction > 0.0) {
+        SphereUpdateStats const& stats = sSphereUpdateStats;
+        double const bytes = static_cast<double>(stats.copied * sizeof(Sphere));
+        std::fprintf(sReports,
+                     "  anim : %" PRIu64 " of %td spheres moved, %" PRIu64
+                     " regions, %.1f KiB (%.2f%% of the buffer), %" PRIu64
+                     " refits\n",
+                     stats.changed, sSceneSpheres.size(), stats.ranges,
+                     bytes / 1024,
+                     100.0 * bytes /
+                      static_cast<double>(sSceneSpheres.size_bytes()),
+                     sSphereRefitCount);
+      }
+
+      std::fprintf(sReports,
+                   "  cull : %2.5g ms, %zu of %zu instances (%.1f%% culled)\n",
+                   sInstanceCullMs, sCulledInstances.size(),
+                   sTopLevelInstances.size(),
+                   sInstanceCullStats.CulledFraction() * 100.0);
+
+      // Build time scales with the instance count, so the time a build of
+      // every instance would take is extrapolated from the last rebuild.
+      if (sTopLevelBuildInstanceCount > 0) {
+        double const fullMs = sTopLevelBuildMs * sTopLevelInstances.size() /
+                              sTopLevelBuildInstanceCount;
+        std::fprintf(sReports,
+                     "  tlas : %2.5g ms for %u instances, ~%2.5g ms saved\n",
+                     sTopLevelBuildMs, sTopLevelBuildInstanceCount,
+                     fullMs - sTopLevelBuildMs);
+      }
     }
 
     last = now;
   }
+
+  vkDeviceWaitIdle(sDevice);
+  sDeletionQueue.Flush();
+  sPresentDeletionQueue.Flush();
+  DestroyShaderBindingTable();
+
+  if (sVideoStream.IsOpen()) {
+    if (auto closed = sVideoStream.Close(); !closed) {
+      std::fprintf(stderr, "%s: %s\n", sVideoPath.c_str(),
+                   closed.error().what());
+      std::exit(EXIT_FAILURE);
+    }
+    VideoStreamStats const stats = sVideoStream.Stats();
+    std::fprintf(sReports, "recorded %" PRIu64 " frames to %s, %.1f frames/s, "
+                 "%.1f MB/s\n",
+                 stats.frames, sVideoPath.c_str(), stats.frames / stats.seconds,
+                 stats.bytes / stats.seconds / 1e6);
+  }
 }
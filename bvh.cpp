@@ -0,0 +1,299 @@
+#include "bvh.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+struct Bounds {
+  float min[3]{std::numeric_limits<float>::max(),
+               std::numeric_limits<float>::max(),
+               std::numeric_limits<float>::max()};
+  float max[3]{std::numeric_limits<float>::lowest(),
+               std::numeric_limits<float>::lowest(),
+               std::numeric_limits<float>::lowest()};
+
+  void Grow(float const (&lo)[3], float const (&hi)[3]) noexcept {
+    for (int i = 0; i < 3; ++i) {
+      min[i] = std::min(min[i], lo[i]);
+      max[i] = std::max(max[i], hi[i]);
+    }
+  }
+
+  void Grow(Bounds const& other) noexcept { Grow(other.min, other.max); }
+
+  void Grow(float const (&point)[3]) noexcept { Grow(point, point); }
+
+  [[nodiscard]] bool Empty() const noexcept { return min[0] > max[0]; }
+
+  [[nodiscard]] float HalfArea() const noexcept {
+    if (Empty()) return 0.f;
+    float const dx = max[0] - min[0];
+    float const dy = max[1] - min[1];
+    float const dz = max[2] - min[2];
+    return dx * dy + dy * dz + dz * dx;
+  }
+}; // struct Bounds
+
+void Centroid(SceneSphere const& sphere, float (&centroid)[3]) noexcept {
+  for (int i = 0; i < 3; ++i) {
+    centroid[i] = (sphere.aabbMin[i] + sphere.aabbMax[i]) * .5f;
+  }
+} // Centroid
+
+struct Bin {
+  Bounds bounds{};
+  std::uint32_t count{0};
+}; // struct Bin
+
+constexpr std::uint32_t kMaxBins = 64;
+
+} // namespace
+
+BVH BuildBVH(gsl::span<SceneSphere const> spheres,
+             BVHBuildParams const& params) {
+  Expects(params.maxLeafSize > 0);
+  Expects(params.binCount >= 2 && params.binCount <= kMaxBins);
+  Expects(static_cast<std::uint64_t>(spheres.size()) <
+          std::numeric_limits<std::uint32_t>::max());
+
+  auto const primitiveCount = static_cast<std::uint32_t>(spheres.size());
+
+  BVH bvh;
+  bvh.primitives.resize(primitiveCount);
+  for (std::uint32_t i = 0; i < primitiveCount; ++i) bvh.primitives[i] = i;
+  if (primitiveCount == 0) return bvh;
+
+  bvh.nodes.reserve(2 * (primitiveCount / params.maxLeafSize) + 1);
+  bvh.nodes.push_back({});
+
+  struct Task {
+    std::uint32_t node;
+    std::uint32_t begin;
+    std::uint32_t end;
+  };
+  std::vector<Task> stack = {{0, 0, primitiveCount}};
+
+  std::array<Bin, kMaxBins> bins;
+  std::array<float, kMaxBins> rightAreas;
+  std::array<std::uint32_t, kMaxBins> rightCounts;
+
+  while (!stack.empty()) {
+    Task const task = stack.back();
+    stack.pop_back();
+
+    Bounds bounds, centroids;
+    for (std::uint32_t i = task.begin; i < task.end; ++i) {
+      SceneSphere const& sphere = spheres[bvh.primitives[i]];
+      float centroid[3];
+      Centroid(sphere, centroid);
+      bounds.Grow(sphere.aabbMin, sphere.aabbMax);
+      centroids.Grow(centroid);
+    }
+
+    BVHNode& node = bvh.nodes[task.node];
+    std::copy_n(bounds.min, 3, node.boundsMin);
+    std::copy_n(bounds.max, 3, node.boundsMax);
+
+    std::uint32_t const count = task.end - task.begin;
+    auto makeLeaf = [&] {
+      node.first = task.begin;
+      node.count = count;
+    };
+
+    if (count <= params.maxLeafSize) {
+      makeLeaf();
+      continue;
+    }
+
+    int axis = 0;
+    for (int i = 1; i < 3; ++i) {
+      if (centroids.max[i] - centroids.min[i] >
+          centroids.max[axis] - centroids.min[axis]) {
+        axis = i;
+      }
+    }
+
+    float const extent = centroids.max[axis] - centroids.min[axis];
+    std::uint32_t mid = task.begin + count / 2;
+
+    if (extent > 0.f) {
+      std::uint32_t const binCount = params.binCount;
+      float const scale = static_cast<float>(binCount) / extent;
+      auto binOf = [&](std::uint32_t primitive) {
+        float centroid[3];
+        Centroid(spheres[primitive], centroid);
+        auto const bin = static_cast<std::uint32_t>(
+          (centroid[axis] - centroids.min[axis]) * scale);
+        return std::min(bin, binCount - 1);
+      };
+
+      std::fill_n(bins.begin(), binCount, Bin{});
+      for (std::uint32_t i = task.begin; i < task.end; ++i) {
+        SceneSphere const& sphere = spheres[bvh.primitives[i]];
+        Bin& bin = bins[binOf(bvh.primitives[i])];
+        bin.bounds.Grow(sphere.aabbMin, sphere.aabbMax);
+        bin.count += 1;
+      }
+
+      Bounds right;
+      std::uint32_t rightCount = 0;
+      for (std::uint32_t i = binCount - 1; i > 0; --i) {
+        right.Grow(bins[i].bounds);
+        rightCount += bins[i].count;
+        rightAreas[i] = right.HalfArea();
+        rightCounts[i] = rightCount;
+      }
+
+      // Split after bin i: bins [0, i] go left.
+      Bounds left;
+      std::uint32_t leftCount = 0;
+      float bestCost = std::numeric_limits<float>::max();
+      std::uint32_t bestSplit = 0;
+      for (std::uint32_t i = 0; i + 1 < binCount; ++i) {
+        left.Grow(bins[i].bounds);
+        leftCount += bins[i].count;
+        if (leftCount == 0 || rightCounts[i + 1] == 0) continue;
+
+        float const cost = left.HalfArea() * static_cast<float>(leftCount) +
+                           rightAreas[i + 1] *
+                             static_cast<float>(rightCounts[i + 1]);
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestSplit = i;
+        }
+      }
+
+      float const leafCost = bounds.HalfArea() * static_cast<float>(count);
+      if (bestCost >= leafCost && count <= 4 * params.maxLeafSize) {
+        makeLeaf();
+        continue;
+      }
+
+      if (bestCost < std::numeric_limits<float>::max()) {
+        auto const first = bvh.primitives.begin();
+        mid = static_cast<std::uint32_t>(
+          std::partition(first + task.begin, first + task.end,
+                         [&](std::uint32_t primitive) {
+                           return binOf(primitive) <= bestSplit;
+                         }) -
+          first);
+      }
+    }
+
+    // Coincident centroids or no usable bin boundary: split by index.
+    if (mid == task.begin || mid == task.end) mid = task.begin + count / 2;
+
+    auto const left = static_cast<std::uint32_t>(bvh.nodes.size());
+    node.first = left;
+    node.count = 0;
+
+    // node is invalidated here.
+    bvh.nodes.push_back({});
+    bvh.nodes.push_back({});
+
+    // Right first so the left subtree is laid out next to its parent.
+    stack.push_back({left + 1, mid, task.end});
+    stack.push_back({left, task.begin, mid});
+  }
+
+  return bvh;
+} // BuildBVH
+
+BVHStats ComputeBVHStats(BVHView bvh) {
+  BVHStats stats;
+  if (bvh.nodes.empty()) return stats;
+
+  auto halfArea = [](BVHNode const& node) {
+    Bounds bounds;
+    bounds.Grow(node.boundsMin, node.boundsMax);
+    return static_cast<double>(bounds.HalfArea());
+  };
+
+  double const rootArea = std::max(halfArea(bvh.nodes[0]), 1e-30);
+  constexpr double kTraversalCost = 1.0;
+  constexpr double kIntersectionCost = 1.0;
+
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> stack = {{0, 1}};
+  while (!stack.empty()) {
+    auto const [index, depth] = stack.back();
+    stack.pop_back();
+
+    BVHNode const& node = bvh.nodes[index];
+    double const area = halfArea(node) / rootArea;
+    stats.nodeCount += 1;
+    stats.maxDepth = std::max(stats.maxDepth, depth);
+
+    if (node.IsLeaf()) {
+      stats.leafCount += 1;
+      stats.sahCost += area * kIntersectionCost * node.count;
+    } else {
+      stats.sahCost += area * kTraversalCost;
+      stack.push_back({node.first, depth + 1});
+      stack.push_back({node.first + 1, depth + 1});
+    }
+  }
+
+  return stats;
+} // ComputeBVHStats
+
+bool ValidateBVH(BVHView bvh, std::uint64_t primitiveCount) {
+  auto const nodeCount = static_cast<std::uint64_t>(bvh.nodes.size());
+  if (static_cast<std::uint64_t>(bvh.primitives.size()) != primitiveCount) {
+    return false;
+  }
+  if (nodeCount == 0) return primitiveCount == 0;
+
+  std::vector<bool> seen(primitiveCount, false);
+  std::uint64_t covered = 0;
+
+  for (std::uint64_t i = 0; i < nodeCount; ++i) {
+    BVHNode const& node = bvh.nodes[static_cast<gsl::index>(i)];
+
+    if (node.IsLeaf()) {
+      if (std::uint64_t{node.first} + node.count > primitiveCount) return false;
+      for (std::uint32_t j = node.first; j < node.first + node.count; ++j) {
+        std::uint32_t const primitive = bvh.primitives[j];
+        if (primitive >= primitiveCount || seen[primitive]) return false;
+        seen[primitive] = true;
+      }
+      covered += node.count;
+      continue;
+    }
+
+    // Children always follow their parent, so traversal terminates.
+    if (node.first <= i || std::uint64_t{node.first} + 1 >= nodeCount) {
+      return false;
+    }
+
+    for (std::uint32_t child = node.first; child <= node.first + 1; ++child) {
+      BVHNode const& c = bvh.nodes[child];
+      for (int k = 0; k < 3; ++k) {
+        if (c.boundsMin[k] < node.boundsMin[k] ||
+            c.boundsMax[k] > node.boundsMax[k]) {
+          return false;
+        }
+      }
+    }
+  }
+
+  return covered == primitiveCount;
+} // ValidateBVH
+
+float IntersectBounds(BVHNode const& node, float const (&origin)[3],
+                      float const (&inverseDirection)[3], float tMin,
+                      float tMax) noexcept {
+  for (int i = 0; i < 3; ++i) {
+    float t0 = (node.boundsMin[i] - origin[i]) * inverseDirection[i];
+    float t1 = (node.boundsMax[i] - origin[i]) * inverseDirection[i];
+    if (t0 > t1) std::swap(t0, t1);
+    // Widen the far distance by the rounding error of the two operations
+    // above so rays grazing a box are not lost; NaNs (0 * inf) keep the
+    // current interval.
+    t1 *= 1.f + 2.f * std::numeric_limits<float>::epsilon();
+    tMin = t0 > tMin ? t0 : tMin;
+    tMax = t1 < tMax ? t1 : tMax;
+  }
+  return tMin <= tMax ? tMin : std::numeric_limits<float>::infinity();
+} // IntersectBounds
@@ -0,0 +1,143 @@
+#ifndef BVH_HPP_
+#define BVH_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include "scene_file.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+//
+// Bounding volume hierarchy over SceneSphere boxes, built on the CPU with
+// binned SAH. Nodes are stored depth first in one array and refer to each
+// other by index, never by pointer, so a built hierarchy can be written to
+// disk and used straight from a mapping without fixups.
+//
+
+struct BVHNode {
+  float boundsMin[3];
+  // Interior nodes: index of the left child; the right child follows it.
+  // Leaves: index of the first entry in the primitive index array.
+  std::uint32_t first;
+  float boundsMax[3];
+  // Number of primitives in a leaf, 0 for interior nodes.
+  std::uint32_t count;
+
+  [[nodiscard]] bool IsLeaf() const noexcept { return count != 0; }
+}; // struct BVHNode
+
+static_assert(sizeof(BVHNode) == 32);
+
+struct BVHBuildParams {
+  std::uint32_t maxLeafSize{4};
+  std::uint32_t binCount{16};
+}; // struct BVHBuildParams
+
+// Non-owning view of a hierarchy; nodes[0] is the root.
+struct BVHView {
+  gsl::span<BVHNode const> nodes{};
+  gsl::span<std::uint32_t const> primitives{};
+}; // struct BVHView
+
+struct BVH {
+  std::vector<BVHNode> nodes{};
+  std::vector<std::uint32_t> primitives{};
+
+  [[nodiscard]] BVHView View() const noexcept { return {nodes, primitives}; }
+
+  // Host bytes the hierarchy holds, as MemoryCategory::kHostBVH counts them.
+  [[nodiscard]] std::uint64_t Bytes() const noexcept {
+    return std::uint64_t{nodes.capacity()} * sizeof(BVHNode) +
+           std::uint64_t{primitives.capacity()} * sizeof(std::uint32_t);
+  }
+}; // struct BVH
+
+[[nodiscard]] BVH BuildBVH(gsl::span<SceneSphere const> spheres,
+                           BVHBuildParams const& params);
+
+struct BVHStats {
+  std::uint64_t nodeCount{0};
+  std::uint64_t leafCount{0};
+  std::uint32_t maxDepth{0};
+  // Expected traversal cost relative to the root's surface area.
+  double sahCost{0.0};
+}; // struct BVHStats
+
+[[nodiscard]] BVHStats ComputeBVHStats(BVHView bvh);
+
+// Check that every index is in range, every primitive appears exactly once
+// and every node bounds its subtree. Used on data read from disk before it
+// is trusted.
+[[nodiscard]] bool ValidateBVH(BVHView bvh, std::uint64_t primitiveCount);
+
+// Entry distance of a ray into node's bounds within [tMin, tMax], or
+// infinity if it misses.
+[[nodiscard]] float IntersectBounds(BVHNode const& node,
+                                    float const (&origin)[3],
+                                    float const (&inverseDirection)[3],
+                                    float tMin, float tMax) noexcept;
+
+inline constexpr std::size_t kMaxBVHTraversalDepth = 256;
+
+// Closest hit of a ray through bvh, for CPU ray queries of any primitive.
+// intersect(primitive, tMax) tests one primitive inside (tMin, tMax); on a
+// hit it records the hit, lowers tMax to its distance and returns true.
+// Returns whether any primitive was hit.
+template <class IntersectPrimitive>
+bool TraverseBVH(BVHView bvh, float const (&origin)[3],
+                 float const (&direction)[3], float tMin, float tMax,
+                 IntersectPrimitive&& intersect) {
+  if (bvh.nodes.empty()) return false;
+
+  float inverseDirection[3];
+  for (int i = 0; i < 3; ++i) inverseDirection[i] = 1.f / direction[i];
+
+  bool found = false;
+
+  // Nodes to visit with the distance at which the ray enters them, so
+  // nodes beyond a hit found since they were pushed are skipped.
+  struct Entry {
+    std::uint32_t node;
+    float t;
+  };
+  std::array<Entry, kMaxBVHTraversalDepth> stack;
+  std::size_t top = 0;
+  stack[top++] = {0, IntersectBounds(bvh.nodes[0], origin, inverseDirection,
+                                     tMin, tMax)};
+
+  while (top > 0) {
+    Entry const entry = stack[--top];
+    if (!(entry.t <= tMax)) continue;
+    BVHNode const& node = bvh.nodes[entry.node];
+
+    if (node.IsLeaf()) {
+      for (std::uint32_t i = 0; i < node.count; ++i) {
+        if (intersect(bvh.primitives[node.first + i], tMax)) found = true;
+      }
+      continue;
+    }
+
+    // Visit the nearer child first so the farther one is more likely to be
+    // culled by the hit found in it.
+    std::uint32_t near = node.first;
+    std::uint32_t far = node.first + 1;
+    float tNear = IntersectBounds(bvh.nodes[near], origin, inverseDirection,
+                                  tMin, tMax);
+    float tFar = IntersectBounds(bvh.nodes[far], origin, inverseDirection,
+                                 tMin, tMax);
+    if (tFar < tNear) {
+      std::swap(near, far);
+      std::swap(tNear, tFar);
+    }
+
+    Expects(top + 2 <= stack.size());
+    if (tFar <= tMax) stack[top++] = {far, tFar};
+    if (tNear <= tMax) stack[top++] = {near, tNear};
+  }
+
+  return found;
+} // TraverseBVH
+
+#endif // BVH_HPP_
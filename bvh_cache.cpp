@@ -0,0 +1,291 @@
+#include "bvh_cache.hpp"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+constexpr std::array<char, 8> kBVHCacheMagic = {'S', 'P', 'H', 'B',
+                                                'V', 'H', 'C', 'A'};
+constexpr std::uint64_t kBVHCacheAlignment = 64;
+
+struct BVHCacheHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t maxLeafSize;
+  std::uint32_t binCount;
+  std::uint32_t reserved0;
+  std::uint64_t contentHash;
+  std::uint64_t primitiveCount;
+  std::uint64_t nodeCount;
+  std::uint64_t nodeOffset;
+  std::uint64_t primitiveOffset;
+  std::uint64_t fileSize;
+  std::uint64_t reserved[7];
+}; // struct BVHCacheHeader
+
+static_assert(sizeof(BVHCacheHeader) == 128);
+
+constexpr std::uint64_t AlignUp(std::uint64_t value) noexcept {
+  return (value + kBVHCacheAlignment - 1) & ~(kBVHCacheAlignment - 1);
+} // AlignUp
+
+std::system_error CacheError(char const* what) {
+  return std::system_error(std::make_error_code(std::errc::invalid_argument),
+                           std::string("BVH cache: ") + what);
+} // CacheError
+
+// Four independent multiply-rotate lanes over 32 byte stripes, in the style
+// of XXH64, so the hash runs at memory bandwidth on large sphere arrays.
+constexpr std::uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t kPrime3 = 0x165667B19E3779F9ull;
+constexpr std::uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+constexpr std::uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+constexpr std::uint64_t Rotl(std::uint64_t x, int r) noexcept {
+  return (x << r) | (x >> (64 - r));
+} // Rotl
+
+constexpr std::uint64_t Round(std::uint64_t acc, std::uint64_t input) noexcept {
+  return Rotl(acc + input * kPrime2, 31) * kPrime1;
+} // Round
+
+constexpr std::uint64_t Merge(std::uint64_t acc, std::uint64_t lane) noexcept {
+  return (acc ^ Round(0, lane)) * kPrime1 + kPrime4;
+} // Merge
+
+std::uint64_t Load64(std::byte const* p) noexcept {
+  std::uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+} // Load64
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now() - start)
+    .count();
+} // MillisecondsSince
+
+} // namespace
+
+std::uint64_t HashBytes(gsl::span<std::byte const> bytes,
+                        std::uint64_t seed) noexcept {
+  std::byte const* p = bytes.data();
+  auto const size = static_cast<std::uint64_t>(bytes.size());
+  std::byte const* const end = p + size;
+  std::uint64_t hash;
+
+  if (size >= 32) {
+    std::uint64_t lanes[4] = {seed + kPrime1 + kPrime2, seed + kPrime2, seed,
+                              seed - kPrime1};
+    for (; end - p >= 32; p += 32) {
+      for (int i = 0; i < 4; ++i) lanes[i] = Round(lanes[i], Load64(p + 8 * i));
+    }
+    hash = Rotl(lanes[0], 1) + Rotl(lanes[1], 7) + Rotl(lanes[2], 12) +
+           Rotl(lanes[3], 18);
+    for (auto lane : lanes) hash = Merge(hash, lane);
+  } else {
+    hash = seed + kPrime5;
+  }
+
+  hash += size;
+  for (; end - p >= 8; p += 8) {
+    hash ^= Round(0, Load64(p));
+    hash = Rotl(hash, 27) * kPrime1 + kPrime4;
+  }
+  for (; p < end; ++p) {
+    hash ^= static_cast<std::uint64_t>(*p) * kPrime5;
+    hash = Rotl(hash, 11) * kPrime1;
+  }
+
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+} // HashBytes
+
+BVHCacheKey MakeBVHCacheKey(gsl::span<SceneSphere const> spheres,
+                            BVHBuildParams const& params) noexcept {
+  BVHCacheKey key;
+  key.contentHash = HashBytes(gsl::as_bytes(spheres), kBVHCacheVersion);
+  key.primitiveCount = static_cast<std::uint64_t>(spheres.size());
+  key.params = params;
+  return key;
+} // MakeBVHCacheKey
+
+tl::expected<BVHCache, std::system_error>
+BVHCache::Open(gsl::czstring path, BVHCacheKey const& key) noexcept {
+  auto file = MappedFile::Open(path);
+  if (!file) return tl::unexpected(file.error());
+
+  auto const size = static_cast<std::uint64_t>(file->size());
+  if (size < sizeof(BVHCacheHeader)) {
+    return tl::unexpected(CacheError("truncated header"));
+  }
+
+  BVHCacheHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+
+  if (header.magic != kBVHCacheMagic) {
+    return tl::unexpected(CacheError("bad magic"));
+  }
+  if (header.version != kBVHCacheVersion || header.fileSize != size) {
+    return tl::unexpected(CacheError("wrong version or size"));
+  }
+
+  BVHCacheKey stored;
+  stored.contentHash = header.contentHash;
+  stored.primitiveCount = header.primitiveCount;
+  stored.params.maxLeafSize = header.maxLeafSize;
+  stored.params.binCount = header.binCount;
+  if (!(stored == key)) {
+    return tl::unexpected(CacheError("stale: built from other input"));
+  }
+
+  if (header.nodeOffset % kBVHCacheAlignment != 0 ||
+      header.primitiveOffset % kBVHCacheAlignment != 0 ||
+      header.nodeCount > (size - std::min(size, header.nodeOffset)) /
+                           sizeof(BVHNode) ||
+      header.primitiveCount >
+        (size - std::min(size, header.primitiveOffset)) /
+          sizeof(std::uint32_t)) {
+    return tl::unexpected(CacheError("arrays out of bounds"));
+  }
+
+  BVHView view;
+  view.nodes = {
+    reinterpret_cast<BVHNode const*>(file->data() + header.nodeOffset),
+    static_cast<gsl::index>(header.nodeCount)};
+  view.primitives = {reinterpret_cast<std::uint32_t const*>(
+                       file->data() + header.primitiveOffset),
+                     static_cast<gsl::index>(header.primitiveCount)};
+
+  if (!ValidateBVH(view, key.primitiveCount)) {
+    return tl::unexpected(CacheError("malformed hierarchy"));
+  }
+
+  BVHCache cache;
+  cache.file_ = std::move(*file);
+  cache.view_ = view;
+  return cache;
+} // BVHCache::Open
+
+tl::expected<void, std::system_error>
+WriteBVHCache(gsl::czstring path, BVHCacheKey const& key,
+              BVHView bvh) noexcept {
+  Expects(path != nullptr);
+  Expects(static_cast<std::uint64_t>(bvh.primitives.size()) ==
+          key.primitiveCount);
+
+  auto const nodeBytes = gsl::as_bytes(bvh.nodes);
+  auto const primitiveBytes = gsl::as_bytes(bvh.primitives);
+
+  BVHCacheHeader header = {};
+  header.magic = kBVHCacheMagic;
+  header.version = kBVHCacheVersion;
+  header.maxLeafSize = key.params.maxLeafSize;
+  header.binCount = key.params.binCount;
+  header.contentHash = key.contentHash;
+  header.primitiveCount = key.primitiveCount;
+  header.nodeCount = static_cast<std::uint64_t>(bvh.nodes.size());
+  header.nodeOffset = AlignUp(sizeof(header));
+  header.primitiveOffset =
+    AlignUp(header.nodeOffset + static_cast<std::uint64_t>(nodeBytes.size()));
+  header.fileSize = AlignUp(header.primitiveOffset +
+                            static_cast<std::uint64_t>(primitiveBytes.size()));
+
+  // Write to a temporary name and rename, so a reader never maps a partly
+  // written cache and an interrupted write leaves the old one in place.
+  std::string const temporary = std::string(path) + ".tmp";
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
+    std::fopen(temporary.c_str(), "wb"), &std::fclose);
+  if (!file) {
+    return tl::unexpected(std::system_error(
+      std::error_code(errno, std::generic_category()), "fopen"));
+  }
+
+  std::uint64_t written = 0;
+  auto write = [&](void const* data, std::uint64_t size) {
+    written += size;
+    return size == 0 ||
+           std::fwrite(data, 1, static_cast<std::size_t>(size), file.get()) ==
+             size;
+  };
+
+  std::array<std::byte, kBVHCacheAlignment> const padding = {};
+  auto padTo = [&](std::uint64_t offset) {
+    return write(padding.data(), offset - written);
+  };
+
+  bool const ok =
+    write(&header, sizeof(header)) && padTo(header.nodeOffset) &&
+    write(nodeBytes.data(), static_cast<std::uint64_t>(nodeBytes.size())) &&
+    padTo(header.primitiveOffset) &&
+    write(primitiveBytes.data(),
+          static_cast<std::uint64_t>(primitiveBytes.size())) &&
+    padTo(header.fileSize) && std::fflush(file.get()) == 0;
+  int const error = errno;
+  file.reset();
+
+  if (!ok) {
+    std::remove(temporary.c_str());
+    return tl::unexpected(std::system_error(
+      std::error_code(error, std::generic_category()), "fwrite"));
+  }
+
+  // rename does not replace an existing file on Windows.
+  std::remove(path);
+  if (std::rename(temporary.c_str(), path) != 0) {
+    int const renameError = errno;
+    std::remove(temporary.c_str());
+    return tl::unexpected(std::system_error(
+      std::error_code(renameError, std::generic_category()), "rename"));
+  }
+
+  return {};
+} // WriteBVHCache
+
+LoadedBVH LoadOrBuildBVH(gsl::czstring cachePath,
+                         gsl::span<SceneSphere const> spheres,
+                         BVHBuildParams const& params) {
+  using Clock = std::chrono::steady_clock;
+  LoadedBVH loaded;
+
+  auto start = Clock::now();
+  BVHCacheKey const key = MakeBVHCacheKey(spheres, params);
+  loaded.hashMs = MillisecondsSince(start);
+
+  if (cachePath != nullptr) {
+    start = Clock::now();
+    if (auto cache = BVHCache::Open(cachePath, key)) {
+      loaded.cache = std::move(*cache);
+      loaded.fromCache = true;
+      loaded.loadMs = MillisecondsSince(start);
+      return loaded;
+    } else {
+      loaded.cacheError = cache.error().what();
+    }
+  }
+
+  start = Clock::now();
+  loaded.built = BuildBVH(spheres, params);
+  loaded.buildMs = MillisecondsSince(start);
+
+  if (cachePath != nullptr) {
+    start = Clock::now();
+    if (auto result = WriteBVHCache(cachePath, key, loaded.built.View());
+        !result) {
+      loaded.cacheError += std::string("; not written: ") +
+                           result.error().what();
+    }
+    loaded.writeMs = MillisecondsSince(start);
+  }
+
+  return loaded;
+} // LoadOrBuildBVH
@@ -0,0 +1,92 @@
+#ifndef BVH_CACHE_HPP_
+#define BVH_CACHE_HPP_
+
+#include "bvh.hpp"
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+//
+// On-disk cache of a BVH built by BuildBVH, normally kept next to the scene
+// file as <scene>.bvh. The file is a header followed by the node and
+// primitive index arrays exactly as BVH stores them, so a cache hit is a
+// map, a header check and a structural validation; nothing is rebuilt or
+// relocated.
+//
+// The header stores a content hash of the sphere array together with the
+// sphere count and build parameters. A cache whose key does not match the
+// input is stale and is rebuilt and rewritten by LoadOrBuildBVH.
+//
+
+inline constexpr std::uint32_t kBVHCacheVersion = 1;
+
+// Fast 64-bit hash of bytes; not cryptographic.
+[[nodiscard]] std::uint64_t HashBytes(gsl::span<std::byte const> bytes,
+                                      std::uint64_t seed = 0) noexcept;
+
+struct BVHCacheKey {
+  std::uint64_t contentHash{0};
+  std::uint64_t primitiveCount{0};
+  BVHBuildParams params{};
+
+  [[nodiscard]] bool operator==(BVHCacheKey const& other) const noexcept {
+    return contentHash == other.contentHash &&
+           primitiveCount == other.primitiveCount &&
+           params.maxLeafSize == other.params.maxLeafSize &&
+           params.binCount == other.params.binCount;
+  }
+}; // struct BVHCacheKey
+
+[[nodiscard]] BVHCacheKey
+MakeBVHCacheKey(gsl::span<SceneSphere const> spheres,
+                BVHBuildParams const& params) noexcept;
+
+// A mapped cache file.
+class BVHCache {
+public:
+  // Fails if the file is malformed or was built from other input.
+  [[nodiscard]] static tl::expected<BVHCache, std::system_error>
+  Open(gsl::czstring path, BVHCacheKey const& key) noexcept;
+
+  [[nodiscard]] BVHView View() const noexcept { return view_; }
+  [[nodiscard]] MappedFile const& Mapping() const noexcept { return file_; }
+
+private:
+  MappedFile file_{};
+  BVHView view_{};
+}; // class BVHCache
+
+[[nodiscard]] tl::expected<void, std::system_error>
+WriteBVHCache(gsl::czstring path, BVHCacheKey const& key, BVHView bvh) noexcept;
+
+// The hierarchy for a sphere set, from the cache when it is current and
+// from BuildBVH otherwise. View() points into whichever holds it.
+struct LoadedBVH {
+  BVHCache cache{};
+  BVH built{};
+  bool fromCache{false};
+  std::string cacheError{}; // why the cache was not used, if it was not
+  double hashMs{0.0};
+  double loadMs{0.0};  // map and validate, on a hit
+  double buildMs{0.0}; // on a miss
+  double writeMs{0.0}; // on a miss
+
+  [[nodiscard]] BVHView View() const noexcept {
+    return fromCache ? cache.View() : built.View();
+  }
+  // Host bytes of a hierarchy built here; a cached one stays in the
+  // mapping, which the page cache can drop and reread.
+  [[nodiscard]] std::uint64_t HostBytes() const noexcept {
+    return fromCache ? 0 : built.Bytes();
+  }
+}; // struct LoadedBVH
+
+// Failing to write the cache is not an error; it is reported in cacheError.
+[[nodiscard]] LoadedBVH LoadOrBuildBVH(gsl::czstring cachePath,
+                                       gsl::span<SceneSphere const> spheres,
+                                       BVHBuildParams const& params);
+
+#endif // BVH_CACHE_HPP_
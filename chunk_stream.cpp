@@ -0,0 +1,527 @@
+#include "chunk_stream.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+
+namespace {
+
+std::system_error ErrnoError(char const* what) {
+  return std::system_error(std::error_code(errno, std::generic_category()),
+                           what);
+} // ErrnoError
+
+// Sphere centroids sampled to place the chunk boundaries, which bounds the
+// partition's bookkeeping to a few tens of MiB, and the fewest samples a
+// chunk is placed with when the scene has more spheres than that.
+constexpr std::uint64_t kMaxSamples = std::uint64_t{1} << 22;
+constexpr std::uint64_t kMinSamplesPerChunk = 16;
+
+// Spheres buffered per chunk before they are written out, bounded overall.
+constexpr std::uint64_t kScatterBufferBytes = std::uint64_t{64} << 20;
+
+using Point = std::array<float, 3>;
+
+float Centroid(SceneSphere const& sphere, int axis) noexcept {
+  return (sphere.aabbMin[axis] + sphere.aabbMax[axis]) * .5f;
+} // Centroid
+
+float LargestExtent(float const (&lo)[3], float const (&hi)[3]) noexcept {
+  return std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+} // LargestExtent
+
+//
+// A kd tree splitting sampled sphere centroids at the sample that gives
+// each side its share of the leaves, so every leaf's cell holds about as
+// many spheres as the others however the spheres are spread. A uniform grid
+// over the centroids' bounds puts nearly every sphere of a scene with one
+// far away sphere into one cell.
+//
+class ChunkTree {
+public:
+  // Reorders samples. Throws std::bad_alloc.
+  ChunkTree(gsl::span<Point> samples, std::uint64_t leafCount) {
+    Expects(!samples.empty() && leafCount > 0);
+    float lo[3], hi[3];
+    Bounds(samples, lo, hi);
+    Build(samples, leafCount, lo, hi);
+  }
+
+  [[nodiscard]] std::uint64_t LeafCount() const noexcept {
+    return leafExtents_.size();
+  }
+
+  // The leaf whose cell holds sphere's centroid.
+  [[nodiscard]] std::uint32_t LeafOf(SceneSphere const& sphere) const noexcept {
+    Node const* node = &nodes_[0];
+    while (node->axis >= 0) {
+      node = &nodes_[node->child[Centroid(sphere, node->axis) < node->split
+                                   ? 0
+                                   : 1]];
+    }
+    return node->child[0];
+  }
+
+  // The largest extent of leaf's cell. The outer cells end at the samples'
+  // bounds.
+  [[nodiscard]] float LeafExtent(std::uint32_t leaf) const noexcept {
+    return leafExtents_[leaf];
+  }
+
+private:
+  struct Node {
+    float split{0.f};
+    int axis{-1};                 // -1 for a leaf
+    std::uint32_t child[2]{0, 0}; // a leaf's index in child[0]
+  }; // struct Node
+
+  static void Bounds(gsl::span<Point const> samples, float (&lo)[3],
+                     float (&hi)[3]) noexcept {
+    for (int c = 0; c < 3; ++c) {
+      lo[c] = std::numeric_limits<float>::max();
+      hi[c] = std::numeric_limits<float>::lowest();
+    }
+    for (auto&& sample : samples) {
+      for (int c = 0; c < 3; ++c) {
+        lo[c] = std::min(lo[c], sample[c]);
+        hi[c] = std::max(hi[c], sample[c]);
+      }
+    }
+  }
+
+  std::uint32_t Build(gsl::span<Point> samples, std::uint64_t leafCount,
+                      float const (&cellLo)[3], float const (&cellHi)[3]) {
+    auto const index = static_cast<std::uint32_t>(nodes_.size());
+    nodes_.emplace_back();
+
+    // Split along the samples' widest extent, unless they all coincide.
+    float lo[3], hi[3];
+    Bounds(samples, lo, hi);
+    int axis = 0;
+    for (int c = 1; c < 3; ++c) {
+      if (hi[c] - lo[c] > hi[axis] - lo[axis]) axis = c;
+    }
+
+    if (leafCount == 1 || samples.size() < 2 || !(hi[axis] > lo[axis])) {
+      nodes_[index].child[0] = static_cast<std::uint32_t>(LeafCount());
+      leafExtents_.push_back(LargestExtent(cellLo, cellHi));
+      return index;
+    }
+
+    std::uint64_t const leftLeaves = leafCount / 2;
+    auto const middle = static_cast<gsl::index>(
+      static_cast<std::uint64_t>(samples.size()) * leftLeaves / leafCount);
+    std::nth_element(samples.begin(), samples.begin() + middle, samples.end(),
+                     [axis](Point const& a, Point const& b) {
+                       return a[axis] < b[axis];
+                     });
+    float const split = samples[middle][axis];
+
+    float leftHi[3] = {cellHi[0], cellHi[1], cellHi[2]};
+    float rightLo[3] = {cellLo[0], cellLo[1], cellLo[2]};
+    leftHi[axis] = rightLo[axis] = split;
+
+    std::uint32_t const left =
+      Build(samples.first(middle), leftLeaves, cellLo, leftHi);
+    std::uint32_t const right =
+      Build(samples.subspan(middle), leafCount - leftLeaves, rightLo, cellHi);
+    nodes_[index] = {split, axis, {left, right}};
+    return index;
+  }
+
+  std::vector<Node> nodes_{};
+  std::vector<float> leafExtents_{};
+}; // class ChunkTree
+
+} // namespace
+
+tl::expected<ChunkPartitionStats, std::system_error>
+PartitionSceneIntoChunks(SceneView const& input, gsl::czstring outputPath,
+                         ChunkPartitionParams const& params) noexcept {
+  Expects(outputPath != nullptr);
+  Expects(params.targetSpheresPerChunk > 0);
+
+  if (!input.instances.empty()) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_supported),
+      "cannot partition a scene with instances into chunks"));
+  }
+
+  auto const sphereCount = static_cast<std::uint64_t>(input.spheres.size());
+  if (sphereCount == 0) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::invalid_argument), "scene is empty"));
+  }
+  bool const hasMaterials = !input.sphereMaterials.empty();
+  std::uint64_t const target = params.targetSpheresPerChunk;
+
+  // Every stride-th centroid, in one pass front to back.
+  std::uint64_t const stride = (sphereCount + kMaxSamples - 1) / kMaxSamples;
+  std::vector<Point> samples;
+  samples.reserve(static_cast<std::size_t>(sphereCount / stride + 1));
+  for (std::uint64_t i = 0; i < sphereCount; i += stride) {
+    SceneSphere const& sphere = input.spheres[static_cast<gsl::index>(i)];
+    samples.push_back(
+      {Centroid(sphere, 0), Centroid(sphere, 1), Centroid(sphere, 2)});
+  }
+
+  std::uint64_t leafCount = (sphereCount + target - 1) / target;
+  if (stride > 1) {
+    leafCount = std::min<std::uint64_t>(leafCount,
+                                        samples.size() / kMinSamplesPerChunk);
+  }
+  ChunkTree const tree(samples, std::max<std::uint64_t>(leafCount, 1));
+  samples = {};
+
+  // A sphere larger than its leaf's cell, such as the ground sphere of the
+  // weekend scene, would stretch the leaf's chunk over the cells around it,
+  // so such spheres go, in order, into chunks of their own of at most
+  // target spheres after the leaves'. oversized counts them as they come.
+  auto cellOf = [&tree, target](SceneSphere const& sphere,
+                                std::uint64_t& oversized) -> std::uint64_t {
+    std::uint32_t const leaf = tree.LeafOf(sphere);
+    if (LargestExtent(sphere.aabbMin, sphere.aabbMax) <=
+        tree.LeafExtent(leaf)) {
+      return leaf;
+    }
+    return tree.LeafCount() + oversized++ / target;
+  };
+
+  std::vector<SceneChunk> cells(static_cast<std::size_t>(tree.LeafCount()));
+  auto emptyCell = [] {
+    SceneChunk cell{};
+    for (int c = 0; c < 3; ++c) {
+      cell.boundsMin[c] = std::numeric_limits<float>::max();
+      cell.boundsMax[c] = std::numeric_limits<float>::lowest();
+    }
+    return cell;
+  };
+  std::fill(cells.begin(), cells.end(), emptyCell());
+
+  ChunkPartitionStats stats;
+  for (auto&& sphere : input.spheres) {
+    std::uint64_t const index = cellOf(sphere, stats.oversizedSpheres);
+    if (index == cells.size()) cells.push_back(emptyCell());
+    SceneChunk& cell = cells[static_cast<std::size_t>(index)];
+    cell.sphereCount += 1;
+    for (int c = 0; c < 3; ++c) {
+      cell.boundsMin[c] = std::min(cell.boundsMin[c], sphere.aabbMin[c]);
+      cell.boundsMax[c] = std::max(cell.boundsMax[c], sphere.aabbMax[c]);
+    }
+  }
+  std::uint64_t const cellCount = cells.size();
+
+  std::vector<SceneChunk> chunks;
+  std::vector<std::uint32_t> cellChunk(cellCount, UINT32_MAX);
+  std::uint64_t first = 0;
+  for (std::uint64_t i = 0; i < cellCount; ++i) {
+    if (cells[i].sphereCount == 0) continue;
+    cells[i].firstSphere = first;
+    first += cells[i].sphereCount;
+    cellChunk[i] = static_cast<std::uint32_t>(chunks.size());
+    chunks.push_back(cells[i]);
+    stats.largestChunk = std::max(stats.largestChunk, cells[i].sphereCount);
+  }
+  cells = {};
+  stats.chunkCount = chunks.size();
+
+  SceneView output;
+  output.spheres = input.spheres;
+  output.sphereMaterials = input.sphereMaterials;
+  output.materials = input.materials;
+  output.chunks = chunks;
+  SceneFileLayout const layout = LayoutSceneFile(output);
+
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
+    std::fopen(outputPath, "wb"), &std::fclose);
+  if (!file) return tl::unexpected(ErrnoError("fopen"));
+
+  std::uint64_t const spheresOffset = layout.Offset(SceneSection::kSpheres);
+  std::uint64_t const materialsOffset =
+    layout.Offset(SceneSection::kSphereMaterials);
+  std::uint64_t const chunksOffset = layout.Offset(SceneSection::kChunks);
+  auto const chunkBytes = gsl::as_bytes(gsl::span<SceneChunk const>(chunks));
+  auto const materialBytes = gsl::as_bytes(input.materials);
+
+  bool ok =
+    WriteFileAt(file.get(), 0, &layout.header, sizeof(layout.header)) &&
+    WriteFileAt(file.get(), sizeof(layout.header), layout.sections.data(),
+                layout.sections.size() * sizeof(SceneSectionHeader)) &&
+    WriteFileAt(file.get(), layout.Offset(SceneSection::kMaterials),
+                materialBytes.data(),
+                static_cast<std::size_t>(materialBytes.size())) &&
+    WriteFileAt(file.get(), chunksOffset, chunkBytes.data(),
+                static_cast<std::size_t>(chunkBytes.size()));
+
+  // The chunk table is the last section; pad the file out to its size.
+  std::uint64_t const end =
+    chunksOffset + static_cast<std::uint64_t>(chunkBytes.size());
+  std::vector<std::byte> const padding(
+    static_cast<std::size_t>(layout.header.fileSize - end));
+  ok = ok && WriteFileAt(file.get(), end, padding.data(), padding.size());
+
+  // Scatter the spheres (and their material indices) to their chunks
+  // through per-chunk buffers so each write is a large sequential one.
+  std::size_t const capacity = static_cast<std::size_t>(std::clamp<
+    std::uint64_t>(kScatterBufferBytes / sizeof(SceneSphere) / chunks.size(),
+                   64, 16384));
+
+  struct Cursor {
+    std::uint64_t next;
+    std::vector<SceneSphere> spheres;
+    std::vector<std::uint32_t> materials;
+  };
+  std::vector<Cursor> cursors(chunks.size());
+  for (std::size_t i = 0; i < chunks.size(); ++i) {
+    cursors[i].next = chunks[i].firstSphere;
+  }
+
+  auto flush = [&](Cursor& cursor) {
+    bool const written =
+      WriteFileAt(file.get(),
+                  spheresOffset + cursor.next * sizeof(SceneSphere),
+                  cursor.spheres.data(),
+                  cursor.spheres.size() * sizeof(SceneSphere)) &&
+      WriteFileAt(file.get(),
+                  materialsOffset + cursor.next * sizeof(std::uint32_t),
+                  cursor.materials.data(),
+                  cursor.materials.size() * sizeof(std::uint32_t));
+    cursor.next += cursor.spheres.size();
+    cursor.spheres.clear();
+    cursor.materials.clear();
+    return written;
+  };
+
+  std::uint64_t oversized = 0;
+  for (std::uint64_t i = 0; ok && i < sphereCount; ++i) {
+    SceneSphere const& sphere = input.spheres[static_cast<gsl::index>(i)];
+    Cursor& cursor = cursors[cellChunk[cellOf(sphere, oversized)]];
+    cursor.spheres.push_back(sphere);
+    if (hasMaterials) {
+      cursor.materials.push_back(
+        input.sphereMaterials[static_cast<gsl::index>(i)]);
+    }
+    if (cursor.spheres.size() == capacity) ok = flush(cursor);
+  }
+
+  for (auto&& cursor : cursors) {
+    if (ok && !cursor.spheres.empty()) ok = flush(cursor);
+  }
+
+  if (!ok || std::fflush(file.get()) != 0) {
+    return tl::unexpected(ErrnoError("fwrite"));
+  }
+
+  return stats;
+} // PartitionSceneIntoChunks
+
+tl::expected<std::unique_ptr<ChunkStreamer>, std::system_error>
+ChunkStreamer::Open(gsl::czstring path,
+                    ChunkStreamConfig const& config) noexcept {
+  auto scene = SceneFile::Open(path);
+  if (!scene) return tl::unexpected(scene.error());
+
+  if (scene->View().chunks.empty()) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::invalid_argument),
+      std::string(path) + " has no chunk table"));
+  }
+
+  // A chunk over the budget could never be loaded.
+  for (auto&& chunk : scene->View().chunks) {
+    std::uint64_t const bytes = chunk.sphereCount * sizeof(SceneSphere);
+    if (bytes > config.budgetBytes) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::file_too_large),
+        "a chunk of " + std::to_string(bytes) +
+          " bytes exceeds the budget of " +
+          std::to_string(config.budgetBytes) + " bytes"));
+    }
+  }
+
+  auto file = RandomAccessFile::Open(path);
+  if (!file) return tl::unexpected(file.error());
+
+  return std::unique_ptr<ChunkStreamer>(
+    new ChunkStreamer(std::move(*scene), std::move(*file), config));
+} // ChunkStreamer::Open
+
+ChunkStreamer::ChunkStreamer(SceneFile scene, RandomAccessFile file,
+                             ChunkStreamConfig const& config)
+  : scene_(std::move(scene))
+  , file_(std::move(file))
+  , config_(config)
+  , entries_(static_cast<std::size_t>(scene_.View().chunks.size())) {
+  loader_ = std::thread(&ChunkStreamer::Loader, this);
+} // ChunkStreamer::ChunkStreamer
+
+ChunkStreamer::~ChunkStreamer() noexcept {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  workAvailable_.notify_all();
+  loader_.join();
+} // ChunkStreamer::~ChunkStreamer
+
+std::uint64_t ChunkStreamer::ChunkBytes(std::uint32_t index) const noexcept {
+  return Chunks()[index].sphereCount * sizeof(SceneSphere);
+} // ChunkStreamer::ChunkBytes
+
+std::vector<ResidentChunk> ChunkStreamer::Update(Frustum const& frustum) {
+  auto const chunks = Chunks();
+
+  std::vector<std::pair<float, std::uint32_t>> visible, nearby;
+  for (std::uint32_t i = 0; i < chunks.size(); ++i) {
+    SceneChunk const& chunk = chunks[i];
+    float const distance = frustum.Distance(chunk.boundsMin, chunk.boundsMax);
+    if (frustum.Intersects(chunk.boundsMin, chunk.boundsMax)) {
+      visible.push_back({distance, i});
+    } else if (distance <= config_.prefetchDistance) {
+      nearby.push_back({distance, i});
+    }
+  }
+  std::sort(visible.begin(), visible.end());
+  std::sort(nearby.begin(), nearby.end());
+
+  std::vector<ResidentChunk> resident;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    epoch_ += 1;
+
+    // Requests from the last update that were not started are replaced.
+    for (auto index : queue_) {
+      if (entries_[index].state == State::kQueued) {
+        entries_[index].state = State::kAbsent;
+      }
+    }
+    queue_.clear();
+
+    for (auto [distance, index] : visible) {
+      Entry& entry = entries_[index];
+      entry.visibleEpoch = epoch_;
+      stats_.requests += 1;
+
+      if (entry.state == State::kResident) {
+        stats_.hits += 1;
+        lru_.splice(lru_.begin(), lru_, entry.lru);
+        resident.push_back({index, &chunks[index], entry.spheres});
+      } else if (entry.state == State::kAbsent) {
+        entry.state = State::kQueued;
+        queue_.push_back(index);
+      }
+    }
+
+    for (auto [distance, index] : nearby) {
+      Entry& entry = entries_[index];
+      if (entry.state == State::kAbsent) {
+        entry.state = State::kQueued;
+        queue_.push_back(index);
+      }
+    }
+  }
+
+  workAvailable_.notify_one();
+  return resident;
+} // ChunkStreamer::Update
+
+bool ChunkStreamer::MakeRoom(std::uint64_t bytes) {
+  // Open rejects chunks over the budget.
+  Expects(bytes <= config_.budgetBytes);
+
+  while (stats_.residentBytes + bytes > config_.budgetBytes) {
+    // Chunks visible in the latest update are pinned.
+    auto const victim =
+      std::find_if(lru_.rbegin(), lru_.rend(), [this](std::uint32_t index) {
+        return entries_[index].visibleEpoch != epoch_;
+      });
+    if (victim == lru_.rend()) return false;
+
+    std::uint32_t const index = *victim;
+    lru_.erase(std::next(victim).base());
+
+    Entry& entry = entries_[index];
+    entry.spheres.reset();
+    entry.state = State::kAbsent;
+    stats_.residentBytes -= ChunkBytes(index);
+    stats_.residentChunks -= 1;
+    stats_.evictions += 1;
+  }
+  return true;
+} // ChunkStreamer::MakeRoom
+
+void ChunkStreamer::Loader() noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (queue_.empty()) idle_.notify_all();
+    workAvailable_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (stop_) return;
+
+    std::uint32_t const index = queue_.front();
+    queue_.pop_front();
+
+    Entry& entry = entries_[index];
+    std::uint64_t const bytes = ChunkBytes(index);
+    if (!MakeRoom(bytes)) {
+      entry.state = State::kAbsent;
+      stats_.deferred += 1;
+      continue;
+    }
+
+    // Reserve the bytes before unlocking so Stats never exceeds the budget.
+    entry.state = State::kLoading;
+    stats_.residentBytes += bytes;
+    loading_ = true;
+    lock.unlock();
+
+    SceneChunk const& chunk = Chunks()[index];
+    auto spheres = std::make_shared<std::vector<SceneSphere>>(
+      static_cast<std::size_t>(chunk.sphereCount));
+
+    auto const start = std::chrono::steady_clock::now();
+    auto result = file_.ReadAt(
+      scene_.SphereOffset() + chunk.firstSphere * sizeof(SceneSphere),
+      gsl::as_writeable_bytes(gsl::span<SceneSphere>(*spheres)));
+    double const seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+
+    lock.lock();
+    loading_ = false;
+
+    if (!result) {
+      std::fprintf(stderr, "Cannot load chunk %u: %s\n", index,
+                   result.error().what());
+      entry.state = State::kAbsent;
+      stats_.residentBytes -= bytes;
+      continue;
+    }
+
+    entry.spheres = std::move(spheres);
+    entry.state = State::kResident;
+    // Prefetched chunks go to the back so they are evicted before chunks
+    // that have actually been visible.
+    entry.lru = entry.visibleEpoch == epoch_
+                  ? lru_.insert(lru_.begin(), index)
+                  : lru_.insert(lru_.end(), index);
+
+    stats_.loads += 1;
+    stats_.residentChunks += 1;
+    stats_.bytesRead += bytes;
+    stats_.readSeconds += seconds;
+  }
+} // ChunkStreamer::Loader
+
+void ChunkStreamer::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return stop_ || (queue_.empty() && !loading_); });
+} // ChunkStreamer::WaitIdle
+
+ChunkStreamStats ChunkStreamer::Stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+} // ChunkStreamer::Stats
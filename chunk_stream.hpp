@@ -0,0 +1,150 @@
+#ifndef CHUNK_STREAM_HPP_
+#define CHUNK_STREAM_HPP_
+
+#include "expected.hpp"
+#include "frustum.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "mapped_file.hpp"
+#include "scene_file.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+//
+// Out-of-core sphere sets. PartitionSceneIntoChunks sorts a scene's spheres
+// into spatial chunks of about equal sphere counts, the cells of a kd tree
+// split at sampled medians, and writes them, with a chunk table of bounds
+// and sphere ranges, as a new scene file. ChunkStreamer then keeps
+// only the chunks the camera needs in memory: each Update selects the chunks
+// intersecting the view frustum (plus any within the prefetch distance),
+// queues the missing ones nearest first for a background loader thread and
+// returns the visible chunks that are resident. Resident chunks are kept in
+// an LRU list and evicted, least recently visible first, to stay under the
+// memory budget.
+//
+
+struct ChunkPartitionParams {
+  std::uint64_t targetSpheresPerChunk{std::uint64_t{1} << 16};
+}; // struct ChunkPartitionParams
+
+struct ChunkPartitionStats {
+  std::uint64_t chunkCount{0};
+  std::uint64_t largestChunk{0};     // spheres
+  std::uint64_t oversizedSpheres{0}; // larger than their cell
+}; // struct ChunkPartitionStats
+
+// Reads input front to back (it may be a mapping larger than memory) and
+// writes at most a few tens of MiB of buffered output at a time. Spheres
+// larger than the cell their centroid falls in are gathered into chunks of
+// their own, so one huge sphere does not stretch a chunk over its
+// neighbours. Scenes with instances are rejected since reordering spheres
+// would break their sphere ranges.
+[[nodiscard]] tl::expected<ChunkPartitionStats, std::system_error>
+PartitionSceneIntoChunks(SceneView const& input, gsl::czstring outputPath,
+                         ChunkPartitionParams const& params) noexcept;
+
+struct ChunkStreamConfig {
+  std::uint64_t budgetBytes{std::uint64_t{1} << 30};
+  // Chunks outside the frustum but closer than this are loaded after the
+  // visible ones, so turning the camera finds them resident.
+  float prefetchDistance{0.f};
+}; // struct ChunkStreamConfig
+
+// A chunk's spheres. The data is shared with the cache so an eviction never
+// frees spheres a caller is still reading.
+struct ResidentChunk {
+  std::uint32_t index{0};
+  SceneChunk const* chunk{nullptr};
+  std::shared_ptr<std::vector<SceneSphere> const> spheres{};
+}; // struct ResidentChunk
+
+struct ChunkStreamStats {
+  std::uint64_t requests{0}; // visible chunks over all updates
+  std::uint64_t hits{0};     // of those, already resident
+  std::uint64_t loads{0};
+  std::uint64_t evictions{0};
+  std::uint64_t deferred{0}; // loads skipped because the budget was pinned
+  std::uint64_t bytesRead{0};
+  double readSeconds{0.0};
+  std::uint64_t residentBytes{0};
+  std::uint64_t residentChunks{0};
+
+  [[nodiscard]] double HitRate() const noexcept {
+    return requests > 0 ? static_cast<double>(hits) / requests : 1.0;
+  }
+
+  // Bytes per second while reading, which excludes time the loader waited
+  // for work.
+  [[nodiscard]] double ReadBandwidth() const noexcept {
+    return readSeconds > 0.0 ? static_cast<double>(bytesRead) / readSeconds
+                             : 0.0;
+  }
+}; // struct ChunkStreamStats
+
+class ChunkStreamer {
+public:
+  // path must be a scene file with a chunk table, none of whose chunks is
+  // larger than the budget.
+  [[nodiscard]] static tl::expected<std::unique_ptr<ChunkStreamer>,
+                                    std::system_error>
+  Open(gsl::czstring path, ChunkStreamConfig const& config) noexcept;
+
+  ~ChunkStreamer() noexcept;
+  ChunkStreamer(ChunkStreamer const&) = delete;
+  ChunkStreamer& operator=(ChunkStreamer const&) = delete;
+
+  [[nodiscard]] std::vector<ResidentChunk> Update(Frustum const& frustum);
+
+  // Block until the loader has nothing queued.
+  void WaitIdle();
+
+  [[nodiscard]] ChunkStreamStats Stats() const;
+
+  [[nodiscard]] gsl::span<SceneChunk const> Chunks() const noexcept {
+    return scene_.View().chunks;
+  }
+
+private:
+  enum class State : std::uint8_t { kAbsent, kQueued, kLoading, kResident };
+
+  struct Entry {
+    State state{State::kAbsent};
+    std::uint64_t visibleEpoch{0};
+    std::shared_ptr<std::vector<SceneSphere> const> spheres{};
+    std::list<std::uint32_t>::iterator lru{};
+  }; // struct Entry
+
+  ChunkStreamer(SceneFile scene, RandomAccessFile file,
+                ChunkStreamConfig const& config);
+
+  void Loader() noexcept;
+  [[nodiscard]] std::uint64_t ChunkBytes(std::uint32_t index) const noexcept;
+  // Evict unpinned chunks until bytes more fit; false if the chunks visible
+  // in the latest update leave no room.
+  bool MakeRoom(std::uint64_t bytes);
+
+  SceneFile scene_;
+  RandomAccessFile file_;
+  ChunkStreamConfig const config_;
+
+  mutable std::mutex mutex_{};
+  std::condition_variable workAvailable_{};
+  std::condition_variable idle_{};
+  bool stop_{false};
+  bool loading_{false};
+  std::uint64_t epoch_{0};
+  std::vector<Entry> entries_{};
+  std::deque<std::uint32_t> queue_{};
+  std::list<std::uint32_t> lru_{}; // most recently visible first
+  ChunkStreamStats stats_{};
+
+  std::thread loader_{};
+}; // class ChunkStreamer
+
+#endif // CHUNK_STREAM_HPP_
@@ -0,0 +1,140 @@
+#include "cpu_renderer.hpp"
+#include "sample_tables.hpp"
+#include "sphere_query.hpp"
+#include "sphere_shader.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+RenderCamera LookAtCamera(float const (&eye)[3], float const (&lookAt)[3],
+                          float const (&viewUp)[3], float vfovDegrees,
+                          float aspectRatio) noexcept {
+  glm::vec3 const from(eye[0], eye[1], eye[2]);
+  glm::vec3 const up(viewUp[0], viewUp[1], viewUp[2]);
+  glm::vec3 const w = glm::vec3(lookAt[0], lookAt[1], lookAt[2]) - from;
+  glm::vec3 u = glm::normalize(glm::cross(w, up));
+  glm::vec3 v = glm::normalize(glm::cross(u, w));
+
+  float const length =
+    glm::length(w) * std::tan(.5f * vfovDegrees * 3.14159265f / 180.f);
+  v = v * length;
+  u = u * (length * aspectRatio);
+
+  RenderCamera camera;
+  for (int c = 0; c < 3; ++c) {
+    camera.eye[c] = eye[c];
+    camera.u[c] = u[c];
+    camera.v[c] = v[c];
+    camera.w[c] = w[c];
+  }
+  return camera;
+} // LookAtCamera
+
+void RenderRect(RenderScene const& scene, RenderCamera const& camera,
+                std::uint32_t imageWidth, std::uint32_t imageHeight,
+                ImageRect const& rect, gsl::span<float> rgba,
+                std::uint32_t samplesPerPixel) noexcept {
+  Expects(rect.x + rect.width <= imageWidth);
+  Expects(rect.y + rect.height <= imageHeight);
+  Expects(static_cast<std::uint64_t>(rgba.size()) == 4 * rect.PixelCount());
+  Expects(samplesPerPixel > 0);
+
+  glm::vec3 const u(camera.u[0], camera.u[1], camera.u[2]);
+  glm::vec3 const v(camera.v[0], camera.v[1], camera.v[2]);
+  glm::vec3 const w(camera.w[0], camera.w[1], camera.w[2]);
+  auto const width = static_cast<float>(imageWidth);
+  auto const height = static_cast<float>(imageHeight);
+  shader::SampleTables const* const tables =
+    samplesPerPixel > 1 ? &GetSampleTables() : nullptr;
+
+  SphereRay ray;
+  for (int c = 0; c < 3; ++c) ray.origin[c] = camera.eye[c];
+  // The ray generation shader's tmin and tmax.
+  ray.tMin = 0.f;
+  ray.tMax = 1e38f;
+
+  auto trace = [&](glm::vec3 const& direction) noexcept {
+    for (int c = 0; c < 3; ++c) ray.direction[c] = direction[c];
+    SphereHit hit;
+    return !scene.spheres.empty() &&
+               IntersectSpheres(scene.spheres, scene.bvh, ray, hit)
+             ? shader::ShadeNormal(
+                 glm::vec3(hit.normal[0], hit.normal[1], hit.normal[2]))
+             : shader::ShadeMiss(direction);
+  };
+
+  float* pixel = rgba.data();
+  for (std::uint32_t y = rect.y; y < rect.y + rect.height; ++y) {
+    for (std::uint32_t x = rect.x; x < rect.x + rect.width; ++x) {
+      auto const fx = static_cast<float>(x), fy = static_cast<float>(y);
+      glm::vec3 color;
+      if (tables == nullptr) {
+        color = trace(
+          shader::PrimaryRayDirection(fx, fy, width, height, u, v, w));
+      } else {
+        // As the ray generation shader samples, see sampling_shader.hpp.
+        std::uint32_t const blueNoise =
+          tables->blueNoise[shader::BlueNoiseTableIndex(x, y)];
+        color = glm::vec3(0.f);
+        for (std::uint32_t i = 0; i < samplesPerPixel; ++i) {
+          glm::vec2 const offset = shader::PixelSample(
+            tables->sobol[shader::SobolTableIndex(i)], blueNoise, i);
+          color = color + trace(shader::PrimaryRayDirectionAt(
+                            fx + offset.x, fy + offset.y, width, height, u,
+                            v, w));
+        }
+        color = color / static_cast<float>(samplesPerPixel);
+      }
+
+      pixel[0] = color.x;
+      pixel[1] = color.y;
+      pixel[2] = color.z;
+      pixel[3] = 1.f;
+      pixel += 4;
+    }
+  }
+} // RenderRect
+
+void RenderLayers(RenderScene const& scene,
+                  gsl::span<RenderCamera const> cameras,
+                  std::uint32_t imageWidth, std::uint32_t imageHeight,
+                  gsl::span<float> rgba, std::uint32_t samplesPerPixel,
+                  std::uint32_t threadCount) noexcept {
+  std::uint64_t const layerFloats = std::uint64_t{4} * imageWidth * imageHeight;
+  Expects(static_cast<std::uint64_t>(rgba.size()) ==
+          layerFloats * static_cast<std::uint64_t>(cameras.size()));
+
+  std::uint64_t const rowCount =
+    std::uint64_t{imageHeight} * static_cast<std::uint64_t>(cameras.size());
+  std::uint64_t const rowFloats = std::uint64_t{4} * imageWidth;
+  std::atomic<std::uint64_t> nextRow{0};
+
+  auto work = [&]() noexcept {
+    for (std::uint64_t row; (row = nextRow.fetch_add(1)) < rowCount;) {
+      auto const layer = static_cast<gsl::index>(row / imageHeight);
+      auto const y = static_cast<std::uint32_t>(row % imageHeight);
+      RenderRect(scene, cameras[layer], imageWidth, imageHeight,
+                 {0, y, imageWidth, 1},
+                 rgba.subspan(static_cast<gsl::index>(row * rowFloats),
+                              static_cast<gsl::index>(rowFloats)),
+                 samplesPerPixel);
+    }
+  };
+
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::uint64_t const count = std::min<std::uint64_t>(rowCount, threadCount);
+  std::vector<std::thread> threads;
+  try {
+    for (std::uint64_t t = 1; t < count; ++t) threads.emplace_back(work);
+  } catch (std::system_error const&) {
+    // Out of threads: the ones started and this one share the rows.
+  } catch (std::bad_alloc const&) {
+  }
+  work();
+  for (auto&& thread : threads) thread.join();
+} // RenderLayers
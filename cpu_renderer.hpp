@@ -0,0 +1,71 @@
+#ifndef CPU_RENDERER_HPP_
+#define CPU_RENDERER_HPP_
+
+#include "bvh.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "scene_file.hpp"
+#include <cstdint>
+
+//
+// The sphere scene rendered on the CPU: the ray generation shader's primary
+// rays, traced through the CPU BVH with shader::IntersectSphere and shaded
+// with shader::ShadeNormal and shader::ShadeMiss, so a CPU image holds the
+// same HDR values the ray tracing pipeline writes. It renders where there
+// is no GPU to render on: tile workers, and the render server's tests.
+//
+
+// The ray generation shader's Camera uniform without the padding: the eye,
+// w from it to the image center and u and v from there to the image's
+// right and top edges.
+struct RenderCamera {
+  float eye[3];
+  float u[3];
+  float v[3];
+  float w[3];
+}; // struct RenderCamera
+
+// The frame Camera computes for a view, without an arcball rotation.
+[[nodiscard]] RenderCamera LookAtCamera(float const (&eye)[3],
+                                        float const (&lookAt)[3],
+                                        float const (&viewUp)[3],
+                                        float vfovDegrees,
+                                        float aspectRatio) noexcept;
+
+struct ImageRect {
+  std::uint32_t x{0};
+  std::uint32_t y{0};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+
+  [[nodiscard]] std::uint64_t PixelCount() const noexcept {
+    return std::uint64_t{width} * height;
+  }
+}; // struct ImageRect
+
+// Spheres and a BVH built over them.
+struct RenderScene {
+  gsl::span<SceneSphere const> spheres{};
+  BVHView bvh{};
+}; // struct RenderScene
+
+// Render rect of an imageWidth by imageHeight image to RGBA32F pixels, one
+// row of rect.width after the other; rgba holds 4 * rect.PixelCount()
+// floats. One sample per pixel traces its center, as the renderer does by
+// default; more average rays placed by sampling_shader.hpp's sampler.
+void RenderRect(RenderScene const& scene, RenderCamera const& camera,
+                std::uint32_t imageWidth, std::uint32_t imageHeight,
+                ImageRect const& rect, gsl::span<float> rgba,
+                std::uint32_t samplesPerPixel = 1) noexcept;
+
+// Render a stack of imageWidth by imageHeight views, view i from cameras[i]
+// to layer i of rgba, as a ray generation launch with depth
+// cameras.size() would. The rows of all layers are shared out among
+// threadCount threads (0 for hardware_concurrency), so a batch of small
+// views keeps every thread as busy as one large view.
+void RenderLayers(RenderScene const& scene,
+                  gsl::span<RenderCamera const> cameras,
+                  std::uint32_t imageWidth, std::uint32_t imageHeight,
+                  gsl::span<float> rgba, std::uint32_t samplesPerPixel = 1,
+                  std::uint32_t threadCount = 0) noexcept;
+
+#endif // CPU_RENDERER_HPP_
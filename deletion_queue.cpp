@@ -0,0 +1,33 @@
+#include "deletion_queue.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <algorithm>
+#include <cstdint>
+
+void DeletionQueue::Retire(std::uint64_t frame, Deleter deleter) {
+  Expects(deleter);
+
+  // Keep the queue sorted; deleting later than necessary is always safe.
+  if (!entries_.empty()) frame = std::max(frame, entries_.back().frame);
+
+  entries_.push_back({frame, std::move(deleter)});
+  retiredCount_ += 1;
+} // DeletionQueue::Retire
+
+std::size_t DeletionQueue::Collect(std::uint64_t completedFrame) {
+  std::size_t count = 0;
+
+  while (!entries_.empty() && entries_.front().frame <= completedFrame) {
+    // Pop before running so a deleter may retire further resources.
+    Deleter deleter = std::move(entries_.front().deleter);
+    entries_.pop_front();
+    deleter();
+    count += 1;
+  }
+
+  deletedCount_ += count;
+  return count;
+} // DeletionQueue::Collect
+
+std::size_t DeletionQueue::Flush() {
+  return Collect(UINT64_MAX);
+} // DeletionQueue::Flush
@@ -0,0 +1,51 @@
+#ifndef DELETION_QUEUE_HPP_
+#define DELETION_QUEUE_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+//
+// Defers destroying resources until the GPU has finished every frame that
+// may still use them. Frames are identified by a serial that increases with
+// each submit; a resource retired after frame N was submitted is destroyed by
+// the first Collect call that sees frame N completed.
+//
+// The queue only runs deleters, so it can be driven by a stub device to check
+// that every retired resource is eventually destroyed.
+//
+class DeletionQueue {
+public:
+  using Deleter = std::function<void()>;
+
+  // A serial older than that of the last retired resource is treated as that
+  // serial, so resources are always deleted in the order they were retired.
+  void Retire(std::uint64_t frame, Deleter deleter);
+
+  // Destroy everything retired at or before completedFrame, in the order it
+  // was retired. Returns the number of deleters run.
+  std::size_t Collect(std::uint64_t completedFrame);
+
+  // Destroy everything; the device must be idle.
+  std::size_t Flush();
+
+  [[nodiscard]] std::size_t Pending() const noexcept { return entries_.size(); }
+  [[nodiscard]] std::uint64_t RetiredCount() const noexcept {
+    return retiredCount_;
+  }
+  [[nodiscard]] std::uint64_t DeletedCount() const noexcept {
+    return deletedCount_;
+  }
+
+private:
+  struct Entry {
+    std::uint64_t frame;
+    Deleter deleter;
+  }; // struct Entry
+
+  std::deque<Entry> entries_{};
+  std::uint64_t retiredCount_{0};
+  std::uint64_t deletedCount_{0};
+}; // class DeletionQueue
+
+#endif // DELETION_QUEUE_HPP_
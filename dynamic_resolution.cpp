@@ -0,0 +1,62 @@
+#include "dynamic_resolution.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <algorithm>
+#include <cmath>
+
+DynamicResolutionController::DynamicResolutionController(
+  Config const& config) noexcept
+  : config_(config)
+  , scale_(config.maxScale) {
+  Expects(config_.targetMs > 0.f);
+  Expects(config_.minScale > 0.f && config_.minScale <= config_.maxScale);
+  Expects(config_.smoothing > 0.f && config_.smoothing <= 1.f);
+  Expects(config_.hysteresis >= 0.f);
+  Expects(config_.gain > 0.f && config_.gain <= 1.f);
+  Expects(config_.maxStep > 0.f);
+  Expects(config_.quantum > 0.f);
+} // DynamicResolutionController::DynamicResolutionController
+
+bool DynamicResolutionController::Update(float traceMs) noexcept {
+  if (!(traceMs > 0.f) || !std::isfinite(traceMs)) return false;
+
+  if (haveSample_) {
+    smoothedMs_ += config_.smoothing * (traceMs - smoothedMs_);
+  } else {
+    smoothedMs_ = traceMs;
+    haveSample_ = true;
+  }
+
+  if (cooldown_ > 0) {
+    --cooldown_;
+    return false;
+  }
+
+  float const low = config_.targetMs * (1.f - config_.hysteresis);
+  float const high = config_.targetMs * (1.f + config_.hysteresis);
+  if (smoothedMs_ >= low && smoothedMs_ <= high) return false;
+
+  float const ideal = scale_ * std::sqrt(config_.targetMs / smoothedMs_);
+  float const step = std::clamp(config_.gain * (ideal - scale_),
+                                -config_.maxStep, config_.maxStep);
+
+  float next = std::round((scale_ + step) / config_.quantum) * config_.quantum;
+  next = std::clamp(next, config_.minScale, config_.maxScale);
+  if (next == scale_) return false;
+
+  // Predict the time at the new scale so the smoothed value does not have to
+  // relearn it from scratch.
+  float const ratio = next / scale_;
+  smoothedMs_ *= ratio * ratio;
+
+  scale_ = next;
+  cooldown_ = config_.cooldownFrames;
+  ++changeCount_;
+  return true;
+} // DynamicResolutionController::Update
+
+void DynamicResolutionController::Reset(float scale) noexcept {
+  scale_ = std::clamp(scale, config_.minScale, config_.maxScale);
+  smoothedMs_ = 0.f;
+  haveSample_ = false;
+  cooldown_ = 0;
+} // DynamicResolutionController::Reset
@@ -0,0 +1,65 @@
+#ifndef DYNAMIC_RESOLUTION_HPP_
+#define DYNAMIC_RESOLUTION_HPP_
+
+#include <cstdint>
+
+//
+// Closed-loop render scale controller. Fed one trace time per frame, it
+// picks the render scale that holds the trace time at a target budget.
+//
+// Trace cost is proportional to the traced pixel count, so the scale that
+// would hit the target is scale * sqrt(target / time). The controller moves
+// part of the way there (gain) on an exponentially smoothed time, ignores
+// errors inside a hysteresis band around the target, and waits cooldown
+// frames after each change so timings that still reflect the previous scale
+// do not cause overshoot. It has no device dependencies so its stability can
+// be checked against recorded or synthetic timing traces.
+//
+class DynamicResolutionController {
+public:
+  struct Config {
+    float targetMs{8.f};
+    float minScale{.25f};
+    float maxScale{1.f};
+    // Weight of the newest sample in the smoothed trace time.
+    float smoothing{.2f};
+    // No change while the smoothed time is within targetMs * (1 +- band).
+    float hysteresis{.1f};
+    // Fraction of the distance to the ideal scale moved per change.
+    float gain{.5f};
+    // Largest change of scale per update.
+    float maxStep{.125f};
+    // Scales are rounded to multiples of this to avoid tiny changes.
+    float quantum{1.f / 64.f};
+    // Samples ignored after a change.
+    std::uint32_t cooldownFrames{4};
+  }; // struct Config
+
+  DynamicResolutionController() noexcept
+    : DynamicResolutionController(Config{}) {}
+  explicit DynamicResolutionController(Config const& config) noexcept;
+
+  // Feed the trace time of the last frame traced at Scale(). Returns true if
+  // Scale() changed.
+  bool Update(float traceMs) noexcept;
+
+  // Restart from scale, discarding the smoothed time.
+  void Reset(float scale) noexcept;
+
+  [[nodiscard]] float Scale() const noexcept { return scale_; }
+  [[nodiscard]] float SmoothedMs() const noexcept { return smoothedMs_; }
+  [[nodiscard]] Config const& GetConfig() const noexcept { return config_; }
+  [[nodiscard]] std::uint64_t ChangeCount() const noexcept {
+    return changeCount_;
+  }
+
+private:
+  Config config_;
+  float scale_;
+  float smoothedMs_{0.f};
+  bool haveSample_{false};
+  std::uint32_t cooldown_{0};
+  std::uint64_t changeCount_{0};
+}; // class DynamicResolutionController
+
+#endif // DYNAMIC_RESOLUTION_HPP_
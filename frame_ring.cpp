@@ -0,0 +1,35 @@
+#include "frame_ring.hpp"
+#include <cstring>
+
+gsl::czstring to_string(LatencyMode mode) noexcept {
+  switch (mode) {
+  case LatencyMode::kThroughput: return "throughput";
+  case LatencyMode::kLowLatency: return "low";
+  }
+  return "unknown";
+} // to_string
+
+bool FromString(gsl::czstring name, LatencyMode& mode) noexcept {
+  for (auto candidate : {LatencyMode::kThroughput, LatencyMode::kLowLatency}) {
+    if (std::strcmp(name, to_string(candidate)) == 0) {
+      mode = candidate;
+      return true;
+    }
+  }
+  return false;
+} // FromString
+
+FrameSlot FrameRing::Begin() noexcept {
+  FrameSlot slot;
+  slot.serial = ++serial_;
+  slot.index = SlotOf(slot.serial);
+
+  std::uint64_t const behind = mode_ == LatencyMode::kLowLatency ? 1 : size_;
+  slot.waitSerial = slot.serial > behind ? slot.serial - behind : 0;
+  return slot;
+} // FrameRing::Begin
+
+std::uint32_t FrameRing::SlotOf(std::uint64_t serial) const noexcept {
+  Expects(serial >= 1 && serial <= serial_);
+  return static_cast<std::uint32_t>((serial - 1) % size_);
+} // FrameRing::SlotOf
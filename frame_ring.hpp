@@ -0,0 +1,70 @@
+#ifndef FRAME_RING_HPP_
+#define FRAME_RING_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include <cstdint>
+
+//
+// Which per-frame resources a frame records into, and which earlier frame
+// must complete before it may. Frames take the slots of a ring of 1 to
+// kMaxFramesInFlight in turn, whichever swapchain image they render to, so
+// how far the CPU runs ahead of the GPU depends on the ring size and not on
+// the order the presentation engine hands out images.
+//
+// Frames are numbered by a serial that starts at 1, as DeletionQueue
+// numbers them. The ring holds no fences itself, so it can be driven by a
+// stub device.
+//
+
+inline constexpr std::uint32_t kMaxFramesInFlight = 4;
+
+enum class LatencyMode : std::uint32_t {
+  // Queue up to the ring size of frames: the GPU never waits for the CPU,
+  // but input reaches the screen up to that many frames late.
+  kThroughput = 0,
+  // Wait for the previous frame before starting the next, so input is
+  // sampled as late as possible at the cost of the GPU idling in between.
+  kLowLatency = 1,
+};
+
+[[nodiscard]] gsl::czstring to_string(LatencyMode mode) noexcept;
+
+// Inverse of to_string; false if name is not a mode.
+[[nodiscard]] bool FromString(gsl::czstring name, LatencyMode& mode) noexcept;
+
+struct FrameSlot {
+  std::uint32_t index{0};      // the ring slot to record into
+  std::uint64_t serial{0};     // of this frame
+  std::uint64_t waitSerial{0}; // frame to wait for first, 0 for none
+}; // struct FrameSlot
+
+class FrameRing {
+public:
+  explicit FrameRing(std::uint32_t size = 2,
+                     LatencyMode mode = LatencyMode::kThroughput) noexcept
+    : size_{size}, mode_{mode} {
+    Expects(size >= 1 && size <= kMaxFramesInFlight);
+  }
+
+  [[nodiscard]] std::uint32_t Size() const noexcept { return size_; }
+  [[nodiscard]] LatencyMode Mode() const noexcept { return mode_; }
+  void SetMode(LatencyMode mode) noexcept { mode_ = mode; }
+
+  // Start the next frame. Its slot is free, and input may be sampled, once
+  // the frame waitSerial has completed, which is the one that used the slot
+  // before or, in low latency mode, the one before this.
+  [[nodiscard]] FrameSlot Begin() noexcept;
+
+  // The slot frame serial was recorded into, for any frame begun so far.
+  [[nodiscard]] std::uint32_t SlotOf(std::uint64_t serial) const noexcept;
+
+  // The serial of the frame begun last.
+  [[nodiscard]] std::uint64_t Serial() const noexcept { return serial_; }
+
+private:
+  std::uint32_t size_;
+  LatencyMode mode_;
+  std::uint64_t serial_{0};
+}; // class FrameRing
+
+#endif // FRAME_RING_HPP_
@@ -0,0 +1,101 @@
+#include "frustum.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+void Cross(float const (&a)[3], float const (&b)[3], float (&out)[3]) noexcept {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+} // Cross
+
+float Dot(float const (&a)[3], float const (&b)[3]) noexcept {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+} // Dot
+
+// Plane through point with normal n, flipped so that the direction inside
+// points to its positive side.
+FrustumPlane MakePlane(float (&n)[3], float const (&point)[3],
+                       float const (&inside)[3]) noexcept {
+  float const length = std::sqrt(Dot(n, n));
+  if (length > 0.f) {
+    for (auto& c : n) c /= length;
+  }
+  if (Dot(n, inside) < 0.f) {
+    for (auto& c : n) c = -c;
+  }
+  return {{n[0], n[1], n[2]}, -Dot(n, point)};
+} // MakePlane
+
+} // namespace
+
+Frustum Frustum::FromPinhole(float const (&eye)[3], float const (&u)[3],
+                             float const (&v)[3], float const (&w)[3],
+                             float farDistance) noexcept {
+  Frustum frustum;
+  std::copy_n(eye, 3, frustum.eye_);
+
+  // Corner ray directions, counter-clockwise.
+  float corners[4][3];
+  float const signs[4][2] = {{-1.f, -1.f}, {1.f, -1.f}, {1.f, 1.f},
+                             {-1.f, 1.f}};
+  for (int i = 0; i < 4; ++i) {
+    for (int c = 0; c < 3; ++c) {
+      corners[i][c] = w[c] + signs[i][0] * u[c] + signs[i][1] * v[c];
+    }
+  }
+
+  // The four sides pass through the eye and two adjacent corner rays; w
+  // points inside all of them.
+  for (int i = 0; i < 4; ++i) {
+    float n[3];
+    Cross(corners[i], corners[(i + 1) % 4], n);
+    frustum.planes_[i] = MakePlane(n, eye, w);
+  }
+
+  float forward[3] = {w[0], w[1], w[2]};
+  float const wLength = std::sqrt(Dot(forward, forward));
+  frustum.planes_[4] = MakePlane(forward, eye, w);
+
+  float const far =
+    std::min(farDistance, std::numeric_limits<float>::max() / 4.f);
+  float back[3] = {-w[0], -w[1], -w[2]};
+  float farPoint[3];
+  for (int c = 0; c < 3; ++c) {
+    farPoint[c] = eye[c] + (wLength > 0.f ? w[c] / wLength * far : 0.f);
+  }
+  frustum.planes_[5] = MakePlane(back, farPoint, back);
+
+  return frustum;
+} // Frustum::FromPinhole
+
+bool Frustum::Intersects(float const (&boxMin)[3],
+                         float const (&boxMax)[3]) const noexcept {
+  for (auto&& plane : planes_) {
+    // The box corner furthest along the plane normal.
+    float const p[3] = {plane.normal[0] >= 0.f ? boxMax[0] : boxMin[0],
+                        plane.normal[1] >= 0.f ? boxMax[1] : boxMin[1],
+                        plane.normal[2] >= 0.f ? boxMax[2] : boxMin[2]};
+    if (Dot(plane.normal, p) + plane.distance < 0.f) return false;
+  }
+  return true;
+} // Frustum::Intersects
+
+Frustum Frustum::Expanded(float margin) const noexcept {
+  // Plane normals are unit length, so distance is in world units.
+  Frustum expanded = *this;
+  for (auto&& plane : expanded.planes_) plane.distance += margin;
+  return expanded;
+} // Frustum::Expanded
+
+float Frustum::Distance(float const (&boxMin)[3],
+                        float const (&boxMax)[3]) const noexcept {
+  float squared = 0.f;
+  for (int c = 0; c < 3; ++c) {
+    float const d =
+      std::max({boxMin[c] - eye_[c], 0.f, eye_[c] - boxMax[c]});
+    squared += d * d;
+  }
+  return std::sqrt(squared);
+} // Frustum::Distance
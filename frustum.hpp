@@ -0,0 +1,54 @@
+#ifndef FRUSTUM_HPP_
+#define FRUSTUM_HPP_
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+// A plane n.p + d = 0 with the inside where n.p + d >= 0.
+struct FrustumPlane {
+  float normal[3];
+  float distance;
+}; // struct FrustumPlane
+
+//
+// View frustum of a pinhole camera given as eye and the u, v, w vectors the
+// ray generation shader uses (primary rays are w + x * u + y * v for x and y
+// in [-1, 1]), with a near plane through the eye and an optional far
+// distance along w. Intersects is conservative: a box reported outside is
+// outside, a box reported inside may still be outside near the corners.
+//
+class Frustum {
+public:
+  static constexpr std::size_t kPlaneCount = 6;
+
+  Frustum() noexcept = default;
+
+  [[nodiscard]] static Frustum
+  FromPinhole(float const (&eye)[3], float const (&u)[3], float const (&v)[3],
+              float const (&w)[3],
+              float farDistance = std::numeric_limits<float>::max()) noexcept;
+
+  [[nodiscard]] bool Intersects(float const (&boxMin)[3],
+                                float const (&boxMax)[3]) const noexcept;
+
+  // The frustum with every plane moved margin further out, so it also
+  // accepts boxes within margin of it.
+  [[nodiscard]] Frustum Expanded(float margin) const noexcept;
+
+  // Distance from the eye to the closest point of the box, 0 if the eye is
+  // inside. Used to order loads and evictions.
+  [[nodiscard]] float Distance(float const (&boxMin)[3],
+                               float const (&boxMax)[3]) const noexcept;
+
+  [[nodiscard]] std::array<FrustumPlane, kPlaneCount> const&
+  Planes() const noexcept {
+    return planes_;
+  }
+
+private:
+  std::array<FrustumPlane, kPlaneCount> planes_{};
+  float eye_[3]{0.f, 0.f, 0.f};
+}; // class Frustum
+
+#endif // FRUSTUM_HPP_
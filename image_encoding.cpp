@@ -0,0 +1,249 @@
+#include "image_encoding.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+namespace {
+
+void PutBigEndian32(std::vector<std::byte>& bytes, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    bytes.push_back(static_cast<std::byte>(value >> shift & 0xFF));
+  }
+} // PutBigEndian32
+
+void Put(std::vector<std::byte>& bytes, std::uint32_t value) {
+  bytes.push_back(static_cast<std::byte>(value));
+} // Put
+
+// CRC-32 as PNG chunks use it (ISO 3309, reflected, polynomial 0xEDB88320).
+std::uint32_t Crc32(std::byte const* data, std::size_t size,
+                    std::uint32_t crc = 0) noexcept {
+  static auto const kTable = [] {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t n = 0; n < 256; ++n) {
+      std::uint32_t c = n;
+      for (int k = 0; k < 8; ++k) c = c & 1 ? 0xEDB8'8320 ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    return table;
+  }();
+
+  crc = ~crc;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc = kTable[(crc ^ static_cast<std::uint32_t>(data[i])) & 0xFF] ^
+          (crc >> 8);
+  }
+  return ~crc;
+} // Crc32
+
+// Append a PNG chunk with its length and CRC around data.
+void PutChunk(std::vector<std::byte>& bytes, char const (&type)[5],
+              gsl::span<std::byte const> data) {
+  PutBigEndian32(bytes, static_cast<std::uint32_t>(data.size()));
+  std::size_t const crcBegin = bytes.size();
+  for (int i = 0; i < 4; ++i) Put(bytes, static_cast<std::uint8_t>(type[i]));
+  bytes.insert(bytes.end(), data.begin(), data.end());
+  PutBigEndian32(bytes, Crc32(bytes.data() + crcBegin,
+                              bytes.size() - crcBegin));
+} // PutChunk
+
+} // namespace
+
+gsl::czstring to_string(ImageFormat format) noexcept {
+  switch (format) {
+  case ImageFormat::kPPM: return "ppm";
+  case ImageFormat::kQOI: return "qoi";
+  case ImageFormat::kPNG: return "png";
+  }
+  return "unknown";
+} // to_string
+
+bool FromString(gsl::czstring name, ImageFormat& format) noexcept {
+  for (auto candidate :
+       {ImageFormat::kPPM, ImageFormat::kQOI, ImageFormat::kPNG}) {
+    if (std::strcmp(name, to_string(candidate)) == 0) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+} // FromString
+
+std::vector<std::byte> EncodePPM(LDRImageView const& image) {
+  std::string const header = "P6\n" + std::to_string(image.width) + " " +
+                             std::to_string(image.height) + "\n255\n";
+
+  std::vector<std::byte> bytes(header.size() +
+                               std::size_t{3} * image.width * image.height);
+  std::byte* out = bytes.data();
+  for (char c : header) *out++ = static_cast<std::byte>(c);
+
+  for (std::uint32_t y = 0; y < image.height; ++y) {
+    std::uint8_t const* pixel =
+      image.data + std::size_t{y} * image.rowPitch * 4;
+    for (std::uint32_t x = 0; x < image.width; ++x, pixel += 4) {
+      *out++ = static_cast<std::byte>(pixel[0]);
+      *out++ = static_cast<std::byte>(pixel[1]);
+      *out++ = static_cast<std::byte>(pixel[2]);
+    }
+  }
+  return bytes;
+} // EncodePPM
+
+std::vector<std::byte> EncodeQOI(LDRImageView const& image) {
+  constexpr std::uint32_t kOpIndex = 0x00;
+  constexpr std::uint32_t kOpDiff = 0x40;
+  constexpr std::uint32_t kOpLuma = 0x80;
+  constexpr std::uint32_t kOpRun = 0xC0;
+  constexpr std::uint32_t kOpRGB = 0xFE;
+  constexpr int kMaxRun = 62;
+
+  std::vector<std::byte> bytes;
+  // Worst case: a tag and three bytes per pixel.
+  bytes.reserve(14 + std::size_t{4} * image.width * image.height + 8);
+  for (char c : {'q', 'o', 'i', 'f'}) Put(bytes, static_cast<std::uint8_t>(c));
+  PutBigEndian32(bytes, image.width);
+  PutBigEndian32(bytes, image.height);
+  Put(bytes, 3); // RGB
+  Put(bytes, 0); // sRGB with linear alpha
+
+  // Alpha is always 255, so it drops out of the index hash as 255 * 11.
+  std::array<std::uint32_t, 64> seen{};
+  std::uint32_t previous = 0x0000'00FF; // r, g, b, a from high to low byte
+  int run = 0;
+
+  for (std::uint32_t y = 0; y < image.height; ++y) {
+    std::uint8_t const* pixel =
+      image.data + std::size_t{y} * image.rowPitch * 4;
+    for (std::uint32_t x = 0; x < image.width; ++x, pixel += 4) {
+      std::uint32_t const r = pixel[0], g = pixel[1], b = pixel[2];
+      std::uint32_t const current = r << 24 | g << 16 | b << 8 | 0xFF;
+
+      if (current == previous) {
+        if (++run == kMaxRun) {
+          Put(bytes, kOpRun | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        Put(bytes, kOpRun | (run - 1));
+        run = 0;
+      }
+
+      std::uint32_t const index = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+      if (seen[index] == current) {
+        Put(bytes, kOpIndex | index);
+      } else {
+        seen[index] = current;
+
+        // Channel differences wrap around, as the decoder adds them mod 256.
+        auto const dr = static_cast<std::int8_t>(r - (previous >> 24 & 0xFF));
+        auto const dg = static_cast<std::int8_t>(g - (previous >> 16 & 0xFF));
+        auto const db = static_cast<std::int8_t>(b - (previous >> 8 & 0xFF));
+        int const drg = dr - dg;
+        int const dbg = db - dg;
+
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 &&
+            db <= 1) {
+          Put(bytes, kOpDiff | static_cast<std::uint32_t>(dr + 2) << 4 |
+                       static_cast<std::uint32_t>(dg + 2) << 2 |
+                       static_cast<std::uint32_t>(db + 2));
+        } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 &&
+                   dbg >= -8 && dbg <= 7) {
+          Put(bytes, kOpLuma | static_cast<std::uint32_t>(dg + 32));
+          Put(bytes, static_cast<std::uint32_t>(drg + 8) << 4 |
+                       static_cast<std::uint32_t>(dbg + 8));
+        } else {
+          Put(bytes, kOpRGB);
+          Put(bytes, r);
+          Put(bytes, g);
+          Put(bytes, b);
+        }
+      }
+      previous = current;
+    }
+  }
+  if (run > 0) Put(bytes, kOpRun | (run - 1));
+
+  for (int i = 0; i < 7; ++i) Put(bytes, 0);
+  Put(bytes, 1);
+  return bytes;
+} // EncodeQOI
+
+std::vector<std::byte> EncodePNG(LDRImageView const& image) {
+  // Largest stored deflate block.
+  constexpr std::size_t kMaxBlock = 65535;
+
+  // Scanlines of a filter type byte (0, none) and RGB.
+  std::size_t const rowBytes = 1 + std::size_t{3} * image.width;
+  std::size_t const rawBytes = rowBytes * image.height;
+  std::size_t const blockCount =
+    rawBytes == 0 ? 1 : (rawBytes + kMaxBlock - 1) / kMaxBlock;
+
+  std::vector<std::byte> raw;
+  raw.reserve(rawBytes);
+  for (std::uint32_t y = 0; y < image.height; ++y) {
+    std::uint8_t const* pixel =
+      image.data + std::size_t{y} * image.rowPitch * 4;
+    raw.push_back(std::byte{0});
+    for (std::uint32_t x = 0; x < image.width; ++x, pixel += 4) {
+      raw.push_back(static_cast<std::byte>(pixel[0]));
+      raw.push_back(static_cast<std::byte>(pixel[1]));
+      raw.push_back(static_cast<std::byte>(pixel[2]));
+    }
+  }
+
+  // zlib: header, stored blocks, Adler-32 of the raw bytes.
+  std::vector<std::byte> zlib;
+  zlib.reserve(2 + rawBytes + 5 * blockCount + 4);
+  Put(zlib, 0x78);
+  Put(zlib, 0x01);
+  std::uint32_t a = 1, b = 0;
+  for (std::size_t offset = 0, block = 0; block < blockCount; ++block) {
+    std::size_t const size = std::min(kMaxBlock, rawBytes - offset);
+    Put(zlib, block + 1 == blockCount ? 1 : 0); // BFINAL, BTYPE 00
+    Put(zlib, size & 0xFF);
+    Put(zlib, size >> 8);
+    Put(zlib, ~size & 0xFF);
+    Put(zlib, (~size >> 8) & 0xFF);
+    zlib.insert(zlib.end(), raw.begin() + static_cast<std::ptrdiff_t>(offset),
+                raw.begin() + static_cast<std::ptrdiff_t>(offset + size));
+    for (std::size_t i = offset; i < offset + size; ++i) {
+      a = (a + static_cast<std::uint32_t>(raw[i])) % 65521;
+      b = (b + a) % 65521;
+    }
+    offset += size;
+  }
+  PutBigEndian32(zlib, b << 16 | a);
+
+  std::vector<std::byte> bytes;
+  bytes.reserve(8 + 25 + zlib.size() + 12 + 12);
+  for (std::uint32_t c : {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A}) {
+    Put(bytes, c);
+  }
+
+  std::vector<std::byte> header;
+  PutBigEndian32(header, image.width);
+  PutBigEndian32(header, image.height);
+  Put(header, 8); // bit depth
+  Put(header, 2); // truecolor
+  Put(header, 0); // deflate
+  Put(header, 0); // adaptive filtering
+  Put(header, 0); // not interlaced
+  PutChunk(bytes, "IHDR", header);
+  PutChunk(bytes, "IDAT", zlib);
+  PutChunk(bytes, "IEND", {});
+  return bytes;
+} // EncodePNG
+
+std::vector<std::byte> EncodeImage(LDRImageView const& image,
+                                   ImageFormat format) {
+  switch (format) {
+  case ImageFormat::kPPM: return EncodePPM(image);
+  case ImageFormat::kQOI: return EncodeQOI(image);
+  case ImageFormat::kPNG: return EncodePNG(image);
+  }
+  return {};
+} // EncodeImage
@@ -0,0 +1,43 @@
+#ifndef IMAGE_ENCODING_HPP_
+#define IMAGE_ENCODING_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include "tonemap.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// Encoded image files from tonemapped RGBA8 pixels, for frames rendered
+// off screen. Alpha is dropped: every format is written as 8-bit RGB.
+//
+// QOI is the format to send over a socket: it encodes at memory speed and
+// compresses the smooth gradients and flat regions of a render well. PNG is
+// for tools that do not read QOI; its deflate stream is written in stored
+// blocks, so it is valid and fast to write but no smaller than the pixels.
+//
+
+enum class ImageFormat : std::uint32_t {
+  kPPM = 0,
+  kQOI = 1,
+  kPNG = 2,
+};
+
+[[nodiscard]] gsl::czstring to_string(ImageFormat format) noexcept;
+
+// Inverse of to_string; false if name is not a format.
+[[nodiscard]] bool FromString(gsl::czstring name,
+                              ImageFormat& format) noexcept;
+
+// Binary PPM (P6).
+[[nodiscard]] std::vector<std::byte> EncodePPM(LDRImageView const& image);
+
+// The Quite OK Image format, version 1.0, sRGB with linear alpha.
+[[nodiscard]] std::vector<std::byte> EncodeQOI(LDRImageView const& image);
+
+[[nodiscard]] std::vector<std::byte> EncodePNG(LDRImageView const& image);
+
+[[nodiscard]] std::vector<std::byte> EncodeImage(LDRImageView const& image,
+                                                 ImageFormat format);
+
+#endif // IMAGE_ENCODING_HPP_
@@ -0,0 +1,120 @@
+#include "instance_culling.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define INSTANCE_CULLING_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+InstanceBounds TransformBounds(float const (&transform)[3][4],
+                               float const (&boxMin)[3],
+                               float const (&boxMax)[3]) noexcept {
+  // Arvo: each output extent takes the smaller and larger of every matrix
+  // element times the matching input extent.
+  InstanceBounds bounds;
+  for (int r = 0; r < 3; ++r) {
+    bounds.boundsMin[r] = bounds.boundsMax[r] = transform[r][3];
+    for (int c = 0; c < 3; ++c) {
+      float const a = transform[r][c] * boxMin[c];
+      float const b = transform[r][c] * boxMax[c];
+      bounds.boundsMin[r] += std::min(a, b);
+      bounds.boundsMax[r] += std::max(a, b);
+    }
+  }
+  return bounds;
+} // TransformBounds
+
+void InstanceCuller::Assign(gsl::span<InstanceBounds const> bounds) {
+  count_ = static_cast<std::size_t>(bounds.size());
+  std::size_t const padded = (count_ + 3) & ~std::size_t{3};
+
+  for (auto&& component : soa_) component.assign(padded, 0.f);
+  for (std::size_t i = 0; i < count_; ++i) {
+    InstanceBounds const& b = bounds[static_cast<gsl::index>(i)];
+    for (int c = 0; c < 3; ++c) {
+      soa_[c][i] = b.boundsMin[c];
+      soa_[3 + c][i] = b.boundsMax[c];
+    }
+  }
+} // InstanceCuller::Assign
+
+InstanceCullStats
+InstanceCuller::CullScalar(Frustum const& frustum,
+                           std::vector<std::uint32_t>& visible) const {
+  visible.clear();
+  auto const& planes = frustum.Planes();
+
+  for (std::size_t i = 0; i < count_; ++i) {
+    bool inside = true;
+    for (auto&& plane : planes) {
+      // The box corner furthest along the plane normal.
+      float const x = soa_[plane.normal[0] >= 0.f ? 3 : 0][i];
+      float const y = soa_[plane.normal[1] >= 0.f ? 4 : 1][i];
+      float const z = soa_[plane.normal[2] >= 0.f ? 5 : 2][i];
+      float const d = plane.normal[0] * x + plane.normal[1] * y +
+                      plane.normal[2] * z + plane.distance;
+      inside = inside && !(d < 0.f);
+    }
+    if (inside) visible.push_back(static_cast<std::uint32_t>(i));
+  }
+
+  return {count_, visible.size()};
+} // InstanceCuller::CullScalar
+
+InstanceCullStats
+InstanceCuller::Cull(Frustum const& frustum,
+                     std::vector<std::uint32_t>& visible) const {
+#ifdef INSTANCE_CULLING_USE_SSE2
+  visible.clear();
+
+  // Per plane, the normal, distance and the arrays holding the corner
+  // furthest along the normal; the same for all instances.
+  struct Plane {
+    __m128 n[3];
+    __m128 d;
+    float const* corner[3];
+  };
+  Plane planes[Frustum::kPlaneCount];
+  for (std::size_t p = 0; p < Frustum::kPlaneCount; ++p) {
+    FrustumPlane const& plane = frustum.Planes()[p];
+    for (int c = 0; c < 3; ++c) {
+      planes[p].n[c] = _mm_set1_ps(plane.normal[c]);
+      planes[p].corner[c] =
+        soa_[plane.normal[c] >= 0.f ? 3 + c : c].data();
+    }
+    planes[p].d = _mm_set1_ps(plane.distance);
+  }
+
+  __m128 const zero = _mm_setzero_ps();
+
+  for (std::size_t i = 0; i < count_; i += 4) {
+    __m128 outside = zero;
+    for (auto&& plane : planes) {
+      __m128 d = _mm_mul_ps(plane.n[0], _mm_loadu_ps(plane.corner[0] + i));
+      d = _mm_add_ps(d, _mm_mul_ps(plane.n[1],
+                                   _mm_loadu_ps(plane.corner[1] + i)));
+      d = _mm_add_ps(d, _mm_mul_ps(plane.n[2],
+                                   _mm_loadu_ps(plane.corner[2] + i)));
+      d = _mm_add_ps(d, plane.d);
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(d, zero));
+    }
+
+    int mask = ~_mm_movemask_ps(outside) & 0xF;
+    // Padding lanes past the last instance.
+    if (count_ - i < 4) mask &= (1 << (count_ - i)) - 1;
+
+    while (mask != 0) {
+      int lane = 0;
+      while ((mask & (1 << lane)) == 0) ++lane;
+      visible.push_back(static_cast<std::uint32_t>(i + lane));
+      mask &= mask - 1;
+    }
+  }
+
+  return {count_, visible.size()};
+#else
+  return CullScalar(frustum, visible);
+#endif
+} // InstanceCuller::Cull
@@ -0,0 +1,60 @@
+#ifndef INSTANCE_CULLING_HPP_
+#define INSTANCE_CULLING_HPP_
+
+#include "frustum.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <cstdint>
+#include <vector>
+
+// World space bounds of a top level acceleration structure instance.
+struct InstanceBounds {
+  float boundsMin[3];
+  float boundsMax[3];
+}; // struct InstanceBounds
+
+// Bounds of a box after a 3x4 row-major transform, in the layout of
+// VkGeometryInstanceNV's transform.
+[[nodiscard]] InstanceBounds
+TransformBounds(float const (&transform)[3][4], float const (&boxMin)[3],
+                float const (&boxMax)[3]) noexcept;
+
+struct InstanceCullStats {
+  std::uint64_t tested{0};
+  std::uint64_t visible{0};
+
+  [[nodiscard]] double CulledFraction() const noexcept {
+    return tested > 0 ? 1.0 - static_cast<double>(visible) / tested : 0.0;
+  }
+}; // struct InstanceCullStats
+
+//
+// Frustum culling of instance bounds ahead of a TLAS build. The bounds are
+// assigned once, when the instances change, and stored as structure of
+// arrays so Cull tests four instances per plane with SSE2 where available.
+// CullScalar is the reference it is validated against; both do the same
+// arithmetic in the same order so they agree exactly.
+//
+// Rays other than primary rays (reflections, shadows) can hit instances
+// outside the view, so callers cull against Frustum::Expanded(margin) to
+// keep instances near the frustum as well.
+//
+class InstanceCuller {
+public:
+  void Assign(gsl::span<InstanceBounds const> bounds);
+
+  [[nodiscard]] std::size_t size() const noexcept { return count_; }
+
+  // Replace visible with the indices, ascending, of the instances whose
+  // bounds intersect frustum.
+  InstanceCullStats Cull(Frustum const& frustum,
+                         std::vector<std::uint32_t>& visible) const;
+  InstanceCullStats CullScalar(Frustum const& frustum,
+                               std::vector<std::uint32_t>& visible) const;
+
+private:
+  // minX, minY, minZ, maxX, maxY, maxZ, each padded to a multiple of four.
+  std::vector<float> soa_[6]{};
+  std::size_t count_{0};
+}; // class InstanceCuller
+
+#endif // INSTANCE_CULLING_HPP_
@@ -0,0 +1,276 @@
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+static std::system_error LastError(char const* what) {
+  return std::system_error(
+    std::error_code(static_cast<int>(GetLastError()), std::system_category()),
+    what);
+} // LastError
+
+tl::expected<MappedFile, std::system_error>
+MappedFile::Open(gsl::czstring path) noexcept {
+  Expects(path != nullptr);
+
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return tl::unexpected(LastError("CreateFileA"));
+  }
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    auto error = LastError("GetFileSizeEx");
+    CloseHandle(file);
+    return tl::unexpected(error);
+  }
+
+  MappedFile mapped;
+  if (size.QuadPart == 0) {
+    CloseHandle(file);
+    return mapped;
+  }
+
+  HANDLE mapping =
+    CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
+    return tl::unexpected(LastError("CreateFileMappingA"));
+  }
+
+  void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr) {
+    auto error = LastError("MapViewOfFile");
+    CloseHandle(mapping);
+    return tl::unexpected(error);
+  }
+
+  mapped.data_ = static_cast<std::byte const*>(data);
+  mapped.size_ = static_cast<std::size_t>(size.QuadPart);
+  mapped.mapping_ = mapping;
+  return mapped;
+} // MappedFile::Open
+
+void MappedFile::Close() noexcept {
+  if (data_ != nullptr) UnmapViewOfFile(data_);
+  if (mapping_ != nullptr) CloseHandle(mapping_);
+  data_ = nullptr;
+  size_ = 0;
+  mapping_ = nullptr;
+} // MappedFile::Close
+
+void MappedFile::AdviseSequential() const noexcept {
+  if (data_ == nullptr) return;
+  WIN32_MEMORY_RANGE_ENTRY range = {const_cast<std::byte*>(data_), size_};
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+} // MappedFile::AdviseSequential
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    mapping_ = std::exchange(other.mapping_, nullptr);
+  }
+  return *this;
+} // MappedFile::operator=
+
+tl::expected<RandomAccessFile, std::system_error>
+RandomAccessFile::Open(gsl::czstring path) noexcept {
+  Expects(path != nullptr);
+
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return tl::unexpected(LastError("CreateFileA"));
+  }
+
+  RandomAccessFile file;
+  file.handle_ = handle;
+  return file;
+} // RandomAccessFile::Open
+
+void RandomAccessFile::Close() noexcept {
+  if (handle_ != nullptr) CloseHandle(handle_);
+  handle_ = nullptr;
+} // RandomAccessFile::Close
+
+tl::expected<void, std::system_error>
+RandomAccessFile::ReadAt(std::uint64_t offset,
+                         gsl::span<std::byte> buffer) const noexcept {
+  Expects(handle_ != nullptr);
+
+  auto* data = buffer.data();
+  auto remaining = static_cast<std::uint64_t>(buffer.size());
+  while (remaining > 0) {
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD const request =
+      static_cast<DWORD>(std::min<std::uint64_t>(remaining, 1u << 30));
+    DWORD read = 0;
+    if (!ReadFile(handle_, data, request, &read, &overlapped)) {
+      return tl::unexpected(LastError("ReadFile"));
+    }
+    if (read == 0) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::io_error), "ReadFile: end of file"));
+    }
+
+    data += read;
+    offset += read;
+    remaining -= read;
+  }
+  return {};
+} // RandomAccessFile::ReadAt
+
+RandomAccessFile&
+RandomAccessFile::operator=(RandomAccessFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    handle_ = std::exchange(other.handle_, nullptr);
+  }
+  return *this;
+} // RandomAccessFile::operator=
+
+#else
+
+static std::system_error LastError(char const* what) {
+  return std::system_error(std::error_code(errno, std::generic_category()),
+                           what);
+} // LastError
+
+tl::expected<MappedFile, std::system_error>
+MappedFile::Open(gsl::czstring path) noexcept {
+  Expects(path != nullptr);
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return tl::unexpected(LastError("open"));
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    auto error = LastError("fstat");
+    ::close(fd);
+    return tl::unexpected(error);
+  }
+
+  MappedFile mapped;
+  if (st.st_size == 0) {
+    ::close(fd);
+    return mapped;
+  }
+
+  auto const size = static_cast<std::size_t>(st.st_size);
+  void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file referenced.
+  ::close(fd);
+  if (data == MAP_FAILED) return tl::unexpected(LastError("mmap"));
+
+  mapped.data_ = static_cast<std::byte const*>(data);
+  mapped.size_ = size;
+  return mapped;
+} // MappedFile::Open
+
+void MappedFile::Close() noexcept {
+  if (data_ != nullptr) {
+    ::munmap(const_cast<std::byte*>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+} // MappedFile::Close
+
+void MappedFile::AdviseSequential() const noexcept {
+  if (data_ == nullptr) return;
+  ::madvise(const_cast<std::byte*>(data_), size_, MADV_SEQUENTIAL);
+  ::madvise(const_cast<std::byte*>(data_), size_, MADV_WILLNEED);
+} // MappedFile::AdviseSequential
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    data_ = std::exchange(other.data_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+} // MappedFile::operator=
+
+tl::expected<RandomAccessFile, std::system_error>
+RandomAccessFile::Open(gsl::czstring path) noexcept {
+  Expects(path != nullptr);
+
+  int fd = ::open(path, O_RDONLY);
+  if (fd < 0) return tl::unexpected(LastError("open"));
+
+  RandomAccessFile file;
+  file.fd_ = fd;
+  return file;
+} // RandomAccessFile::Open
+
+void RandomAccessFile::Close() noexcept {
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+} // RandomAccessFile::Close
+
+tl::expected<void, std::system_error>
+RandomAccessFile::ReadAt(std::uint64_t offset,
+                         gsl::span<std::byte> buffer) const noexcept {
+  Expects(fd_ >= 0);
+
+  auto* data = buffer.data();
+  auto remaining = static_cast<std::size_t>(buffer.size());
+  while (remaining > 0) {
+    ssize_t const read =
+      ::pread(fd_, data, remaining, static_cast<off_t>(offset));
+    if (read < 0) {
+      if (errno == EINTR) continue;
+      return tl::unexpected(LastError("pread"));
+    }
+    if (read == 0) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::io_error), "pread: end of file"));
+    }
+
+    data += read;
+    offset += static_cast<std::uint64_t>(read);
+    remaining -= static_cast<std::size_t>(read);
+  }
+  return {};
+} // RandomAccessFile::ReadAt
+
+RandomAccessFile&
+RandomAccessFile::operator=(RandomAccessFile&& other) noexcept {
+  if (this != &other) {
+    Close();
+    fd_ = std::exchange(other.fd_, -1);
+  }
+  return *this;
+} // RandomAccessFile::operator=
+
+#endif // _WIN32
+
+bool WriteFileAt(std::FILE* file, std::uint64_t offset, void const* data,
+                 std::size_t size) noexcept {
+  Expects(file != nullptr);
+  if (size == 0) return true;
+#ifdef _WIN32
+  int const seek = _fseeki64(file, static_cast<long long>(offset), SEEK_SET);
+#else
+  int const seek = fseeko(file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+  return seek == 0 && std::fwrite(data, 1, size, file) == size;
+} // WriteFileAt
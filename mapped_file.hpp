@@ -0,0 +1,87 @@
+#ifndef MAPPED_FILE_HPP_
+#define MAPPED_FILE_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <system_error>
+
+//
+// A read-only memory mapping of a whole file. Pages are faulted in on first
+// touch, so opening a file costs the same regardless of its size and data
+// can be copied straight from the mapping to its destination.
+//
+class MappedFile {
+public:
+  [[nodiscard]] static tl::expected<MappedFile, std::system_error>
+  Open(gsl::czstring path) noexcept;
+
+  MappedFile() noexcept = default;
+  MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(MappedFile const&) = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+  ~MappedFile() noexcept { Close(); }
+
+  void Close() noexcept;
+
+  // Tell the OS the mapping will be read front to back so it reads ahead.
+  void AdviseSequential() const noexcept;
+
+  [[nodiscard]] std::byte const* data() const noexcept { return data_; }
+  [[nodiscard]] std::size_t size() const noexcept { return size_; }
+  [[nodiscard]] bool empty() const noexcept { return size_ == 0; }
+
+  [[nodiscard]] gsl::span<std::byte const> bytes() const noexcept {
+    return {data_, static_cast<gsl::index>(size_)};
+  }
+
+private:
+  std::byte const* data_{nullptr};
+  std::size_t size_{0};
+#ifdef _WIN32
+  void* mapping_{nullptr};
+#endif
+}; // class MappedFile
+
+//
+// A read-only file read at explicit offsets into caller-owned memory, for
+// data that must not stay in the address space (or page cache mappings)
+// once the caller drops it. ReadAt may be called from several threads.
+//
+class RandomAccessFile {
+public:
+  [[nodiscard]] static tl::expected<RandomAccessFile, std::system_error>
+  Open(gsl::czstring path) noexcept;
+
+  RandomAccessFile() noexcept = default;
+  RandomAccessFile(RandomAccessFile&& other) noexcept {
+    *this = std::move(other);
+  }
+  RandomAccessFile& operator=(RandomAccessFile&& other) noexcept;
+  RandomAccessFile(RandomAccessFile const&) = delete;
+  RandomAccessFile& operator=(RandomAccessFile const&) = delete;
+  ~RandomAccessFile() noexcept { Close(); }
+
+  void Close() noexcept;
+
+  // Fill buffer from offset; short reads are an error.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  ReadAt(std::uint64_t offset, gsl::span<std::byte> buffer) const noexcept;
+
+private:
+#ifdef _WIN32
+  void* handle_{nullptr};
+#else
+  int fd_{-1};
+#endif
+}; // class RandomAccessFile
+
+// fwrite size bytes at offset of a file opened for writing, with 64-bit
+// offsets where fseek's long is 32 bits. Skipped ranges read back as zeros.
+[[nodiscard]] bool WriteFileAt(std::FILE* file, std::uint64_t offset,
+                               void const* data, std::size_t size) noexcept;
+
+#endif // MAPPED_FILE_HPP_
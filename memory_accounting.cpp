@@ -0,0 +1,96 @@
+#include "memory_accounting.hpp"
+#include <cinttypes>
+#include <cstdio>
+
+gsl::czstring to_string(MemoryCategory category) noexcept {
+  switch (category) {
+  case MemoryCategory::kAccelerationStructure: return "AccelerationStructure";
+  case MemoryCategory::kScratch: return "Scratch";
+  case MemoryCategory::kShaderBindingTable: return "ShaderBindingTable";
+  case MemoryCategory::kSpheres: return "Spheres";
+  case MemoryCategory::kMeshes: return "Meshes";
+  case MemoryCategory::kOutputImage: return "OutputImage";
+  case MemoryCategory::kStaging: return "Staging";
+  case MemoryCategory::kUniform: return "Uniform";
+  case MemoryCategory::kSampleTables: return "SampleTables";
+  case MemoryCategory::kHostBVH: return "HostBVH";
+  case MemoryCategory::kHostScene: return "HostScene";
+  case MemoryCategory::kCount: break;
+  }
+  return "Unknown";
+} // to_string
+
+void MemoryAccounting::Allocated(MemoryCategory category,
+                                 std::uint64_t size) noexcept {
+  Expects(category != MemoryCategory::kCount);
+  Add(categories_[static_cast<std::size_t>(category)], size);
+  Add(IsHostCategory(category) ? hostTotal_ : deviceTotal_, size);
+} // MemoryAccounting::Allocated
+
+void MemoryAccounting::Freed(MemoryCategory category,
+                             std::uint64_t size) noexcept {
+  Expects(category != MemoryCategory::kCount);
+  Sub(categories_[static_cast<std::size_t>(category)], size);
+  Sub(IsHostCategory(category) ? hostTotal_ : deviceTotal_, size);
+} // MemoryAccounting::Freed
+
+MemoryAccounting::CategoryStats
+MemoryAccounting::Stats(MemoryCategory category) const noexcept {
+  Expects(category != MemoryCategory::kCount);
+  return Load(categories_[static_cast<std::size_t>(category)]);
+} // MemoryAccounting::Stats
+
+std::string MemoryAccounting::ToJson(gsl::czstring allocatorJson) const {
+  std::string json;
+  char buffer[256];
+
+  auto append = [&](gsl::czstring name, CategoryStats const& stats,
+                    bool last) {
+    std::snprintf(buffer, sizeof(buffer),
+                  "    \"%s\": {\"Current\": %" PRIu64 ", \"Peak\": %" PRIu64
+                  ", \"Allocations\": %" PRIu64 "}%s\n",
+                  name, stats.current, stats.peak, stats.allocationCount,
+                  last ? "" : ",");
+    json += buffer;
+  };
+
+  json += "{\n  \"Categories\": {\n";
+  for (std::size_t i = 0; i < categories_.size(); ++i) {
+    append(to_string(static_cast<MemoryCategory>(i)), Load(categories_[i]),
+           i + 1 == categories_.size());
+  }
+  json += "  },\n  \"Total\": {\n";
+  append("Device", DeviceTotal(), false);
+  append("Host", HostTotal(), true);
+  json += "  }";
+
+  if (allocatorJson) {
+    json += ",\n  \"Allocator\": ";
+    json += allocatorJson;
+  }
+
+  json += "\n}\n";
+  return json;
+} // MemoryAccounting::ToJson
+
+void MemoryAccounting::Add(Counters& counters, std::uint64_t size) noexcept {
+  std::uint64_t const current = counters.current.fetch_add(size) + size;
+  counters.allocationCount.fetch_add(1);
+
+  std::uint64_t peak = counters.peak.load();
+  while (current > peak &&
+         !counters.peak.compare_exchange_weak(peak, current)) {
+  }
+} // MemoryAccounting::Add
+
+void MemoryAccounting::Sub(Counters& counters, std::uint64_t size) noexcept {
+  Expects(counters.current.load() >= size);
+  counters.current.fetch_sub(size);
+  counters.allocationCount.fetch_sub(1);
+} // MemoryAccounting::Sub
+
+MemoryAccounting::CategoryStats
+MemoryAccounting::Load(Counters const& counters) noexcept {
+  return {counters.current.load(), counters.peak.load(),
+          counters.allocationCount.load()};
+} // MemoryAccounting::Load
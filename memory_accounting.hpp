@@ -0,0 +1,82 @@
+#ifndef MEMORY_ACCOUNTING_HPP_
+#define MEMORY_ACCOUNTING_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum class MemoryCategory {
+  kAccelerationStructure,
+  kScratch,
+  kShaderBindingTable,
+  kSpheres,
+  kMeshes,
+  kOutputImage,
+  kStaging,
+  kUniform,
+  kSampleTables,
+  kHostBVH,
+  kHostScene,
+  kCount
+}; // enum class MemoryCategory
+
+[[nodiscard]] gsl::czstring to_string(MemoryCategory category) noexcept;
+
+// True for categories that live in host memory rather than in allocations
+// made through the device allocator.
+[[nodiscard]] constexpr bool IsHostCategory(MemoryCategory category) noexcept {
+  return category == MemoryCategory::kHostBVH ||
+         category == MemoryCategory::kHostScene;
+}
+
+//
+// Per-subsystem byte counts with peaks. Knows nothing about the device so it
+// can be fed from VMA allocations, host containers or a stub device alike.
+// Safe to update from several threads.
+//
+class MemoryAccounting {
+public:
+  struct CategoryStats {
+    std::uint64_t current{0};
+    std::uint64_t peak{0};
+    std::uint64_t allocationCount{0};
+  }; // struct CategoryStats
+
+  void Allocated(MemoryCategory category, std::uint64_t size) noexcept;
+  void Freed(MemoryCategory category, std::uint64_t size) noexcept;
+
+  [[nodiscard]] CategoryStats Stats(MemoryCategory category) const noexcept;
+
+  // Sum of the current and peak bytes of all device or all host categories.
+  // The total peak is tracked as a whole, not summed from category peaks.
+  [[nodiscard]] CategoryStats DeviceTotal() const noexcept {
+    return Load(deviceTotal_);
+  }
+  [[nodiscard]] CategoryStats HostTotal() const noexcept {
+    return Load(hostTotal_);
+  }
+
+  // JSON report of all categories. allocatorJson, if given, is embedded
+  // verbatim as the "Allocator" member (e.g. from vmaBuildStatsString).
+  [[nodiscard]] std::string ToJson(gsl::czstring allocatorJson = nullptr) const;
+
+private:
+  struct Counters {
+    std::atomic<std::uint64_t> current{0};
+    std::atomic<std::uint64_t> peak{0};
+    std::atomic<std::uint64_t> allocationCount{0};
+  }; // struct Counters
+
+  std::array<Counters, static_cast<std::size_t>(MemoryCategory::kCount)>
+    categories_{};
+  Counters deviceTotal_{};
+  Counters hostTotal_{};
+
+  static void Add(Counters& counters, std::uint64_t size) noexcept;
+  static void Sub(Counters& counters, std::uint64_t size) noexcept;
+  static CategoryStats Load(Counters const& counters) noexcept;
+}; // class MemoryAccounting
+
+#endif // MEMORY_ACCOUNTING_HPP_
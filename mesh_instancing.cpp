@@ -0,0 +1,249 @@
+#include "mesh_instancing.hpp"
+#include "bvh_cache.hpp"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESH_INSTANCING_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// SplitMix64 finalizer.
+constexpr std::uint64_t Mix(std::uint64_t x) noexcept {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  return x;
+} // Mix
+
+// One instance of PackInstanceTransforms; the SSE2 path repeats these
+// operations four lanes at a time.
+void PackOne(TransformStream const& stream, std::size_t i,
+             Transform3x4& out) noexcept {
+  float const x = stream.rotation[0][i];
+  float const y = stream.rotation[1][i];
+  float const z = stream.rotation[2][i];
+  float const w = stream.rotation[3][i];
+  float const sx = stream.scale[0][i];
+  float const sy = stream.scale[1][i];
+  float const sz = stream.scale[2][i];
+
+  float const x2 = x + x, y2 = y + y, z2 = z + z;
+  float const xx = x * x2, yy = y * y2, zz = z * z2;
+  float const xy = x * y2, xz = x * z2, yz = y * z2;
+  float const wx = w * x2, wy = w * y2, wz = w * z2;
+
+  out.m[0][0] = (1.f - (yy + zz)) * sx;
+  out.m[0][1] = (xy - wz) * sy;
+  out.m[0][2] = (xz + wy) * sz;
+  out.m[0][3] = stream.translation[0][i];
+  out.m[1][0] = (xy + wz) * sx;
+  out.m[1][1] = (1.f - (xx + zz)) * sy;
+  out.m[1][2] = (yz - wx) * sz;
+  out.m[1][3] = stream.translation[1][i];
+  out.m[2][0] = (xz - wy) * sx;
+  out.m[2][1] = (yz + wx) * sy;
+  out.m[2][2] = (1.f - (xx + yy)) * sz;
+  out.m[2][3] = stream.translation[2][i];
+} // PackOne
+
+} // namespace
+
+Transform3x4 Multiply(Transform3x4 const& a, Transform3x4 const& b) noexcept {
+  Transform3x4 result;
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      result.m[r][c] = a.m[r][0] * b.m[0][c] + a.m[r][1] * b.m[1][c] +
+                       a.m[r][2] * b.m[2][c];
+    }
+    result.m[r][3] += a.m[r][3];
+  }
+  return result;
+} // Multiply
+
+Transform3x4 EncodingTransform(EncodedMesh const& mesh) noexcept {
+  Transform3x4 transform;
+  mesh.Transform(transform.m);
+  return transform;
+} // EncodingTransform
+
+void TransformStream::Reserve(std::size_t count) {
+  for (auto&& component : translation) component.reserve(count);
+  for (auto&& component : rotation) component.reserve(count);
+  for (auto&& component : scale) component.reserve(count);
+} // TransformStream::Reserve
+
+void TransformStream::Clear() noexcept {
+  for (auto&& component : translation) component.clear();
+  for (auto&& component : rotation) component.clear();
+  for (auto&& component : scale) component.clear();
+} // TransformStream::Clear
+
+void TransformStream::Append(float const (&t)[3], float const (&r)[4],
+                             float const (&s)[3]) {
+  for (int c = 0; c < 3; ++c) translation[c].push_back(t[c]);
+  for (int c = 0; c < 4; ++c) rotation[c].push_back(r[c]);
+  for (int c = 0; c < 3; ++c) scale[c].push_back(s[c]);
+} // TransformStream::Append
+
+void PackInstanceTransformsScalar(TransformStream const& stream,
+                                  std::size_t first,
+                                  gsl::span<Transform3x4> output) noexcept {
+  auto const count = static_cast<std::size_t>(output.size());
+  Expects(first + count <= stream.size());
+
+  for (std::size_t i = 0; i < count; ++i) {
+    PackOne(stream, first + i, output[static_cast<gsl::index>(i)]);
+  }
+} // PackInstanceTransformsScalar
+
+void PackInstanceTransforms(TransformStream const& stream, std::size_t first,
+                            gsl::span<Transform3x4> output) noexcept {
+#ifdef MESH_INSTANCING_USE_SSE2
+  auto const count = static_cast<std::size_t>(output.size());
+  Expects(first + count <= stream.size());
+
+  __m128 const one = _mm_set1_ps(1.f);
+  std::size_t i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    std::size_t const j = first + i;
+    __m128 const x = _mm_loadu_ps(stream.rotation[0].data() + j);
+    __m128 const y = _mm_loadu_ps(stream.rotation[1].data() + j);
+    __m128 const z = _mm_loadu_ps(stream.rotation[2].data() + j);
+    __m128 const w = _mm_loadu_ps(stream.rotation[3].data() + j);
+    __m128 const sx = _mm_loadu_ps(stream.scale[0].data() + j);
+    __m128 const sy = _mm_loadu_ps(stream.scale[1].data() + j);
+    __m128 const sz = _mm_loadu_ps(stream.scale[2].data() + j);
+
+    __m128 const x2 = _mm_add_ps(x, x);
+    __m128 const y2 = _mm_add_ps(y, y);
+    __m128 const z2 = _mm_add_ps(z, z);
+    __m128 const xx = _mm_mul_ps(x, x2);
+    __m128 const yy = _mm_mul_ps(y, y2);
+    __m128 const zz = _mm_mul_ps(z, z2);
+    __m128 const xy = _mm_mul_ps(x, y2);
+    __m128 const xz = _mm_mul_ps(x, z2);
+    __m128 const yz = _mm_mul_ps(y, z2);
+    __m128 const wx = _mm_mul_ps(w, x2);
+    __m128 const wy = _mm_mul_ps(w, y2);
+    __m128 const wz = _mm_mul_ps(w, z2);
+
+    // Element (r, c) of four instances, one per lane.
+    __m128 m[3][4];
+    m[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    m[0][1] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+    m[0][2] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+    m[0][3] = _mm_loadu_ps(stream.translation[0].data() + j);
+    m[1][0] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+    m[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    m[1][2] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+    m[1][3] = _mm_loadu_ps(stream.translation[1].data() + j);
+    m[2][0] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+    m[2][1] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+    m[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+    m[2][3] = _mm_loadu_ps(stream.translation[2].data() + j);
+
+    // Transposing the four elements of a row gives that row of each of the
+    // four instances.
+    for (int r = 0; r < 3; ++r) {
+      _MM_TRANSPOSE4_PS(m[r][0], m[r][1], m[r][2], m[r][3]);
+      for (int lane = 0; lane < 4; ++lane) {
+        _mm_storeu_ps(output[static_cast<gsl::index>(i + lane)].m[r],
+                      m[r][lane]);
+      }
+    }
+  }
+
+  for (; i < count; ++i) {
+    PackOne(stream, first + i, output[static_cast<gsl::index>(i)]);
+  }
+#else
+  PackInstanceTransformsScalar(stream, first, output);
+#endif
+} // PackInstanceTransforms
+
+void AppendInstanceGrid(TransformStream& stream, std::uint64_t count,
+                        float const (&pivot)[3], float spacing,
+                        std::uint64_t seed) {
+  auto const side = static_cast<std::uint64_t>(
+    std::ceil(std::sqrt(static_cast<double>(count))));
+  float const half = .5f * static_cast<float>(side > 0 ? side - 1 : 0);
+  float const scale[3] = {1.f, 1.f, 1.f};
+
+  stream.Reserve(stream.size() + static_cast<std::size_t>(count));
+  for (std::uint64_t k = 0; k < count; ++k) {
+    float const angle =
+      k == 0 ? 0.f
+             : 6.2831853f * static_cast<float>(Mix(Mix(seed) ^ k) >> 40) *
+                 (1.f / 16777216.f);
+    float const c = std::cos(angle);
+    float const s = std::sin(angle);
+    float const rotation[4] = {0.f, std::sin(.5f * angle), 0.f,
+                               std::cos(.5f * angle)};
+
+    // Turn about the vertical axis through pivot, then move to the cell.
+    float const dx = (static_cast<float>(k % side) - half) * spacing;
+    float const dz = (static_cast<float>(k / side) - half) * spacing;
+    float const translation[3] = {
+      pivot[0] - (c * pivot[0] + s * pivot[2]) + dx, 0.f,
+      pivot[2] - (c * pivot[2] - s * pivot[0]) + dz};
+
+    stream.Append(translation, rotation, scale);
+  }
+} // AppendInstanceGrid
+
+std::uint64_t HashMesh(EncodedMesh const& mesh) noexcept {
+  std::uint64_t const seed =
+    static_cast<std::uint64_t>(mesh.format) << 1 | (mesh.index16 ? 1 : 0);
+  return HashBytes(mesh.indices, HashBytes(mesh.vertices, seed));
+} // HashMesh
+
+MeshLibrary::AddResult MeshLibrary::Add(EncodedMesh mesh) {
+  ++addCount_;
+  std::uint64_t const hash = HashMesh(mesh);
+
+  auto const [begin, end] = byHash_.equal_range(hash);
+  for (auto it = begin; it != end; ++it) {
+    EncodedMesh const& other = meshes_[it->second];
+    Expects(other.vertices.size() == other.vertexCount * other.vertexStride);
+    if (other.format == mesh.format && other.index16 == mesh.index16 &&
+        other.vertices == mesh.vertices && other.indices == mesh.indices) {
+      return {it->second, false};
+    }
+  }
+
+  auto const id = gsl::narrow<std::uint32_t>(meshes_.size());
+  meshes_.push_back(std::move(mesh));
+  byHash_.emplace(hash, id);
+  return {id, true};
+} // MeshLibrary::Add
+
+void MeshLibrary::ReleaseGeometry() noexcept {
+  for (auto&& mesh : meshes_) {
+    std::vector<std::byte>().swap(mesh.vertices);
+    std::vector<std::byte>().swap(mesh.indices);
+    std::vector<std::uint32_t>().swap(mesh.normals);
+  }
+} // MeshLibrary::ReleaseGeometry
+
+InstancingStats
+ComputeInstancingStats(MeshLibrary const& library,
+                       gsl::span<std::uint32_t const> instanceMeshes,
+                       gsl::span<std::uint64_t const> meshBytes) noexcept {
+  Expects(static_cast<std::size_t>(meshBytes.size()) == library.size());
+
+  InstancingStats stats;
+  stats.meshesAdded = library.AddCount();
+  stats.uniqueMeshes = library.size();
+  stats.instances = static_cast<std::uint64_t>(instanceMeshes.size());
+  for (auto bytes : meshBytes) stats.sharedBytes += bytes;
+  for (auto id : instanceMeshes) stats.flattenedBytes += meshBytes[id];
+  return stats;
+} // ComputeInstancingStats
@@ -0,0 +1,138 @@
+#ifndef MESH_INSTANCING_HPP_
+#define MESH_INSTANCING_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include "triangle_mesh.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+//
+// Instancing: many TLAS instances referencing one BLAS per distinct piece
+// of geometry, instead of a copy of the geometry (and its BLAS) for every
+// placement.
+//
+// MeshLibrary deduplicates meshes as they are added: a mesh whose content
+// hash and bytes match one already in the library gets that mesh's id, so
+// loading the same geometry twice costs one BLAS. Instances are then a mesh
+// id and a transform each; the transforms are kept as a TransformStream,
+// structure of arrays, and packed to the 3x4 row-major matrices
+// VkGeometryInstanceNV takes when the TLAS instances are written.
+//
+
+// A 3x4 row-major affine transform, the layout of VkGeometryInstanceNV's
+// transform.
+struct Transform3x4 {
+  float m[3][4];
+}; // struct Transform3x4
+
+inline constexpr Transform3x4 kIdentityTransform = {
+  {{1.f, 0.f, 0.f, 0.f}, {0.f, 1.f, 0.f, 0.f}, {0.f, 0.f, 1.f, 0.f}}};
+
+// a applied after b.
+[[nodiscard]] Transform3x4 Multiply(Transform3x4 const& a,
+                                    Transform3x4 const& b) noexcept;
+
+// The transform from a mesh's encoded vertices to its loaded positions.
+[[nodiscard]] Transform3x4 EncodingTransform(EncodedMesh const& mesh) noexcept;
+
+//
+// Instance transforms as translation, rotation (a unit quaternion, xyzw)
+// and per-axis scale, one array per component. This is the form animation
+// and placement code produces and updates; scale is applied first, then
+// rotation, then translation.
+//
+struct TransformStream {
+  std::vector<float> translation[3];
+  std::vector<float> rotation[4];
+  std::vector<float> scale[3];
+
+  [[nodiscard]] std::size_t size() const noexcept {
+    return translation[0].size();
+  }
+
+  void Reserve(std::size_t count);
+  void Clear() noexcept;
+  void Append(float const (&t)[3], float const (&r)[4],
+              float const (&s)[3]);
+}; // struct TransformStream
+
+// Pack stream[first, first + output.size()) into output. Four instances are
+// packed at a time with SSE2 where available; PackInstanceTransformsScalar
+// is the reference and does the same arithmetic in the same order, so the
+// two agree exactly.
+void PackInstanceTransforms(TransformStream const& stream, std::size_t first,
+                            gsl::span<Transform3x4> output) noexcept;
+void PackInstanceTransformsScalar(TransformStream const& stream,
+                                  std::size_t first,
+                                  gsl::span<Transform3x4> output) noexcept;
+
+// Append count instances of a mesh on a square grid in the xz plane,
+// spacing apart and centered on where the mesh was loaded. Each is turned
+// about the vertical axis through pivot by an angle drawn from seed, except
+// the first, so a grid of one is the identity.
+void AppendInstanceGrid(TransformStream& stream, std::uint64_t count,
+                        float const (&pivot)[3], float spacing,
+                        std::uint64_t seed);
+
+class MeshLibrary {
+public:
+  struct AddResult {
+    std::uint32_t id;
+    bool added; // false if an identical mesh was already in the library
+  };
+
+  // Meshes are compared by format, vertex and index bytes; normals, bounds
+  // and the encoding transform follow from those. Comparing reads both
+  // meshes' bytes, so meshes must not be added after ReleaseGeometry.
+  AddResult Add(EncodedMesh mesh);
+
+  [[nodiscard]] std::size_t size() const noexcept { return meshes_.size(); }
+  [[nodiscard]] std::uint64_t AddCount() const noexcept { return addCount_; }
+
+  [[nodiscard]] EncodedMesh const& operator[](std::uint32_t id) const {
+    return meshes_[id];
+  }
+
+  // Drop the host copy of every mesh's geometry once it is on the GPU,
+  // keeping the counts, bounds and encoding transforms.
+  void ReleaseGeometry() noexcept;
+
+private:
+  std::vector<EncodedMesh> meshes_{};
+  std::unordered_multimap<std::uint64_t, std::uint32_t> byHash_{};
+  std::uint64_t addCount_{0};
+}; // class MeshLibrary
+
+[[nodiscard]] std::uint64_t HashMesh(EncodedMesh const& mesh) noexcept;
+
+// Memory of the instanced scene against the same scene flattened, with a
+// copy of the geometry for every instance, for any per-mesh measure of
+// size: BLAS bytes on the GPU, or encoded geometry bytes.
+struct InstancingStats {
+  std::uint64_t meshesAdded{0};
+  std::uint64_t uniqueMeshes{0};
+  std::uint64_t instances{0};
+  std::uint64_t sharedBytes{0};
+  std::uint64_t flattenedBytes{0};
+
+  [[nodiscard]] std::uint64_t SavedBytes() const noexcept {
+    return flattenedBytes > sharedBytes ? flattenedBytes - sharedBytes : 0;
+  }
+
+  [[nodiscard]] double SavedFraction() const noexcept {
+    return flattenedBytes > 0
+             ? static_cast<double>(SavedBytes()) / flattenedBytes
+             : 0.0;
+  }
+}; // struct InstancingStats
+
+// instanceMeshes holds each instance's mesh id and meshBytes each mesh's
+// size, indexed by id. Meshes no instance uses count as shared all the same.
+[[nodiscard]] InstancingStats
+ComputeInstancingStats(MeshLibrary const& library,
+                       gsl::span<std::uint32_t const> instanceMeshes,
+                       gsl::span<std::uint64_t const> meshBytes) noexcept;
+
+#endif // MESH_INSTANCING_HPP_
@@ -0,0 +1,463 @@
+#include "message_socket.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Bytes read from the socket per call.
+constexpr std::size_t kReadSize = std::size_t{1} << 16;
+
+std::system_error ErrnoError(char const* what) {
+  return std::system_error(std::error_code(errno, std::generic_category()),
+                           what);
+} // ErrnoError
+
+std::system_error InvalidAddress(gsl::czstring text) {
+  return std::system_error(std::make_error_code(std::errc::invalid_argument),
+                           std::string("invalid socket address ") + text);
+} // InvalidAddress
+
+#ifdef _WIN32
+
+std::system_error NotSupported() {
+  return std::system_error(
+    std::make_error_code(std::errc::function_not_supported), "sockets");
+} // NotSupported
+
+#else
+
+// A socket address in the form bind and connect take.
+struct NativeAddress {
+  sockaddr_storage storage{};
+  socklen_t length{0};
+
+  [[nodiscard]] sockaddr const* get() const noexcept {
+    return reinterpret_cast<sockaddr const*>(&storage);
+  }
+}; // struct NativeAddress
+
+tl::expected<NativeAddress, std::system_error>
+ToNative(SocketAddress const& address) noexcept {
+  NativeAddress native;
+  if (address.kind == SocketAddress::Kind::kUnix) {
+    auto* const un = reinterpret_cast<sockaddr_un*>(&native.storage);
+    if (address.path.empty() || address.path.size() >= sizeof(un->sun_path)) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::filename_too_long), address.path));
+    }
+    un->sun_family = AF_UNIX;
+    std::copy(address.path.begin(), address.path.end(), un->sun_path);
+    native.length = sizeof(sockaddr_un);
+  } else {
+    auto* const in = reinterpret_cast<sockaddr_in*>(&native.storage);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(address.ipv4);
+    in->sin_port = htons(address.port);
+    native.length = sizeof(sockaddr_in);
+  }
+  return native;
+} // ToNative
+
+// A socket that is not inherited by processes this one starts, so workers
+// started by a coordinator hold no copies of its connections.
+tl::expected<int, std::system_error> OpenSocket(int family) noexcept {
+  int const fd = ::socket(family, SOCK_STREAM, 0);
+  if (fd < 0) return tl::unexpected(ErrnoError("socket"));
+  if (::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+    auto error = ErrnoError("fcntl");
+    ::close(fd);
+    return tl::unexpected(error);
+  }
+#ifdef SO_NOSIGPIPE
+  int const one = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  return fd;
+} // OpenSocket
+
+// Messages are small and answered at once; don't hold them back.
+void DisableNagle(int fd) noexcept {
+  int const one = 1;
+  ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+} // DisableNagle
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+#endif // _WIN32
+
+} // namespace
+
+tl::expected<SocketAddress, std::system_error>
+ParseSocketAddress(gsl::czstring text) noexcept {
+  Expects(text != nullptr);
+
+  try {
+    std::string const address(text);
+    SocketAddress result;
+
+    if (address.rfind("unix:", 0) == 0) {
+      result.kind = SocketAddress::Kind::kUnix;
+      result.path = address.substr(5);
+      if (result.path.empty()) return tl::unexpected(InvalidAddress(text));
+      return result;
+    }
+    if (address.rfind("tcp:", 0) != 0) {
+      return tl::unexpected(InvalidAddress(text));
+    }
+
+    result.kind = SocketAddress::Kind::kTcp;
+    result.ipv4 = 0x7F00'0001; // 127.0.0.1
+    std::string port = address.substr(4);
+    if (auto const colon = port.rfind(':'); colon != std::string::npos) {
+      std::uint32_t octets[4];
+      char end;
+      if (std::sscanf(port.substr(0, colon).c_str(), "%u.%u.%u.%u%c",
+                      &octets[0], &octets[1], &octets[2], &octets[3],
+                      &end) != 4 ||
+          std::any_of(octets, octets + 4, [](auto o) { return o > 255; })) {
+        return tl::unexpected(InvalidAddress(text));
+      }
+      result.ipv4 =
+        octets[0] << 24 | octets[1] << 16 | octets[2] << 8 | octets[3];
+      port = port.substr(colon + 1);
+    }
+
+    char* end = nullptr;
+    unsigned long const value = std::strtoul(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || value == 0 || value > 65535) {
+      return tl::unexpected(InvalidAddress(text));
+    }
+    result.port = static_cast<std::uint16_t>(value);
+    return result;
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), text));
+  }
+} // ParseSocketAddress
+
+std::string to_string(SocketAddress const& address) {
+  if (address.kind == SocketAddress::Kind::kUnix) return "unix:" + address.path;
+  return "tcp:" + std::to_string(address.ipv4 >> 24) + "." +
+         std::to_string(address.ipv4 >> 16 & 0xFF) + "." +
+         std::to_string(address.ipv4 >> 8 & 0xFF) + "." +
+         std::to_string(address.ipv4 & 0xFF) + ":" +
+         std::to_string(address.port);
+} // to_string
+
+MessageSocket& MessageSocket::operator=(MessageSocket&& other) noexcept {
+  if (this != &other) {
+    Close();
+    fd_ = std::exchange(other.fd_, -1);
+    unlinkPath_ = std::move(other.unlinkPath_);
+    received_ = std::move(other.received_);
+    receivedBegin_ = std::exchange(other.receivedBegin_, 0);
+    other.unlinkPath_.clear();
+    other.received_.clear();
+  }
+  return *this;
+} // MessageSocket::operator=
+
+#ifdef _WIN32
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Listen(SocketAddress const&) noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Connect(SocketAddress const&) noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+void MessageSocket::Close() noexcept {}
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Accept() const noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+tl::expected<void, std::system_error>
+MessageSocket::Send(std::uint32_t, gsl::span<std::byte const>) const noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+tl::expected<MessageSocket::ReadStatus, std::system_error>
+MessageSocket::Read(bool) noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+#else
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Listen(SocketAddress const& address) noexcept {
+  auto native = ToNative(address);
+  if (!native) return tl::unexpected(native.error());
+
+  bool const isUnix = address.kind == SocketAddress::Kind::kUnix;
+  auto fd = OpenSocket(isUnix ? AF_UNIX : AF_INET);
+  if (!fd) return tl::unexpected(fd.error());
+
+  MessageSocket socket;
+  socket.fd_ = *fd;
+
+  if (isUnix) {
+    ::unlink(address.path.c_str());
+  } else {
+    int const one = 1;
+    ::setsockopt(socket.fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  }
+
+  if (::bind(socket.fd_, native->get(), native->length) != 0) {
+    return tl::unexpected(ErrnoError("bind"));
+  }
+  if (isUnix) socket.unlinkPath_ = address.path;
+  if (::listen(socket.fd_, SOMAXCONN) != 0) {
+    return tl::unexpected(ErrnoError("listen"));
+  }
+  return socket;
+} // MessageSocket::Listen
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Connect(SocketAddress const& address) noexcept {
+  auto native = ToNative(address);
+  if (!native) return tl::unexpected(native.error());
+
+  bool const isUnix = address.kind == SocketAddress::Kind::kUnix;
+  auto fd = OpenSocket(isUnix ? AF_UNIX : AF_INET);
+  if (!fd) return tl::unexpected(fd.error());
+
+  MessageSocket socket;
+  socket.fd_ = *fd;
+
+  int result;
+  do {
+    result = ::connect(socket.fd_, native->get(), native->length);
+  } while (result != 0 && errno == EINTR);
+  if (result != 0) return tl::unexpected(ErrnoError("connect"));
+
+  if (!isUnix) DisableNagle(socket.fd_);
+  return socket;
+} // MessageSocket::Connect
+
+void MessageSocket::Close() noexcept {
+  if (fd_ >= 0) ::close(fd_);
+  if (!unlinkPath_.empty()) ::unlink(unlinkPath_.c_str());
+  fd_ = -1;
+  unlinkPath_.clear();
+  received_.clear();
+  receivedBegin_ = 0;
+} // MessageSocket::Close
+
+tl::expected<MessageSocket, std::system_error>
+MessageSocket::Accept() const noexcept {
+  Expects(fd_ >= 0);
+
+  int fd;
+  do {
+    fd = ::accept(fd_, nullptr, nullptr);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) return tl::unexpected(ErrnoError("accept"));
+
+  MessageSocket socket;
+  socket.fd_ = fd;
+  if (::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+    return tl::unexpected(ErrnoError("fcntl"));
+  }
+  // Fails, harmlessly, on a Unix-domain socket.
+  DisableNagle(fd);
+  return socket;
+} // MessageSocket::Accept
+
+tl::expected<void, std::system_error>
+MessageSocket::Send(std::uint32_t type,
+                    gsl::span<std::byte const> payload) const noexcept {
+  Expects(fd_ >= 0);
+  Expects(static_cast<std::size_t>(payload.size()) <= kMaxMessageSize);
+
+  MessageHeader header;
+  header.type = type;
+  header.size = static_cast<std::uint32_t>(payload.size());
+
+  // Header and payload in one call, so a small message is one segment.
+  iovec parts[2] = {
+    {&header, sizeof(header)},
+    {const_cast<std::byte*>(payload.data()),
+     static_cast<std::size_t>(payload.size())}};
+  iovec* part = parts;
+  int partCount = payload.empty() ? 1 : 2;
+
+  while (partCount > 0) {
+    msghdr message{};
+    message.msg_iov = part;
+    message.msg_iovlen = static_cast<decltype(message.msg_iovlen)>(partCount);
+
+    ssize_t const sent = ::sendmsg(fd_, &message, kSendFlags);
+    if (sent < 0) {
+      if (errno == EINTR) continue;
+      return tl::unexpected(ErrnoError("sendmsg"));
+    }
+
+    auto remaining = static_cast<std::size_t>(sent);
+    while (partCount > 0 && remaining >= part->iov_len) {
+      remaining -= part->iov_len;
+      ++part;
+      --partCount;
+    }
+    if (partCount > 0) {
+      part->iov_base = static_cast<char*>(part->iov_base) + remaining;
+      part->iov_len -= remaining;
+    }
+  }
+  return {};
+} // MessageSocket::Send
+
+tl::expected<MessageSocket::ReadStatus, std::system_error>
+MessageSocket::Read(bool wait) noexcept {
+  Expects(fd_ >= 0);
+
+  try {
+    std::size_t const used = received_.size();
+    received_.resize(used + kReadSize);
+
+    ssize_t count;
+    do {
+      count = ::recv(fd_, received_.data() + used, kReadSize,
+                     wait ? 0 : MSG_DONTWAIT);
+    } while (count < 0 && errno == EINTR);
+
+    received_.resize(used + static_cast<std::size_t>(std::max<ssize_t>(
+                              count, 0)));
+    if (count > 0) return ReadStatus::kRead;
+    if (count == 0) return ReadStatus::kEnd;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return ReadStatus::kWouldBlock;
+    }
+    // A reset connection ends the stream like an orderly close.
+    if (errno == ECONNRESET) return ReadStatus::kEnd;
+    return tl::unexpected(ErrnoError("recv"));
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "recv"));
+  }
+} // MessageSocket::Read
+
+#endif // _WIN32
+
+tl::expected<void, std::system_error>
+MessageSocket::Receive(MessageHeader& header,
+                       std::vector<std::byte>& payload) noexcept {
+  for (;;) {
+    auto taken = TakeMessage(header, payload);
+    if (!taken) return tl::unexpected(taken.error());
+    if (*taken) return {};
+
+    auto status = Read(true);
+    if (!status) return tl::unexpected(status.error());
+    if (*status == ReadStatus::kEnd) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::connection_reset), "recv"));
+    }
+  }
+} // MessageSocket::Receive
+
+tl::expected<bool, std::system_error> MessageSocket::ReadAvailable() noexcept {
+  for (;;) {
+    auto status = Read(false);
+    if (!status) return tl::unexpected(status.error());
+    if (*status == ReadStatus::kWouldBlock) return true;
+    if (*status == ReadStatus::kEnd) return false;
+  }
+} // MessageSocket::ReadAvailable
+
+tl::expected<bool, std::system_error>
+MessageSocket::TakeMessage(MessageHeader& header,
+                           std::vector<std::byte>& payload) noexcept {
+  std::size_t const available = received_.size() - receivedBegin_;
+  if (available < sizeof(MessageHeader)) return false;
+
+  MessageHeader next;
+  std::memcpy(&next, received_.data() + receivedBegin_, sizeof(next));
+  if (next.magic != kMessageMagic || next.size > kMaxMessageSize) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::bad_message), "message header"));
+  }
+  if (available < sizeof(MessageHeader) + next.size) return false;
+
+  try {
+    auto const begin = received_.begin() +
+                       static_cast<std::ptrdiff_t>(receivedBegin_ +
+                                                   sizeof(MessageHeader));
+    payload.assign(begin, begin + next.size);
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "message"));
+  }
+  header = next;
+  receivedBegin_ += sizeof(MessageHeader) + next.size;
+
+  // Drop what has been taken once it is all taken, or once it is most of
+  // the buffer.
+  if (receivedBegin_ == received_.size()) {
+    received_.clear();
+    receivedBegin_ = 0;
+  } else if (receivedBegin_ >= kReadSize &&
+             receivedBegin_ * 2 >= received_.size()) {
+    received_.erase(received_.begin(),
+                    received_.begin() +
+                      static_cast<std::ptrdiff_t>(receivedBegin_));
+    receivedBegin_ = 0;
+  }
+  return true;
+} // MessageSocket::TakeMessage
+
+tl::expected<void, std::system_error>
+WaitReadable(gsl::span<int const> fds, gsl::span<char> readable,
+             int timeoutMs) noexcept {
+  Expects(fds.size() == readable.size());
+#ifdef _WIN32
+  (void)timeoutMs;
+  return tl::unexpected(std::system_error(
+    std::make_error_code(std::errc::function_not_supported), "poll"));
+#else
+  try {
+    std::vector<pollfd> polled(static_cast<std::size_t>(fds.size()));
+    for (std::size_t i = 0; i < polled.size(); ++i) {
+      polled[i] = {fds[static_cast<gsl::index>(i)], POLLIN, 0};
+    }
+
+    int result;
+    do {
+      result = ::poll(polled.data(), static_cast<nfds_t>(polled.size()),
+                      timeoutMs);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) return tl::unexpected(ErrnoError("poll"));
+
+    for (std::size_t i = 0; i < polled.size(); ++i) {
+      readable[static_cast<gsl::index>(i)] = polled[i].revents != 0;
+    }
+    return {};
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "poll"));
+  }
+#endif
+} // WaitReadable
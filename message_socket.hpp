@@ -0,0 +1,150 @@
+#ifndef MESSAGE_SOCKET_HPP_
+#define MESSAGE_SOCKET_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+//
+// Stream sockets carrying length-prefixed messages between processes on
+// one machine or a few, addressed as
+//
+//   unix:<path>           a Unix-domain socket
+//   tcp:<port>            TCP on the loopback interface
+//   tcp:<a.b.c.d>:<port>  TCP on an IPv4 address
+//
+// A message is a MessageHeader followed by size payload bytes. Like the
+// scene file, messages are little-endian structs sent as they are in
+// memory, so both ends must share byte order and struct layout; the magic
+// in every header catches a peer that does not.
+//
+// Received bytes are buffered per socket, so a socket can be read either
+// blocking, one whole message at a time, or as part of a poll() loop, by
+// reading what has arrived and taking the complete messages out of it.
+//
+// POSIX only: on Windows every call fails with function_not_supported.
+//
+
+struct SocketAddress {
+  enum class Kind { kUnix, kTcp };
+
+  Kind kind{Kind::kUnix};
+  std::string path{};      // kUnix
+  std::uint32_t ipv4{0};   // kTcp, host byte order
+  std::uint16_t port{0};   // kTcp
+}; // struct SocketAddress
+
+// Fails with invalid_argument on a malformed address.
+[[nodiscard]] tl::expected<SocketAddress, std::system_error>
+ParseSocketAddress(gsl::czstring text) noexcept;
+
+[[nodiscard]] std::string to_string(SocketAddress const& address);
+
+inline constexpr std::uint32_t kMessageMagic = 0x4753'4D53; // "SMSG"
+// Larger payloads are refused rather than allocated.
+inline constexpr std::uint32_t kMaxMessageSize = std::uint32_t{1} << 28;
+
+struct MessageHeader {
+  std::uint32_t magic{kMessageMagic};
+  std::uint32_t type{0};
+  std::uint32_t size{0}; // payload bytes
+  std::uint32_t reserved{0};
+}; // struct MessageHeader
+
+static_assert(sizeof(MessageHeader) == 16);
+
+class MessageSocket {
+public:
+  // A listening socket. A Unix-domain socket file left at the path by an
+  // earlier process is replaced, and removed again when the socket closes.
+  [[nodiscard]] static tl::expected<MessageSocket, std::system_error>
+  Listen(SocketAddress const& address) noexcept;
+
+  [[nodiscard]] static tl::expected<MessageSocket, std::system_error>
+  Connect(SocketAddress const& address) noexcept;
+
+  MessageSocket() noexcept = default;
+  MessageSocket(MessageSocket&& other) noexcept { *this = std::move(other); }
+  MessageSocket& operator=(MessageSocket&& other) noexcept;
+  MessageSocket(MessageSocket const&) = delete;
+  MessageSocket& operator=(MessageSocket const&) = delete;
+  ~MessageSocket() noexcept { Close(); }
+
+  void Close() noexcept;
+
+  [[nodiscard]] bool IsOpen() const noexcept { return fd_ >= 0; }
+
+  // The descriptor, for poll().
+  [[nodiscard]] int Descriptor() const noexcept { return fd_; }
+
+  // Wait for and accept a connection on a listening socket.
+  [[nodiscard]] tl::expected<MessageSocket, std::system_error>
+  Accept() const noexcept;
+
+  // Send a whole message, blocking until it is written.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Send(std::uint32_t type, gsl::span<std::byte const> payload) const noexcept;
+
+  // A struct as the payload. Containers go to the overload above.
+  template <class T,
+            class = std::enable_if_t<std::is_trivially_copyable_v<T>>>
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Send(std::uint32_t type, T const& payload) const noexcept {
+    return Send(type, gsl::as_bytes(gsl::make_span(&payload, 1)));
+  }
+
+  // Block until a whole message has arrived and take it. Fails with
+  // connection_reset once the peer has closed the connection.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Receive(MessageHeader& header, std::vector<std::byte>& payload) noexcept;
+
+  // Read whatever has arrived without blocking. Returns false once the peer
+  // has closed the connection and nothing more will arrive.
+  [[nodiscard]] tl::expected<bool, std::system_error> ReadAvailable() noexcept;
+
+  // Take the next complete message read so far, if there is one. Fails on
+  // a header that is not a message's.
+  [[nodiscard]] tl::expected<bool, std::system_error>
+  TakeMessage(MessageHeader& header, std::vector<std::byte>& payload) noexcept;
+
+private:
+  enum class ReadStatus { kRead, kWouldBlock, kEnd };
+
+  // One read into the buffer, waiting for data or not.
+  tl::expected<ReadStatus, std::system_error> Read(bool wait) noexcept;
+
+  int fd_{-1};
+  std::string unlinkPath_{};
+  std::vector<std::byte> received_{};
+  std::size_t receivedBegin_{0};
+}; // class MessageSocket
+
+// The struct at the start of a message's payload, or invalid_argument if
+// the message is not of type or too short to hold it.
+template <class T>
+[[nodiscard]] tl::expected<T, std::system_error>
+MessagePayload(MessageHeader const& header,
+               gsl::span<std::byte const> payload, std::uint32_t type) {
+  if (header.type != type ||
+      static_cast<std::size_t>(payload.size()) < sizeof(T)) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::invalid_argument), "unexpected message"));
+  }
+  T value;
+  std::memcpy(&value, payload.data(), sizeof(T));
+  return value;
+} // MessagePayload
+
+// Wait up to timeoutMs, or forever if it is negative, for any of fds to be
+// readable or closed, and flag those in readable.
+[[nodiscard]] tl::expected<void, std::system_error>
+WaitReadable(gsl::span<int const> fds, gsl::span<char> readable,
+             int timeoutMs) noexcept;
+
+#endif // MESSAGE_SOCKET_HPP_
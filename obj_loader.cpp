@@ -0,0 +1,343 @@
+#include "obj_loader.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Below this many bytes per thread, starting threads costs more than it
+// saves.
+constexpr std::size_t kMinBytesPerThread = 1 << 20;
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+           std::chrono::steady_clock::now() - start)
+    .count();
+} // MillisecondsSince
+
+bool IsSpace(char c) noexcept { return c == ' ' || c == '\t'; }
+
+bool IsDigit(char c) noexcept { return c >= '0' && c <= '9'; }
+
+char const* SkipSpace(char const* p, char const* end) noexcept {
+  while (p < end && IsSpace(*p)) ++p;
+  return p;
+}
+
+char const* LineEnd(char const* p, char const* end) noexcept {
+  auto const* newline = static_cast<char const*>(
+    std::memchr(p, '\n', static_cast<std::size_t>(end - p)));
+  return newline != nullptr ? newline : end;
+}
+
+// Start of the line after the one ending at lineEnd.
+char const* NextLine(char const* lineEnd, char const* end) noexcept {
+  return lineEnd < end ? lineEnd + 1 : end;
+}
+
+// A decimal float: up to 19 significant digits are accumulated exactly and
+// scaled by a power of ten once, which is correctly rounded or within an
+// ulp of it for everything an exporter writes, and several times faster
+// than strtof, which also depends on the locale.
+bool ParseFloat(char const*& p, char const* end, float& value) noexcept {
+  static constexpr double kPowersOf10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  char const* s = p;
+  bool const negative = s < end && *s == '-';
+  if (s < end && (*s == '-' || *s == '+')) ++s;
+
+  std::uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any = false;
+
+  for (; s < end && IsDigit(*s); ++s, any = true) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + static_cast<unsigned>(*s - '0');
+      if (mantissa != 0) ++digits;
+    } else {
+      ++exponent;
+    }
+  }
+  if (s < end && *s == '.') {
+    for (++s; s < end && IsDigit(*s); ++s, any = true) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + static_cast<unsigned>(*s - '0');
+        if (mantissa != 0) ++digits;
+        --exponent;
+      }
+    }
+  }
+  if (!any) return false;
+
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    ++s;
+    bool const negativeExponent = s < end && *s == '-';
+    if (s < end && (*s == '-' || *s == '+')) ++s;
+    if (s == end || !IsDigit(*s)) return false;
+    int e = 0;
+    for (; s < end && IsDigit(*s); ++s) {
+      if (e < 10000) e = e * 10 + (*s - '0');
+    }
+    exponent += negativeExponent ? -e : e;
+  }
+
+  auto result = static_cast<double>(mantissa);
+  if (exponent >= 0 && exponent <= 22) {
+    result *= kPowersOf10[exponent];
+  } else if (exponent < 0 && exponent >= -22) {
+    result /= kPowersOf10[-exponent];
+  } else if (mantissa != 0) {
+    result *= std::pow(10.0, exponent);
+  }
+
+  value = static_cast<float>(negative ? -result : result);
+  p = s;
+  return true;
+} // ParseFloat
+
+bool ParseInteger(char const*& p, char const* end,
+                  std::int64_t& value) noexcept {
+  char const* s = p;
+  bool const negative = s < end && *s == '-';
+  if (s < end && (*s == '-' || *s == '+')) ++s;
+  if (s == end || !IsDigit(*s)) return false;
+
+  std::int64_t magnitude = 0;
+  for (; s < end && IsDigit(*s); ++s) {
+    if (magnitude > std::numeric_limits<std::uint32_t>::max()) return false;
+    magnitude = magnitude * 10 + (*s - '0');
+  }
+
+  value = negative ? -magnitude : magnitude;
+  p = s;
+  return true;
+} // ParseInteger
+
+bool IsVertexStatement(char const* p, char const* end) noexcept {
+  return end - p >= 2 && p[0] == 'v' && IsSpace(p[1]);
+}
+
+bool IsFaceStatement(char const* p, char const* end) noexcept {
+  return end - p >= 2 && p[0] == 'f' && IsSpace(p[1]);
+}
+
+struct Range {
+  char const* begin;
+  char const* end;
+
+  // Filled by the counting pass.
+  std::uint64_t lineCount{0};
+  std::uint64_t vertexCount{0};
+
+  // Filled before the parsing pass.
+  std::uint64_t firstLine{0};
+  std::uint64_t firstVertex{0};
+
+  // Filled by the parsing pass.
+  std::vector<std::uint32_t> indices{};
+  std::string error{};
+  std::uint64_t errorLine{0};
+  bool outOfMemory{false};
+}; // struct Range
+
+void Count(Range& range) noexcept {
+  for (char const* line = range.begin; line < range.end;) {
+    char const* const end = LineEnd(line, range.end);
+    if (IsVertexStatement(SkipSpace(line, end), end)) ++range.vertexCount;
+    ++range.lineCount;
+    line = NextLine(end, range.end);
+  }
+} // Count
+
+void Parse(Range& range, std::uint64_t totalVertexCount,
+           gsl::span<float> positions) {
+  std::uint64_t vertex = range.firstVertex;
+  std::uint64_t lineNumber = range.firstLine;
+  std::uint32_t polygon[3];
+
+  auto fail = [&](char const* message) {
+    range.error = message;
+    range.errorLine = lineNumber + 1;
+  };
+
+  for (char const* line = range.begin; line < range.end; ++lineNumber) {
+    char const* end = LineEnd(line, range.end);
+    char const* const next = NextLine(end, range.end);
+    if (end > line && end[-1] == '\r') --end;
+    char const* p = SkipSpace(line, end);
+    line = next;
+
+    if (IsVertexStatement(p, end)) {
+      float* const position = &positions[static_cast<gsl::index>(3 * vertex)];
+      p += 2;
+      for (int c = 0; c < 3; ++c) {
+        p = SkipSpace(p, end);
+        if (!ParseFloat(p, end, position[c])) {
+          return fail("expected three vertex coordinates");
+        }
+      }
+      // An optional w or vertex color follows; neither is used.
+      ++vertex;
+    } else if (IsFaceStatement(p, end)) {
+      std::uint32_t corners = 0;
+      for (p = SkipSpace(p + 2, end); p < end; p = SkipSpace(p, end)) {
+        std::int64_t index;
+        if (!ParseInteger(p, end, index) || index == 0) {
+          return fail("expected a vertex index");
+        }
+        // Negative indices count back from the last vertex defined.
+        std::int64_t const resolved =
+          index > 0 ? index - 1 : static_cast<std::int64_t>(vertex) + index;
+        if (resolved < 0 ||
+            static_cast<std::uint64_t>(resolved) >= totalVertexCount) {
+          return fail("vertex index out of range");
+        }
+        // Skip /texture/normal indices.
+        while (p < end && !IsSpace(*p)) ++p;
+
+        auto const v = static_cast<std::uint32_t>(resolved);
+        if (corners < 2) {
+          polygon[corners] = v;
+        } else {
+          polygon[2] = v;
+          range.indices.insert(range.indices.end(), polygon, polygon + 3);
+          polygon[1] = v;
+        }
+        ++corners;
+      }
+      if (corners < 3) return fail("face with fewer than three vertices");
+    }
+  }
+} // Parse
+
+// Run work(0) .. work(count - 1) on up to count threads.
+template <class Work>
+void RunParallel(std::size_t count, Work work) {
+  if (count == 0) return;
+  std::vector<std::thread> threads;
+  std::size_t t = 1;
+  try {
+    for (; t < count; ++t) threads.emplace_back(work, t);
+  } catch (std::system_error const&) {
+    // Out of threads: do the remaining work here.
+    for (; t < count; ++t) work(t);
+  }
+  work(0);
+  for (auto&& thread : threads) thread.join();
+} // RunParallel
+
+} // namespace
+
+tl::expected<TriangleMesh, std::system_error>
+ParseObj(gsl::span<char const> text, gsl::czstring name,
+         std::uint32_t threadCount, ObjLoadStats* stats) noexcept {
+  auto const start = std::chrono::steady_clock::now();
+  auto const size = static_cast<std::size_t>(text.size());
+
+  std::size_t rangeCount =
+    threadCount > 0 ? threadCount : std::thread::hardware_concurrency();
+  rangeCount = std::clamp<std::size_t>(
+    rangeCount, 1, std::max<std::size_t>(1, size / kMinBytesPerThread));
+
+  try {
+    // Split at the first line boundary after each even split point.
+    std::vector<Range> ranges;
+    char const* const textEnd = text.data() + size;
+    char const* begin = text.data();
+    for (std::size_t i = 1; i <= rangeCount && begin < textEnd; ++i) {
+      char const* end = std::max(begin, text.data() + size * i / rangeCount);
+      if (end < textEnd) end = NextLine(LineEnd(end, textEnd), textEnd);
+      ranges.push_back({begin, end});
+      begin = ranges.back().end;
+    }
+
+    RunParallel(ranges.size(), [&](std::size_t i) { Count(ranges[i]); });
+    double const countMs = MillisecondsSince(start);
+
+    std::uint64_t vertexCount = 0;
+    std::uint64_t lineCount = 0;
+    for (auto&& range : ranges) {
+      range.firstVertex = vertexCount;
+      range.firstLine = lineCount;
+      vertexCount += range.vertexCount;
+      lineCount += range.lineCount;
+    }
+
+    if (vertexCount > std::numeric_limits<std::uint32_t>::max()) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::value_too_large), name));
+    }
+
+    TriangleMesh mesh;
+    mesh.positions.resize(static_cast<std::size_t>(3 * vertexCount));
+
+    RunParallel(ranges.size(), [&](std::size_t i) {
+      try {
+        Parse(ranges[i], vertexCount, mesh.positions);
+      } catch (std::bad_alloc const&) {
+        ranges[i].outOfMemory = true;
+      }
+    });
+
+    std::size_t indexCount = 0;
+    for (auto&& range : ranges) {
+      if (range.outOfMemory) throw std::bad_alloc();
+      if (!range.error.empty()) {
+        return tl::unexpected(std::system_error(
+          std::make_error_code(std::errc::invalid_argument),
+          std::string(name) + ":" + std::to_string(range.errorLine) + ": " +
+            range.error));
+      }
+      indexCount += range.indices.size();
+    }
+
+    mesh.indices.reserve(indexCount);
+    for (auto&& range : ranges) {
+      mesh.indices.insert(mesh.indices.end(), range.indices.begin(),
+                          range.indices.end());
+      std::vector<std::uint32_t>().swap(range.indices);
+    }
+
+    if (stats != nullptr) {
+      stats->bytes = size;
+      stats->threadCount = static_cast<std::uint32_t>(ranges.size());
+      stats->countMs = countMs;
+      stats->totalMs = MillisecondsSince(start);
+      stats->parseMs = stats->totalMs - countMs;
+    }
+
+    return mesh;
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), name));
+  }
+} // ParseObj
+
+tl::expected<TriangleMesh, std::system_error>
+LoadObj(gsl::czstring path, std::uint32_t threadCount,
+        ObjLoadStats* stats) noexcept {
+  auto const start = std::chrono::steady_clock::now();
+
+  auto file = MappedFile::Open(path);
+  if (!file) return tl::unexpected(file.error());
+  file->AdviseSequential();
+
+  gsl::span<char const> const text(
+    reinterpret_cast<char const*>(file->data()),
+    static_cast<gsl::index>(file->size()));
+
+  auto mesh = ParseObj(text, path, threadCount, stats);
+  // Include opening and mapping the file in the throughput.
+  if (mesh && stats != nullptr) stats->totalMs = MillisecondsSince(start);
+  return mesh;
+} // LoadObj
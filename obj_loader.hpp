@@ -0,0 +1,44 @@
+#ifndef OBJ_LOADER_HPP_
+#define OBJ_LOADER_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "triangle_mesh.hpp"
+#include <cstdint>
+#include <system_error>
+
+//
+// Wavefront OBJ geometry: v and f statements, with polygons triangulated
+// as fans. Texture coordinates, normals, groups and materials are skipped.
+//
+// The file is mapped and split at line boundaries into one range per
+// thread. A first pass counts the vertices in each range so every range
+// knows the index of its first vertex; the second pass parses the ranges
+// in parallel, writing positions straight to their final place and
+// resolving negative (relative) face indices on the spot.
+//
+
+struct ObjLoadStats {
+  std::uint64_t bytes{0};
+  std::uint32_t threadCount{0};
+  double countMs{0.0};
+  double parseMs{0.0};
+  double totalMs{0.0};
+
+  [[nodiscard]] double MegabytesPerSecond() const noexcept {
+    return totalMs > 0.0 ? bytes / (totalMs * 1e3) : 0.0;
+  }
+}; // struct ObjLoadStats
+
+// threadCount 0 is std::thread::hardware_concurrency. Parse errors are
+// reported as invalid_argument with the name and line number.
+[[nodiscard]] tl::expected<TriangleMesh, std::system_error>
+ParseObj(gsl::span<char const> text, gsl::czstring name,
+         std::uint32_t threadCount = 0,
+         ObjLoadStats* stats = nullptr) noexcept;
+
+[[nodiscard]] tl::expected<TriangleMesh, std::system_error>
+LoadObj(gsl::czstring path, std::uint32_t threadCount = 0,
+        ObjLoadStats* stats = nullptr) noexcept;
+
+#endif // OBJ_LOADER_HPP_
@@ -0,0 +1,127 @@
+#include "present_barriers.hpp"
+#include <array>
+
+namespace {
+
+VkImageMemoryBarrier ImageBarrier(VkImage image, VkAccessFlags srcAccessMask,
+                                  VkAccessFlags dstAccessMask,
+                                  VkImageLayout oldLayout,
+                                  VkImageLayout newLayout) noexcept {
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = srcAccessMask;
+  barrier.dstAccessMask = dstAccessMask;
+  barrier.oldLayout = oldLayout;
+  barrier.newLayout = newLayout;
+  barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex =
+    VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  return barrier;
+} // ImageBarrier
+
+} // namespace
+
+gsl::czstring to_string(PresentPath path) noexcept {
+  switch (path) {
+  case PresentPath::kCopy: return "copy";
+  case PresentPath::kDirect: return "direct";
+  }
+  return "unknown";
+} // to_string
+
+gsl::czstring to_string(FrameStep step) noexcept {
+  switch (step) {
+  case FrameStep::kBeforeTrace: return "before trace";
+  case FrameStep::kBeforeTonemap: return "before tonemap";
+  case FrameStep::kAfterTonemap: return "after tonemap";
+  case FrameStep::kAfterCopy: return "after copy";
+  }
+  return "unknown";
+} // to_string
+
+PresentPath
+SelectPresentPath(VkImageUsageFlags supportedUsageFlags,
+                  VkFormatFeatureFlags optimalTilingFeatures) noexcept {
+  return (supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT) != 0 &&
+             (optimalTilingFeatures &
+              VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0
+           ? PresentPath::kDirect
+           : PresentPath::kCopy;
+} // SelectPresentPath
+
+VkImageUsageFlags SwapchainUsage(PresentPath path) noexcept {
+  return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+         (path == PresentPath::kDirect ? VK_IMAGE_USAGE_STORAGE_BIT
+                                       : VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+} // SwapchainUsage
+
+VkPipelineStageFlags PresentWaitStage(PresentPath path) noexcept {
+  return path == PresentPath::kDirect ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+                                      : VK_PIPELINE_STAGE_TRANSFER_BIT;
+} // PresentWaitStage
+
+void RecordPresentBarriers(FrameStep step, PresentPath path,
+                           PresentImages const& images,
+                           BarrierSink const& sink) {
+  bool const direct = path == PresentPath::kDirect;
+
+  switch (step) {
+  case FrameStep::kBeforeTrace: {
+    // The previous frame's tonemap pass may still be reading the HDR image.
+    VkImageMemoryBarrier const barrier =
+      ImageBarrier(images.hdr, 0, VK_ACCESS_SHADER_WRITE_BIT,
+                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    sink(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+         VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV, {&barrier, 1});
+    break;
+  }
+
+  case FrameStep::kBeforeTonemap: {
+    // The traced pixels become visible to the tonemap pass, and its target
+    // is made writable: sOutputImage once the previous frame's copy out of
+    // it is done, the swapchain image once it has been acquired.
+    std::array<VkImageMemoryBarrier, 2> const barriers = {
+      ImageBarrier(images.hdr, VK_ACCESS_SHADER_WRITE_BIT,
+                   VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                   VK_IMAGE_LAYOUT_GENERAL),
+      ImageBarrier(direct ? images.swapchain : images.output, 0,
+                   VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED,
+                   VK_IMAGE_LAYOUT_GENERAL)};
+    sink(VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV |
+           (direct ? PresentWaitStage(path) : VK_PIPELINE_STAGE_TRANSFER_BIT),
+         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, barriers);
+    break;
+  }
+
+  case FrameStep::kAfterTonemap:
+    if (direct) {
+      VkImageMemoryBarrier const barrier = ImageBarrier(
+        images.swapchain, VK_ACCESS_SHADER_WRITE_BIT, 0,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+      sink(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, {&barrier, 1});
+    } else {
+      std::array<VkImageMemoryBarrier, 2> const barriers = {
+        ImageBarrier(images.output, VK_ACCESS_SHADER_WRITE_BIT,
+                     VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL,
+                     VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL),
+        ImageBarrier(images.swapchain, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_IMAGE_LAYOUT_UNDEFINED,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)};
+      sink(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | PresentWaitStage(path),
+           VK_PIPELINE_STAGE_TRANSFER_BIT, barriers);
+    }
+    break;
+
+  case FrameStep::kAfterCopy:
+    if (!direct) {
+      VkImageMemoryBarrier const barrier = ImageBarrier(
+        images.swapchain, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+      sink(VK_PIPELINE_STAGE_TRANSFER_BIT,
+           VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, {&barrier, 1});
+    }
+    break;
+  }
+} // RecordPresentBarriers
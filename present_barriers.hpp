@@ -0,0 +1,74 @@
+#ifndef PRESENT_BARRIERS_HPP_
+#define PRESENT_BARRIERS_HPP_
+
+#include "flextVk.h"
+#include "gsl/gsl-lite.hpp"
+#include <cstdint>
+#include <functional>
+
+//
+// The image barriers a frame records around the trace and the tonemap pass,
+// for either way of getting the tonemapped image onto the screen:
+//
+//  - kCopy: the tonemap pass writes sOutputImage, which is copied into the
+//    acquired swapchain image;
+//  - kDirect: the tonemap pass writes the swapchain image itself through a
+//    storage view, which needs the surface to support storage usage in its
+//    format, and saves the copy and the barriers around it.
+//
+// Each barrier waits on the stages that last touched the image and blocks
+// only the stages that touch it next, instead of ALL_COMMANDS, so the trace
+// of one frame overlaps the tail of the previous one. The swapchain image is
+// first touched at PresentWaitStage, which is where the submit waits for the
+// acquire semaphore, and its layout transition is ordered after that wait by
+// having that stage in its source scope.
+//
+// The barriers go to a BarrierSink, which records them with
+// vkCmdPipelineBarrier in Draw and can keep them for a check instead.
+//
+
+enum class PresentPath : std::uint8_t { kCopy, kDirect };
+
+[[nodiscard]] gsl::czstring to_string(PresentPath path) noexcept;
+
+// kDirect if images of the surface can be created with storage usage and
+// the surface format supports storage images with optimal tiling.
+[[nodiscard]] PresentPath
+SelectPresentPath(VkImageUsageFlags supportedUsageFlags,
+                  VkFormatFeatureFlags optimalTilingFeatures) noexcept;
+
+// The usage to create swapchain images with: color attachment for the
+// framebuffers, and transfer destination or storage for path.
+[[nodiscard]] VkImageUsageFlags SwapchainUsage(PresentPath path) noexcept;
+
+// The stage the frame's submit waits for the acquired image at: the copy
+// into it, or the tonemap pass writing it.
+[[nodiscard]] VkPipelineStageFlags PresentWaitStage(PresentPath path) noexcept;
+
+// Where in a frame barriers are recorded.
+enum class FrameStep : std::uint8_t {
+  kBeforeTrace,
+  kBeforeTonemap,
+  kAfterTonemap,
+  kAfterCopy, // kCopy only
+};
+
+[[nodiscard]] gsl::czstring to_string(FrameStep step) noexcept;
+
+struct PresentImages {
+  VkImage hdr{VK_NULL_HANDLE};
+  VkImage output{VK_NULL_HANDLE}; // unused by kDirect
+  VkImage swapchain{VK_NULL_HANDLE};
+}; // struct PresentImages
+
+// One vkCmdPipelineBarrier with image barriers only.
+using BarrierSink = std::function<void(
+  VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask,
+  gsl::span<VkImageMemoryBarrier const> barriers)>;
+
+// Record the barriers path needs at step, if any, to sink.
+void RecordPresentBarriers(FrameStep step, PresentPath path,
+                           PresentImages const& images,
+                           BarrierSink const& sink);
+
+#endif // PRESENT_BARRIERS_HPP_
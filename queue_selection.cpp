@@ -0,0 +1,30 @@
+#include "queue_selection.hpp"
+
+QueueFamilySelection
+SelectQueueFamilies(gsl::span<VkQueueFamilyProperties const> families,
+                    gsl::span<VkBool32 const> presentSupport,
+                    VkQueueFlags graphicsFlags) noexcept {
+  Expects(presentSupport.size() == families.size());
+  QueueFamilySelection selection;
+
+  for (std::uint32_t i = 0; i < families.size(); ++i) {
+    auto&& family = families[i];
+    if (family.queueCount == 0) continue;
+
+    if (selection.graphics == UINT32_MAX &&
+        (family.queueFlags & graphicsFlags) == graphicsFlags &&
+        presentSupport[i] == VK_TRUE) {
+      selection.graphics = i;
+    }
+
+    if (selection.compute == UINT32_MAX &&
+        (family.queueFlags & VK_QUEUE_COMPUTE_BIT) &&
+        !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+      selection.compute = i;
+    }
+  }
+
+  if (selection.graphics == UINT32_MAX) return {};
+  if (selection.compute == UINT32_MAX) selection.compute = selection.graphics;
+  return selection;
+} // SelectQueueFamilies
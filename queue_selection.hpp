@@ -0,0 +1,36 @@
+#ifndef QUEUE_SELECTION_HPP_
+#define QUEUE_SELECTION_HPP_
+
+#include "flextVk.h"
+#include "gsl/gsl-lite.hpp"
+#include <cstdint>
+
+struct QueueFamilySelection {
+  std::uint32_t graphics{UINT32_MAX};
+  std::uint32_t compute{UINT32_MAX};
+
+  [[nodiscard]] bool Valid() const noexcept {
+    return graphics != UINT32_MAX && compute != UINT32_MAX;
+  }
+
+  // True when compute work runs on a different queue family, which means
+  // resources shared with the graphics queue need ownership transfers.
+  [[nodiscard]] bool AsyncCompute() const noexcept {
+    return compute != graphics;
+  }
+}; // struct QueueFamilySelection
+
+// Choose the family for graphics work and presents (the first with all of
+// graphicsFlags that can present, presentSupport[i] being whether family i
+// can) and for acceleration structure builds: a compute family without
+// graphics support if there is one, since those usually map to separate
+// hardware queues, otherwise the graphics family. With no family that can
+// both draw and present the selection is not Valid. Takes the queried
+// properties rather than a physical device so the choice can be checked
+// against any layout.
+[[nodiscard]] QueueFamilySelection
+SelectQueueFamilies(gsl::span<VkQueueFamilyProperties const> families,
+                    gsl::span<VkBool32 const> presentSupport,
+                    VkQueueFlags graphicsFlags) noexcept;
+
+#endif // QUEUE_SELECTION_HPP_
@@ -0,0 +1,476 @@
+#include "render_server.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class RenderMessage : std::uint32_t {
+  kRequest = 1,      // client: RenderRequestMessage
+  kReply = 2,        // server: RenderReplyMessage, then the encoded image
+  kMetrics = 3,      // client: no payload
+  kMetricsReply = 4, // server: the metrics text
+  kShutdown = 5,     // client: no payload
+};
+
+struct RenderRequestMessage {
+  std::uint64_t id;
+  RenderCamera camera;
+  std::uint32_t width;
+  std::uint32_t height;
+  std::uint32_t format;
+  std::uint32_t reserved;
+}; // struct RenderRequestMessage
+
+struct RenderReplyMessage {
+  std::uint64_t id;
+  // 0, or the std::errc value the request failed with.
+  std::uint32_t status;
+  std::uint32_t format;
+  std::uint32_t batchSize;
+  std::uint32_t reserved;
+  double renderMs;
+}; // struct RenderReplyMessage
+
+static_assert(sizeof(RenderRequestMessage) == 72);
+static_assert(sizeof(RenderReplyMessage) == 32);
+
+constexpr std::uint32_t Type(RenderMessage message) noexcept {
+  return static_cast<std::uint32_t>(message);
+} // Type
+
+double MillisecondsSince(Clock::time_point start) noexcept {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+    .count();
+} // MillisecondsSince
+
+bool ValidFormat(std::uint32_t format) noexcept {
+  return format <= static_cast<std::uint32_t>(ImageFormat::kPNG);
+} // ValidFormat
+
+// A reply with no image.
+tl::expected<void, std::system_error>
+SendRefusal(MessageSocket const& socket, std::uint64_t id, std::errc error) {
+  RenderReplyMessage const reply = {id, static_cast<std::uint32_t>(error),
+                                    0, 0, 0, 0.0};
+  return socket.Send(Type(RenderMessage::kReply), reply);
+} // SendRefusal
+
+void PutMetric(std::string& text, char const* name, char const* type,
+               char const* help) {
+  text += "# HELP ";
+  text += name;
+  text += ' ';
+  text += help;
+  text += "\n# TYPE ";
+  text += name;
+  text += ' ';
+  text += type;
+  text += '\n';
+} // PutMetric
+
+void PutSample(std::string& text, char const* name, char const* labels,
+               double value) {
+  char line[160];
+  std::snprintf(line, sizeof(line), "%s%s %.10g\n", name, labels, value);
+  text += line;
+} // PutSample
+
+} // namespace
+
+double Percentile(std::vector<double> samples, double q) noexcept {
+  if (samples.empty()) return 0.0;
+  std::size_t const count = samples.size();
+  std::size_t const rank = std::clamp<std::size_t>(
+    static_cast<std::size_t>(std::ceil(q * static_cast<double>(count))), 1,
+    count);
+  auto const nth = samples.begin() + static_cast<std::ptrdiff_t>(rank - 1);
+  std::nth_element(samples.begin(), nth, samples.end());
+  return *nth;
+} // Percentile
+
+std::string FormatMetrics(RenderServerStats const& stats) {
+  std::string text;
+
+  PutMetric(text, "render_requests_total", "counter",
+            "Views rendered and sent.");
+  PutSample(text, "render_requests_total", "",
+            static_cast<double>(stats.requests));
+  PutMetric(text, "render_refused_total", "counter",
+            "Requests answered with an error.");
+  PutSample(text, "render_refused_total", "",
+            static_cast<double>(stats.refused));
+
+  PutMetric(text, "render_latency_ms", "summary",
+            "Milliseconds from a request arriving to its reply.");
+  for (double q : {0.5, 0.9, 0.99, 1.0}) {
+    char labels[32];
+    std::snprintf(labels, sizeof(labels), "{quantile=\"%g\"}", q);
+    PutSample(text, "render_latency_ms", labels,
+              Percentile(stats.latencyMs, q));
+  }
+  PutSample(text, "render_latency_ms_sum", "", stats.latencyMsSum);
+  PutSample(text, "render_latency_ms_count", "",
+            static_cast<double>(stats.requests));
+
+  PutMetric(text, "render_batch_size", "histogram",
+            "Views rendered by one backend dispatch.");
+  std::uint64_t batches = 0;
+  double views = 0.0;
+  for (std::size_t size = 1; size < stats.batchSizes.size(); ++size) {
+    batches += stats.batchSizes[size];
+    views += static_cast<double>(size * stats.batchSizes[size]);
+    char labels[32];
+    std::snprintf(labels, sizeof(labels), "{le=\"%zu\"}", size);
+    PutSample(text, "render_batch_size_bucket", labels,
+              static_cast<double>(batches));
+  }
+  PutSample(text, "render_batch_size_bucket", "{le=\"+Inf\"}",
+            static_cast<double>(batches));
+  PutSample(text, "render_batch_size_sum", "", views);
+  PutSample(text, "render_batch_size_count", "",
+            static_cast<double>(stats.batches));
+
+  PutMetric(text, "render_backend_ms_total", "counter",
+            "Milliseconds spent in the backend.");
+  PutSample(text, "render_backend_ms_total", "", stats.renderMs);
+  PutMetric(text, "render_encode_ms_total", "counter",
+            "Milliseconds spent encoding images.");
+  PutSample(text, "render_encode_ms_total", "", stats.encodeMs);
+  return text;
+} // FormatMetrics
+
+tl::expected<RenderServer, std::system_error>
+RenderServer::Listen(SocketAddress const& address, RenderBackend backend,
+                     RenderServerParams const& params) noexcept {
+  Expects(backend);
+  Expects(params.maxBatch > 0);
+
+  auto listener = MessageSocket::Listen(address);
+  if (!listener) return tl::unexpected(listener.error());
+
+  try {
+    RenderServer server;
+    server.listener_ = std::move(*listener);
+    server.backend_ = std::move(backend);
+    server.params_ = params;
+    server.stats_.batchSizes.assign(params.maxBatch + 1, 0);
+    server.stats_.latencyMs.reserve(kLatencySamples);
+    return server;
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "render server"));
+  }
+} // RenderServer::Listen
+
+tl::expected<void, std::system_error> RenderServer::Run() noexcept {
+  Expects(listener_.IsOpen());
+
+  auto const window = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double, std::milli>(params_.batchWindowMs));
+
+  try {
+    std::vector<int> fds;
+    std::vector<char> readable;
+    MessageHeader header;
+    std::vector<std::byte> payload;
+
+    while (!stopping_ || !pending_.empty()) {
+      // Render once a batch is full, the oldest request has waited the
+      // window out, or there will be no more requests to wait for.
+      int timeoutMs = -1;
+      if (!pending_.empty()) {
+        auto const due = pending_.front().arrival + window;
+        auto const now = Clock::now();
+        if (stopping_ || pending_.size() >= params_.maxBatch || now >= due) {
+          RenderBatch();
+          continue;
+        }
+        timeoutMs = static_cast<int>(std::max<long long>(
+          1, std::chrono::ceil<std::chrono::milliseconds>(due - now).count()));
+      }
+
+      fds.assign(1, listener_.Descriptor());
+      for (auto const& client : clients_) {
+        fds.push_back(client.socket.Descriptor());
+      }
+      readable.assign(fds.size(), 0);
+      if (auto waited = WaitReadable(fds, readable, timeoutMs); !waited) {
+        return tl::unexpected(waited.error());
+      }
+
+      for (std::size_t c = 0; c < clients_.size(); ++c) {
+        if (!readable[c + 1]) continue;
+        Client& client = clients_[c];
+
+        auto open = client.socket.ReadAvailable();
+        for (;;) {
+          auto taken = client.socket.TakeMessage(header, payload);
+          if (!taken || !*taken) {
+            if (!taken) open = false;
+            break;
+          }
+          if (!Receive(client, header, payload)) {
+            open = false;
+            break;
+          }
+        }
+        if (!open || !*open) client.socket.Close();
+      }
+
+      // Forget the clients that left and the requests they left behind.
+      auto const gone = [this](std::uint64_t serial) {
+        return std::none_of(clients_.begin(), clients_.end(),
+                            [serial](Client const& client) {
+                              return client.serial == serial &&
+                                     client.socket.IsOpen();
+                            });
+      };
+      pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                    [&](Pending const& p) {
+                                      return gone(p.client);
+                                    }),
+                     pending_.end());
+      clients_.erase(std::remove_if(clients_.begin(), clients_.end(),
+                                    [](Client const& client) {
+                                      return !client.socket.IsOpen();
+                                    }),
+                     clients_.end());
+
+      if (readable[0] && !stopping_) {
+        auto socket = listener_.Accept();
+        if (!socket) return tl::unexpected(socket.error());
+        clients_.push_back({nextSerial_++, std::move(*socket)});
+      }
+    }
+
+    for (auto& client : clients_) client.socket.Close();
+    clients_.clear();
+    return {};
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "render server"));
+  }
+} // RenderServer::Run
+
+bool RenderServer::Receive(Client& client, MessageHeader const& header,
+                           gsl::span<std::byte const> payload) {
+  switch (static_cast<RenderMessage>(header.type)) {
+  case RenderMessage::kRequest: {
+    auto message = MessagePayload<RenderRequestMessage>(
+      header, payload, Type(RenderMessage::kRequest));
+    if (!message) return false;
+
+    if (message->width == 0 || message->width > params_.maxWidth ||
+        message->height == 0 || message->height > params_.maxHeight ||
+        !ValidFormat(message->format) || stopping_) {
+      ++stats_.refused;
+      return SendRefusal(client.socket, message->id,
+                         stopping_ ? std::errc::operation_canceled
+                                   : std::errc::invalid_argument)
+        .has_value();
+    }
+
+    RenderRequest const request = {message->camera, message->width,
+                                   message->height,
+                                   static_cast<ImageFormat>(message->format)};
+    pending_.push_back({client.serial, message->id, request, Clock::now()});
+    return true;
+  }
+
+  case RenderMessage::kMetrics: {
+    std::string const text = FormatMetrics(stats_);
+    return client.socket
+      .Send(Type(RenderMessage::kMetricsReply),
+            gsl::as_bytes(gsl::make_span(text.data(), text.size())))
+      .has_value();
+  }
+
+  case RenderMessage::kShutdown: stopping_ = true; return true;
+
+  default: return false;
+  }
+} // RenderServer::Receive
+
+void RenderServer::RenderBatch() {
+  Expects(!pending_.empty());
+
+  std::uint32_t const width = pending_.front().request.width;
+  std::uint32_t const height = pending_.front().request.height;
+  auto const sameSize = [&](Pending const& p) {
+    return p.request.width == width && p.request.height == height;
+  };
+
+  // The oldest requests of the oldest request's size, in arrival order.
+  std::vector<Pending> batch;
+  for (auto it = pending_.begin();
+       it != pending_.end() && batch.size() < params_.maxBatch;) {
+    if (sameSize(*it)) {
+      batch.push_back(*it);
+      it = pending_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  std::vector<RenderCamera> cameras;
+  cameras.reserve(batch.size());
+  for (auto const& p : batch) cameras.push_back(p.request.camera);
+
+  std::size_t const viewBytes = std::size_t{4} * width * height;
+  rgba_.resize(viewBytes * batch.size());
+
+  auto const renderStart = Clock::now();
+  auto rendered = backend_(cameras, width, height, rgba_);
+  double const renderMs = MillisecondsSince(renderStart);
+  stats_.renderMs += renderMs;
+
+  auto const client = [this](std::uint64_t serial) -> Client* {
+    for (auto& c : clients_) {
+      if (c.serial == serial && c.socket.IsOpen()) return &c;
+    }
+    return nullptr;
+  };
+
+  if (!rendered) {
+    for (auto const& p : batch) {
+      ++stats_.refused;
+      if (Client* c = client(p.client)) {
+        if (!SendRefusal(c->socket, p.id, std::errc::io_error)) {
+          c->socket.Close();
+        }
+      }
+    }
+    return;
+  }
+
+  ++stats_.batches;
+  ++stats_.batchSizes[batch.size()];
+
+  for (std::size_t i = 0; i < batch.size(); ++i) {
+    Pending const& p = batch[i];
+    Client* c = client(p.client);
+    if (c == nullptr) continue;
+
+    auto const encodeStart = Clock::now();
+    std::vector<std::byte> const image = EncodeImage(
+      {rgba_.data() + i * viewBytes, width, height, width}, p.request.format);
+    stats_.encodeMs += MillisecondsSince(encodeStart);
+
+    RenderReplyMessage const reply = {
+      p.id, 0, static_cast<std::uint32_t>(p.request.format),
+      static_cast<std::uint32_t>(batch.size()), 0, renderMs};
+    std::vector<std::byte> message(sizeof(reply) + image.size());
+    std::memcpy(message.data(), &reply, sizeof(reply));
+    std::copy(image.begin(), image.end(), message.begin() + sizeof(reply));
+    if (!c->socket.Send(Type(RenderMessage::kReply), message)) {
+      c->socket.Close();
+      continue;
+    }
+
+    ++stats_.requests;
+    RecordLatency(p.arrival);
+  }
+} // RenderServer::RenderBatch
+
+void RenderServer::RecordLatency(Clock::time_point arrival) {
+  double const latencyMs = MillisecondsSince(arrival);
+  stats_.latencyMsSum += latencyMs;
+  if (stats_.latencyMs.size() < kLatencySamples) {
+    stats_.latencyMs.push_back(latencyMs);
+  } else {
+    stats_.latencyMs[nextLatency_] = latencyMs;
+    nextLatency_ = (nextLatency_ + 1) % kLatencySamples;
+  }
+} // RenderServer::RecordLatency
+
+tl::expected<RenderClient, std::system_error>
+RenderClient::Connect(SocketAddress const& address) noexcept {
+  auto socket = MessageSocket::Connect(address);
+  if (!socket) return tl::unexpected(socket.error());
+
+  RenderClient client;
+  client.socket_ = std::move(*socket);
+  return client;
+} // RenderClient::Connect
+
+tl::expected<void, std::system_error>
+RenderClient::Render(RenderRequest const& request,
+                     std::vector<std::byte>& image,
+                     RenderReplyInfo* info) noexcept {
+  Expects(socket_.IsOpen());
+
+  std::uint64_t const id = nextId_++;
+  RenderRequestMessage const message = {
+    id, request.camera, request.width, request.height,
+    static_cast<std::uint32_t>(request.format), 0};
+  if (auto sent = socket_.Send(Type(RenderMessage::kRequest), message);
+      !sent) {
+    return tl::unexpected(sent.error());
+  }
+
+  MessageHeader header;
+  std::vector<std::byte> payload;
+  if (auto received = socket_.Receive(header, payload); !received) {
+    return tl::unexpected(received.error());
+  }
+  auto reply = MessagePayload<RenderReplyMessage>(header, payload,
+                                                  Type(RenderMessage::kReply));
+  if (!reply || reply->id != id) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::bad_message), "render reply"));
+  }
+  if (reply->status != 0) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(static_cast<std::errc>(reply->status)),
+      "render request"));
+  }
+
+  try {
+    image.assign(payload.begin() + sizeof(RenderReplyMessage), payload.end());
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "render reply"));
+  }
+  if (info != nullptr) {
+    info->batchSize = reply->batchSize;
+    info->renderMs = reply->renderMs;
+  }
+  return {};
+} // RenderClient::Render
+
+tl::expected<std::string, std::system_error> RenderClient::Metrics() noexcept {
+  Expects(socket_.IsOpen());
+
+  if (auto sent = socket_.Send(Type(RenderMessage::kMetrics),
+                                gsl::span<std::byte const>{}); !sent) {
+    return tl::unexpected(sent.error());
+  }
+
+  MessageHeader header;
+  std::vector<std::byte> payload;
+  if (auto received = socket_.Receive(header, payload); !received) {
+    return tl::unexpected(received.error());
+  }
+  if (header.type != Type(RenderMessage::kMetricsReply)) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::bad_message), "metrics reply"));
+  }
+
+  try {
+    return std::string(reinterpret_cast<char const*>(payload.data()),
+                       payload.size());
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "metrics reply"));
+  }
+} // RenderClient::Metrics
+
+tl::expected<void, std::system_error> RenderClient::Shutdown() noexcept {
+  Expects(socket_.IsOpen());
+  return socket_.Send(Type(RenderMessage::kShutdown),
+                      gsl::span<std::byte const>{});
+} // RenderClient::Shutdown
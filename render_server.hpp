@@ -0,0 +1,171 @@
+#ifndef RENDER_SERVER_HPP_
+#define RENDER_SERVER_HPP_
+
+#include "cpu_renderer.hpp"
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "image_encoding.hpp"
+#include "message_socket.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+//
+// Views of one scene rendered on request for other processes. A
+// RenderServer listens on a MessageSocket address and keeps its backend,
+// and whatever device, acceleration structures and pipeline the backend
+// holds, for as long as it runs. Clients connect, send cameras and get
+// encoded images back.
+//
+// Requests that arrive close together are rendered together. Once a
+// request is pending the server waits up to batchWindowMs for others of the
+// same size and hands up to maxBatch of them to the backend at once, as a
+// stack of views it renders in one dispatch. A request waits no longer than
+// the window when the server is idle and the batch fills up at once when it
+// is busy.
+//
+// scene_tool serve renders a batch with RenderLayers on the CPU. 01_sphere
+// --serve traces it as one ray generation launch of depth cameras.size(),
+// each layer of which renders its own camera's view below the last, and
+// tonemaps and reads back the whole stack at once.
+//
+// The server records how long each request took from arriving to its reply
+// being sent and how many views each batch held, and sends both to any
+// client that asks, in Prometheus text format.
+//
+// POSIX only, as MessageSocket is.
+//
+
+// Render cameras.size() views of width by height pixels to rgba, RGBA8 and
+// tonemapped, view i to the i'th width * height * 4 bytes.
+using RenderBackend = std::function<tl::expected<void, std::system_error>(
+  gsl::span<RenderCamera const> cameras, std::uint32_t width,
+  std::uint32_t height, gsl::span<std::uint8_t> rgba)>;
+
+struct RenderServerParams {
+  std::uint32_t maxBatch{16};
+  double batchWindowMs{2.0};
+  // Larger requests are refused.
+  std::uint32_t maxWidth{4096};
+  std::uint32_t maxHeight{4096};
+}; // struct RenderServerParams
+
+struct RenderRequest {
+  RenderCamera camera{};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  ImageFormat format{ImageFormat::kQOI};
+}; // struct RenderRequest
+
+// What the server says about a reply besides the image.
+struct RenderReplyInfo {
+  std::uint32_t batchSize{0}; // views rendered with this one
+  double renderMs{0.0};       // the batch's backend time
+}; // struct RenderReplyInfo
+
+// Latencies kept for the percentiles; older ones are overwritten.
+inline constexpr std::size_t kLatencySamples = std::size_t{1} << 16;
+
+struct RenderServerStats {
+  std::uint64_t requests{0}; // replied to with an image
+  std::uint64_t refused{0};  // invalid, or the backend failed
+  std::uint64_t batches{0};
+  // batchSizes[n] batches held n views.
+  std::vector<std::uint64_t> batchSizes{};
+  // Milliseconds from arrival to reply of up to kLatencySamples of the
+  // latest requests, in no particular order.
+  std::vector<double> latencyMs{};
+  double latencyMsSum{0.0}; // of every request
+  double renderMs{0.0};
+  double encodeMs{0.0};
+}; // struct RenderServerStats
+
+// The value below which fraction q of samples lie, by the nearest rank; 0
+// if there are none.
+[[nodiscard]] double Percentile(std::vector<double> samples,
+                                double q) noexcept;
+
+// stats in the Prometheus text exposition format.
+[[nodiscard]] std::string FormatMetrics(RenderServerStats const& stats);
+
+class RenderServer {
+public:
+  [[nodiscard]] static tl::expected<RenderServer, std::system_error>
+  Listen(SocketAddress const& address, RenderBackend backend,
+         RenderServerParams const& params = {}) noexcept;
+
+  // Serve clients until one sends a shutdown, then render and reply to the
+  // requests still pending and return.
+  [[nodiscard]] tl::expected<void, std::system_error> Run() noexcept;
+
+  [[nodiscard]] RenderServerStats const& Stats() const noexcept {
+    return stats_;
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Client {
+    std::uint64_t serial{0};
+    MessageSocket socket{};
+  }; // struct Client
+
+  struct Pending {
+    std::uint64_t client;
+    std::uint64_t id;
+    RenderRequest request;
+    Clock::time_point arrival;
+  }; // struct Pending
+
+  // Handle one message from a client; false to disconnect it.
+  bool Receive(Client& client, MessageHeader const& header,
+               gsl::span<std::byte const> payload);
+
+  // Render the oldest pending request and up to maxBatch - 1 more of the
+  // same size, and reply to each.
+  void RenderBatch();
+
+  void RecordLatency(Clock::time_point arrival);
+
+  MessageSocket listener_{};
+  RenderBackend backend_{};
+  RenderServerParams params_{};
+  std::uint64_t nextSerial_{0};
+  std::vector<Client> clients_{};
+  std::vector<Pending> pending_{};
+  std::vector<std::uint8_t> rgba_{};
+  std::size_t nextLatency_{0};
+  bool stopping_{false};
+  RenderServerStats stats_{};
+}; // class RenderServer
+
+// One connection to a RenderServer, one request at a time; open several
+// for requests in parallel.
+class RenderClient {
+public:
+  [[nodiscard]] static tl::expected<RenderClient, std::system_error>
+  Connect(SocketAddress const& address) noexcept;
+
+  // Render a view and wait for it, encoded in request.format. Fails with
+  // the server's error if it refused the request.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Render(RenderRequest const& request, std::vector<std::byte>& image,
+         RenderReplyInfo* info = nullptr) noexcept;
+
+  // The server's metrics, as FormatMetrics writes them.
+  [[nodiscard]] tl::expected<std::string, std::system_error>
+  Metrics() noexcept;
+
+  // Ask the server to stop once it has replied to every pending request.
+  [[nodiscard]] tl::expected<void, std::system_error> Shutdown() noexcept;
+
+private:
+  MessageSocket socket_{};
+  std::uint64_t nextId_{0};
+}; // class RenderClient
+
+#endif // RENDER_SERVER_HPP_
@@ -0,0 +1,191 @@
+#include "sample_tables.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Ulichney's choice; wider kernels blur the mask's spectrum.
+constexpr double kBlueNoiseSigma = 1.5;
+
+// The pattern void and cluster starts from covers this fraction of the mask.
+constexpr std::uint32_t kInitialPatternDivisor = 10;
+
+// Seeds of the x and y masks.
+constexpr std::uint64_t kBlueNoiseSeedX = 1;
+constexpr std::uint64_t kBlueNoiseSeedY = 2;
+
+// SplitMix64, as the scene generator uses.
+std::uint64_t NextRandom(std::uint64_t& state) noexcept {
+  std::uint64_t z = (state += 0x9E37'79B9'7F4A'7C15);
+  z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+  z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+  return z ^ (z >> 31);
+} // NextRandom
+
+// A binary pattern on a torus and the energy of each pixel: the sum of a
+// Gaussian of its distance to every set pixel. Tight clusters are the set
+// pixels of highest energy, large voids the clear pixels of lowest.
+class EnergyField {
+public:
+  explicit EnergyField(std::uint32_t size)
+    : size_(size), mask_(size - 1),
+      kernel_(std::size_t{size} * size), energy_(kernel_.size(), 0.0),
+      set_(kernel_.size(), 0) {
+    for (std::uint32_t dy = 0; dy < size; ++dy) {
+      for (std::uint32_t dx = 0; dx < size; ++dx) {
+        double const x = std::min(dx, size - dx);
+        double const y = std::min(dy, size - dy);
+        kernel_[std::size_t{dy} * size + dx] = std::exp(
+          -(x * x + y * y) / (2.0 * kBlueNoiseSigma * kBlueNoiseSigma));
+      }
+    }
+  }
+
+  [[nodiscard]] bool IsSet(std::uint32_t pixel) const noexcept {
+    return set_[pixel] != 0;
+  }
+
+  void Toggle(std::uint32_t pixel) noexcept {
+    double const sign = set_[pixel] != 0 ? -1.0 : 1.0;
+    set_[pixel] ^= 1;
+
+    std::uint32_t const px = pixel & mask_, py = pixel / size_;
+    double* energy = energy_.data();
+    for (std::uint32_t y = 0; y < size_; ++y) {
+      double const* kernelRow =
+        kernel_.data() + std::size_t{(y - py) & mask_} * size_;
+      for (std::uint32_t x = 0; x < size_; ++x) {
+        *energy++ += sign * kernelRow[(x - px) & mask_];
+      }
+    }
+  }
+
+  // The set pixel of highest energy, or the clear one of lowest.
+  [[nodiscard]] std::uint32_t TightestCluster() const noexcept {
+    return Extreme(true);
+  }
+  [[nodiscard]] std::uint32_t LargestVoid() const noexcept {
+    return Extreme(false);
+  }
+
+private:
+  [[nodiscard]] std::uint32_t Extreme(bool set) const noexcept {
+    std::uint32_t best = 0;
+    double bestEnergy = 0.0;
+    bool found = false;
+    for (std::uint32_t i = 0; i < energy_.size(); ++i) {
+      if ((set_[i] != 0) != set) continue;
+      double const energy = set ? energy_[i] : -energy_[i];
+      if (!found || energy > bestEnergy) {
+        best = i;
+        bestEnergy = energy;
+        found = true;
+      }
+    }
+    Expects(found);
+    return best;
+  }
+
+  std::uint32_t size_;
+  std::uint32_t mask_;
+  std::vector<double> kernel_;
+  std::vector<double> energy_;
+  std::vector<std::uint8_t> set_;
+}; // class EnergyField
+
+// Fixed point in [0, 1) of the middle of rank's interval, rank in
+// [0, count).
+std::uint32_t RankToFixed16(std::uint32_t rank, std::uint32_t count) noexcept {
+  return static_cast<std::uint32_t>(
+    ((std::uint64_t{2} * rank + 1) << 15) / count);
+} // RankToFixed16
+
+} // namespace
+
+void SobolPoint(std::uint32_t index, std::uint32_t& x,
+                std::uint32_t& y) noexcept {
+  // The first dimension is the van der Corput sequence. The second has the
+  // primitive polynomial x + 1, whose direction numbers each shift the one
+  // before into itself.
+  x = shader::ReverseBits(index);
+  y = 0;
+  std::uint32_t direction = 0x8000'0000u;
+  for (std::uint32_t i = index; i != 0; i >>= 1) {
+    if ((i & 1) != 0) y ^= direction;
+    direction ^= direction >> 1;
+  }
+} // SobolPoint
+
+void BuildBlueNoiseMask(std::uint32_t size, std::uint64_t seed,
+                        gsl::span<std::uint16_t> ranks) {
+  Expects(size > 0 && size <= 256 && (size & (size - 1)) == 0);
+  std::uint32_t const count = size * size;
+  Expects(ranks.size() == static_cast<gsl::index>(count));
+
+  // A random initial pattern, relaxed by moving its tightest cluster into
+  // its largest void until that puts the pixel back where it came from.
+  EnergyField initial(size);
+  std::uint32_t const initialCount =
+    std::max(1u, count / kInitialPatternDivisor);
+  std::uint64_t state = seed;
+  for (std::uint32_t placed = 0; placed < initialCount;) {
+    auto const pixel = static_cast<std::uint32_t>(NextRandom(state) % count);
+    if (initial.IsSet(pixel)) continue;
+    initial.Toggle(pixel);
+    placed += 1;
+  }
+  for (std::uint32_t i = 0; i < count; ++i) {
+    std::uint32_t const cluster = initial.TightestCluster();
+    initial.Toggle(cluster);
+    std::uint32_t const hole = initial.LargestVoid();
+    initial.Toggle(hole);
+    if (hole == cluster) break;
+  }
+
+  // The initial pattern's pixels are ranked below its size, the tightest
+  // cluster highest, by removing them one at a time.
+  EnergyField removing = initial;
+  for (std::uint32_t rank = initialCount; rank-- > 0;) {
+    std::uint32_t const cluster = removing.TightestCluster();
+    removing.Toggle(cluster);
+    ranks[cluster] = static_cast<std::uint16_t>(rank);
+  }
+
+  // The rest are ranked above it, each filling the largest void left. On a
+  // torus the energy of the clear pixels is the total less that of the set
+  // ones, so this is also Ulichney's third phase, which picks the tightest
+  // cluster of clear pixels once they are the minority.
+  for (std::uint32_t rank = initialCount; rank < count; ++rank) {
+    std::uint32_t const hole = initial.LargestVoid();
+    initial.Toggle(hole);
+    ranks[hole] = static_cast<std::uint16_t>(rank);
+  }
+} // BuildBlueNoiseMask
+
+void BuildSampleTables(shader::SampleTables& tables) {
+  for (std::uint32_t i = 0; i < shader::kSobolPoints; ++i) {
+    std::uint32_t x, y;
+    SobolPoint(i, x, y);
+    tables.sobol[i] = (x >> 16) | (y & 0xFFFF'0000u);
+  }
+
+  constexpr std::uint32_t kCount = shader::kBlueNoiseSize *
+                                   shader::kBlueNoiseSize;
+  std::vector<std::uint16_t> x(kCount), y(kCount);
+  BuildBlueNoiseMask(shader::kBlueNoiseSize, kBlueNoiseSeedX, x);
+  BuildBlueNoiseMask(shader::kBlueNoiseSize, kBlueNoiseSeedY, y);
+  for (std::uint32_t i = 0; i < kCount; ++i) {
+    tables.blueNoise[i] = RankToFixed16(x[i], kCount) |
+                          (RankToFixed16(y[i], kCount) << 16);
+  }
+} // BuildSampleTables
+
+shader::SampleTables const& GetSampleTables() noexcept {
+  static shader::SampleTables const tables = [] {
+    shader::SampleTables built;
+    BuildSampleTables(built);
+    return built;
+  }();
+  return tables;
+} // GetSampleTables
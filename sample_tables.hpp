@@ -0,0 +1,34 @@
+#ifndef SAMPLE_TABLES_HPP_
+#define SAMPLE_TABLES_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include "sampling_shader.hpp"
+#include <cstdint>
+
+//
+// Builds the shader::SampleTables the pixel sampler of sampling_shader.hpp
+// reads: the 2D Sobol points from their direction numbers, and two blue
+// noise masks by Ulichney's void and cluster method on a torus, so they
+// tile without seams. The masks take the time, under 100 ms on one core.
+//
+// The tables are built from fixed seeds, so every process builds the same
+// ones and a tile worker's samples match the renderer's.
+//
+
+// Sobol point index of the first two dimensions, in 32-bit fixed point.
+void SobolPoint(std::uint32_t index, std::uint32_t& x,
+                std::uint32_t& y) noexcept;
+
+// Rank of each pixel of a size by size toroidal blue noise mask, in
+// [0, size * size), rows one after the other. size must be a power of two
+// no larger than 256. Throws std::bad_alloc, as BuildSampleTables does.
+void BuildBlueNoiseMask(std::uint32_t size, std::uint64_t seed,
+                        gsl::span<std::uint16_t> ranks);
+
+void BuildSampleTables(shader::SampleTables& tables);
+
+// Built on first use and shared from then on; the process terminates if
+// the few hundred kilobytes building them takes cannot be allocated.
+[[nodiscard]] shader::SampleTables const& GetSampleTables() noexcept;
+
+#endif // SAMPLE_TABLES_HPP_
@@ -0,0 +1,111 @@
+#ifndef SAMPLING_SHADER_HPP_
+#define SAMPLING_SHADER_HPP_
+
+//
+// Sample positions within a pixel, in the common subset of GLSL and C++
+// that sphere_shader.hpp is written in, so the ray generation shader and
+// the CPU renderer jitter their rays identically.
+//
+// Sample i of a pixel is point i of the 2D Sobol sequence, Owen scrambled
+// so its error falls off like the sequence's without its structure, then
+// shifted toroidally by the pixel's value in a tile of blue noise. Every
+// pixel scrambles with the same seed, so at low sample counts neighbouring
+// pixels get points far apart and what error remains is high frequency
+// noise the eye and any filter forgive, instead of clumps.
+//
+// Both parts come from SampleTables, which sample_tables.hpp builds and the
+// renderer uploads once: the first kSobolPoints Sobol points, and the blue
+// noise masks. Past the table the points start over with a new scramble.
+//
+
+#ifdef __cplusplus
+#include "glm/vec2.hpp"
+#include <cstdint>
+
+#ifndef SHADER_INLINE
+#define SHADER_INLINE inline
+#endif
+
+namespace shader {
+
+using glm::vec2;
+using uint = std::uint32_t;
+
+#else
+
+#ifndef SHADER_INLINE
+#define SHADER_INLINE
+#endif
+
+#endif
+
+const uint kSobolPoints = 256u;
+const uint kBlueNoiseSize = 64u;
+
+// Both tables hold pairs of 16-bit fixed point coordinates in [0, 1), x in
+// the low half of each element and y in the high.
+struct SampleTables {
+  uint sobol[kSobolPoints];
+  // Rows of kBlueNoiseSize pixels, tiled over the image.
+  uint blueNoise[kBlueNoiseSize * kBlueNoiseSize];
+};
+
+SHADER_INLINE uint ReverseBits(uint x) {
+  x = ((x >> 1u) & 0x55555555u) | ((x & 0x55555555u) << 1u);
+  x = ((x >> 2u) & 0x33333333u) | ((x & 0x33333333u) << 2u);
+  x = ((x >> 4u) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4u);
+  x = ((x >> 8u) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8u);
+  return (x >> 16u) | (x << 16u);
+}
+
+// lowbias32 by Chris Wellons.
+SHADER_INLINE uint HashUint(uint x) {
+  x ^= x >> 16u;
+  x *= 0x7FEB352Du;
+  x ^= x >> 15u;
+  x *= 0x846CA68Bu;
+  x ^= x >> 16u;
+  return x;
+}
+
+// Nested uniform (Owen) scrambling of a 32-bit fixed point coordinate: a
+// hash in which each bit only depends on the bits above it, applied to the
+// reversed bits (Laine and Karras, with the constants of Vegdahl's
+// "Building a Better LK Hash").
+SHADER_INLINE uint OwenScramble(uint x, uint seed) {
+  x = ReverseBits(x);
+  x ^= x * 0x3D20ADEAu;
+  x += seed;
+  x *= (seed >> 16u) | 1u;
+  x ^= x * 0x05526C56u;
+  x ^= x * 0x53A22864u;
+  return ReverseBits(x);
+}
+
+SHADER_INLINE uint SobolTableIndex(uint sampleIndex) {
+  return sampleIndex % kSobolPoints;
+}
+
+SHADER_INLINE uint BlueNoiseTableIndex(uint x, uint y) {
+  return (y % kBlueNoiseSize) * kBlueNoiseSize + x % kBlueNoiseSize;
+}
+
+// Offset in [0, 1)^2 from a pixel's corner of its sample sampleIndex, given
+// the table elements SobolTableIndex and BlueNoiseTableIndex select. The
+// shift by the blue noise wraps round in fixed point, so it is exact.
+SHADER_INLINE vec2 PixelSample(uint sobolPoint, uint blueNoise,
+                               uint sampleIndex) {
+  const uint cycle = sampleIndex / kSobolPoints;
+  const uint x = OwenScramble(sobolPoint << 16u, HashUint(2u * cycle)) +
+                 (blueNoise << 16u);
+  const uint y =
+    OwenScramble(sobolPoint & 0xFFFF0000u, HashUint(2u * cycle + 1u)) +
+    (blueNoise & 0xFFFF0000u);
+  return vec2(float(x >> 8u), float(y >> 8u)) * (1.f / 16777216.f);
+}
+
+#ifdef __cplusplus
+} // namespace shader
+#endif
+
+#endif // SAMPLING_SHADER_HPP_
@@ -0,0 +1,366 @@
+#include "scene_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+gsl::czstring to_string(SceneSection section) noexcept {
+  switch (section) {
+  case SceneSection::kSpheres: return "Spheres";
+  case SceneSection::kSphereMaterials: return "SphereMaterials";
+  case SceneSection::kMaterials: return "Materials";
+  case SceneSection::kInstances: return "Instances";
+  case SceneSection::kChunks: return "Chunks";
+  }
+  return "Unknown";
+} // to_string
+
+gsl::czstring to_string(SceneMaterialType type) noexcept {
+  switch (type) {
+  case SceneMaterialType::kLambertian: return "lambertian";
+  case SceneMaterialType::kMetal: return "metal";
+  case SceneMaterialType::kDielectric: return "dielectric";
+  case SceneMaterialType::kEmissive: return "emissive";
+  }
+  return "unknown";
+} // to_string
+
+namespace {
+
+std::system_error FormatError(std::string const& what) {
+  return std::system_error(std::make_error_code(std::errc::invalid_argument),
+                           "scene file: " + what);
+} // FormatError
+
+constexpr std::uint64_t AlignUp(std::uint64_t value) noexcept {
+  return (value + kSceneSectionAlignment - 1) & ~(kSceneSectionAlignment - 1);
+} // AlignUp
+
+template <class T>
+bool AssignSection(gsl::span<T const>& span, SceneSectionHeader const& section,
+                   std::byte const* base) noexcept {
+  if (section.stride != sizeof(T)) return false;
+  span = {reinterpret_cast<T const*>(base + section.offset),
+          static_cast<gsl::index>(section.count)};
+  return true;
+} // AssignSection
+
+struct SectionSource {
+  SceneSection type;
+  std::uint32_t stride;
+  gsl::span<std::byte const> bytes;
+}; // struct SectionSource
+
+// Non-empty sections of scene in file order.
+std::vector<SectionSource> SectionSources(SceneView const& scene) {
+  std::array<SectionSource, 5> const sources = {{
+    {SceneSection::kSpheres, sizeof(SceneSphere), gsl::as_bytes(scene.spheres)},
+    {SceneSection::kSphereMaterials, sizeof(std::uint32_t),
+     gsl::as_bytes(scene.sphereMaterials)},
+    {SceneSection::kMaterials, sizeof(SceneMaterial),
+     gsl::as_bytes(scene.materials)},
+    {SceneSection::kInstances, sizeof(SceneInstance),
+     gsl::as_bytes(scene.instances)},
+    {SceneSection::kChunks, sizeof(SceneChunk), gsl::as_bytes(scene.chunks)},
+  }};
+
+  std::vector<SectionSource> nonEmpty;
+  for (auto&& source : sources) {
+    if (!source.bytes.empty()) nonEmpty.push_back(source);
+  }
+  return nonEmpty;
+} // SectionSources
+
+} // namespace
+
+tl::expected<SceneView, std::system_error>
+ValidateSceneFile(gsl::span<std::byte const> bytes) noexcept {
+  auto const size = static_cast<std::uint64_t>(bytes.size());
+  if (size < sizeof(SceneFileHeader)) {
+    return tl::unexpected(FormatError("truncated header"));
+  }
+
+  SceneFileHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  if (header.magic != kSceneFileMagic) {
+    return tl::unexpected(FormatError("bad magic"));
+  }
+  if (header.version != kSceneFileVersion) {
+    return tl::unexpected(FormatError(
+      "unsupported version " + std::to_string(header.version)));
+  }
+  if (header.fileSize != size) {
+    return tl::unexpected(FormatError("size does not match header"));
+  }
+
+  std::uint64_t const tableEnd =
+    sizeof(SceneFileHeader) +
+    std::uint64_t{header.sectionCount} * sizeof(SceneSectionHeader);
+  if (tableEnd > size) {
+    return tl::unexpected(FormatError("truncated section table"));
+  }
+
+  // The mapping is page aligned, so aligned offsets give aligned records.
+  auto const* sections = reinterpret_cast<SceneSectionHeader const*>(
+    bytes.data() + sizeof(SceneFileHeader));
+
+  SceneView view;
+  for (std::uint32_t i = 0; i < header.sectionCount; ++i) {
+    SceneSectionHeader const& section = sections[i];
+    std::string const name = to_string(section.type);
+
+    if (section.offset % kSceneSectionAlignment != 0 ||
+        section.offset < tableEnd) {
+      return tl::unexpected(FormatError(name + " section is misplaced"));
+    }
+    if (section.stride == 0 ||
+        section.count > (size - std::min(size, section.offset)) /
+                          section.stride) {
+      return tl::unexpected(FormatError(name + " section is truncated"));
+    }
+
+    bool matches = true;
+    switch (section.type) {
+    case SceneSection::kSpheres:
+      matches = AssignSection(view.spheres, section, bytes.data());
+      break;
+    case SceneSection::kSphereMaterials:
+      matches = AssignSection(view.sphereMaterials, section, bytes.data());
+      break;
+    case SceneSection::kMaterials:
+      matches = AssignSection(view.materials, section, bytes.data());
+      break;
+    case SceneSection::kInstances:
+      matches = AssignSection(view.instances, section, bytes.data());
+      break;
+    case SceneSection::kChunks:
+      matches = AssignSection(view.chunks, section, bytes.data());
+      break;
+    default: break;
+    }
+
+    if (!matches) {
+      return tl::unexpected(FormatError(name + " section has wrong stride"));
+    }
+  }
+
+  if (!view.sphereMaterials.empty() &&
+      view.sphereMaterials.size() != view.spheres.size()) {
+    return tl::unexpected(
+      FormatError("sphere material count does not match sphere count"));
+  }
+
+  auto const sphereCount = static_cast<std::uint64_t>(view.spheres.size());
+  for (auto&& chunk : view.chunks) {
+    if (chunk.firstSphere > sphereCount ||
+        chunk.sphereCount > sphereCount - chunk.firstSphere) {
+      return tl::unexpected(FormatError("chunk sphere range out of bounds"));
+    }
+  }
+
+  return view;
+} // ValidateSceneFile
+
+tl::expected<SceneFile, std::system_error>
+SceneFile::Open(gsl::czstring path) noexcept {
+  auto file = MappedFile::Open(path);
+  if (!file) return tl::unexpected(file.error());
+
+  auto view = ValidateSceneFile(file->bytes());
+  if (!view) return tl::unexpected(view.error());
+
+  SceneFile scene;
+  scene.file_ = std::move(*file);
+  scene.view_ = *view;
+  return scene;
+} // SceneFile::Open
+
+std::uint64_t SceneFileLayout::Offset(SceneSection type) const noexcept {
+  for (auto&& section : sections) {
+    if (section.type == type) return section.offset;
+  }
+  return 0;
+} // SceneFileLayout::Offset
+
+SceneFileLayout LayoutSceneFile(SceneView const& scene) {
+  SceneSectionCounts counts;
+  counts.spheres = static_cast<std::uint64_t>(scene.spheres.size());
+  counts.sphereMaterials =
+    static_cast<std::uint64_t>(scene.sphereMaterials.size());
+  counts.materials = static_cast<std::uint64_t>(scene.materials.size());
+  counts.instances = static_cast<std::uint64_t>(scene.instances.size());
+  counts.chunks = static_cast<std::uint64_t>(scene.chunks.size());
+  return LayoutSceneFile(counts);
+} // LayoutSceneFile
+
+SceneFileLayout LayoutSceneFile(SceneSectionCounts const& counts) {
+  // File order, which SectionSources follows.
+  std::array<SceneSectionHeader, 5> const all = {{
+    {SceneSection::kSpheres, sizeof(SceneSphere), counts.spheres, 0, 0},
+    {SceneSection::kSphereMaterials, sizeof(std::uint32_t),
+     counts.sphereMaterials, 0, 0},
+    {SceneSection::kMaterials, sizeof(SceneMaterial), counts.materials, 0, 0},
+    {SceneSection::kInstances, sizeof(SceneInstance), counts.instances, 0, 0},
+    {SceneSection::kChunks, sizeof(SceneChunk), counts.chunks, 0, 0},
+  }};
+
+  SceneFileLayout layout;
+  for (auto&& section : all) {
+    if (section.count > 0) layout.sections.push_back(section);
+  }
+
+  layout.header.magic = kSceneFileMagic;
+  layout.header.version = kSceneFileVersion;
+  layout.header.sectionCount =
+    static_cast<std::uint32_t>(layout.sections.size());
+
+  std::uint64_t offset =
+    AlignUp(sizeof(SceneFileHeader) +
+            layout.sections.size() * sizeof(SceneSectionHeader));
+  for (auto&& section : layout.sections) {
+    section.offset = offset;
+    offset = AlignUp(offset + section.count * section.stride);
+  }
+  layout.header.fileSize = offset;
+
+  return layout;
+} // LayoutSceneFile
+
+tl::expected<void, std::system_error>
+WriteSceneFile(gsl::czstring path, SceneView const& scene) noexcept {
+  Expects(path != nullptr);
+
+  SceneFileLayout const layout = LayoutSceneFile(scene);
+  std::vector<SectionSource> const sources = SectionSources(scene);
+  SceneFileHeader const& header = layout.header;
+  auto const& sections = layout.sections;
+
+  std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
+    std::fopen(path, "wb"), &std::fclose);
+  if (!file) {
+    return tl::unexpected(std::system_error(
+      std::error_code(errno, std::generic_category()), "fopen"));
+  }
+
+  std::uint64_t written = 0;
+  auto write = [&](void const* data, std::size_t size) {
+    if (size == 0) return true;
+    written += size;
+    return std::fwrite(data, 1, size, file.get()) == size;
+  };
+
+  std::array<std::byte, kSceneSectionAlignment> const padding = {};
+  auto pad = [&] {
+    return write(padding.data(), static_cast<std::size_t>(AlignUp(written) -
+                                                          written));
+  };
+
+  bool ok = write(&header, sizeof(header)) &&
+            write(sections.data(),
+                  sections.size() * sizeof(SceneSectionHeader)) &&
+            pad();
+  for (std::size_t i = 0; ok && i < sources.size(); ++i) {
+    auto const bytes = sources[i].bytes;
+    ok = write(bytes.data(), static_cast<std::size_t>(bytes.size())) && pad();
+  }
+
+  if (!ok || std::fflush(file.get()) != 0) {
+    return tl::unexpected(std::system_error(
+      std::error_code(errno, std::generic_category()), "fwrite"));
+  }
+
+  Ensures(written == header.fileSize);
+  return {};
+} // WriteSceneFile
+
+tl::expected<SceneData, std::system_error> ParseSceneText(std::istream& in) {
+  SceneData scene;
+  bool anySphereMaterial = false;
+
+  std::string line;
+  for (std::uint64_t lineNumber = 1; std::getline(in, line); ++lineNumber) {
+    if (auto comment = line.find('#'); comment != std::string::npos) {
+      line.erase(comment);
+    }
+
+    std::istringstream fields(line);
+    std::string keyword;
+    if (!(fields >> keyword)) continue;
+
+    auto fail = [&](char const* what) {
+      return tl::unexpected(FormatError(
+        "line " + std::to_string(lineNumber) + ": " + what));
+    };
+
+    if (keyword == "material") {
+      std::string type;
+      SceneMaterial material = {};
+      if (!(fields >> type >> material.albedo[0] >> material.albedo[1] >>
+            material.albedo[2])) {
+        return fail("expected material type r g b [param]");
+      }
+      if (!(fields >> material.param)) material.param = 0.f;
+
+      if (type == "lambertian") {
+        material.type = SceneMaterialType::kLambertian;
+      } else if (type == "metal") {
+        material.type = SceneMaterialType::kMetal;
+      } else if (type == "dielectric") {
+        material.type = SceneMaterialType::kDielectric;
+      } else if (type == "emissive") {
+        material.type = SceneMaterialType::kEmissive;
+      } else {
+        return fail("unknown material type");
+      }
+
+      scene.materials.push_back(material);
+    } else if (keyword == "sphere") {
+      float x, y, z, radius;
+      if (!(fields >> x >> y >> z >> radius) || !(radius > 0.f)) {
+        return fail("expected sphere x y z radius [material]");
+      }
+
+      std::uint32_t material = 0;
+      if (fields >> material) {
+        if (material >= scene.materials.size()) {
+          return fail("sphere names an undefined material");
+        }
+        anySphereMaterial = true;
+      }
+
+      scene.spheres.push_back(
+        {{x - radius, y - radius, z - radius}, {x + radius, y + radius,
+                                               z + radius}});
+      scene.sphereMaterials.push_back(material);
+    } else if (keyword == "instance") {
+      SceneInstance instance = {};
+      if (!(fields >> instance.firstSphere >> instance.sphereCount >>
+            instance.material >> instance.mask)) {
+        return fail("expected instance firstSphere sphereCount material mask");
+      }
+      for (auto&& row : instance.transform) {
+        for (auto&& element : row) {
+          if (!(fields >> element)) return fail("expected 12 transform values");
+        }
+      }
+      scene.instances.push_back(instance);
+    } else {
+      return fail("unknown keyword");
+    }
+  }
+
+  for (auto&& instance : scene.instances) {
+    if (std::uint64_t{instance.firstSphere} + instance.sphereCount >
+        scene.spheres.size()) {
+      return tl::unexpected(FormatError("instance sphere range out of bounds"));
+    }
+  }
+
+  if (!anySphereMaterial) scene.sphereMaterials.clear();
+  return scene;
+} // ParseSceneText
@@ -0,0 +1,204 @@
+#ifndef SCENE_FILE_HPP_
+#define SCENE_FILE_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "mapped_file.hpp"
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <system_error>
+#include <vector>
+
+//
+// Versioned binary scene file. A fixed header is followed by a table of
+// section headers and the sections themselves, each starting on a
+// kSceneSectionAlignment boundary and holding tightly packed records in the
+// layout the renderer uploads. Loading maps the file and hands out spans
+// into the mapping: there is no parse step and no intermediate copy, so the
+// sphere section can be memcpy'd straight into a staging buffer.
+//
+// All fields are little-endian. A reader of the wrong endianness or version
+// fails the version check rather than misreading the file. Unknown section
+// types are skipped so later versions can add sections.
+//
+
+inline constexpr std::array<char, 8> kSceneFileMagic = {'S', 'P', 'H', 'S',
+                                                        'C', 'E', 'N', 'E'};
+inline constexpr std::uint32_t kSceneFileVersion = 1;
+inline constexpr std::uint64_t kSceneSectionAlignment = 64;
+
+enum class SceneSection : std::uint32_t {
+  kSpheres = 1,         // SceneSphere
+  kSphereMaterials = 2, // std::uint32_t material index per sphere
+  kMaterials = 3,       // SceneMaterial
+  kInstances = 4,       // SceneInstance
+  kChunks = 5,          // SceneChunk
+};
+
+[[nodiscard]] gsl::czstring to_string(SceneSection section) noexcept;
+
+// Same layout as Sphere in 01_sphere.cpp and the shaders' SphereBuffer.
+struct SceneSphere {
+  float aabbMin[3];
+  float aabbMax[3];
+}; // struct SceneSphere
+
+enum class SceneMaterialType : std::uint32_t {
+  kLambertian = 0,
+  kMetal = 1,
+  kDielectric = 2,
+  kEmissive = 3,
+};
+
+[[nodiscard]] gsl::czstring to_string(SceneMaterialType type) noexcept;
+
+struct SceneMaterial {
+  float albedo[3];
+  float param; // metal fuzz or dielectric index of refraction
+  SceneMaterialType type;
+  std::uint32_t reserved[3];
+}; // struct SceneMaterial
+
+// A 3x4 row-major transform applied to a range of the sphere section, in the
+// layout of VkGeometryInstanceNV's transform.
+struct SceneInstance {
+  float transform[3][4];
+  std::uint32_t firstSphere;
+  std::uint32_t sphereCount;
+  std::uint32_t material;
+  std::uint32_t mask;
+}; // struct SceneInstance
+
+// A spatially coherent range of the sphere section, written by
+// PartitionSceneIntoChunks so the range can be streamed in on its own.
+struct SceneChunk {
+  float boundsMin[3];
+  float boundsMax[3];
+  std::uint64_t firstSphere;
+  std::uint64_t sphereCount;
+}; // struct SceneChunk
+
+struct SceneFileHeader {
+  std::array<char, 8> magic;
+  std::uint32_t version;
+  std::uint32_t sectionCount;
+  std::uint64_t fileSize;
+  std::uint64_t reserved[5];
+}; // struct SceneFileHeader
+
+struct SceneSectionHeader {
+  SceneSection type;
+  std::uint32_t stride; // bytes per record
+  std::uint64_t count;  // records
+  std::uint64_t offset; // from the start of the file
+  std::uint64_t reserved;
+}; // struct SceneSectionHeader
+
+static_assert(sizeof(SceneSphere) == 24);
+static_assert(sizeof(SceneMaterial) == 32);
+static_assert(sizeof(SceneInstance) == 64);
+static_assert(sizeof(SceneChunk) == 40);
+static_assert(sizeof(SceneFileHeader) == 64);
+static_assert(sizeof(SceneSectionHeader) == 32);
+
+// Non-owning view of a scene, as written by WriteSceneFile.
+struct SceneView {
+  gsl::span<SceneSphere const> spheres{};
+  gsl::span<std::uint32_t const> sphereMaterials{};
+  gsl::span<SceneMaterial const> materials{};
+  gsl::span<SceneInstance const> instances{};
+  gsl::span<SceneChunk const> chunks{};
+}; // struct SceneView
+
+// Owning scene, as produced by ParseSceneText.
+struct SceneData {
+  std::vector<SceneSphere> spheres{};
+  std::vector<std::uint32_t> sphereMaterials{};
+  std::vector<SceneMaterial> materials{};
+  std::vector<SceneInstance> instances{};
+  std::vector<SceneChunk> chunks{};
+
+  [[nodiscard]] SceneView View() const noexcept {
+    return {spheres, sphereMaterials, materials, instances, chunks};
+  }
+}; // struct SceneData
+
+//
+// A scene file mapped into memory. The spans stay valid for the lifetime of
+// the SceneFile; moving it does not move the mapping.
+//
+class SceneFile {
+public:
+  [[nodiscard]] static tl::expected<SceneFile, std::system_error>
+  Open(gsl::czstring path) noexcept;
+
+  [[nodiscard]] SceneView View() const noexcept { return view_; }
+  [[nodiscard]] gsl::span<SceneSphere const> Spheres() const noexcept {
+    return view_.spheres;
+  }
+  [[nodiscard]] gsl::span<std::byte const> SphereBytes() const noexcept {
+    return gsl::as_bytes(view_.spheres);
+  }
+
+  [[nodiscard]] MappedFile const& Mapping() const noexcept { return file_; }
+
+  // Offset of the sphere section in the file, for reading parts of it
+  // without touching the mapping.
+  [[nodiscard]] std::uint64_t SphereOffset() const noexcept {
+    return view_.spheres.empty()
+             ? 0
+             : static_cast<std::uint64_t>(SphereBytes().data() -
+                                          file_.data());
+  }
+
+private:
+  MappedFile file_{};
+  SceneView view_{};
+}; // class SceneFile
+
+// Check that bytes hold a well-formed scene file and return views into it.
+[[nodiscard]] tl::expected<SceneView, std::system_error>
+ValidateSceneFile(gsl::span<std::byte const> bytes) noexcept;
+
+// Record counts of a scene's sections.
+struct SceneSectionCounts {
+  std::uint64_t spheres{0};
+  std::uint64_t sphereMaterials{0};
+  std::uint64_t materials{0};
+  std::uint64_t instances{0};
+  std::uint64_t chunks{0};
+}; // struct SceneSectionCounts
+
+// Header and section table of the file WriteSceneFile writes for scene.
+// Only the section sizes are used, so writers that produce the section
+// contents piecewise can lay the file out up front.
+struct SceneFileLayout {
+  SceneFileHeader header{};
+  std::vector<SceneSectionHeader> sections{};
+
+  // 0 for a section that is not present.
+  [[nodiscard]] std::uint64_t Offset(SceneSection type) const noexcept;
+}; // struct SceneFileLayout
+
+[[nodiscard]] SceneFileLayout LayoutSceneFile(SceneView const& scene);
+[[nodiscard]] SceneFileLayout
+LayoutSceneFile(SceneSectionCounts const& counts);
+
+[[nodiscard]] tl::expected<void, std::system_error>
+WriteSceneFile(gsl::czstring path, SceneView const& scene) noexcept;
+
+//
+// Text form, one record per line, '#' starts a comment:
+//
+//   material lambertian|metal|dielectric|emissive r g b [param]
+//   sphere x y z radius [material]
+//   instance firstSphere sphereCount material mask m00 m01 ... m23
+//
+// Materials are numbered in the order they appear. The sphere material
+// section is only written if some sphere names a material.
+//
+[[nodiscard]] tl::expected<SceneData, std::system_error>
+ParseSceneText(std::istream& in);
+
+#endif // SCENE_FILE_HPP_
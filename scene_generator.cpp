@@ -0,0 +1,432 @@
+#include "scene_generator.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+gsl::czstring to_string(SceneDistribution distribution) noexcept {
+  switch (distribution) {
+  case SceneDistribution::kWeekend: return "weekend";
+  case SceneDistribution::kUniform: return "uniform";
+  case SceneDistribution::kClustered: return "clustered";
+  }
+  return "unknown";
+} // to_string
+
+bool FromString(gsl::czstring name, SceneDistribution& distribution) noexcept {
+  for (auto candidate :
+       {SceneDistribution::kWeekend, SceneDistribution::kUniform,
+        SceneDistribution::kClustered}) {
+    if (std::strcmp(name, to_string(candidate)) == 0) {
+      distribution = candidate;
+      return true;
+    }
+  }
+  return false;
+} // FromString
+
+namespace {
+
+// Independent random streams per purpose, so e.g. the random numbers of
+// cluster 5 are unrelated to those of sphere 5.
+enum class Stream : std::uint64_t {
+  kSphere = 1,
+  kCluster = 2,
+  kMaterial = 3,
+};
+
+// SplitMix64 finalizer.
+constexpr std::uint64_t Mix(std::uint64_t x) noexcept {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  x ^= x >> 31;
+  return x;
+} // Mix
+
+// SplitMix64 started from a hash of (seed, stream, index), so the numbers
+// drawn for an index do not depend on any other index.
+class Random {
+public:
+  Random(std::uint64_t seed, Stream stream, std::uint64_t index) noexcept
+    : state_(Mix(Mix(seed ^ Mix(static_cast<std::uint64_t>(stream))) ^
+                 index)) {}
+
+  std::uint64_t Next() noexcept {
+    state_ += 0x9E3779B97F4A7C15ull;
+    return Mix(state_);
+  }
+
+  // Uniform in [0, 1).
+  float Float() noexcept {
+    return static_cast<float>(Next() >> 40) * (1.f / 16777216.f);
+  }
+
+  // Uniform in [0, count).
+  std::uint64_t Below(std::uint64_t count) noexcept { return Next() % count; }
+
+private:
+  std::uint64_t state_;
+}; // class Random
+
+constexpr float kPi = 3.14159265358979f;
+
+// Materials spheres pick from at random, in the proportions of the RTiOW
+// final scene: 80% diffuse, 15% metal, 5% glass.
+constexpr std::uint32_t kPaletteSize = 256;
+
+// The ground and three large spheres of the RTiOW final scene, and their
+// materials, which precede the palette.
+constexpr std::uint32_t kWeekendFixedCount = 4;
+
+constexpr std::uint64_t kSpheresPerCluster = 4096;
+
+// Below this many spheres per thread, starting threads costs more than it
+// saves.
+constexpr std::uint64_t kMinSpheresPerThread = 16384;
+
+// Spheres generated per block by WriteGeneratedScene: 24 MiB of spheres.
+constexpr std::uint64_t kWriteBlockSpheres = std::uint64_t{1} << 20;
+
+SceneMaterial MakeMaterial(SceneMaterialType type, float r, float g, float b,
+                           float param) noexcept {
+  SceneMaterial material = {};
+  material.albedo[0] = r;
+  material.albedo[1] = g;
+  material.albedo[2] = b;
+  material.param = param;
+  material.type = type;
+  return material;
+} // MakeMaterial
+
+std::uint32_t PaletteOffset(SceneDistribution distribution) noexcept {
+  return distribution == SceneDistribution::kWeekend ? kWeekendFixedCount : 0;
+} // PaletteOffset
+
+SceneSphere MakeSphere(float x, float y, float z, float radius) noexcept {
+  return {{x - radius, y - radius, z - radius},
+          {x + radius, y + radius, z + radius}};
+} // MakeSphere
+
+// Side of the cube the uniform and clustered distributions fill, growing
+// with the sphere count so the density is the same at any count.
+float CubeSide(std::uint64_t sphereCount) noexcept {
+  return 2.f * static_cast<float>(std::cbrt(static_cast<double>(sphereCount)));
+} // CubeSide
+
+// Per-scene constants, computed once rather than per sphere.
+struct Layout {
+  // kWeekend: small sphere grid side and ground radius.
+  std::uint64_t grid{0};
+  double groundRadius{0.0};
+  // kUniform and kClustered.
+  float side{0.f};
+  std::uint64_t clusterCount{0};
+  float clusterSigma{0.f};
+}; // struct Layout
+
+Layout MakeLayout(SceneGeneratorParams const& params) noexcept {
+  Layout layout;
+  std::uint64_t const count = params.sphereCount;
+
+  if (params.distribution == SceneDistribution::kWeekend) {
+    std::uint64_t const small =
+      count > kWeekendFixedCount ? count - kWeekendFixedCount : 0;
+    auto& grid = layout.grid;
+    grid = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(small)));
+    while (grid * grid < small) ++grid;
+    // The grid's corners are grid / sqrt(2) from the origin, where the
+    // ground has dropped by about grid / 16 below the small spheres' plane.
+    layout.groundRadius = std::max(1000.0, 4.0 * static_cast<double>(grid));
+  } else {
+    layout.side = CubeSide(count);
+    layout.clusterCount =
+      std::max<std::uint64_t>(1, (count + kSpheresPerCluster - 1) /
+                                   kSpheresPerCluster);
+    float const spacing =
+      layout.side /
+      static_cast<float>(std::cbrt(static_cast<double>(layout.clusterCount)));
+    layout.clusterSigma = .15f * spacing;
+  }
+  return layout;
+} // MakeLayout
+
+void GenerateWeekend(SceneGeneratorParams const& params, Layout const& layout,
+                     std::uint64_t index, SceneSphere& sphere,
+                     std::uint32_t& material) noexcept {
+  constexpr float kBigX[3] = {0.f, -4.f, 4.f};
+  constexpr float kSmallRadius = .2f;
+
+  if (index == 0) {
+    auto const radius = static_cast<float>(layout.groundRadius);
+    sphere = MakeSphere(0.f, -radius, 0.f, radius);
+    material = 0;
+    return;
+  }
+  if (index < kWeekendFixedCount) {
+    sphere = MakeSphere(kBigX[index - 1], 1.f, 0.f, 1.f);
+    material = static_cast<std::uint32_t>(index);
+    return;
+  }
+
+  Random random(params.seed, Stream::kSphere, index);
+  std::uint64_t const cell = index - kWeekendFixedCount;
+  auto const half = static_cast<float>(layout.grid / 2);
+  float x = static_cast<float>(cell % layout.grid) - half;
+  float z = static_cast<float>(cell / layout.grid) - half;
+  x += .9f * random.Float();
+  z += .9f * random.Float();
+
+  // Move small spheres that would intersect a large one out of it.
+  for (float bigX : kBigX) {
+    float const dx = x - bigX;
+    float const distance = std::sqrt(dx * dx + z * z);
+    float const minimum = 1.f + kSmallRadius;
+    if (distance >= minimum) continue;
+    if (distance > 0.f) {
+      x = bigX + dx * (minimum / distance);
+      z = z * (minimum / distance);
+    } else {
+      x = bigX + minimum;
+    }
+  }
+
+  // Rest on the curved ground: sqrt(R^2 - d^2) - R, in a form that does not
+  // cancel for large R.
+  double const d2 = static_cast<double>(x) * x + static_cast<double>(z) * z;
+  double const R = layout.groundRadius;
+  double const height = -d2 / (std::sqrt(std::max(R * R - d2, 0.0)) + R);
+  float const y = static_cast<float>(height) + kSmallRadius;
+
+  sphere = MakeSphere(x, y, z, kSmallRadius);
+  material = kWeekendFixedCount +
+             static_cast<std::uint32_t>(random.Below(kPaletteSize));
+} // GenerateWeekend
+
+void GenerateUniform(SceneGeneratorParams const& params, Layout const& layout,
+                     std::uint64_t index, SceneSphere& sphere,
+                     std::uint32_t& material) noexcept {
+  Random random(params.seed, Stream::kSphere, index);
+  float const x = (random.Float() - .5f) * layout.side;
+  float const y = (random.Float() - .5f) * layout.side;
+  float const z = (random.Float() - .5f) * layout.side;
+  float const radius = .1f + .3f * random.Float();
+
+  sphere = MakeSphere(x, y, z, radius);
+  material = static_cast<std::uint32_t>(random.Below(kPaletteSize));
+} // GenerateUniform
+
+void GenerateClustered(SceneGeneratorParams const& params,
+                       Layout const& layout, std::uint64_t index,
+                       SceneSphere& sphere, std::uint32_t& material) noexcept {
+  Random random(params.seed, Stream::kSphere, index);
+  std::uint64_t const cluster = random.Below(layout.clusterCount);
+
+  Random clusterRandom(params.seed, Stream::kCluster, cluster);
+  float center[3];
+  for (auto&& c : center) c = (clusterRandom.Float() - .5f) * layout.side;
+
+  // Box-Muller: two pairs of uniforms give three normal offsets.
+  float offset[4];
+  for (int i = 0; i < 4; i += 2) {
+    float const r =
+      std::sqrt(-2.f * std::log(1.f - random.Float())) * layout.clusterSigma;
+    float const theta = 2.f * kPi * random.Float();
+    offset[i] = r * std::cos(theta);
+    offset[i + 1] = r * std::sin(theta);
+  }
+  float const radius = .05f + .15f * random.Float();
+
+  sphere = MakeSphere(center[0] + offset[0], center[1] + offset[1],
+                      center[2] + offset[2], radius);
+  // Spheres in a cluster share a material.
+  material = static_cast<std::uint32_t>(clusterRandom.Below(kPaletteSize));
+} // GenerateClustered
+
+void GenerateRange(SceneGeneratorParams const& params, Layout const& layout,
+                   std::uint64_t first, gsl::span<SceneSphere> spheres,
+                   gsl::span<std::uint32_t> sphereMaterials,
+                   std::uint64_t begin, std::uint64_t end) noexcept {
+  bool const writeMaterials = !sphereMaterials.empty();
+  std::uint32_t material = 0;
+
+  for (std::uint64_t i = begin; i < end; ++i) {
+    auto& sphere = spheres[static_cast<gsl::index>(i)];
+    std::uint64_t const index = first + i;
+
+    switch (params.distribution) {
+    case SceneDistribution::kWeekend:
+      GenerateWeekend(params, layout, index, sphere, material);
+      break;
+    case SceneDistribution::kUniform:
+      GenerateUniform(params, layout, index, sphere, material);
+      break;
+    case SceneDistribution::kClustered:
+      GenerateClustered(params, layout, index, sphere, material);
+      break;
+    }
+
+    if (writeMaterials) {
+      sphereMaterials[static_cast<gsl::index>(i)] = material;
+    }
+  }
+} // GenerateRange
+
+} // namespace
+
+std::vector<SceneMaterial>
+GenerateSceneMaterials(SceneGeneratorParams const& params) {
+  std::vector<SceneMaterial> materials;
+
+  if (params.distribution == SceneDistribution::kWeekend) {
+    materials.push_back(
+      MakeMaterial(SceneMaterialType::kLambertian, .5f, .5f, .5f, 0.f));
+    materials.push_back(
+      MakeMaterial(SceneMaterialType::kDielectric, 1.f, 1.f, 1.f, 1.5f));
+    materials.push_back(
+      MakeMaterial(SceneMaterialType::kLambertian, .4f, .2f, .1f, 0.f));
+    materials.push_back(
+      MakeMaterial(SceneMaterialType::kMetal, .7f, .6f, .5f, 0.f));
+  }
+  Ensures(materials.size() == PaletteOffset(params.distribution));
+
+  for (std::uint32_t i = 0; i < kPaletteSize; ++i) {
+    Random random(params.seed, Stream::kMaterial, i);
+    float const choose = random.Float();
+
+    if (choose < .8f) {
+      float albedo[3];
+      for (auto&& c : albedo) c = random.Float() * random.Float();
+      materials.push_back(MakeMaterial(SceneMaterialType::kLambertian,
+                                       albedo[0], albedo[1], albedo[2], 0.f));
+    } else if (choose < .95f) {
+      float albedo[3];
+      for (auto&& c : albedo) c = .5f + .5f * random.Float();
+      float const fuzz = .5f * random.Float();
+      materials.push_back(MakeMaterial(SceneMaterialType::kMetal, albedo[0],
+                                       albedo[1], albedo[2], fuzz));
+    } else {
+      materials.push_back(
+        MakeMaterial(SceneMaterialType::kDielectric, 1.f, 1.f, 1.f, 1.5f));
+    }
+  }
+
+  return materials;
+} // GenerateSceneMaterials
+
+void GenerateSpheres(SceneGeneratorParams const& params, std::uint64_t first,
+                     gsl::span<SceneSphere> spheres,
+                     gsl::span<std::uint32_t> sphereMaterials) {
+  auto const count = static_cast<std::uint64_t>(spheres.size());
+  Expects(first + count <= params.sphereCount);
+  Expects(sphereMaterials.empty() || sphereMaterials.size() == spheres.size());
+
+  Layout const layout = MakeLayout(params);
+
+  std::uint64_t threadCount = params.threadCount > 0
+                                ? params.threadCount
+                                : std::thread::hardware_concurrency();
+  threadCount = std::clamp<std::uint64_t>(
+    threadCount, 1,
+    std::max<std::uint64_t>(1, count / kMinSpheresPerThread));
+
+  // Each sphere depends only on its index, so how the range is split does
+  // not change the output.
+  auto range = [&](std::uint64_t t) {
+    GenerateRange(params, layout, first, spheres, sphereMaterials,
+                  count * t / threadCount, count * (t + 1) / threadCount);
+  };
+
+  std::vector<std::thread> threads;
+  std::uint64_t t = 1;
+  try {
+    for (; t < threadCount; ++t) threads.emplace_back(range, t);
+  } catch (std::system_error const&) {
+    // Out of threads: generate the remaining ranges here.
+    for (; t < threadCount; ++t) range(t);
+  }
+  range(0);
+  for (auto&& thread : threads) thread.join();
+} // GenerateSpheres
+
+tl::expected<void, std::system_error>
+WriteGeneratedScene(gsl::czstring path,
+                    SceneGeneratorParams const& params) noexcept {
+  Expects(path != nullptr);
+  Expects(params.sphereCount > 0);
+
+  auto fail = [](char const* what) {
+    return tl::unexpected(std::system_error(
+      std::error_code(errno, std::generic_category()), what));
+  };
+
+  try {
+    std::vector<SceneMaterial> const materials =
+      GenerateSceneMaterials(params);
+
+    SceneSectionCounts counts;
+    counts.spheres = params.sphereCount;
+    counts.sphereMaterials = params.sphereCount;
+    counts.materials = materials.size();
+    SceneFileLayout const layout = LayoutSceneFile(counts);
+
+    std::unique_ptr<std::FILE, decltype(&std::fclose)> file(
+      std::fopen(path, "wb"), &std::fclose);
+    if (!file) return fail("fopen");
+
+    // Materials are the last section; pad the file out to its size.
+    std::uint64_t const materialsOffset =
+      layout.Offset(SceneSection::kMaterials);
+    std::uint64_t const end =
+      materialsOffset + materials.size() * sizeof(SceneMaterial);
+    std::vector<std::byte> const padding(
+      static_cast<std::size_t>(layout.header.fileSize - end));
+
+    bool ok =
+      WriteFileAt(file.get(), 0, &layout.header, sizeof(layout.header)) &&
+      WriteFileAt(file.get(), sizeof(layout.header), layout.sections.data(),
+                  layout.sections.size() * sizeof(SceneSectionHeader)) &&
+      WriteFileAt(file.get(), materialsOffset, materials.data(),
+                  materials.size() * sizeof(SceneMaterial)) &&
+      WriteFileAt(file.get(), end, padding.data(), padding.size());
+
+    std::uint64_t const spheresOffset = layout.Offset(SceneSection::kSpheres);
+    std::uint64_t const sphereMaterialsOffset =
+      layout.Offset(SceneSection::kSphereMaterials);
+
+    auto const blockSize = static_cast<std::size_t>(
+      std::min(kWriteBlockSpheres, params.sphereCount));
+    std::vector<SceneSphere> spheres(blockSize);
+    std::vector<std::uint32_t> sphereMaterials(blockSize);
+
+    for (std::uint64_t first = 0; ok && first < params.sphereCount;
+         first += blockSize) {
+      auto const size = static_cast<std::size_t>(
+        std::min<std::uint64_t>(blockSize, params.sphereCount - first));
+      gsl::span<SceneSphere> const sphereBlock(
+        spheres.data(), static_cast<gsl::index>(size));
+      gsl::span<std::uint32_t> const materialBlock(
+        sphereMaterials.data(), static_cast<gsl::index>(size));
+
+      GenerateSpheres(params, first, sphereBlock, materialBlock);
+
+      ok = WriteFileAt(file.get(), spheresOffset + first * sizeof(SceneSphere),
+                       spheres.data(), size * sizeof(SceneSphere)) &&
+           WriteFileAt(file.get(),
+                       sphereMaterialsOffset + first * sizeof(std::uint32_t),
+                       sphereMaterials.data(), size * sizeof(std::uint32_t));
+    }
+
+    if (!ok || std::fflush(file.get()) != 0) return fail("fwrite");
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "generate scene"));
+  }
+
+  return {};
+} // WriteGeneratedScene
@@ -0,0 +1,69 @@
+#ifndef SCENE_GENERATOR_HPP_
+#define SCENE_GENERATOR_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "scene_file.hpp"
+#include <cstdint>
+#include <system_error>
+#include <vector>
+
+//
+// Seeded procedural scenes of any size for scaling benchmarks:
+//
+//   kWeekend   the "Ray Tracing in One Weekend" final scene: a ground
+//              sphere, three large spheres and a grid of small jittered
+//              spheres grown to the sphere count. The ground sphere grows
+//              with the grid and the small spheres rest on its surface.
+//   kUniform   spheres uniformly distributed in a cube sized for constant
+//              density.
+//   kClustered Gaussian clusters of about 4096 spheres around cluster
+//              centers uniformly distributed in the same cube.
+//
+// Every sphere is a pure function of (distribution, count, seed, index):
+// its random numbers come from a counter-based generator keyed by its
+// index, not from a sequence shared with the spheres before it. Any range
+// of spheres can be generated on its own, and the output is bit-identical
+// whatever the thread count or block size.
+//
+
+enum class SceneDistribution : std::uint32_t {
+  kWeekend = 0,
+  kUniform = 1,
+  kClustered = 2,
+};
+
+[[nodiscard]] gsl::czstring to_string(SceneDistribution distribution) noexcept;
+
+// Inverse of to_string; false if name is not a distribution.
+[[nodiscard]] bool FromString(gsl::czstring name,
+                              SceneDistribution& distribution) noexcept;
+
+struct SceneGeneratorParams {
+  SceneDistribution distribution{SceneDistribution::kWeekend};
+  std::uint64_t sphereCount{1'000'000};
+  std::uint64_t seed{1};
+  // 0 for std::thread::hardware_concurrency.
+  std::uint32_t threadCount{0};
+}; // struct SceneGeneratorParams
+
+// The material table the generated material indices refer to. It depends
+// only on the distribution and seed.
+[[nodiscard]] std::vector<SceneMaterial>
+GenerateSceneMaterials(SceneGeneratorParams const& params);
+
+// Generate spheres [first, first + spheres.size()) of the scene into
+// spheres, which may be a mapped buffer in the renderer's Sphere layout,
+// and their material indices into sphereMaterials unless it is empty.
+// Work is split across params.threadCount threads.
+void GenerateSpheres(SceneGeneratorParams const& params, std::uint64_t first,
+                     gsl::span<SceneSphere> spheres,
+                     gsl::span<std::uint32_t> sphereMaterials = {});
+
+// Write the whole scene as a scene file, generating it a block at a time
+// so memory use does not grow with the sphere count.
+[[nodiscard]] tl::expected<void, std::system_error>
+WriteGeneratedScene(gsl::czstring path,
+                    SceneGeneratorParams const& params) noexcept;
+
+#endif // SCENE_GENERATOR_HPP_
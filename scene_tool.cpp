@@ -0,0 +1,3632 @@
+// Converts text scenes to the binary scene format, prints scene file
+// summaries and measures how fast scene files and BVH caches load.
+//
+//   scene_tool convert <scene.txt> <scene.bin>
+//   scene_tool info <scene.bin>
+//   scene_tool bench <scene.bin> [spheres]
+//   scene_tool bvh <scene.bin>
+//   scene_tool chunk <scene.bin> <chunked.bin> [spheres per chunk]
+//   scene_tool stream <chunked.bin> [budget MiB]
+//   scene_tool generate <weekend|uniform|clustered> <spheres> <scene.bin>
+//                       [seed] [threads]
+//   scene_tool cull <scene.bin> [margin]
+//   scene_tool mesh <mesh.obj> [rays] [threads]
+//   scene_tool instance <mesh.obj> [instances] [float32|float16|snorm16]
+//   scene_tool trace <scene.bin> [rays]
+//   scene_tool render <scene.bin> <image.ppm> [width height] [workers]
+//                     [address]
+//   scene_tool worker <scene.bin> <address> [slowdown]
+//   scene_tool serve <scene.bin> <address> [max batch]
+//   scene_tool load <scene.bin> <address> [clients] [requests]
+//                   [width height] [qoi|png|ppm]
+//   scene_tool stop <address>
+//   scene_tool export <scene.bin> <ring name> [frames] [width height]
+//   scene_tool capture <ring name> <prefix> [frames] [qoi|png|ppm]
+//   scene_tool video <scene.bin> <out|-> [frames] [width height]
+//                    [y4m|rgb24]
+//   scene_tool sampling <size> [max samples]
+//   scene_tool updates <scene.bin> [percent moving] [frames]
+//   scene_tool resolution <frames>
+//   scene_tool submits <frames>
+//   scene_tool queues
+//   scene_tool ring <frames>
+//   scene_tool barriers
+//   scene_tool tonemap <frames>
+//   scene_tool sbt [records]
+//   scene_tool deletion <frames>
+//   scene_tool memory
+//
+// bench writes a synthetic file with the given number of spheres (10M by
+// default) if the file does not exist, then times opening it and copying
+// the sphere section out of the mapping into a staging-sized buffer, which
+// is the work CreateSpheresBuffer does. For cold cache numbers drop the
+// page cache between runs.
+//
+// bvh loads <scene.bin>.bvh, building and writing it if it is missing or
+// stale, and reports the cache load time against the full rebuild time.
+//
+// chunk partitions a scene into spatial chunks for streaming. stream flies
+// a camera through a chunked scene at 60 frames per second, streaming the
+// chunks it sees under the memory budget (256 MiB by default), and reports
+// the cache hit rate and read bandwidth.
+//
+// generate writes a procedural scene (see scene_generator.hpp) of any size;
+// the same seed gives the same file for any thread count.
+//
+// cull treats each chunk of a chunked scene, or else each sphere, as a TLAS
+// instance and frustum culls them along the stream camera path, reporting
+// the culled fraction and the SSE2 and scalar culling times.
+//
+// mesh loads an OBJ file, reporting the loader's throughput, and the bytes
+// per triangle of each vertex format. It then casts random rays at the
+// mesh through a CPU BVH, checks them against brute force, and checks the
+// 16-bit formats against the loaded positions: the largest position error
+// and how many rays hit the same triangle.
+//
+// instance adds a mesh to a MeshLibrary several times, as a scene naming
+// the same file for many placements would, together with a copy that
+// differs in one vertex, and checks only the copy is kept. It then places
+// the instances (100k by default) on a grid, packs their transforms with
+// SSE2 and scalar code, and reports the geometry memory of the instanced
+// scene against the scene flattened to a mesh per instance.
+//
+// trace fuzzes shader::IntersectSphere, the intersection shader's code,
+// against a double precision reference on random spheres and rays of
+// every scale, then traces random rays (100k by default) at the scene's
+// spheres through its BVH and checks them against brute force.
+//
+// render renders a still (1600x1200 by default) on the CPU with tile
+// workers: it starts 1, 2, 4 ... up to workers (the hardware thread count
+// by default) local scene_tool worker processes, reports the frame time
+// and scaling efficiency of each count, and checks every composited frame
+// against the same frame rendered in process. It then slows one worker
+// down fourfold and reports how the tiles were rebalanced, and writes the
+// frame to image.ppm. Workers connect to address (see message_socket.hpp),
+// unix:<image.ppm>.sock by default; worker runs one, on this machine or
+// another.
+//
+// serve runs a render server (see render_server.hpp) for the scene on the
+// CPU, batching up to max batch views (16 by default), until stop asks it
+// to shut down. load sends it views from several clients at once, 8
+// clients of 32 320x240 QOI views each by default, checks each image
+// against one rendered here and reports the latencies, the batch sizes and
+// the server's metrics.
+//
+// video renders frames (120 640x360 by default) turning round the scene on
+// the CPU and streams them as y4m, or raw rgb24, to a file or to stdout
+// (-) for an encoder to read, and reports the sustained frames/s and MB/s
+// and how long rendering waited on the output.
+//
+// sampling measures how the pixel sampler of sampling_shader.hpp converges
+// against white noise. Over every pixel of a size by size grid it
+// integrates an edge through the pixel, as a sphere's
+// silhouette puts there, and a Gaussian, each placed at random, with 1, 2,
+// 4 ... up to max samples (256 by default), and reports the RMS error of
+// both samplers, the samples white noise needs to match the sampler and
+// the rate each converges at. It also reports how strongly the errors of
+// neighbouring pixels correlate at one sample, which blue noise makes
+// negative, and how long the tables take to build.
+//
+// updates runs the motion of 01_sphere --animate over the scene's spheres,
+// 1 % of them moving each frame for 240 frames by default, through a
+// SphereStore (see sphere_store.hpp) merging ranges across gaps of 0, 1, 4,
+// 16 and 64 unchanged spheres, the last sphere moving every frame as well.
+// For each gap it reports the copy regions and bytes a frame uploads
+// against the whole sphere buffer, and the time spent marking and merging,
+// and checks a copy kept up to date through the ranges alone matches the
+// store. It also rewrites every sphere unchanged
+// and checks that uploads, and so refits, nothing.
+//
+// resolution drives the dynamic resolution controller (see
+// dynamic_resolution.hpp) with a synthetic trace of frames whose trace
+// time is a load, changing every quarter of the frames, times the scale
+// squared, with 5 % noise, completing 1 to kMaxFramesInFlight frames late.
+// Like 01_sphere it feeds the controller each frame once, as it completes,
+// and checks the scale settles within the first half of each load and
+// changes at most once more per load.
+//
+// submits replays the queue submits, acquires and presents of 01_sphere
+// through a SubmitGraph (see submit_graph.hpp), as its debug builds record
+// them, for an async compute family and a shared one, and checks the
+// graph finds no errors, with later frames waiting on their slot's TLAS
+// rebuild on the compute queue. It then injects one fault at a time, such
+// as the first frame not waiting for the acceleration structure build, and
+// checks the graph reports each.
+//
+// queues runs the queue family selection of 01_sphere (see
+// queue_selection.hpp) over family layouts devices report: a dedicated
+// compute family, a graphics family without compute, a single universal
+// family, families that cannot present and so on. It checks the families
+// chosen for graphics and for acceleration structure builds, and whether
+// the spheres then need ownership transfers between them.
+//
+// ring begins frames on a FrameRing (see frame_ring.hpp) of every size in
+// both latency modes against a stub queue that completes a frame only when
+// the CPU waits for it. It checks slots are taken in turn and that waiting
+// for each frame's waitSerial alone frees its slot and bounds the frames
+// in flight, and reports how many frames input runs ahead of the GPU.
+//
+// barriers records the barriers of both present paths (see
+// present_barriers.hpp) through a BarrierSink, prints them, and checks
+// their stage masks, access masks and layouts against a table written out
+// by hand. Independently of the table, it checks each image's layouts
+// chain from one barrier to the next, the swapchain image ends up
+// presentable, and its first barrier waits on the stage the acquire
+// semaphore is waited at.
+//
+// tonemap runs the SSE2 tonemap/upscale kernel (see tonemap.hpp), split
+// into bands of rows, against the scalar one over odd sizes, render scales,
+// filters and exposures, on radiance with NaN, infinite, negative and
+// overflowing texels mixed in, and checks they agree to within one LSB and
+// map NaN to 0 and overflow to 255. It then times both upscaling a 1080p
+// frame from a half resolution trace, frames times each.
+//
+// sbt fills shader binding tables of several fixed shapes with
+// ShaderBindingTableLayout (see shader_binding_table_layout.hpp), one of
+// them 01_sphere's, and generates the same tables with the
+// ShaderBindingTableGenerator from the same fake handle bytes, and checks
+// the offsets, strides and bytes match. It patches the inline data of a
+// few records of a generated table with UpdateInlineData and
+// WriteDirtyRecords in two rounds, staging each round's copy regions in a
+// slice of their own as 01_sphere does, and checks a copy updated through
+// the staged regions alone matches the table generated anew. It then
+// times rebuilding a table of records hit groups (100k by default), each
+// with its own inline data, into reserved storage and generating it from
+// queried handles, the CopyShaderData loop.
+//
+// deletion drives the deferred deletion of 01_sphere's RecreateSwapchain
+// (see deletion_queue.hpp) against a stub device for 1 to 3 frames in
+// flight, resizing every few frames. The stub's frames complete as the
+// CPU waits for them, and its presentation engine shows one present per
+// vblank, falling behind every third frame. The check fails if a
+// resource is destroyed while a pending frame uses it, if a swapchain is
+// destroyed while presents to it are queued or on screen, or if anything
+// is still live after shutdown beyond the current swapchain. It also
+// reports how often retiring swapchains on the frame fence alone would
+// have destroyed one too early.
+//
+// memory replays the allocations of 01_sphere, and a CPU BVH built over a
+// generated scene, through MemoryAccounting (see memory_accounting.hpp)
+// as a stub device, resizing once and shutting down. After every
+// allocation and free it checks each category's bytes, peak and count and
+// the device and host totals against sums kept alongside, then checks the
+// report holds them and the allocator's JSON, and that the totals peak
+// below the sum of the category peaks. It also allocates and frees from
+// several threads at once and checks the counts come back to 0.
+
+#include "bvh_cache.hpp"
+#include "chunk_stream.hpp"
+#include "cpu_renderer.hpp"
+#include "deletion_queue.hpp"
+#include "dynamic_resolution.hpp"
+#include "frame_ring.hpp"
+#include "image_encoding.hpp"
+#include "instance_culling.hpp"
+#include "memory_accounting.hpp"
+#include "mesh_instancing.hpp"
+#include "obj_loader.hpp"
+#include "present_barriers.hpp"
+#include "queue_selection.hpp"
+#include "render_server.hpp"
+#include "sample_tables.hpp"
+#include "scene_generator.hpp"
+#include "scene_file.hpp"
+#include "shader_binding_table_generator.hpp"
+#include "shader_binding_table_layout.hpp"
+#include "shared_frame_ring.hpp"
+#include "sphere_query.hpp"
+#include "sphere_shader.hpp"
+#include "sphere_store.hpp"
+#include "submit_graph.hpp"
+#include "tile_render.hpp"
+#include "tonemap.hpp"
+#include "video_stream.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) noexcept {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+} // SecondsSince
+
+int Usage() {
+  std::fprintf(stderr, "usage: scene_tool convert <scene.txt> <scene.bin>\n"
+                       "       scene_tool info <scene.bin>\n"
+                       "       scene_tool bench <scene.bin> [spheres]\n"
+                       "       scene_tool bvh <scene.bin>\n"
+                       "       scene_tool chunk <scene.bin> <chunked.bin> "
+                       "[spheres per chunk]\n"
+                       "       scene_tool stream <chunked.bin> [budget MiB]\n"
+                       "       scene_tool generate <weekend|uniform|clustered> "
+                       "<spheres> <scene.bin> [seed] [threads]\n"
+                       "       scene_tool cull <scene.bin> [margin]\n"
+                       "       scene_tool mesh <mesh.obj> [rays] [threads]\n"
+                       "       scene_tool instance <mesh.obj> [instances] "
+                       "[float32|float16|snorm16]\n"
+                       "       scene_tool trace <scene.bin> [rays]\n"
+                       "       scene_tool render <scene.bin> <image.ppm> "
+                       "[width height] [workers] [address]\n"
+                       "       scene_tool worker <scene.bin> <address> "
+                       "[slowdown]\n"
+                       "       scene_tool serve <scene.bin> <address> "
+                       "[max batch]\n"
+                       "       scene_tool load <scene.bin> <address> [clients] "
+                       "[requests] [width height] [qoi|png|ppm]\n"
+                       "       scene_tool stop <address>\n"
+                       "       scene_tool export <scene.bin> <ring name> "
+                       "[frames] [width height]\n"
+                       "       scene_tool capture <ring name> <prefix> "
+                       "[frames] [qoi|png|ppm]\n"
+                       "       scene_tool video <scene.bin> <out|-> [frames] "
+                       "[width height] [y4m|rgb24]\n"
+                       "       scene_tool sampling <size> [max samples]\n"
+                       "       scene_tool updates <scene.bin> [percent moving] "
+                       "[frames]\n"
+                       "       scene_tool resolution <frames>\n"
+                       "       scene_tool submits <frames>\n"
+                       "       scene_tool queues\n"
+                       "       scene_tool ring <frames>\n"
+                       "       scene_tool barriers\n"
+                       "       scene_tool tonemap <frames>\n"
+                       "       scene_tool sbt [records]\n"
+                       "       scene_tool deletion <frames>\n"
+                       "       scene_tool memory\n");
+  return EXIT_FAILURE;
+} // Usage
+
+int Convert(char const* input, char const* output) {
+  std::ifstream in(input);
+  if (!in) {
+    std::fprintf(stderr, "Cannot open %s\n", input);
+    return EXIT_FAILURE;
+  }
+
+  auto scene = ParseSceneText(in);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", input, scene.error().what());
+    return EXIT_FAILURE;
+  }
+
+  if (auto result = WriteSceneFile(output, scene->View()); !result) {
+    std::fprintf(stderr, "%s: %s\n", output, result.error().what());
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%s: %zu spheres, %zu materials, %zu instances\n", output,
+              scene->spheres.size(), scene->materials.size(),
+              scene->instances.size());
+  return EXIT_SUCCESS;
+} // Convert
+
+int Info(char const* path) {
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+
+  SceneView const view = scene->View();
+  std::printf("%s: %zu bytes, version %" PRIu32 "\n", path,
+              scene->Mapping().size(), kSceneFileVersion);
+  std::printf("  spheres:          %td\n", view.spheres.size());
+  std::printf("  sphere materials: %td\n", view.sphereMaterials.size());
+  std::printf("  materials:        %td\n", view.materials.size());
+  std::printf("  instances:        %td\n", view.instances.size());
+  std::printf("  chunks:           %td\n", view.chunks.size());
+  return EXIT_SUCCESS;
+} // Info
+
+bool WriteSyntheticScene(char const* path, std::uint64_t count) {
+  std::vector<SceneSphere> spheres(count);
+  std::uint32_t state = 0x9E3779B9u;
+  auto next = [&state] {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return static_cast<float>(state >> 8) * (1.f / 16777216.f);
+  };
+
+  for (auto&& sphere : spheres) {
+    float const center[3] = {next() * 1000.f, next() * 1000.f, next() * 1000.f};
+    float const radius = .05f + next() * .2f;
+    for (int i = 0; i < 3; ++i) {
+      sphere.aabbMin[i] = center[i] - radius;
+      sphere.aabbMax[i] = center[i] + radius;
+    }
+  }
+
+  SceneView view;
+  view.spheres = spheres;
+  if (auto result = WriteSceneFile(path, view); !result) {
+    std::fprintf(stderr, "%s: %s\n", path, result.error().what());
+    return false;
+  }
+  return true;
+} // WriteSyntheticScene
+
+int Bench(char const* path, std::uint64_t count) {
+  if (std::FILE* existing = std::fopen(path, "rb")) {
+    std::fclose(existing);
+  } else {
+    std::printf("writing %" PRIu64 " spheres to %s\n", count, path);
+    if (!WriteSyntheticScene(path, count)) return EXIT_FAILURE;
+  }
+
+  auto const openStart = Clock::now();
+  auto scene = SceneFile::Open(path);
+  double const openSeconds = SecondsSince(openStart);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+
+  auto const bytes = scene->SphereBytes();
+  auto const size = static_cast<std::size_t>(bytes.size());
+  double const gigabytes = static_cast<double>(size) / 1e9;
+  std::printf("%s: %td spheres, %.3f GB sphere section\n", path,
+              scene->Spheres().size(), gigabytes);
+  std::printf("  open + validate: %8.3f ms\n", openSeconds * 1e3);
+
+  std::unique_ptr<std::byte[]> staging(new std::byte[size]);
+  scene->Mapping().AdviseSequential();
+
+  for (int pass = 0; pass < 3; ++pass) {
+    auto const start = Clock::now();
+    std::memcpy(staging.get(), bytes.data(), size);
+    double const seconds = SecondsSince(start);
+    std::printf("  copy pass %d:     %8.3f ms  %6.2f GB/s%s\n", pass,
+                seconds * 1e3, gigabytes / seconds,
+                pass == 0 ? " (includes page faults)" : "");
+  }
+
+  // Baseline: read the same bytes with stdio into the buffer.
+  auto const offset = bytes.data() - scene->Mapping().data();
+  auto const readStart = Clock::now();
+  if (std::FILE* file = std::fopen(path, "rb")) {
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::size_t const read = std::fread(staging.get(), 1, size, file);
+    std::fclose(file);
+    double const seconds = SecondsSince(readStart);
+    if (read == size) {
+      std::printf("  fread baseline:  %8.3f ms  %6.2f GB/s\n", seconds * 1e3,
+                  gigabytes / seconds);
+    }
+  }
+
+  return EXIT_SUCCESS;
+} // Bench
+
+int BVHCacheReport(char const* path) {
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+
+  std::string const cachePath = std::string(path) + ".bvh";
+  BVHBuildParams const params;
+
+  LoadedBVH loaded =
+    LoadOrBuildBVH(cachePath.c_str(), scene->Spheres(), params);
+  if (!loaded.cacheError.empty()) {
+    std::printf("cache miss: %s\n", loaded.cacheError.c_str());
+  }
+
+  if (loaded.fromCache) {
+    // Time the rebuild the cache saved.
+    auto const start = Clock::now();
+    loaded.built = BuildBVH(scene->Spheres(), params);
+    loaded.buildMs = SecondsSince(start) * 1e3;
+  } else {
+    auto const start = Clock::now();
+    auto cache = BVHCache::Open(cachePath.c_str(),
+                                MakeBVHCacheKey(scene->Spheres(), params));
+    loaded.loadMs = SecondsSince(start) * 1e3;
+    if (!cache) {
+      std::fprintf(stderr, "%s: %s\n", cachePath.c_str(),
+                   cache.error().what());
+      return EXIT_FAILURE;
+    }
+    loaded.cache = std::move(*cache);
+  }
+
+  BVHStats const stats = ComputeBVHStats(loaded.cache.View());
+  std::printf("%s: %td spheres, %" PRIu64 " nodes, %" PRIu64
+              " leaves, depth %u, SAH cost %.2f\n",
+              cachePath.c_str(), scene->Spheres().size(), stats.nodeCount,
+              stats.leafCount, stats.maxDepth, stats.sahCost);
+  std::printf("  content hash:    %8.3f ms\n", loaded.hashMs);
+  std::printf("  cache load:      %8.3f ms (map + validate)\n", loaded.loadMs);
+  std::printf("  rebuild:         %8.3f ms\n", loaded.buildMs);
+  if (loaded.writeMs > 0.0) {
+    std::printf("  cache write:     %8.3f ms\n", loaded.writeMs);
+  }
+  std::printf("  load is %.1fx faster than rebuild\n",
+              loaded.buildMs / std::max(loaded.hashMs + loaded.loadMs, 1e-3));
+  return EXIT_SUCCESS;
+} // BVHCacheReport
+
+int Chunk(char const* input, char const* output,
+          std::uint64_t spheresPerChunk) {
+  auto scene = SceneFile::Open(input);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", input, scene.error().what());
+    return EXIT_FAILURE;
+  }
+
+  ChunkPartitionParams params;
+  params.targetSpheresPerChunk = spheresPerChunk;
+
+  scene->Mapping().AdviseSequential();
+  auto const start = Clock::now();
+  auto stats = PartitionSceneIntoChunks(scene->View(), output, params);
+  double const seconds = SecondsSince(start);
+  if (!stats) {
+    std::fprintf(stderr, "%s: %s\n", output, stats.error().what());
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%s: %td spheres in %" PRIu64 " chunks of at most %" PRIu64
+              ", %" PRIu64 " oversized spheres in chunks of their own, "
+              "%.3f s\n",
+              output, scene->Spheres().size(), stats->chunkCount,
+              stats->largestChunk, stats->oversizedSpheres, seconds);
+  return EXIT_SUCCESS;
+} // Chunk
+
+// A camera circling inside a scene's bounds, looking along the direction
+// of travel with a 60 degree field of view and seeing a quarter of the
+// scene ahead.
+class OrbitCamera {
+public:
+  template <class Box>
+  explicit OrbitCamera(gsl::span<Box const> boxes) noexcept {
+    float lo[3], hi[3];
+    for (int c = 0; c < 3; ++c) {
+      lo[c] = std::numeric_limits<float>::max();
+      hi[c] = std::numeric_limits<float>::lowest();
+    }
+    for (auto&& box : boxes) {
+      for (int c = 0; c < 3; ++c) {
+        lo[c] = std::min(lo[c], Min(box)[c]);
+        hi[c] = std::max(hi[c], Max(box)[c]);
+      }
+    }
+
+    for (int c = 0; c < 3; ++c) center_[c] = (lo[c] + hi[c]) * .5f;
+    extent_ = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+  }
+
+  [[nodiscard]] float Extent() const noexcept { return extent_; }
+
+  [[nodiscard]] Frustum At(int frame, int frameCount) const noexcept {
+    constexpr float kPi = 3.14159265f;
+    float const tanHalfFov = std::tan(kPi / 6.f);
+    float const angle = 2.f * kPi * frame / frameCount;
+
+    float const eye[3] = {center_[0] + std::cos(angle) * extent_ * .3f,
+                          center_[1],
+                          center_[2] + std::sin(angle) * extent_ * .3f};
+    float const w[3] = {-std::sin(angle), 0.f, std::cos(angle)};
+    float const u[3] = {-w[2] * tanHalfFov, 0.f, w[0] * tanHalfFov};
+    float const v[3] = {0.f, tanHalfFov, 0.f};
+    return Frustum::FromPinhole(eye, u, v, w, extent_ * .25f);
+  }
+
+private:
+  static float const (&Min(SceneChunk const& chunk))[3] {
+    return chunk.boundsMin;
+  }
+  static float const (&Max(SceneChunk const& chunk))[3] {
+    return chunk.boundsMax;
+  }
+  static float const (&Min(SceneSphere const& sphere))[3] {
+    return sphere.aabbMin;
+  }
+  static float const (&Max(SceneSphere const& sphere))[3] {
+    return sphere.aabbMax;
+  }
+
+  float center_[3]{0.f, 0.f, 0.f};
+  float extent_{0.f};
+}; // class OrbitCamera
+
+int Stream(char const* path, std::uint64_t budgetMiB) {
+  constexpr int kFrameCount = 240;
+  constexpr auto kFrameTime = std::chrono::microseconds(16667);
+
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+  OrbitCamera const camera(scene->View().chunks);
+  scene = {};
+
+  ChunkStreamConfig config;
+  config.budgetBytes = budgetMiB << 20;
+  config.prefetchDistance = camera.Extent() * .05f;
+
+  auto streamer = ChunkStreamer::Open(path, config);
+  if (!streamer) {
+    std::fprintf(stderr, "%s: %s\n", path, streamer.error().what());
+    return EXIT_FAILURE;
+  }
+
+  std::uint64_t visibleSpheres = 0;
+  std::uint64_t peakResidentBytes = 0;
+  auto frameStart = Clock::now();
+
+  for (int frame = 0; frame < kFrameCount; ++frame) {
+    Frustum const frustum = camera.At(frame, kFrameCount);
+
+    for (auto&& chunk : (*streamer)->Update(frustum)) {
+      for (auto&& sphere : *chunk.spheres) {
+        if (frustum.Intersects(sphere.aabbMin, sphere.aabbMax)) {
+          visibleSpheres += 1;
+        }
+      }
+    }
+
+    peakResidentBytes =
+      std::max(peakResidentBytes, (*streamer)->Stats().residentBytes);
+    frameStart += kFrameTime;
+    std::this_thread::sleep_until(frameStart);
+  }
+  (*streamer)->WaitIdle();
+
+  ChunkStreamStats const stats = (*streamer)->Stats();
+  std::printf("%s: %td chunks, %" PRIu64 " MiB budget, %d frames\n", path,
+              (*streamer)->Chunks().size(), budgetMiB, kFrameCount);
+  std::printf("  hit rate:        %8.2f %% of %" PRIu64 " chunk requests\n",
+              stats.HitRate() * 100.0, stats.requests);
+  std::printf("  loads:           %8" PRIu64 "  evictions %" PRIu64
+              "  deferred %" PRIu64 "\n",
+              stats.loads, stats.evictions, stats.deferred);
+  std::printf("  read:            %8.1f MiB  %6.2f GB/s\n",
+              static_cast<double>(stats.bytesRead) / (1 << 20),
+              stats.ReadBandwidth() / 1e9);
+  std::printf("  peak resident:   %8.1f MiB\n",
+              static_cast<double>(peakResidentBytes) / (1 << 20));
+  std::printf("  visible spheres: %8.0f per frame\n",
+              static_cast<double>(visibleSpheres) / kFrameCount);
+  return EXIT_SUCCESS;
+} // Stream
+
+int Generate(SceneGeneratorParams const& params, char const* path) {
+  auto const start = Clock::now();
+  if (auto result = WriteGeneratedScene(path, params); !result) {
+    std::fprintf(stderr, "%s: %s\n", path, result.error().what());
+    return EXIT_FAILURE;
+  }
+  double const seconds = SecondsSince(start);
+
+  double const megaspheres = static_cast<double>(params.sphereCount) / 1e6;
+  std::printf("%s: %" PRIu64 " %s spheres, seed %" PRIu64 ", %.3f s "
+              "(%.1f M spheres/s)\n",
+              path, params.sphereCount, to_string(params.distribution),
+              params.seed, seconds, megaspheres / seconds);
+  return EXIT_SUCCESS;
+} // Generate
+
+int Cull(char const* path, float margin) {
+  constexpr int kFrameCount = 240;
+
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+  SceneView const view = scene->View();
+
+  std::vector<InstanceBounds> bounds;
+  gsl::czstring kind;
+  if (!view.chunks.empty()) {
+    kind = "chunks";
+    for (auto&& chunk : view.chunks) {
+      InstanceBounds b;
+      std::copy_n(chunk.boundsMin, 3, b.boundsMin);
+      std::copy_n(chunk.boundsMax, 3, b.boundsMax);
+      bounds.push_back(b);
+    }
+  } else {
+    kind = "spheres";
+    for (auto&& sphere : view.spheres) {
+      InstanceBounds b;
+      std::copy_n(sphere.aabbMin, 3, b.boundsMin);
+      std::copy_n(sphere.aabbMax, 3, b.boundsMax);
+      bounds.push_back(b);
+    }
+  }
+
+  OrbitCamera const camera =
+    view.chunks.empty() ? OrbitCamera(view.spheres) : OrbitCamera(view.chunks);
+
+  InstanceCuller culler;
+  culler.Assign(bounds);
+
+  std::vector<std::uint32_t> visible, reference;
+  InstanceCullStats total;
+  double simdSeconds = 0.0, scalarSeconds = 0.0;
+  int mismatches = 0;
+
+  for (int frame = 0; frame < kFrameCount; ++frame) {
+    Frustum const frustum = camera.At(frame, kFrameCount).Expanded(margin);
+
+    auto start = Clock::now();
+    InstanceCullStats const stats = culler.Cull(frustum, visible);
+    simdSeconds += SecondsSince(start);
+
+    start = Clock::now();
+    culler.CullScalar(frustum, reference);
+    scalarSeconds += SecondsSince(start);
+
+    total.tested += stats.tested;
+    total.visible += stats.visible;
+    if (visible != reference) ++mismatches;
+  }
+
+  double const perFrameMs = simdSeconds * 1e3 / kFrameCount;
+  std::printf("%s: %zu %s as instances, margin %g, %d frames\n", path,
+              bounds.size(), kind, margin, kFrameCount);
+  std::printf("  culled:          %8.2f %%\n", total.CulledFraction() * 100.0);
+  std::printf("  cull:            %8.3f ms/frame (%.0f M instances/s)\n",
+              perFrameMs,
+              static_cast<double>(bounds.size()) / (perFrameMs * 1e3));
+  std::printf("  scalar cull:     %8.3f ms/frame (%.1fx slower)\n",
+              scalarSeconds * 1e3 / kFrameCount,
+              scalarSeconds / std::max(simdSeconds, 1e-9));
+  std::printf("  mismatches:      %8d frames\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Cull
+
+// Rays from a sphere around the bounds to random points inside them.
+template <class Ray>
+std::vector<Ray> RaysInto(float const (&boundsMin)[3],
+                          float const (&boundsMax)[3], std::uint64_t count) {
+  float center[3], radius = 0.f;
+  for (int c = 0; c < 3; ++c) {
+    center[c] = .5f * (boundsMin[c] + boundsMax[c]);
+    radius = std::max(radius, boundsMax[c] - boundsMin[c]);
+  }
+
+  std::uint64_t state = 0x9E37'79B9'7F4A'7C15;
+  auto uniform = [&state]() {
+    // SplitMix64.
+    std::uint64_t z = (state += 0x9E37'79B9'7F4A'7C15);
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return static_cast<float>((z ^ (z >> 31)) >> 40) * 0x1p-24f;
+  };
+
+  std::vector<Ray> rays(static_cast<std::size_t>(count));
+  for (auto&& ray : rays) {
+    float const z = 2.f * uniform() - 1.f;
+    float const phi = 6.2831853f * uniform();
+    float const r = std::sqrt(std::max(0.f, 1.f - z * z));
+    float const onSphere[3] = {r * std::cos(phi), r * std::sin(phi), z};
+
+    for (int c = 0; c < 3; ++c) {
+      ray.origin[c] = center[c] + radius * onSphere[c];
+      float const target =
+        boundsMin[c] + uniform() * (boundsMax[c] - boundsMin[c]);
+      ray.direction[c] = target - ray.origin[c];
+    }
+  }
+  return rays;
+} // RaysInto
+
+int Mesh(char const* path, std::uint64_t rayCount, std::uint32_t threadCount) {
+  // Brute force is linear in the triangle count, so only this many rays are
+  // checked against it.
+  constexpr std::uint64_t kBruteForceRays = 256;
+
+  ObjLoadStats loadStats;
+  auto mesh = LoadObj(path, threadCount, &loadStats);
+  if (!mesh) {
+    std::fprintf(stderr, "%s\n", mesh.error().what());
+    return EXIT_FAILURE;
+  }
+  if (mesh->TriangleCount() == 0) {
+    std::fprintf(stderr, "%s: no triangles\n", path);
+    return EXIT_FAILURE;
+  }
+
+  std::printf("%s: %zu vertices, %zu triangles, %.1f MiB\n", path,
+              mesh->VertexCount(), mesh->TriangleCount(),
+              static_cast<double>(loadStats.bytes) / (1 << 20));
+  std::printf("  load:            %8.3f ms (count %.3f ms, parse %.3f ms, "
+              "%u threads, %.0f MB/s)\n",
+              loadStats.totalMs, loadStats.countMs, loadStats.parseMs,
+              loadStats.threadCount, loadStats.MegabytesPerSecond());
+
+  float boundsMin[3], boundsMax[3];
+  mesh->Bounds(boundsMin, boundsMax);
+  float extent = 0.f;
+  for (int c = 0; c < 3; ++c) {
+    extent = std::max(extent, boundsMax[c] - boundsMin[c]);
+  }
+
+  auto start = Clock::now();
+  BVH const bvh = BuildTriangleBVH(*mesh, BVHBuildParams{});
+  std::printf("  bvh build:       %8.3f ms, %zu nodes\n",
+              SecondsSince(start) * 1e3, bvh.nodes.size());
+
+  std::vector<TriangleRay> const rays =
+    RaysInto<TriangleRay>(boundsMin, boundsMax, rayCount);
+  std::vector<TriangleHit> hits(rays.size());
+  std::vector<bool> hit(rays.size());
+
+  start = Clock::now();
+  for (std::size_t i = 0; i < rays.size(); ++i) {
+    hit[i] = Intersect(*mesh, bvh.View(), rays[i], hits[i]);
+  }
+  double const traceSeconds = SecondsSince(start);
+  auto const hitCount = std::count(hit.begin(), hit.end(), true);
+  std::printf("  trace:           %8.3f ms, %zu rays, %.1f %% hit "
+              "(%.2f M rays/s)\n",
+              traceSeconds * 1e3, rays.size(),
+              100.0 * hitCount / std::max<std::size_t>(rays.size(), 1),
+              rays.size() / std::max(traceSeconds, 1e-9) / 1e6);
+
+  // Both take the closest hit with the same arithmetic, so t must match
+  // exactly; the triangle may differ where neighbors tie along an edge.
+  std::uint64_t mismatches = 0;
+  std::uint64_t const checked = std::min<std::uint64_t>(kBruteForceRays,
+                                                        rays.size());
+  for (std::size_t i = 0; i < checked; ++i) {
+    TriangleHit reference;
+    bool const found = IntersectBruteForce(*mesh, rays[i], reference);
+    if (found != hit[i] || (found && reference.t != hits[i].t)) ++mismatches;
+  }
+  std::printf("  brute force:     %8" PRIu64 " mismatches in %" PRIu64
+              " rays\n",
+              mismatches, checked);
+
+  for (auto format : {VertexFormat::kFloat32, VertexFormat::kFloat16,
+                      VertexFormat::kSnorm16}) {
+    start = Clock::now();
+    EncodedMesh const encoded = EncodeMesh(*mesh, format);
+    double const encodeMs = SecondsSince(start) * 1e3;
+
+    TriangleMesh const decoded = DecodeMesh(encoded);
+    float maxError = 0.f;
+    for (std::size_t i = 0; i < decoded.positions.size(); ++i) {
+      maxError = std::max(
+        maxError, std::abs(decoded.positions[i] - mesh->positions[i]));
+    }
+
+    BVH const decodedBVH = BuildTriangleBVH(decoded, BVHBuildParams{});
+    std::uint64_t agree = 0;
+    for (std::size_t i = 0; i < rays.size(); ++i) {
+      TriangleHit decodedHit;
+      bool const found = Intersect(decoded, decodedBVH.View(), rays[i],
+                                   decodedHit);
+      if (found == hit[i] &&
+          (!found || decodedHit.triangle == hits[i].triangle)) {
+        ++agree;
+      }
+    }
+
+    std::printf("  %-8s %6.2f B/triangle (%" PRIu64 " B/vertex, %s "
+                "indices), encode %.3f ms, max error %.2e of extent, "
+                "%.3f %% rays agree\n",
+                to_string(format), encoded.BytesPerTriangle(),
+                static_cast<std::uint64_t>(encoded.vertexStride),
+                encoded.index16 ? "16-bit" : "32-bit", encodeMs,
+                extent > 0.f ? maxError / extent : 0.f,
+                100.0 * agree / std::max<std::size_t>(rays.size(), 1));
+  }
+
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Mesh
+
+int Instance(char const* path, std::uint64_t instanceCount,
+             VertexFormat format) {
+  // Times the mesh is added to the library, all but the last identical.
+  constexpr std::uint32_t kAdds = 8;
+
+  auto mesh = LoadObj(path);
+  if (!mesh) {
+    std::fprintf(stderr, "%s\n", mesh.error().what());
+    return EXIT_FAILURE;
+  }
+  if (mesh->TriangleCount() == 0) {
+    std::fprintf(stderr, "%s: no triangles\n", path);
+    return EXIT_FAILURE;
+  }
+
+  EncodedMesh const encoded = EncodeMesh(*mesh, format);
+  std::printf("%s: %zu triangles, %s vertices, %.1f MiB encoded\n", path,
+              mesh->TriangleCount(), to_string(format),
+              static_cast<double>(encoded.SizeBytes()) / (1 << 20));
+
+  MeshLibrary library;
+  std::vector<std::uint32_t> ids;
+  bool deduplicated = true;
+  auto start = Clock::now();
+  for (std::uint32_t i = 0; i + 1 < kAdds; ++i) {
+    auto const added = library.Add(encoded);
+    ids.push_back(added.id);
+    deduplicated = deduplicated && added.id == 0 && added.added == (i == 0);
+  }
+  double const addSeconds = SecondsSince(start);
+
+  // A single flipped bit elsewhere must make a new mesh.
+  EncodedMesh modified = encoded;
+  modified.vertices[modified.vertices.size() / 2] ^= std::byte{1};
+  auto const added = library.Add(std::move(modified));
+  ids.push_back(added.id);
+  deduplicated = deduplicated && added.added && library.size() == 2;
+
+  std::printf("  library:  %u adds, %zu unique meshes (%s), %.3f ms/add "
+              "(%.0f MB/s hashed and compared)\n",
+              kAdds, library.size(), deduplicated ? "ok" : "WRONG",
+              addSeconds * 1e3 / (kAdds - 1),
+              (kAdds - 1) * static_cast<double>(encoded.SizeBytes()) /
+                std::max(addSeconds, 1e-9) / 1e6);
+
+  // Copies twice the mesh's extent apart, turned about its center.
+  float pivot[3], extent = 0.f;
+  for (int c = 0; c < 3; ++c) {
+    pivot[c] = .5f * (encoded.boundsMin[c] + encoded.boundsMax[c]);
+    extent = std::max(extent, encoded.boundsMax[c] - encoded.boundsMin[c]);
+  }
+
+  TransformStream stream;
+  AppendInstanceGrid(stream, instanceCount, pivot, 2.f * extent, 1);
+  std::vector<std::uint32_t> instanceMeshes(stream.size());
+  for (std::size_t i = 0; i < instanceMeshes.size(); ++i) {
+    instanceMeshes[i] = ids[i % ids.size()];
+  }
+
+  std::vector<Transform3x4> packed(stream.size());
+  std::vector<Transform3x4> reference(stream.size());
+  constexpr int kRepeats = 20;
+
+  start = Clock::now();
+  for (int r = 0; r < kRepeats; ++r) {
+    PackInstanceTransforms(stream, 0, packed);
+  }
+  double const packSeconds = SecondsSince(start) / kRepeats;
+
+  start = Clock::now();
+  for (int r = 0; r < kRepeats; ++r) {
+    PackInstanceTransformsScalar(stream, 0, reference);
+  }
+  double const scalarSeconds = SecondsSince(start) / kRepeats;
+
+  bool const agree =
+    packed.empty() || std::memcmp(packed.data(), reference.data(),
+                                  packed.size() * sizeof(Transform3x4)) == 0;
+  std::printf("  pack:     %zu transforms, %.3f ms SSE2 (%.1f M/s), "
+              "%.3f ms scalar (%.1f M/s), %s\n",
+              packed.size(), packSeconds * 1e3,
+              packed.size() / std::max(packSeconds, 1e-9) / 1e6,
+              scalarSeconds * 1e3,
+              packed.size() / std::max(scalarSeconds, 1e-9) / 1e6,
+              agree ? "identical" : "DIFFERENT");
+
+  std::vector<std::uint64_t> meshBytes;
+  for (std::uint32_t id = 0; id < library.size(); ++id) {
+    meshBytes.push_back(library[id].SizeBytes());
+  }
+  InstancingStats const stats =
+    ComputeInstancingStats(library, instanceMeshes, meshBytes);
+  std::printf("  memory:   %" PRIu64 " instances of %" PRIu64
+              " meshes, %.1f MiB shared vs %.1f MiB flattened "
+              "(%.2f %% saved)\n",
+              stats.instances, stats.uniqueMeshes,
+              static_cast<double>(stats.sharedBytes) / (1 << 20),
+              static_cast<double>(stats.flattenedBytes) / (1 << 20),
+              100.0 * stats.SavedFraction());
+
+  return deduplicated && agree ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Instance
+
+// The nearest root of |origin + t * direction - center| = radius in
+// (tMin, tMax), in double precision and solved without cancellation.
+// margin is 1 - (distance of the ray from the center / radius)^2: near 0
+// the ray grazes the sphere and float and double may fairly disagree on
+// whether it hits.
+bool ReferenceIntersect(SceneSphere const& sphere, SphereRay const& ray,
+                        double& t, double& margin) noexcept {
+  double a = 0.0, b = 0.0, c = 0.0;
+  double const radius =
+    (double{sphere.aabbMax[0]} - sphere.aabbMin[0]) / 2.0;
+  for (int i = 0; i < 3; ++i) {
+    double const center =
+      (double{sphere.aabbMax[i]} + sphere.aabbMin[i]) / 2.0;
+    double const oc = ray.origin[i] - center;
+    a += double{ray.direction[i]} * ray.direction[i];
+    b += oc * ray.direction[i];
+    c += oc * oc;
+  }
+  c -= radius * radius;
+  double const d = b * b - a * c;
+  margin = d / (a * radius * radius);
+  if (d <= 0.0) return false;
+
+  // q has the sign of -b, so neither root subtracts nearly equal numbers.
+  double const q = -(b + std::copysign(std::sqrt(d), b));
+  double const t1 = std::min(q / a, c / q);
+  double const t2 = std::max(q / a, c / q);
+  if (ray.tMin < t1 && t1 < ray.tMax) {
+    t = t1;
+  } else if (ray.tMin < t2 && t2 < ray.tMax) {
+    t = t2;
+  } else {
+    return false;
+  }
+  return true;
+} // ReferenceIntersect
+
+int Trace(char const* path, std::uint64_t rayCount) {
+  constexpr std::uint64_t kFuzzCases = 1'000'000;
+  // Rays passing within this fraction of the radius squared of the
+  // silhouette are grazing.
+  constexpr double kGrazingMargin = 1e-4;
+  // Brute force is linear in the sphere count; check at most this many
+  // sphere tests against it.
+  constexpr std::uint64_t kBruteForceTests = 1'000'000'000;
+
+  std::uint64_t state = 0x2545'F491'4F6C'DD1D;
+  auto uniform = [&state]() {
+    // SplitMix64.
+    std::uint64_t z = (state += 0x9E37'79B9'7F4A'7C15);
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return static_cast<float>((z ^ (z >> 31)) >> 40) * 0x1p-24f;
+  };
+  // Log-uniform in [lo, hi].
+  auto logUniform = [&uniform](float lo, float hi) {
+    return lo * std::pow(hi / lo, uniform());
+  };
+
+  // Spheres from 1e-2 to 1e2 in radius, up to 1e4 from the origin, seen
+  // from 2 to 1000 radii away by rays aimed near them, with directions of
+  // any length.
+  std::vector<SceneSphere> fuzzSpheres(kFuzzCases);
+  std::vector<SphereRay> fuzzRays(kFuzzCases);
+  for (std::uint64_t i = 0; i < kFuzzCases; ++i) {
+    float const extent = logUniform(1.f, 1e4f);
+    float const radius = logUniform(1e-2f, 1e2f);
+    float const distance = radius * logUniform(2.f, 1e3f);
+    float const length = logUniform(1e-2f, 1e2f);
+
+    float center[3], away[3], target[3], norm = 0.f;
+    for (int c = 0; c < 3; ++c) {
+      center[c] = extent * (2.f * uniform() - 1.f);
+      away[c] = 2.f * uniform() - 1.f;
+      norm += away[c] * away[c];
+      target[c] = center[c] + 1.5f * radius * (2.f * uniform() - 1.f);
+    }
+    norm = std::sqrt(std::max(norm, 1e-12f));
+
+    SphereRay& ray = fuzzRays[i];
+    float directionNorm = 0.f;
+    for (int c = 0; c < 3; ++c) {
+      fuzzSpheres[i].aabbMin[c] = center[c] - radius;
+      fuzzSpheres[i].aabbMax[c] = center[c] + radius;
+      ray.origin[c] = center[c] + distance * away[c] / norm;
+      ray.direction[c] = target[c] - ray.origin[c];
+      directionNorm += ray.direction[c] * ray.direction[c];
+    }
+    directionNorm = std::sqrt(directionNorm);
+    for (float& component : ray.direction) {
+      component *= length / directionNorm;
+    }
+  }
+
+  std::vector<char> fuzzHit(kFuzzCases);
+  std::vector<float> fuzzT(kFuzzCases);
+  auto start = Clock::now();
+  for (std::uint64_t i = 0; i < kFuzzCases; ++i) {
+    SphereHit hit;
+    fuzzHit[i] = IntersectSpheresBruteForce(
+      gsl::make_span(&fuzzSpheres[i], 1), fuzzRays[i], hit);
+    fuzzT[i] = hit.t;
+  }
+  double const fuzzSeconds = SecondsSince(start);
+
+  std::uint64_t hits = 0, grazing = 0, disagreements = 0, inaccurate = 0;
+  double maxError = 0.0;
+  for (std::uint64_t i = 0; i < kFuzzCases; ++i) {
+    double t = 0.0, margin;
+    bool const reference =
+      ReferenceIntersect(fuzzSpheres[i], fuzzRays[i], t, margin);
+    hits += reference ? 1 : 0;
+    if (std::abs(margin) < kGrazingMargin) {
+      ++grazing;
+      continue;
+    }
+    if (reference != (fuzzHit[i] != 0)) {
+      ++disagreements;
+    } else if (reference) {
+      double const error = std::abs(fuzzT[i] - t) / t;
+      maxError = std::max(maxError, error);
+      if (error > 1e-3) ++inaccurate;
+    }
+  }
+
+  std::printf("fuzz: %" PRIu64 " cases, %.1f %% hit, %" PRIu64
+              " grazing (within %.0e r^2 of the edge) skipped\n",
+              kFuzzCases, 100.0 * hits / kFuzzCases, grazing,
+              kGrazingMargin);
+  std::printf("  intersect:       %8.3f ms (%.1f M tests/s)\n",
+              fuzzSeconds * 1e3, kFuzzCases / fuzzSeconds / 1e6);
+  std::printf("  hit or miss:     %8" PRIu64 " disagreements\n",
+              disagreements);
+  std::printf("  distance:        %8.2e max relative error, %" PRIu64
+              " hits off by more than 1e-3\n",
+              maxError, inaccurate);
+
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+  gsl::span<SceneSphere const> const spheres = scene->Spheres();
+  if (spheres.empty()) {
+    std::fprintf(stderr, "%s: no spheres\n", path);
+    return EXIT_FAILURE;
+  }
+
+  std::string const cachePath = std::string(path) + ".bvh";
+  LoadedBVH const bvh =
+    LoadOrBuildBVH(cachePath.c_str(), spheres, BVHBuildParams{});
+  BVHView const view = bvh.View();
+  float boundsMin[3], boundsMax[3];
+  std::copy_n(view.nodes[0].boundsMin, 3, boundsMin);
+  std::copy_n(view.nodes[0].boundsMax, 3, boundsMax);
+
+  std::vector<SphereRay> const rays =
+    RaysInto<SphereRay>(boundsMin, boundsMax, rayCount);
+  std::vector<SphereHit> sceneHits(rays.size());
+  std::vector<char> sceneHit(rays.size());
+
+  start = Clock::now();
+  for (std::size_t i = 0; i < rays.size(); ++i) {
+    sceneHit[i] = IntersectSpheres(spheres, view, rays[i], sceneHits[i]);
+  }
+  double const traceSeconds = SecondsSince(start);
+  auto const hitCount = std::count(sceneHit.begin(), sceneHit.end(), 1);
+  std::printf("%s: %td spheres\n", path, spheres.size());
+  std::printf("  trace:           %8.3f ms, %zu rays, %.1f %% hit "
+              "(%.2f M rays/s)\n",
+              traceSeconds * 1e3, rays.size(),
+              100.0 * hitCount / std::max<std::size_t>(rays.size(), 1),
+              rays.size() / std::max(traceSeconds, 1e-9) / 1e6);
+
+  // Both run the same test on the same spheres, so the closest t must
+  // match exactly.
+  std::uint64_t mismatches = 0;
+  std::uint64_t const checked = std::min<std::uint64_t>(
+    rays.size(), std::max<std::uint64_t>(
+                   1, kBruteForceTests / static_cast<std::uint64_t>(
+                                           spheres.size())));
+  for (std::size_t i = 0; i < checked; ++i) {
+    SphereHit reference;
+    bool const found = IntersectSpheresBruteForce(spheres, rays[i], reference);
+    if (found != (sceneHit[i] != 0) ||
+        (found && reference.t != sceneHits[i].t)) {
+      ++mismatches;
+    }
+  }
+  std::printf("  brute force:     %8" PRIu64 " mismatches in %" PRIu64
+              " rays\n",
+              mismatches, checked);
+
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Trace
+
+// The host memory of the scenes loaded, which live until the command
+// returns.
+MemoryAccounting sMemoryAccounting;
+
+// A scene file with its BVH, as a tile worker or coordinator has it.
+struct RenderableScene {
+  SceneFile file{};
+  LoadedBVH bvh{};
+  std::uint64_t hash{0};
+
+  [[nodiscard]] RenderScene View() const noexcept {
+    return {file.Spheres(), bvh.View()};
+  }
+}; // struct RenderableScene
+
+bool LoadRenderableScene(char const* path, RenderableScene& scene) {
+  auto file = SceneFile::Open(path);
+  if (!file) {
+    std::fprintf(stderr, "%s: %s\n", path, file.error().what());
+    return false;
+  }
+  scene.file = std::move(*file);
+  if (scene.file.Spheres().empty()) {
+    std::fprintf(stderr, "%s: no spheres\n", path);
+    return false;
+  }
+
+  std::string const cachePath = std::string(path) + ".bvh";
+  scene.bvh = LoadOrBuildBVH(cachePath.c_str(), scene.file.Spheres(),
+                             BVHBuildParams{});
+  if (std::uint64_t const bytes = scene.bvh.HostBytes(); bytes > 0) {
+    sMemoryAccounting.Allocated(MemoryCategory::kHostBVH, bytes);
+  }
+  scene.hash = HashBytes(scene.file.SphereBytes());
+  return true;
+} // LoadRenderableScene
+
+// Looking at the center of the scene's bounds from above and in front,
+// far enough back to see all of it, or from angle radians further round
+// the vertical axis through the center.
+RenderCamera OverviewCamera(BVHView bvh, float aspectRatio,
+                            float angle = 0.f) noexcept {
+  BVHNode const& root = bvh.nodes[0];
+  float center[3], extent = 0.f;
+  for (int c = 0; c < 3; ++c) {
+    center[c] = (root.boundsMin[c] + root.boundsMax[c]) * .5f;
+    extent = std::max(extent, root.boundsMax[c] - root.boundsMin[c]);
+  }
+  float const eye[3] = {center[0] + extent * 1.2f * std::sin(angle),
+                        center[1] + extent * .5f,
+                        center[2] + extent * 1.2f * std::cos(angle)};
+  float const up[3] = {0.f, 1.f, 0.f};
+  return LookAtCamera(eye, center, up, 50.f, aspectRatio);
+} // OverviewCamera
+
+int Worker(char const* path, char const* addressText, double slowdown) {
+  auto address = ParseSocketAddress(addressText);
+  if (!address) {
+    std::fprintf(stderr, "%s\n", address.error().what());
+    return EXIT_FAILURE;
+  }
+
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  TileWorkerParams params;
+  params.slowdown = slowdown;
+  if (auto result = RunTileWorker(*address, scene.View(), scene.hash, params);
+      !result) {
+    std::fprintf(stderr, "worker %s: %s\n", addressText,
+                 result.error().what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+} // Worker
+
+// Tile workers running scene_tool worker, started by RenderTiles.
+class LocalWorkers {
+public:
+  LocalWorkers() noexcept = default;
+  LocalWorkers(LocalWorkers const&) = delete;
+  LocalWorkers& operator=(LocalWorkers const&) = delete;
+  ~LocalWorkers() noexcept { (void)Wait(); }
+
+  bool Spawn(char const* executable, char const* scenePath,
+             std::string const& address, double slowdown) {
+    std::vector<std::string> argv = {executable, "worker", scenePath,
+                                     address};
+    if (slowdown > 1.0) argv.push_back(std::to_string(slowdown));
+    auto pid = SpawnProcess(argv);
+    if (!pid) {
+      std::fprintf(stderr, "%s\n", pid.error().what());
+      return false;
+    }
+    pids_.push_back(*pid);
+    return true;
+  }
+
+  // Wait for every worker to exit; false if any failed.
+  bool Wait() noexcept {
+    bool succeeded = true;
+    for (int pid : pids_) {
+      auto status = WaitProcess(pid);
+      succeeded = succeeded && status && *status == EXIT_SUCCESS;
+    }
+    pids_.clear();
+    return succeeded;
+  }
+
+private:
+  std::vector<int> pids_{};
+}; // class LocalWorkers
+
+// Start workerCount local workers, the first slowed down by slowdown,
+// render a frame on them for each of params and shut them down.
+bool RenderTiles(char const* executable, char const* scenePath,
+                 SocketAddress const& address, std::uint64_t sceneHash,
+                 std::uint32_t workerCount, double slowdown,
+                 std::vector<TileRenderParams> const& params,
+                 std::vector<float>& rgba,
+                 std::vector<TileRenderStats>& stats) {
+  auto coordinator = TileCoordinator::Listen(address, sceneHash);
+  if (!coordinator) {
+    std::fprintf(stderr, "%s: %s\n", to_string(address).c_str(),
+                 coordinator.error().what());
+    return false;
+  }
+
+  LocalWorkers workers;
+  for (std::uint32_t i = 0; i < workerCount; ++i) {
+    if (!workers.Spawn(executable, scenePath, to_string(address),
+                       i == 0 ? slowdown : 1.0)) {
+      return false;
+    }
+  }
+
+  if (auto joined = coordinator->AcceptWorkers(workerCount, 60.0); !joined) {
+    std::fprintf(stderr, "%s: %s\n", to_string(address).c_str(),
+                 joined.error().what());
+    coordinator->Shutdown();
+    return false;
+  }
+
+  stats.resize(params.size());
+  for (std::size_t i = 0; i < params.size(); ++i) {
+    if (auto rendered = coordinator->Render(params[i], rgba, &stats[i]);
+        !rendered) {
+      std::fprintf(stderr, "render: %s\n", rendered.error().what());
+      coordinator->Shutdown();
+      return false;
+    }
+  }
+
+  coordinator->Shutdown();
+  if (!workers.Wait()) {
+    std::fprintf(stderr, "a tile worker failed\n");
+    return false;
+  }
+  return true;
+} // RenderTiles
+
+int Render(char const* executable, char const* path, char const* imagePath,
+           std::uint32_t width, std::uint32_t height,
+           std::uint32_t maxWorkers, char const* addressText) {
+  // The slow worker's slowdown in the rebalancing runs.
+  constexpr double kSlowdown = 4.0;
+
+  std::string const defaultAddress =
+    std::string("unix:") + imagePath + ".sock";
+  auto address = ParseSocketAddress(
+    addressText != nullptr ? addressText : defaultAddress.c_str());
+  if (!address) {
+    std::fprintf(stderr, "%s\n", address.error().what());
+    return EXIT_FAILURE;
+  }
+
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  TileRenderParams params;
+  params.width = width;
+  params.height = height;
+  params.camera = OverviewCamera(scene.bvh.View(),
+                                 static_cast<float>(width) / height);
+
+  std::size_t const floatCount = std::size_t{4} * width * height;
+  std::vector<float> reference(floatCount);
+  auto start = Clock::now();
+  RenderRect(scene.View(), params.camera, width, height,
+             {0, 0, width, height}, reference);
+  double const referenceMs = SecondsSince(start) * 1e3;
+
+  std::printf("%s: %td spheres, %ux%u, %u x %u tiles, %u hardware threads\n",
+              path, scene.file.Spheres().size(), width, height,
+              (width + params.tileSize - 1) / params.tileSize,
+              (height + params.tileSize - 1) / params.tileSize,
+              std::thread::hardware_concurrency());
+  std::printf("  in process:      %9.1f ms (%.2f M pixels/s)\n", referenceMs,
+              1e-3 * width * height / referenceMs);
+  std::printf("  workers        ms   M pixels/s  speedup  efficiency  "
+              "tiles per worker\n");
+
+  std::vector<float> rgba(floatCount);
+  std::vector<TileRenderStats> stats;
+  bool identical = true;
+  double oneWorkerMs = 0.0, allWorkersMs = 0.0;
+
+  for (std::uint32_t workers = 1;;
+       workers = std::min(workers * 2, maxWorkers)) {
+    if (!RenderTiles(executable, path, *address, scene.hash, workers, 1.0,
+                     {params}, rgba, stats)) {
+      return EXIT_FAILURE;
+    }
+    TileRenderStats const& run = stats[0];
+    identical = identical && rgba == reference;
+
+    std::uint64_t fewest = run.tileCount, most = 0;
+    for (auto&& worker : run.workers) {
+      fewest = std::min(fewest, worker.tilesRendered);
+      most = std::max(most, worker.tilesRendered);
+    }
+    if (workers == 1) oneWorkerMs = run.renderMs;
+    allWorkersMs = run.renderMs;
+    double const speedup = oneWorkerMs / run.renderMs;
+    std::printf("  %7u %9.1f %12.2f %8.2f %10.1f %%  %" PRIu64 "-%" PRIu64
+                "\n",
+                workers, run.renderMs, 1e-3 * width * height / run.renderMs,
+                speedup, 100.0 * speedup / workers, fewest, most);
+
+    if (workers >= maxWorkers) break;
+  }
+
+  if (maxWorkers >= 2) {
+    // The same frame with one worker kSlowdown times slower, handed out
+    // without and then with speculative copies.
+    TileRenderParams speculative = params;
+    TileRenderParams pulled = params;
+    pulled.speculate = false;
+    if (!RenderTiles(executable, path, *address, scene.hash, maxWorkers,
+                     kSlowdown, {pulled, speculative}, rgba, stats)) {
+      return EXIT_FAILURE;
+    }
+    identical = identical && rgba == reference;
+
+    std::printf("  one worker %.0fx slower (%.1f ms with none):\n",
+                kSlowdown, allWorkersMs);
+    char const* const names[] = {"pull only", "speculative"};
+    for (std::size_t i = 0; i < stats.size(); ++i) {
+      TileRenderStats const& run = stats[i];
+      std::uint64_t discarded = 0;
+      for (auto&& worker : run.workers) discarded += worker.tilesDiscarded;
+      std::printf("    %-12s %9.1f ms, slow worker %" PRIu64
+                  " of %" PRIu64 " tiles, %" PRIu64 " copies sent, %" PRIu64
+                  " discarded\n",
+                  names[i], run.renderMs, run.workers[0].tilesRendered,
+                  run.tileCount, run.speculativeTiles, discarded);
+    }
+  }
+
+  std::printf("  composited frames %s the in-process render\n",
+              identical ? "match" : "DIFFER FROM");
+
+  std::vector<std::uint8_t> ldr(std::size_t{4} * width * height);
+  TonemapUpscale({reference.data(), width, height, width},
+                 {ldr.data(), width, height, width}, TonemapParams{});
+  std::vector<std::byte> const ppm =
+    EncodePPM({ldr.data(), width, height, width});
+  std::ofstream out(imagePath, std::ios::binary);
+  out.write(reinterpret_cast<char const*>(ppm.data()),
+            static_cast<std::streamsize>(ppm.size()));
+  if (!out) {
+    std::fprintf(stderr, "%s: write failed\n", imagePath);
+    return EXIT_FAILURE;
+  }
+
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Render
+
+// The backend serve renders with: RenderLayers over every view of a batch
+// on all hardware threads, then the tonemap pass on each. The HDR buffer is
+// kept from batch to batch.
+RenderBackend CPUBackend(RenderScene const& scene) {
+  auto hdr = std::make_shared<std::vector<float>>();
+  return [scene, hdr](gsl::span<RenderCamera const> cameras,
+                      std::uint32_t width, std::uint32_t height,
+                      gsl::span<std::uint8_t> rgba)
+           -> tl::expected<void, std::system_error> {
+    std::size_t const viewPixels = std::size_t{width} * height;
+    try {
+      hdr->resize(4 * viewPixels * static_cast<std::size_t>(cameras.size()));
+    } catch (std::bad_alloc const&) {
+      return tl::unexpected(std::system_error(
+        std::make_error_code(std::errc::not_enough_memory), "CPU backend"));
+    }
+
+    RenderLayers(scene, cameras, width, height, *hdr);
+    for (std::size_t i = 0; i < static_cast<std::size_t>(cameras.size());
+         ++i) {
+      TonemapUpscale({hdr->data() + 4 * viewPixels * i, width, height, width},
+                     {rgba.data() + 4 * viewPixels * i, width, height, width},
+                     TonemapParams{});
+    }
+    return {};
+  };
+} // CPUBackend
+
+int Serve(char const* path, char const* addressText, std::uint32_t maxBatch) {
+  auto address = ParseSocketAddress(addressText);
+  if (!address) {
+    std::fprintf(stderr, "%s\n", address.error().what());
+    return EXIT_FAILURE;
+  }
+
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  RenderServerParams params;
+  params.maxBatch = maxBatch;
+  auto server = RenderServer::Listen(*address, CPUBackend(scene.View()),
+                                     params);
+  if (!server) {
+    std::fprintf(stderr, "%s: %s\n", addressText, server.error().what());
+    return EXIT_FAILURE;
+  }
+  std::printf("%s: %td spheres, serving on %s\n", path,
+              scene.file.Spheres().size(), to_string(*address).c_str());
+  std::fflush(stdout);
+
+  auto const served = server->Run();
+  RenderServerStats const& stats = server->Stats();
+  std::printf("served %" PRIu64 " views in %" PRIu64
+              " batches, refused %" PRIu64 ", latency p50 %.2f ms p99 "
+              "%.2f ms\n",
+              stats.requests, stats.batches, stats.refused,
+              Percentile(stats.latencyMs, .5),
+              Percentile(stats.latencyMs, .99));
+  MemoryAccounting::CategoryStats const bvhMemory =
+    sMemoryAccounting.Stats(MemoryCategory::kHostBVH);
+  std::printf("host BVH memory: %" PRIu64 " bytes, peak %" PRIu64 "\n",
+              bvhMemory.current, bvhMemory.peak);
+  if (!served) {
+    std::fprintf(stderr, "serve: %s\n", served.error().what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+} // Serve
+
+// Send requestCount views round the scene from each of clientCount
+// clients at once, check every image against one rendered, tonemapped and
+// encoded here, and report the latencies and the server's metrics.
+int Load(char const* path, char const* addressText, std::uint32_t clientCount,
+         std::uint32_t requestCount, std::uint32_t width, std::uint32_t height,
+         ImageFormat format) {
+  auto address = ParseSocketAddress(addressText);
+  if (!address) {
+    std::fprintf(stderr, "%s\n", address.error().what());
+    return EXIT_FAILURE;
+  }
+
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  std::uint32_t const total = clientCount * requestCount;
+  float const aspectRatio = static_cast<float>(width) / height;
+  std::vector<RenderRequest> requests(total);
+  for (std::uint32_t i = 0; i < total; ++i) {
+    requests[i].camera = OverviewCamera(scene.bvh.View(), aspectRatio,
+                                        6.2831853f * i / total);
+    requests[i].width = width;
+    requests[i].height = height;
+    requests[i].format = format;
+  }
+
+  std::vector<std::vector<std::byte>> images(total);
+  std::vector<double> latencyMs(total);
+  std::vector<std::uint32_t> batchSizes(total);
+  std::vector<std::string> errors(clientCount);
+
+  // Client c sends requests c, c + clientCount, ..., one at a time.
+  auto client = [&](std::uint32_t c) {
+    auto connection = RenderClient::Connect(*address);
+    if (!connection) {
+      errors[c] = connection.error().what();
+      return;
+    }
+    for (std::uint32_t i = c; i < total; i += clientCount) {
+      RenderReplyInfo info;
+      auto const start = Clock::now();
+      if (auto rendered = connection->Render(requests[i], images[i], &info);
+          !rendered) {
+        errors[c] = rendered.error().what();
+        return;
+      }
+      latencyMs[i] = SecondsSince(start) * 1e3;
+      batchSizes[i] = info.batchSize;
+    }
+  };
+
+  auto const start = Clock::now();
+  std::vector<std::thread> threads;
+  for (std::uint32_t c = 1; c < clientCount; ++c) {
+    threads.emplace_back(client, c);
+  }
+  client(0);
+  for (auto&& thread : threads) thread.join();
+  double const seconds = SecondsSince(start);
+
+  for (auto const& error : errors) {
+    if (!error.empty()) {
+      std::fprintf(stderr, "%s: %s\n", addressText, error.c_str());
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::uint64_t matching = 0, batched = 0;
+  std::size_t imageBytes = 0;
+  std::vector<float> hdr(std::size_t{4} * width * height);
+  std::vector<std::uint8_t> ldr(hdr.size());
+  for (std::uint32_t i = 0; i < total; ++i) {
+    RenderLayers(scene.View(), gsl::make_span(&requests[i].camera, 1), width,
+                 height, hdr);
+    TonemapUpscale({hdr.data(), width, height, width},
+                   {ldr.data(), width, height, width}, TonemapParams{});
+    matching += EncodeImage({ldr.data(), width, height, width}, format) ==
+                images[i];
+    batched += batchSizes[i];
+    imageBytes += images[i].size();
+  }
+
+  std::printf("%u clients x %u %ux%u %s views: %.1f views/s, %.1f views per "
+              "batch, %.1f KiB per image\n",
+              clientCount, requestCount, width, height, to_string(format),
+              total / seconds, static_cast<double>(batched) / total,
+              imageBytes / 1024.0 / total);
+  std::printf("  latency ms: p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+              Percentile(latencyMs, .5), Percentile(latencyMs, .9),
+              Percentile(latencyMs, .99), Percentile(latencyMs, 1.0));
+  std::printf("  %" PRIu64 " of %u images match the local render\n",
+              matching, total);
+
+  auto connection = RenderClient::Connect(*address);
+  if (!connection) {
+    std::fprintf(stderr, "%s: %s\n", addressText, connection.error().what());
+    return EXIT_FAILURE;
+  }
+  auto metrics = connection->Metrics();
+  if (!metrics) {
+    std::fprintf(stderr, "%s: %s\n", addressText, metrics.error().what());
+    return EXIT_FAILURE;
+  }
+  std::printf("server metrics:\n%s", metrics->c_str());
+
+  return matching == total ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Load
+
+int Stop(char const* addressText) {
+  auto address = ParseSocketAddress(addressText);
+  if (!address) {
+    std::fprintf(stderr, "%s\n", address.error().what());
+    return EXIT_FAILURE;
+  }
+  auto connection = RenderClient::Connect(*address);
+  if (!connection) {
+    std::fprintf(stderr, "%s: %s\n", addressText, connection.error().what());
+    return EXIT_FAILURE;
+  }
+  if (auto stopped = connection->Shutdown(); !stopped) {
+    std::fprintf(stderr, "%s: %s\n", addressText, stopped.error().what());
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+} // Stop
+
+// Publish frameCount views round the scene, rendered and tonemapped on the
+// CPU straight into the slots of a shared frame ring, as the renderer's
+// frame export would: a stand-in producer for testing capture.
+int Export(char const* path, char const* name, std::uint32_t frameCount,
+           std::uint32_t width, std::uint32_t height) {
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  auto writer = SharedFrameWriter::Create(name, 4, width, height);
+  if (!writer) {
+    std::fprintf(stderr, "%s: %s\n", name, writer.error().what());
+    return EXIT_FAILURE;
+  }
+
+  float const aspectRatio = static_cast<float>(width) / height;
+  std::vector<float> hdr(std::size_t{4} * width * height);
+  auto const start = Clock::now();
+  for (std::uint32_t i = 0; i < frameCount; ++i) {
+    RenderCamera const camera = OverviewCamera(scene.bvh.View(), aspectRatio,
+                                               6.2831853f * i / frameCount);
+    RenderLayers(scene.View(), gsl::make_span(&camera, 1), width, height,
+                 hdr);
+
+    gsl::span<std::uint8_t> const pixels =
+      writer->BeginFrame(width, height, SecondsSince(start));
+    TonemapUpscale({hdr.data(), width, height, width},
+                   {pixels.data(), width, height, width}, TonemapParams{});
+    writer->Publish();
+  }
+
+  double const seconds = SecondsSince(start);
+  std::printf("%s: published %" PRIu64 " %ux%u frames, %.1f frames/s\n",
+              name, writer->Published(), width, height,
+              writer->Published() / seconds);
+  return EXIT_SUCCESS;
+} // Export
+
+// Read frames from a shared frame ring as an external encoder would,
+// encoding each in place and writing it to <prefix><serial>.<format>, until
+// frameCount frames are written or the writer closes the ring. Frames the
+// writer overwrote before they were encoded are counted as lost.
+int Capture(char const* name, char const* prefix, std::uint32_t frameCount,
+            ImageFormat format) {
+  // The writer may still be starting up.
+  auto reader = SharedFrameReader::Open(name);
+  for (int attempt = 0; !reader && attempt < 500; ++attempt) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    reader = SharedFrameReader::Open(name);
+  }
+  if (!reader) {
+    std::fprintf(stderr, "%s: %s\n", name, reader.error().what());
+    return EXIT_FAILURE;
+  }
+
+  std::uint64_t next = 1, written = 0, lost = 0;
+  double encodeSeconds = 0.0;
+  while (written < frameCount) {
+    std::uint64_t const published = reader->Published();
+    if (published < next) {
+      if (!reader->WriterOpen() && reader->Published() < next) break;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    SharedFrame frame;
+    if (!reader->Peek(next, frame)) {
+      // Overwritten already: skip to the oldest frame still in the ring.
+      std::uint64_t const oldest =
+        published > reader->SlotCount() ? published - reader->SlotCount() + 1
+                                        : 1;
+      lost += std::max(oldest, next + 1) - next;
+      next = std::max(oldest, next + 1);
+      continue;
+    }
+
+    auto const start = Clock::now();
+    // The encoders only read the pixels, which are mapped read only.
+    LDRImageView const image = {const_cast<std::uint8_t*>(frame.data),
+                                frame.width, frame.height, frame.width};
+    std::vector<std::byte> const bytes = EncodeImage(image, format);
+    encodeSeconds += SecondsSince(start);
+
+    if (!reader->StillValid(frame)) {
+      lost += 1;
+      next += 1;
+      continue;
+    }
+
+    std::string const path =
+      std::string(prefix) + std::to_string(frame.serial) + "." +
+      to_string(format);
+    std::ofstream out(path, std::ios::binary);
+    out.write(reinterpret_cast<char const*>(bytes.data()),
+              static_cast<std::streamsize>(bytes.size()));
+    if (!out) {
+      std::fprintf(stderr, "%s: write failed\n", path.c_str());
+      return EXIT_FAILURE;
+    }
+    written += 1;
+    next += 1;
+  }
+
+  std::printf("%s: wrote %" PRIu64 " frames, lost %" PRIu64
+              ", %.2f ms to encode each\n",
+              name, written, lost,
+              written > 0 ? encodeSeconds * 1e3 / written : 0.0);
+  return EXIT_SUCCESS;
+} // Capture
+
+// Stream frameCount views round the scene to output as video. Each frame
+// is rendered and tonemapped while the one before is written, so the
+// report shows whether the output or the renderer set the pace.
+int Video(char const* path, char const* output, std::uint32_t frameCount,
+          std::uint32_t width, std::uint32_t height, VideoFormat format) {
+  RenderableScene scene;
+  if (!LoadRenderableScene(path, scene)) return EXIT_FAILURE;
+
+  VideoStreamParams params;
+  params.format = format;
+  params.width = width;
+  params.height = height;
+  auto stream = VideoStream::Open(output, params);
+  if (!stream) {
+    std::fprintf(stderr, "%s: %s\n", output, stream.error().what());
+    return EXIT_FAILURE;
+  }
+
+  float const aspectRatio = static_cast<float>(width) / height;
+  std::vector<float> hdr(std::size_t{4} * width * height);
+  std::vector<std::uint8_t> ldr(std::size_t{4} * width * height);
+  double renderSeconds = 0.0;
+  for (std::uint32_t i = 0; i < frameCount; ++i) {
+    auto const start = Clock::now();
+    RenderCamera const camera = OverviewCamera(scene.bvh.View(), aspectRatio,
+                                               6.2831853f * i / frameCount);
+    RenderLayers(scene.View(), gsl::make_span(&camera, 1), width, height,
+                 hdr);
+    TonemapUpscale({hdr.data(), width, height, width},
+                   {ldr.data(), width, height, width}, TonemapParams{});
+    renderSeconds += SecondsSince(start);
+
+    if (auto written = stream->Write({ldr.data(), width, height, width});
+        !written) {
+      std::fprintf(stderr, "%s: %s\n", output, written.error().what());
+      return EXIT_FAILURE;
+    }
+  }
+  if (auto closed = stream->Close(); !closed) {
+    std::fprintf(stderr, "%s: %s\n", output, closed.error().what());
+    return EXIT_FAILURE;
+  }
+
+  // stdout may be the video itself.
+  VideoStreamStats const stats = stream->Stats();
+  std::FILE* const report = std::strcmp(output, "-") == 0 ? stderr : stdout;
+  std::fprintf(report,
+               "%s: %" PRIu64 " %ux%u %s frames, %.1f frames/s, %.1f MB/s\n"
+               "  render  : %.2f ms/frame\n"
+               "  convert : %.2f ms/frame\n"
+               "  waited  : %.2f ms/frame for the output\n",
+               output, stats.frames, width, height, to_string(format),
+               stats.frames / stats.seconds, stats.bytes / stats.seconds / 1e6,
+               renderSeconds * 1e3 / frameCount,
+               stats.convertSeconds * 1e3 / frameCount,
+               stats.waitSeconds * 1e3 / frameCount);
+  return EXIT_SUCCESS;
+} // Video
+
+// Area of the part of the unit square where dot(p - point, normal) < 0.
+double HalfPlaneArea(double const (&point)[2], double const (&normal)[2]) {
+  std::vector<std::array<double, 2>> polygon = {
+    {0.0, 0.0}, {1.0, 0.0}, {1.0, 1.0}, {0.0, 1.0}};
+  std::vector<std::array<double, 2>> clipped;
+  auto side = [&](std::array<double, 2> const& p) {
+    return (p[0] - point[0]) * normal[0] + (p[1] - point[1]) * normal[1];
+  };
+  for (std::size_t i = 0; i < polygon.size(); ++i) {
+    auto const& a = polygon[i];
+    auto const& b = polygon[(i + 1) % polygon.size()];
+    double const sa = side(a), sb = side(b);
+    if (sa < 0.0) clipped.push_back(a);
+    if ((sa < 0.0) != (sb < 0.0)) {
+      double const t = sa / (sa - sb);
+      clipped.push_back({a[0] + t * (b[0] - a[0]), a[1] + t * (b[1] - a[1])});
+    }
+  }
+  double area = 0.0;
+  for (std::size_t i = 0; i < clipped.size(); ++i) {
+    auto const& a = clipped[i];
+    auto const& b = clipped[(i + 1) % clipped.size()];
+    area += a[0] * b[1] - b[0] * a[1];
+  }
+  return .5 * std::abs(area);
+} // HalfPlaneArea
+
+int Sampling(std::uint32_t size, std::uint32_t maxSamples) {
+  constexpr double kPi = 3.14159265358979;
+
+  auto const buildStart = Clock::now();
+  shader::SampleTables const& tables = GetSampleTables();
+  double const buildSeconds = SecondsSince(buildStart);
+
+  std::uint64_t state = 0x5851'F42D'4C95'7F2D;
+  auto next = [](std::uint64_t& z) {
+    // SplitMix64.
+    std::uint64_t x = (z += 0x9E37'79B9'7F4A'7C15);
+    x = (x ^ (x >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    x = (x ^ (x >> 27)) * 0x94D0'49BB'1331'11EB;
+    return x ^ (x >> 31);
+  };
+  auto uniform = [&next](std::uint64_t& z) {
+    return static_cast<double>(next(z) >> 11) * 0x1p-53;
+  };
+
+  // An edge and a Gaussian in each pixel, with their exact integrals.
+  struct Integrands {
+    double edgePoint[2];
+    double edgeNormal[2];
+    double edge;
+    double center[2];
+    double sigma;
+    double gaussian;
+  };
+  std::uint64_t const pixelCount = std::uint64_t{size} * size;
+  std::vector<Integrands> integrands(static_cast<std::size_t>(pixelCount));
+  for (auto&& pixel : integrands) {
+    double const angle = 2.0 * kPi * uniform(state);
+    pixel.edgePoint[0] = uniform(state);
+    pixel.edgePoint[1] = uniform(state);
+    pixel.edgeNormal[0] = std::cos(angle);
+    pixel.edgeNormal[1] = std::sin(angle);
+    pixel.edge = HalfPlaneArea(pixel.edgePoint, pixel.edgeNormal);
+
+    pixel.center[0] = uniform(state);
+    pixel.center[1] = uniform(state);
+    pixel.sigma = .1 + .4 * uniform(state);
+    pixel.gaussian = 1.0;
+    for (double const c : pixel.center) {
+      double const scale = pixel.sigma * std::sqrt(2.0);
+      pixel.gaussian *= pixel.sigma * std::sqrt(kPi / 2.0) *
+                        (std::erf((1.0 - c) / scale) - std::erf(-c / scale));
+    }
+  }
+
+  // Squared errors summed over the pixels at 1, 2, 4 ... samples, and the
+  // error at one sample of integrating x + y, for its correlation.
+  struct Errors {
+    std::vector<double> edge;
+    std::vector<double> gaussian;
+    std::vector<double> ramp;
+  };
+  std::uint32_t levelCount = 0;
+  while ((1u << levelCount) <= maxSamples) ++levelCount;
+
+  auto measure = [&](auto&& sample) {
+    Errors errors = {std::vector<double>(levelCount),
+                     std::vector<double>(levelCount),
+                     std::vector<double>(static_cast<std::size_t>(pixelCount))};
+    for (std::uint32_t y = 0; y < size; ++y) {
+      for (std::uint32_t x = 0; x < size; ++x) {
+        std::size_t const index = std::size_t{y} * size + x;
+        Integrands const& pixel = integrands[index];
+        double edge = 0.0, gaussian = 0.0;
+        std::uint32_t level = 0;
+        for (std::uint32_t i = 0; i < (1u << (levelCount - 1)); ++i) {
+          glm::vec2 const p = sample(x, y, i);
+          if (i == 0) errors.ramp[index] = p.x + p.y - 1.0;
+
+          double const dx = p.x - pixel.edgePoint[0];
+          double const dy = p.y - pixel.edgePoint[1];
+          if (dx * pixel.edgeNormal[0] + dy * pixel.edgeNormal[1] < 0.0) {
+            edge += 1.0;
+          }
+          double const gx = p.x - pixel.center[0];
+          double const gy = p.y - pixel.center[1];
+          gaussian += std::exp(-(gx * gx + gy * gy) /
+                               (2.0 * pixel.sigma * pixel.sigma));
+
+          if (i + 1 == (1u << level)) {
+            double const e = edge / (i + 1) - pixel.edge;
+            double const g = gaussian / (i + 1) - pixel.gaussian;
+            errors.edge[level] += e * e;
+            errors.gaussian[level] += g * g;
+            level += 1;
+          }
+        }
+      }
+    }
+    return errors;
+  };
+
+  Errors const white = measure([&next](std::uint32_t x, std::uint32_t y,
+                                       std::uint32_t i) {
+    std::uint64_t z = (std::uint64_t{y} << 48) ^ (std::uint64_t{x} << 32) ^ i;
+    std::uint64_t const bits = next(z);
+    return glm::vec2(static_cast<float>(bits >> 40) * 0x1p-24f,
+                     static_cast<float>((bits >> 16) & 0xFF'FFFF) * 0x1p-24f);
+  });
+  Errors const sobol = measure([&tables](std::uint32_t x, std::uint32_t y,
+                                         std::uint32_t i) {
+    return shader::PixelSample(
+      tables.sobol[shader::SobolTableIndex(i)],
+      tables.blueNoise[shader::BlueNoiseTableIndex(x, y)], i);
+  });
+
+  std::printf("%u x %u pixels, sample tables built in %.1f ms\n", size,
+              size, buildSeconds * 1e3);
+  std::printf("  samples   edge: white   sampler  gain   "
+              "gaussian: white   sampler  gain\n");
+  auto rms = [pixelCount](double sum) { return std::sqrt(sum / pixelCount); };
+  for (std::uint32_t level = 0; level < levelCount; ++level) {
+    double const we = rms(white.edge[level]), se = rms(sobol.edge[level]);
+    double const wg = rms(white.gaussian[level]);
+    double const sg = rms(sobol.gaussian[level]);
+    // White noise error falls as 1 / sqrt(n), so matching the sampler
+    // takes the square of the error ratio as many samples.
+    std::printf("  %7u   %11.5f %9.5f %5.1fx %15.5f %9.5f %5.1fx\n",
+                1u << level, we, se, (we / se) * (we / se), wg, sg,
+                (wg / sg) * (wg / sg));
+  }
+
+  // Least squares slope of log error against log samples, from 4 samples.
+  auto rate = [&](std::vector<double> const& sums) {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (std::uint32_t level = 2; level < levelCount; ++level) {
+      double const lx = level * std::log(2.0);
+      double const ly = std::log(rms(sums[level]));
+      n += 1;
+      sx += lx;
+      sy += ly;
+      sxx += lx * lx;
+      sxy += lx * ly;
+    }
+    return n < 2 ? 0.0 : (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  };
+  std::printf("  convergence: edge n^%.2f white, n^%.2f sampler; "
+              "gaussian n^%.2f white, n^%.2f sampler\n",
+              rate(white.edge), rate(sobol.edge), rate(white.gaussian),
+              rate(sobol.gaussian));
+
+  auto correlation = [size](std::vector<double> const& errors) {
+    double product = 0.0, square = 0.0;
+    for (std::uint32_t y = 0; y < size; ++y) {
+      for (std::uint32_t x = 0; x < size; ++x) {
+        double const e = errors[std::size_t{y} * size + x];
+        product += e * errors[std::size_t{y} * size + (x + 1) % size];
+        product += e * errors[std::size_t{(y + 1) % size} * size + x];
+        square += 2.0 * e * e;
+      }
+    }
+    return square > 0.0 ? product / square : 0.0;
+  };
+  std::printf("  neighbour error correlation at 1 sample: %.3f white, "
+              "%.3f sampler\n",
+              correlation(white.ramp), correlation(sobol.ramp));
+  return EXIT_SUCCESS;
+} // Sampling
+
+int Updates(char const* path, double percent, std::uint32_t frameCount) {
+  constexpr std::uint64_t kGaps[] = {0, 1, 4, 16, 64};
+
+  auto scene = SceneFile::Open(path);
+  if (!scene) {
+    std::fprintf(stderr, "%s: %s\n", path, scene.error().what());
+    return EXIT_FAILURE;
+  }
+  gsl::span<SceneSphere const> const rest = scene->Spheres();
+  auto const bufferBytes = static_cast<double>(rest.size_bytes());
+
+  std::printf("%s: %td spheres, %.1f MiB, %g %% moving, %u frames\n", path,
+              rest.size(), bufferBytes / (1 << 20), percent, frameCount);
+
+  SphereStore store;
+  std::vector<SceneSphere> device;
+  std::vector<DirtyRange> ranges;
+  int mismatches = 0;
+
+  // Ranges running to the end of the tracker's last word, and past it.
+  for (std::uint64_t size : {64, 128, 130}) {
+    DirtyRangeTracker tracker(size, 0);
+    tracker.Mark(size - 1);
+    tracker.Take(ranges);
+    if (ranges.size() != 1 || ranges[0].first != size - 1 ||
+        ranges[0].count != 1) {
+      ++mismatches;
+    }
+  }
+
+  for (std::uint64_t gap : kGaps) {
+    store.Assign(rest, gap);
+    device.assign(rest.begin(), rest.end());
+
+    SphereUpdateStats total;
+    double animateSeconds = 0.0, takeSeconds = 0.0;
+    for (std::uint32_t frame = 0; frame < frameCount; ++frame) {
+      auto start = Clock::now();
+      AnimateSpheres(rest, percent / 100.0, frame, store);
+      animateSeconds += SecondsSince(start);
+
+      // The last sphere moves every frame, so a range ends the array.
+      if (!rest.empty()) {
+        SceneSphere last = rest[rest.size() - 1];
+        last.aabbMin[1] += static_cast<float>(frame + 1);
+        last.aabbMax[1] += static_cast<float>(frame + 1);
+        store.Set(static_cast<std::uint64_t>(rest.size() - 1), last);
+      }
+
+      start = Clock::now();
+      SphereUpdateStats const stats = store.TakeChanges(ranges);
+      takeSeconds += SecondsSince(start);
+
+      total.changed += stats.changed;
+      total.copied += stats.copied;
+      total.ranges += stats.ranges;
+
+      // The copies vkCmdCopyBuffer would make.
+      for (auto&& range : ranges) {
+        std::copy_n(store.Spheres().begin() +
+                      static_cast<gsl::index>(range.first),
+                    range.count, device.begin() + range.first);
+      }
+    }
+    if (!std::equal(device.begin(), device.end(), store.Spheres().begin(),
+                    [](SceneSphere const& a, SceneSphere const& b) {
+                      return std::memcmp(&a, &b, sizeof(a)) == 0;
+                    })) {
+      ++mismatches;
+    }
+
+    // Spheres changed twice in a frame are copied once.
+    double const copiedBytes =
+      static_cast<double>(total.copied) * sizeof(SceneSphere) / frameCount;
+    double const filler =
+      total.copied > 0 ? 1.0 - static_cast<double>(std::min(
+                                 total.changed, total.copied)) /
+                                 total.copied
+                       : 0.0;
+    std::printf("  gap %2" PRIu64 ": %8.1f regions, %8.1f KiB, %5.2f %% "
+                "of the buffer (%.1fx less), %4.1f %% unchanged\n"
+                "          mark %.3f ms, merge %.3f ms per frame\n",
+                gap, static_cast<double>(total.ranges) / frameCount,
+                copiedBytes / 1024, 100.0 * copiedBytes / bufferBytes,
+                copiedBytes > 0.0 ? bufferBytes / copiedBytes : 0.0,
+                100.0 * filler, animateSeconds * 1e3 / frameCount,
+                takeSeconds * 1e3 / frameCount);
+  }
+
+  // A simulation writing every sphere back as it is uploads nothing.
+  auto const start = Clock::now();
+  std::vector<SceneSphere> const current(store.Spheres().begin(),
+                                         store.Spheres().end());
+  for (std::size_t i = 0; i < current.size(); ++i) store.Set(i, current[i]);
+  SphereUpdateStats const unchanged = store.TakeChanges(ranges);
+  std::printf("  rewrite: %" PRIu64 " spheres written, %" PRIu64
+              " changed, %" PRIu64 " regions in %.3f ms\n",
+              unchanged.written, unchanged.changed, unchanged.ranges,
+              SecondsSince(start) * 1e3);
+  if (unchanged.ranges != 0) ++mismatches;
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Updates
+
+int Resolution(std::uint32_t frameCount) {
+  // The renderer's controller, holding the trace at 8 ms.
+  DynamicResolutionController::Config config;
+  config.targetMs = 8.f;
+  config.minScale = .25f;
+  config.maxScale = 1.f;
+
+  // The trace time at full scale in each quarter of the trace: the ideal
+  // scales are .63, 1 (clamped from 1.15), .45 and .82.
+  constexpr float kLoadMs[] = {20.f, 6.f, 40.f, 12.f};
+  constexpr std::uint32_t kPhaseCount = 4;
+  std::uint32_t const phaseFrames = frameCount / kPhaseCount;
+
+  // A settled scale traces within the hysteresis band, widened by the
+  // noise and a quantum either way.
+  constexpr float kNoise = .05f;
+  auto settled = [&config](float scale, float loadMs) noexcept {
+    float const ideal = std::sqrt(config.targetMs / loadMs);
+    float const low =
+      ideal * std::sqrt(1.f - config.hysteresis - kNoise) - config.quantum;
+    float const high =
+      ideal * std::sqrt(1.f + config.hysteresis + kNoise) + config.quantum;
+    return scale >= std::clamp(low, config.minScale, config.maxScale) &&
+           scale <= std::clamp(high, config.minScale, config.maxScale);
+  };
+
+  std::printf("%u frames, %u per load of %g, %g, %g and %g ms at full scale, "
+              "target %g ms\n",
+              frameCount, phaseFrames, kLoadMs[0], kLoadMs[1], kLoadMs[2],
+              kLoadMs[3], config.targetMs);
+
+  int mismatches = 0;
+  for (std::uint32_t framesInFlight = 1; framesInFlight <= kMaxFramesInFlight;
+       ++framesInFlight) {
+    DynamicResolutionController controller(config);
+    // The trace times of the frames in flight, oldest first.
+    std::vector<float> inFlight;
+    std::uint64_t state = 1;
+
+    std::uint64_t settledChanges = 0;
+    std::uint32_t settleFrames = 0;
+    bool allSettled = true;
+    for (std::uint32_t phase = 0; phase < kPhaseCount; ++phase) {
+      // The frame the scale last entered the band, and stayed there.
+      std::uint32_t settledSince = UINT32_MAX;
+      for (std::uint32_t frame = 0; frame < phaseFrames; ++frame) {
+        float const scale = controller.Scale();
+        // Uniform noise of +-kNoise, from a 64-bit LCG.
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        float const noise =
+          1.f + kNoise * (2.f * static_cast<float>(state >> 40) /
+                            static_cast<float>(1 << 24) -
+                          1.f);
+        inFlight.push_back(kLoadMs[phase] * scale * scale * noise);
+
+        // The oldest frame in flight completes, and is fed once.
+        if (inFlight.size() > framesInFlight) {
+          float const traceMs = inFlight.front();
+          inFlight.erase(inFlight.begin());
+          if (controller.Update(traceMs) && frame >= phaseFrames / 2) {
+            ++settledChanges;
+          }
+        }
+
+        if (!settled(controller.Scale(), kLoadMs[phase])) {
+          settledSince = UINT32_MAX;
+        } else if (settledSince == UINT32_MAX) {
+          settledSince = frame;
+        }
+      }
+      if (settledSince > phaseFrames / 2) {
+        allSettled = false;
+      } else {
+        settleFrames = std::max(settleFrames, settledSince);
+      }
+    }
+
+    std::printf("  %u in flight: %3" PRIu64 " changes, %" PRIu64
+                " once settled, ",
+                framesInFlight, controller.ChangeCount(), settledChanges);
+    if (allSettled) {
+      std::printf("settled within %u frames\n", settleFrames);
+    } else {
+      std::printf("did not settle\n");
+    }
+
+    // Once settled, the scale changes at most once per load.
+    if (!allSettled || settledChanges > kPhaseCount) ++mismatches;
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Resolution
+
+// The faults Submits injects into the renderer's submits.
+enum class SubmitFault {
+  kNone,
+  kNoUploadWait,    // the build acquires the spheres before the upload ends
+  kNoBuildWait,     // the first frame does not wait for the build
+  kNoAcquireSignal, // a frame waits on an image that was never acquired
+  kNoPresent,       // an image is rendered to again before it is presented
+  kNoTopLevelBuild, // a frame waits on a TLAS build that was not submitted
+}; // enum class SubmitFault
+
+char const* to_string(SubmitFault fault) noexcept {
+  switch (fault) {
+  case SubmitFault::kNone: return "none";
+  case SubmitFault::kNoUploadWait: return "no upload wait";
+  case SubmitFault::kNoBuildWait: return "no build wait";
+  case SubmitFault::kNoAcquireSignal: return "no acquire signal";
+  case SubmitFault::kNoPresent: return "no present";
+  case SubmitFault::kNoTopLevelBuild: return "no tlas build";
+  }
+  return "unknown";
+} // to_string
+
+int Submits(std::uint32_t frameCount) {
+  // Stand-ins for the handles 01_sphere records: the spheres buffer,
+  // sAccelerationStructuresBuilt, each frame slot's imageAvailable and
+  // topLevelBuilt and each swapchain image's sRenderFinished.
+  static constexpr std::uint64_t kSpheres = 0x100, kBuilt = 0x200;
+  static constexpr std::uint64_t kImageAvailable = 0x1000,
+                                 kRenderFinished = 0x2000,
+                                 kTopLevelBuilt = 0x3000;
+  constexpr std::uint32_t kFramesInFlight = 2, kImageCount = 3;
+
+  // The submits of 01_sphere from CreateSpheresBuffer on, through the
+  // recording QueueSubmit does in debug builds, with fault injected. Returns
+  // the errors the graph reported, and the log of the first frame's
+  // submits in log.
+  auto replay = [frameCount](bool async, SubmitFault fault,
+                             std::string* log = nullptr) {
+    SubmitGraph graph;
+    std::vector<std::string> errors;
+    auto check = [&errors](std::string error) {
+      if (!error.empty()) errors.push_back(std::move(error));
+    };
+    std::vector<std::uint64_t> spheres;
+    if (async) spheres.push_back(kSpheres);
+
+    // EndOneTimeSubmit: the upload releases the spheres to the compute
+    // family and is waited for.
+    check(graph.Record({QueueRole::kGraphics, "EndOneTimeSubmit", {}, {},
+                        spheres, {}}));
+    if (fault != SubmitFault::kNoUploadWait) {
+      graph.RecordHostWait(QueueRole::kGraphics);
+    }
+
+    // SubmitAccelerationStructureBuild takes the spheres and gives them back.
+    check(graph.Record({QueueRole::kCompute, "AccelerationStructureBuild", {},
+                        {kBuilt}, spheres, spheres}));
+
+    for (std::uint32_t frame = 0; frame < frameCount; ++frame) {
+      std::uint64_t const imageAvailable =
+        kImageAvailable + frame % kFramesInFlight;
+      std::uint64_t const renderFinished =
+        kRenderFinished + frame % kImageCount;
+      std::uint64_t const topLevelBuilt =
+        kTopLevelBuilt + frame % kFramesInFlight;
+
+      // Later frames rebuild their slot's TLAS on the compute queue, but
+      // for every third, which refits the spheres and rebuilds on the
+      // graphics queue.
+      bool const computeBuild = frame > 0 && frame % 3 != 0;
+      if (computeBuild &&
+          (fault != SubmitFault::kNoTopLevelBuild || frame != 1)) {
+        check(graph.Record(
+          {QueueRole::kCompute, "TopLevelBuild", {}, {topLevelBuilt}}));
+      }
+
+      if (fault != SubmitFault::kNoAcquireSignal || frame != 1) {
+        check(graph.RecordSignal(imageAvailable, "vkAcquireNextImage2KHR"));
+      }
+
+      // The first frame waits for the build and takes the spheres back.
+      SubmitGraph::Submit draw{QueueRole::kGraphics, "Draw"};
+      draw.waits.push_back(
+        {imageAvailable, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV});
+      if (frame == 0) {
+        if (fault != SubmitFault::kNoBuildWait) {
+          draw.waits.push_back(
+            {kBuilt, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV});
+        }
+        draw.acquires = spheres;
+      }
+      if (computeBuild) {
+        draw.waits.push_back(
+          {topLevelBuilt, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV});
+      }
+      draw.signals.push_back(renderFinished);
+      check(graph.Record(std::move(draw)));
+
+      if (fault != SubmitFault::kNoPresent || frame != 1) {
+        check(graph.RecordWait(renderFinished, "vkQueuePresentKHR"));
+      }
+
+      if (frame == 0 && log) *log = graph.Describe();
+      graph.ClearLog();
+    }
+    return errors;
+  };
+
+  std::printf("%u frames, %u in flight, %u swapchain images\n", frameCount,
+              kFramesInFlight, kImageCount);
+
+  int mismatches = 0;
+  for (bool const async : {true, false}) {
+    std::string log;
+    std::vector<std::string> errors = replay(async, SubmitFault::kNone, &log);
+    std::printf("  %s compute family: %zu errors\n",
+                async ? "async" : "shared", errors.size());
+    for (auto&& error : errors) std::printf("    %s\n", error.c_str());
+    if (!errors.empty()) ++mismatches;
+
+    // The first frame's submits, indented.
+    for (std::size_t begin = 0; begin < log.size();) {
+      std::size_t const end = log.find('\n', begin);
+      std::printf("    %s\n", log.substr(begin, end - begin).c_str());
+      begin = end + 1;
+    }
+  }
+
+  // Each fault is reported. The ownership faults only exist with an async
+  // compute family.
+  for (SubmitFault const fault :
+       {SubmitFault::kNoUploadWait, SubmitFault::kNoBuildWait,
+        SubmitFault::kNoAcquireSignal, SubmitFault::kNoPresent,
+        SubmitFault::kNoTopLevelBuild}) {
+    std::vector<std::string> const errors = replay(true, fault);
+    std::printf("  %-17s: %s\n", to_string(fault),
+                errors.empty() ? "NOT reported" : errors.front().c_str());
+    if (errors.empty()) ++mismatches;
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Submits
+
+int Queues() {
+  // Queue family layouts as devices report them, with whether each family
+  // can present, and the families 01_sphere must choose from each.
+  struct Family {
+    VkQueueFlags flags;
+    std::uint32_t queueCount;
+    bool present;
+  }; // struct Family
+  struct Case {
+    char const* name;
+    std::vector<Family> families;
+    bool valid;
+    std::uint32_t graphics;
+    std::uint32_t compute;
+    bool asyncCompute; // the spheres change family around builds
+  }; // struct Case
+
+  constexpr VkQueueFlags G = VK_QUEUE_GRAPHICS_BIT, C = VK_QUEUE_COMPUTE_BIT,
+                         T = VK_QUEUE_TRANSFER_BIT;
+  constexpr std::uint32_t kNone = UINT32_MAX;
+  std::vector<Case> const cases = {
+    {"dedicated compute",
+     {{G | C | T, 16, true}, {C | T, 8, false}, {T, 2, false}},
+     true, 0, 1, true},
+    {"graphics-only first",
+     {{G | T, 1, true}, {G | C | T, 16, true}, {C | T, 8, false}},
+     true, 1, 2, true},
+    {"graphics-only", {{G | T, 16, true}, {T, 2, false}}, false, kNone,
+     kNone, false},
+    {"single universal", {{G | C | T, 16, true}}, true, 0, 0, false},
+    {"two universal", {{G | C | T, 16, true}, {G | C, 1, true}}, true, 0, 0,
+     false},
+    {"no present support", {{G | C | T, 16, false}, {C | T, 8, false}},
+     false, kNone, kNone, false},
+    {"present on second",
+     {{G | C | T, 16, false}, {G | C | T, 1, true}, {C, 4, false}},
+     true, 1, 2, true},
+    {"empty compute family", {{C | T, 0, false}, {G | C | T, 16, true}},
+     true, 1, 1, false},
+  };
+
+
+  int mismatches = 0;
+  for (auto&& test : cases) {
+    std::vector<VkQueueFamilyProperties> families(test.families.size());
+    std::vector<VkBool32> presentSupport(test.families.size());
+    for (std::size_t i = 0; i < families.size(); ++i) {
+      families[i] = {};
+      families[i].queueFlags = test.families[i].flags;
+      families[i].queueCount = test.families[i].queueCount;
+      presentSupport[i] = test.families[i].present ? VK_TRUE : VK_FALSE;
+    }
+
+    QueueFamilySelection const selection = SelectQueueFamilies(
+      families, presentSupport, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+    bool const matches =
+      selection.Valid() == test.valid &&
+      (!test.valid || (selection.graphics == test.graphics &&
+                       selection.compute == test.compute &&
+                       selection.AsyncCompute() == test.asyncCompute));
+    if (!matches) ++mismatches;
+
+    if (selection.Valid()) {
+      std::printf("  %-20s: graphics %u, compute %u, %s%s\n", test.name,
+                  selection.graphics, selection.compute,
+                  selection.AsyncCompute() ? "ownership transfers"
+                                           : "shared",
+                  matches ? "" : "  MISMATCH");
+    } else {
+      std::printf("  %-20s: no family can draw and present%s\n", test.name,
+                  matches ? "" : "  MISMATCH");
+    }
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Queues
+
+int Ring(std::uint32_t frameCount) {
+  std::printf("%u frames per ring\n", frameCount);
+
+  int mismatches = 0;
+  for (std::uint32_t size = 1; size <= kMaxFramesInFlight; ++size) {
+    for (LatencyMode const mode :
+         {LatencyMode::kThroughput, LatencyMode::kLowLatency}) {
+      // Stub queue for a GPU that is never ahead of the CPU: it completes a
+      // frame only when the CPU waits for it, so the ring alone bounds the
+      // frames in flight.
+      FrameRing ring(size, mode);
+      std::uint64_t submitted = 0, completed = 0;
+      std::vector<std::uint64_t> slotSerial(size, 0), slotUses(size, 0);
+      std::uint64_t maxInFlight = 0, latencySum = 0;
+
+      for (std::uint32_t frame = 0; frame < frameCount; ++frame) {
+        FrameSlot const slot = ring.Begin();
+        if (slot.serial != submitted + 1 || slot.index >= size ||
+            slot.index != (slot.serial - 1) % size ||
+            ring.SlotOf(slot.serial) != slot.index) {
+          ++mismatches;
+          break;
+        }
+
+        // Draw waits for waitSerial, and so for every frame before it.
+        completed = std::max(completed, slot.waitSerial);
+
+        // Waiting for waitSerial alone frees the slot, and bounds the
+        // frames in flight to the ring size, or to none in low latency
+        // mode, where input is then one frame from the screen.
+        std::uint64_t const inFlight = submitted - completed;
+        std::uint64_t const allowed =
+          mode == LatencyMode::kLowLatency ? 0 : size - 1;
+        if (slotSerial[slot.index] > completed || inFlight > allowed) {
+          ++mismatches;
+        }
+        maxInFlight = std::max(maxInFlight, inFlight);
+        latencySum += slot.serial - completed;
+
+        slotSerial[slot.index] = slot.serial;
+        slotUses[slot.index] += 1;
+        submitted = slot.serial;
+      }
+
+      // Slots are taken in turn.
+      auto const [fewest, most] =
+        std::minmax_element(slotUses.begin(), slotUses.end());
+      if (*most - *fewest > 1) ++mismatches;
+
+      std::printf("  %u slots, %-10s: %" PRIu64 " frames in flight while "
+                  "recording at most, input %.2f frames ahead of the GPU\n",
+                  size, to_string(mode), maxInFlight,
+                  static_cast<double>(latencySum) / frameCount);
+    }
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Ring
+
+int Barriers() {
+  // Stand-ins for sHDRImage, sOutputImage and the acquired swapchain image.
+  VkImage const hdr = reinterpret_cast<VkImage>(std::uintptr_t{0x10});
+  VkImage const output = reinterpret_cast<VkImage>(std::uintptr_t{0x20});
+  VkImage const swapchain = reinterpret_cast<VkImage>(std::uintptr_t{0x30});
+  PresentImages const images = {hdr, output, swapchain};
+
+  struct Barrier {
+    VkImage image;
+    VkAccessFlags srcAccessMask, dstAccessMask;
+    VkImageLayout oldLayout, newLayout;
+  };
+  struct Call {
+    FrameStep step;
+    VkPipelineStageFlags srcStageMask, dstStageMask;
+    std::vector<Barrier> barriers;
+  };
+
+  constexpr VkPipelineStageFlags kTrace =
+    VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_NV;
+  constexpr VkPipelineStageFlags kCompute =
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  constexpr VkPipelineStageFlags kTransfer = VK_PIPELINE_STAGE_TRANSFER_BIT;
+  constexpr VkPipelineStageFlags kBottom = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  constexpr VkAccessFlags kWrite = VK_ACCESS_SHADER_WRITE_BIT;
+  constexpr VkAccessFlags kRead = VK_ACCESS_SHADER_READ_BIT;
+  constexpr VkImageLayout kUndefined = VK_IMAGE_LAYOUT_UNDEFINED;
+  constexpr VkImageLayout kGeneral = VK_IMAGE_LAYOUT_GENERAL;
+  constexpr VkImageLayout kPresent = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  // What each path has to record, written out by hand.
+  Call const beforeTrace = {FrameStep::kBeforeTrace,
+                            kCompute,
+                            kTrace,
+                            {{hdr, 0, kWrite, kUndefined, kGeneral}}};
+  std::vector<Call> const copy = {
+    beforeTrace,
+    {FrameStep::kBeforeTonemap,
+     kTrace | kTransfer,
+     kCompute,
+     {{hdr, kWrite, kRead, kGeneral, kGeneral},
+      {output, 0, kWrite, kUndefined, kGeneral}}},
+    {FrameStep::kAfterTonemap,
+     kCompute | kTransfer,
+     kTransfer,
+     {{output, kWrite, VK_ACCESS_TRANSFER_READ_BIT, kGeneral,
+       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL},
+      {swapchain, 0, VK_ACCESS_TRANSFER_WRITE_BIT, kUndefined,
+       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL}}},
+    {FrameStep::kAfterCopy,
+     kTransfer,
+     kBottom,
+     {{swapchain, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, kPresent}}}};
+  std::vector<Call> const direct = {
+    beforeTrace,
+    {FrameStep::kBeforeTonemap,
+     kTrace | kCompute,
+     kCompute,
+     {{hdr, kWrite, kRead, kGeneral, kGeneral},
+      {swapchain, 0, kWrite, kUndefined, kGeneral}}},
+    {FrameStep::kAfterTonemap,
+     kCompute,
+     kBottom,
+     {{swapchain, kWrite, 0, kGeneral, kPresent}}}};
+
+  auto name = [&](VkImage image) {
+    return image == hdr ? "hdr" : image == output ? "output" : "swapchain";
+  };
+
+  int mismatches = 0;
+  for (PresentPath const path : {PresentPath::kCopy, PresentPath::kDirect}) {
+    std::vector<Call> calls;
+    for (FrameStep const step :
+         {FrameStep::kBeforeTrace, FrameStep::kBeforeTonemap,
+          FrameStep::kAfterTonemap, FrameStep::kAfterCopy}) {
+      RecordPresentBarriers(
+        step, path, images,
+        [&calls, step](VkPipelineStageFlags srcStageMask,
+                       VkPipelineStageFlags dstStageMask,
+                       gsl::span<VkImageMemoryBarrier const> barriers) {
+          Call call{step, srcStageMask, dstStageMask, {}};
+          for (auto&& barrier : barriers) {
+            call.barriers.push_back({barrier.image, barrier.srcAccessMask,
+                                     barrier.dstAccessMask, barrier.oldLayout,
+                                     barrier.newLayout});
+          }
+          calls.push_back(std::move(call));
+        });
+    }
+
+    std::printf("%s path, waiting for the swapchain image at 0x%x:\n",
+                to_string(path), static_cast<unsigned>(PresentWaitStage(path)));
+    for (auto&& call : calls) {
+      std::printf("  %-14s: stages 0x%x -> 0x%x\n", to_string(call.step),
+                  static_cast<unsigned>(call.srcStageMask),
+                  static_cast<unsigned>(call.dstStageMask));
+      for (auto&& barrier : call.barriers) {
+        std::printf("    %-9s: access 0x%x -> 0x%x, layout %u -> %u\n",
+                    name(barrier.image),
+                    static_cast<unsigned>(barrier.srcAccessMask),
+                    static_cast<unsigned>(barrier.dstAccessMask),
+                    static_cast<unsigned>(barrier.oldLayout),
+                    static_cast<unsigned>(barrier.newLayout));
+      }
+    }
+
+    std::vector<Call> const& expected =
+      path == PresentPath::kCopy ? copy : direct;
+    bool const same = std::equal(
+      calls.begin(), calls.end(), expected.begin(), expected.end(),
+      [](Call const& a, Call const& b) {
+        return a.step == b.step && a.srcStageMask == b.srcStageMask &&
+               a.dstStageMask == b.dstStageMask &&
+               std::equal(a.barriers.begin(), a.barriers.end(),
+                          b.barriers.begin(), b.barriers.end(),
+                          [](Barrier const& x, Barrier const& y) {
+                            return x.image == y.image &&
+                                   x.srcAccessMask == y.srcAccessMask &&
+                                   x.dstAccessMask == y.dstAccessMask &&
+                                   x.oldLayout == y.oldLayout &&
+                                   x.newLayout == y.newLayout;
+                          });
+      });
+    if (!same) ++mismatches;
+
+    // Whatever the table says: each image's layout carries on from its last
+    // barrier, the swapchain image ends up presentable, and its first
+    // barrier is ordered after the wait for the acquire.
+    std::vector<std::pair<VkImage, VkImageLayout>> layouts;
+    bool chained = true, waited = false, first = true;
+    VkImageLayout swapchainLayout = kUndefined;
+    for (auto&& call : calls) {
+      for (auto&& barrier : call.barriers) {
+        auto last = std::find_if(layouts.begin(), layouts.end(),
+                                 [&barrier](auto const& entry) {
+                                   return entry.first == barrier.image;
+                                 });
+        if (last == layouts.end()) {
+          layouts.push_back({barrier.image, barrier.newLayout});
+        } else {
+          chained = chained && (barrier.oldLayout == kUndefined ||
+                                barrier.oldLayout == last->second);
+          last->second = barrier.newLayout;
+        }
+        if (barrier.image == swapchain) {
+          if (first) {
+            waited = (call.srcStageMask & PresentWaitStage(path)) != 0;
+            first = false;
+          }
+          swapchainLayout = barrier.newLayout;
+        }
+      }
+    }
+    if (!chained || !waited || swapchainLayout != kPresent) ++mismatches;
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Barriers
+
+int Tonemap(std::uint32_t frameCount) {
+  std::uint64_t state = 0x9E37'79B9'7F4A'7C15;
+  auto random = [&state]() {
+    // SplitMix64.
+    std::uint64_t z = (state += 0x9E37'79B9'7F4A'7C15);
+    z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+    z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+    return z ^ (z >> 31);
+  };
+
+  // Radiance spanning several stops, with a few texels of every kind a
+  // trace gets wrong: NaN, infinite, negative and overflowing.
+  float const kSpecial[] = {std::numeric_limits<float>::quiet_NaN(),
+                            std::numeric_limits<float>::infinity(),
+                            -std::numeric_limits<float>::infinity(), -4.f,
+                            1e30f};
+  auto fill = [&](std::vector<float>& hdr) {
+    for (auto&& value : hdr) {
+      std::uint64_t const bits = random();
+      value = bits % 64 == 0
+                ? kSpecial[(bits >> 6) % std::size(kSpecial)]
+                : std::exp2(static_cast<float>(bits >> 40) * 0x1p-24f * 12.f -
+                            6.f);
+    }
+  };
+
+  // The SIMD kernel, in three bands of rows as threads split a frame,
+  // against the scalar one.
+  int largestDifference = 0, mismatches = 0, caseCount = 0;
+  auto compare = [&](HDRImageView const& src, std::uint32_t width,
+                     std::uint32_t height, TonemapParams const& params) {
+    std::uint32_t const pitch = width + 3;
+    std::vector<std::uint8_t> simd(std::size_t{pitch} * height * 4, 0),
+      scalar(simd.size(), 0);
+    LDRImageView const simdView = {simd.data(), width, height, pitch};
+    std::uint32_t const band = (height + 2) / 3;
+    for (std::uint32_t row = 0; row < height; row += band) {
+      TonemapUpscale(src, simdView, params, row, band);
+    }
+    TonemapUpscaleScalar(src, {scalar.data(), width, height, pitch}, params);
+
+    bool same = true;
+    for (std::size_t i = 0; i < simd.size(); ++i) {
+      int const difference = std::abs(simd[i] - scalar[i]);
+      largestDifference = std::max(largestDifference, difference);
+      same = same && difference <= 1;
+    }
+    if (!same) ++mismatches;
+    ++caseCount;
+    return simd;
+  };
+
+  struct Size {
+    std::uint32_t width, height;
+  };
+  for (Size const size : {Size{1, 1}, Size{255, 3}, Size{257, 17},
+                          Size{640, 360}, Size{1000, 7}}) {
+    for (float const renderScale : {1.f, .67f, .5f}) {
+      auto const srcWidth = std::max(
+        1u, static_cast<std::uint32_t>(std::lround(size.width * renderScale)));
+      auto const srcHeight = std::max(
+        1u, static_cast<std::uint32_t>(std::lround(size.height * renderScale)));
+      std::vector<float> hdr(std::size_t{srcWidth + 1} * srcHeight * 4);
+      fill(hdr);
+      HDRImageView const src = {hdr.data(), srcWidth, srcHeight, srcWidth + 1};
+
+      for (auto filter : {UpscaleFilter::kBilinear, UpscaleFilter::kBicubic}) {
+        for (float const exposure : {1.f, .25f, 8.f}) {
+          compare(src, size.width, size.height, {exposure, filter});
+        }
+      }
+    }
+  }
+
+  // Uniform images whose every channel sum is known: NaN must come out 0,
+  // and overflow, or infinite exposure, 255.
+  struct Uniform {
+    float value, exposure;
+    std::uint8_t expected;
+  };
+  for (Uniform const uniform :
+       {Uniform{std::numeric_limits<float>::quiet_NaN(), 1.f, 0},
+        Uniform{1e30f, 1.f, 255},
+        Uniform{1.f, std::numeric_limits<float>::infinity(), 255}}) {
+    std::vector<float> hdr(4 * 4 * 4, uniform.value);
+    for (auto filter : {UpscaleFilter::kBilinear, UpscaleFilter::kBicubic}) {
+      std::vector<std::uint8_t> const ldr =
+        compare({hdr.data(), 4, 4, 4}, 7, 5, {uniform.exposure, filter});
+      for (std::uint32_t y = 0; y < 5; ++y) {
+        for (std::uint32_t x = 0; x < 7; ++x) {
+          std::uint8_t const* pixel = &ldr[(std::size_t{y} * 10 + x) * 4];
+          if (pixel[0] != uniform.expected || pixel[1] != uniform.expected ||
+              pixel[2] != uniform.expected || pixel[3] != 255) {
+            ++mismatches;
+          }
+        }
+      }
+    }
+  }
+
+  std::printf("tonemap: %d cases, largest SIMD-scalar difference %d LSB\n",
+              caseCount, largestDifference);
+
+  // A 1080p frame from a half resolution trace, as 01_sphere upscales it.
+  constexpr std::uint32_t kWidth = 1920, kHeight = 1080;
+  std::vector<float> hdr(std::size_t{kWidth / 2} * kHeight / 2 * 4);
+  fill(hdr);
+  HDRImageView const src = {hdr.data(), kWidth / 2, kHeight / 2, kWidth / 2};
+  std::vector<std::uint8_t> ldr(std::size_t{kWidth} * kHeight * 4);
+  LDRImageView const dst = {ldr.data(), kWidth, kHeight, kWidth};
+
+  for (auto filter : {UpscaleFilter::kBilinear, UpscaleFilter::kBicubic}) {
+    TonemapParams const params = {1.f, filter};
+
+    auto start = Clock::now();
+    for (std::uint32_t i = 0; i < frameCount; ++i) {
+      TonemapUpscale(src, dst, params);
+    }
+    double const simdSeconds = SecondsSince(start);
+
+    start = Clock::now();
+    for (std::uint32_t i = 0; i < frameCount; ++i) {
+      TonemapUpscaleScalar(src, dst, params);
+    }
+    double const scalarSeconds = SecondsSince(start);
+
+    double const perFrameMs = simdSeconds * 1e3 / frameCount;
+    std::printf("  %-8s %ux%u from %ux%u: %8.3f ms/frame (%.0f Mpixels/s)\n",
+                to_string(filter), kWidth, kHeight, kWidth / 2, kHeight / 2,
+                perFrameMs, kWidth * kHeight / (perFrameMs * 1e3));
+    std::printf("  %-8s scalar:               %8.3f ms/frame (%.1fx slower)\n",
+                to_string(filter), scalarSeconds * 1e3 / frameCount,
+                scalarSeconds / std::max(simdSeconds, 1e-9));
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Tonemap
+
+// Inline data of the records of the layouts ShaderBindingTables checks.
+struct SBTMaterial {
+  float albedo[3];
+  std::uint32_t texture;
+}; // struct SBTMaterial
+
+template <class T>
+gsl::span<std::byte const> AsBytes(T const& value) noexcept {
+  return gsl::as_bytes(gsl::make_span(&value, 1));
+} // AsBytes
+
+// Fill Layout and generate a table with the generator from the same fake
+// handles, records added by addRecords and inline data, and compare the
+// two byte for byte, padding included.
+template <class Layout, class AddRecords, class Fill>
+bool CompareSBTLayout(char const* name, AddRecords&& addRecords, Fill&& fill) {
+  std::vector<std::byte> handles(Layout::kGroupCount * Layout::kHandleSize);
+  for (std::size_t i = 0; i < handles.size(); ++i) {
+    handles[i] = static_cast<std::byte>(i * 37 + 11);
+  }
+
+  ShaderBindingTableGenerator generator;
+  addRecords(generator);
+  VkDeviceSize const size =
+    generator.ComputeSize(Layout::kHandleSize, Layout::kBaseAlignment);
+
+  using Section = ShaderBindingTableGenerator::Section;
+  bool same = size == Layout::kSize &&
+              generator.GroupCount() == Layout::kGroupCount &&
+              generator.RayGenStride() == Layout::kRayGenStride &&
+              generator.MissOffset() == Layout::kMissOffset &&
+              generator.MissStride() == Layout::kMissStride &&
+              generator.HitGroupOffset() == Layout::kHitGroupOffset &&
+              generator.HitGroupStride() == Layout::kHitGroupStride &&
+              generator.Offset(Section::kCallable) == Layout::kCallableOffset &&
+              generator.CallableStride() == Layout::kCallableStride;
+
+  if (same) {
+    // Padding is never written, so start both from the same garbage.
+    std::vector<std::byte> generated(Layout::kSize, std::byte{0xCD});
+    std::vector<std::byte> filled(generated);
+    generator.Generate(handles, generated.data());
+    fill(handles.data(), filled.data());
+    same = generated == filled;
+  }
+
+  std::printf("  %-9s %5u bytes, hit groups at %4u, stride %3u: %s\n", name,
+              static_cast<unsigned>(Layout::kSize),
+              static_cast<unsigned>(Layout::kHitGroupOffset),
+              static_cast<unsigned>(Layout::kHitGroupStride),
+              same ? "same" : "DIFFERENT");
+  return same;
+} // CompareSBTLayout
+
+int ShaderBindingTables(std::uint32_t recordCount) {
+  int mismatches = 0;
+  std::printf("shader binding table layouts against the generator:\n");
+
+  // 01_sphere's SphereShaderBindingTableLayout.
+  shader::SphereMaterial const tint = {{1.f, .6f, .3f}};
+  using Sphere = ShaderBindingTableLayout<
+    16, 64, SBTSection<SBTRecord<0>>, SBTSection<SBTRecord<1>>,
+    SBTSection<SBTRecord<2, shader::SphereMaterial>, SBTRecord<3>>>;
+  if (!CompareSBTLayout<Sphere>(
+        "sphere",
+        [&](ShaderBindingTableGenerator& generator) {
+          generator.AddRayGen(0);
+          generator.AddMiss(1);
+          generator.AddHitGroup(2, AsBytes(tint));
+          generator.AddHitGroup(3);
+        },
+        [&](std::byte const* handles, std::byte* output) {
+          Sphere::Fill(handles, output, {}, {},
+                       std::make_tuple(tint, SBTNoInlineData{}));
+        })) {
+    ++mismatches;
+  }
+
+  // Inline data in every section, records repeated and groups out of
+  // order, with 32 byte handles.
+  std::array<SBTMaterial, 3> const materials = {
+    {{{.8f, .3f, .3f}, 0}, {{.8f, .8f, 0.f}, 1}, {{.1f, .2f, .5f}, 2}}};
+  std::array<std::uint64_t, 2> const callables = {0x0123'4567'89AB'CDEF, 42};
+  float const cameraScale = 1.5f;
+  float const missIntensity = .25f;
+  using Materials = ShaderBindingTableLayout<
+    32, 64, SBTSection<SBTRecord<0, float>>,
+    SBTSection<SBTRecord<2>, SBTRecord<1, float>>,
+    SBTSection<SBTRecord<4, SBTMaterial, 3>, SBTRecord<3>>,
+    SBTSection<SBTRecord<5, std::uint64_t, 2>>>;
+  if (!CompareSBTLayout<Materials>(
+        "materials",
+        [&](ShaderBindingTableGenerator& generator) {
+          generator.AddRayGen(0, AsBytes(cameraScale));
+          generator.AddMiss(2);
+          generator.AddMiss(1, AsBytes(missIntensity));
+          for (auto&& material : materials) {
+            generator.AddHitGroup(4, AsBytes(material));
+          }
+          generator.AddHitGroup(3);
+          for (auto&& callable : callables) {
+            generator.AddCallable(5, AsBytes(callable));
+          }
+        },
+        [&](std::byte const* handles, std::byte* output) {
+          Materials::Fill(handles, output, std::make_tuple(cameraScale),
+                          std::make_tuple(SBTNoInlineData{}, missIntensity),
+                          std::make_tuple(materials, SBTNoInlineData{}),
+                          std::make_tuple(callables));
+        })) {
+    ++mismatches;
+  }
+
+  // No miss section, so the hit groups follow the raygen record, and
+  // handles as large as the base alignment.
+  std::uint32_t const hitIndex = 7;
+  using NoMiss =
+    ShaderBindingTableLayout<64, 64, SBTSection<SBTRecord<0>>, SBTSection<>,
+                             SBTSection<SBTRecord<1, std::uint32_t>>>;
+  if (!CompareSBTLayout<NoMiss>(
+        "no miss",
+        [&](ShaderBindingTableGenerator& generator) {
+          generator.AddRayGen(0);
+          generator.AddHitGroup(1, AsBytes(hitIndex));
+        },
+        [&](std::byte const* handles, std::byte* output) {
+          NoMiss::Fill(handles, output, {}, {}, std::make_tuple(hitIndex));
+        })) {
+    ++mismatches;
+  }
+
+  // Patch the inline data of a few records in a host copy of the table and
+  // stage only the copy regions in a slice per frame, as 01_sphere's
+  // UpdateShaderBindingTable does, then bring a device copy up to date from
+  // the slices alone. After each round it must match the table generated
+  // from scratch with the new data.
+  {
+    using Section = ShaderBindingTableGenerator::Section;
+    constexpr std::uint32_t kPatchRecordCount = 64;
+    std::vector<std::byte> handles(8 * 32);
+    for (std::size_t i = 0; i < handles.size(); ++i) {
+      handles[i] = static_cast<std::byte>(i * 13 + 5);
+    }
+
+    std::vector<SBTMaterial> patched(kPatchRecordCount);
+    std::uint64_t callable = 7;
+    auto addRecords = [&](ShaderBindingTableGenerator& generator) {
+      generator.AddRayGen(0);
+      generator.AddMiss(1);
+      for (auto&& material : patched) {
+        generator.AddHitGroup(2, AsBytes(material));
+      }
+      generator.AddCallable(3, AsBytes(callable));
+    };
+    for (std::uint32_t i = 0; i < kPatchRecordCount; ++i) {
+      patched[i] = {{0.f, 0.f, 0.f}, i};
+    }
+
+    ShaderBindingTableGenerator generator;
+    addRecords(generator);
+    auto const size = static_cast<std::size_t>(generator.ComputeSize(32, 64));
+    std::vector<std::byte> host(size);
+    generator.Generate(handles, host.data());
+    std::vector<std::byte> device(host);
+
+    // Slices only ever hold the regions staged in them, so start them from
+    // garbage: a copy that relied on the rest would not match.
+    constexpr std::size_t kSliceCount = 2;
+    std::vector<std::byte> staging(kSliceCount * size, std::byte{0xCD});
+
+    // Neighbours, which merge across the handle between them, a record
+    // updated twice, one far from the rest and the callable section; then
+    // the records either side of 20, staged in the other slice, whose
+    // merged region carries 20 as the first round left it.
+    std::vector<std::vector<std::uint32_t>> const rounds = {
+      {3, 4, 5, 20, 4, 63}, {19, 21}};
+    std::vector<VkBufferCopy> regions;
+    ShaderBindingTableGenerator::UpdateStats firstStats;
+    std::size_t firstRegionCount = 0;
+    bool same = true;
+
+    for (std::size_t round = 0; round < rounds.size(); ++round) {
+      for (std::uint32_t const i : rounds[round]) {
+        patched[i].albedo[0] += 1.f;
+        generator.UpdateInlineData(Section::kHitGroup, i, AsBytes(patched[i]));
+      }
+      if (round == 0) {
+        callable = 8;
+        generator.UpdateInlineData(Section::kCallable, 0, AsBytes(callable));
+      }
+
+      auto const stats = generator.WriteDirtyRecords(host.data(), regions);
+      std::size_t const sliceOffset = (round % kSliceCount) * size;
+      for (auto&& region : regions) {
+        region.srcOffset += sliceOffset;
+        std::memcpy(staging.data() + region.srcOffset,
+                    host.data() + region.dstOffset,
+                    static_cast<std::size_t>(region.size));
+      }
+      for (auto&& region : regions) {
+        std::memcpy(device.data() + region.dstOffset,
+                    staging.data() + region.srcOffset,
+                    static_cast<std::size_t>(region.size));
+      }
+
+      ShaderBindingTableGenerator reference;
+      addRecords(reference);
+      reference.ComputeSize(32, 64);
+      std::vector<std::byte> expected(size);
+      reference.Generate(handles, expected.data());
+
+      bool sorted = true;
+      for (std::size_t i = 1; i < regions.size(); ++i) {
+        sorted = sorted && regions[i - 1].dstOffset + regions[i - 1].size <
+                             regions[i].dstOffset;
+      }
+      same = same && device == expected && host == expected && sorted;
+      if (round == 0) {
+        firstStats = stats;
+        firstRegionCount = regions.size();
+      }
+    }
+
+    std::vector<VkBufferCopy> none;
+    same = same && firstStats.recordCount == 6 &&
+           firstStats.bytesWritten ==
+             5 * sizeof(SBTMaterial) + sizeof(callable) &&
+           !generator.HasDirtyRecords() &&
+           generator.WriteDirtyRecords(host.data(), none).recordCount == 0 &&
+           none.empty();
+    if (!same) ++mismatches;
+
+    std::printf("  patch     %u of %zu records dirty, %zu regions, %u of %zu "
+                "bytes copied, %zu slices: %s\n",
+                firstStats.recordCount,
+                generator.RecordCount(Section::kRayGen) +
+                  generator.RecordCount(Section::kMiss) +
+                  generator.RecordCount(Section::kHitGroup) +
+                  generator.RecordCount(Section::kCallable),
+                firstRegionCount,
+                static_cast<unsigned>(firstStats.bytesCopied), size,
+                kSliceCount, same ? "same" : "DIFFERENT");
+  }
+
+  // A table of recordCount hit groups, one per material, rebuilt into
+  // reserved storage and generated from handles queried once, as a scene
+  // with a hit group per object would each time it changes.
+  constexpr int kRepeatCount = 20;
+  constexpr VkDeviceSize kHandleSize = 32;
+  std::vector<SBTMaterial> objects(recordCount);
+  for (std::uint32_t i = 0; i < recordCount; ++i) {
+    objects[i] = {{static_cast<float>(i % 7) / 7.f, .5f, .5f}, i};
+  }
+  std::vector<std::byte> handles(4 * kHandleSize);
+  for (std::size_t i = 0; i < handles.size(); ++i) {
+    handles[i] = static_cast<std::byte>(i);
+  }
+
+  ShaderBindingTableGenerator generator;
+  generator.Reserve(1, 1, recordCount, 0, recordCount * sizeof(SBTMaterial));
+  std::vector<std::byte> table;
+  double buildSeconds = 0.0, generateSeconds = 0.0;
+
+  for (int repeat = 0; repeat < kRepeatCount; ++repeat) {
+    auto start = Clock::now();
+    generator.Clear();
+    generator.AddRayGen(0);
+    generator.AddMiss(1);
+    for (std::uint32_t i = 0; i < recordCount; ++i) {
+      generator.AddHitGroup(2 + i % 2, AsBytes(objects[i]));
+    }
+    VkDeviceSize const size = generator.ComputeSize(kHandleSize, 64);
+    buildSeconds += SecondsSince(start);
+
+    table.resize(static_cast<std::size_t>(size));
+    start = Clock::now();
+    generator.Generate(handles, table.data());
+    generateSeconds += SecondsSince(start);
+  }
+
+  // Spot check the last record against what was added.
+  std::uint32_t const lastGroup = 2 + (recordCount - 1) % 2;
+  std::byte const* last = table.data() + generator.HitGroupOffset() +
+                          (recordCount - 1) * generator.HitGroupStride();
+  if (std::memcmp(last, handles.data() + lastGroup * kHandleSize,
+                  kHandleSize) != 0 ||
+      std::memcmp(last + kHandleSize, &objects.back(), sizeof(SBTMaterial)) !=
+        0) {
+    ++mismatches;
+  }
+
+  double const perRecordNs = 1e9 / (double{kRepeatCount} * recordCount);
+  std::printf("  %u hit records, %zu bytes:\n", recordCount, table.size());
+  std::printf("    build:    %8.3f ms (%.1f ns/record)\n",
+              buildSeconds * 1e3 / kRepeatCount, buildSeconds * perRecordNs);
+  std::printf("    generate: %8.3f ms (%.1f ns/record, %.2f GB/s)\n",
+              generateSeconds * 1e3 / kRepeatCount,
+              generateSeconds * perRecordNs,
+              table.size() * double{kRepeatCount} /
+                (std::max(generateSeconds, 1e-9) * 1e9));
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // ShaderBindingTables
+
+int Deletion(std::uint32_t frameCount) {
+  // A stub device: every resource is an id, live until its deleter runs,
+  // with the last frame that used it, and for swapchains the presents to
+  // them queued or on screen.
+  struct Resource {
+    std::uint64_t frame{0};
+    std::uint32_t presents{0};
+    bool swapchain{false};
+  };
+  enum class ImageState { kFree, kAcquired, kPresented };
+  struct Present {
+    std::uint64_t swapchain;
+    std::uint32_t image;
+  };
+
+  int mismatches = 0;
+  for (std::uint32_t framesInFlight = 1; framesInFlight <= 3;
+       ++framesInFlight) {
+    std::unordered_map<std::uint64_t, Resource> live;
+    std::uint64_t nextId = 1;
+    std::uint64_t submitted = 0, completed = 0;
+    int destroyedInUse = 0, destroyedPresenting = 0, fenceOnlyPresenting = 0;
+    std::size_t maxPending = 0, maxPresentPending = 0;
+
+    // A FIFO presentation engine showing one queued present per vblank,
+    // releasing the image it showed before.
+    std::deque<Present> queued;
+    std::optional<Present> shown;
+    std::vector<ImageState> images;
+    std::uint64_t swapchain = 0;
+    auto release = [&](Present const& present) {
+      live.at(present.swapchain).presents -= 1;
+      if (present.swapchain == swapchain) {
+        images[present.image] = ImageState::kFree;
+      }
+    };
+    auto vblank = [&]() {
+      if (queued.empty()) return;
+      if (shown) release(*shown);
+      shown = queued.front();
+      queued.pop_front();
+    };
+
+    // What 01_sphere keeps: the deletion queues and the present tracking.
+    DeletionQueue deletionQueue, presentDeletionQueue;
+    std::vector<std::uint64_t> imagePresentedFrame;
+    std::uint64_t presentedFrameDone = 0;
+    std::vector<std::uint64_t> releasedPresent(framesInFlight, 0);
+
+    // The framebuffers, views and images of a swapchain, recreated with it.
+    std::vector<std::uint64_t> resources;
+    auto create = [&](std::uint32_t imageCount) {
+      swapchain = nextId++;
+      live[swapchain].swapchain = true;
+      images.assign(imageCount, ImageState::kFree);
+      imagePresentedFrame.assign(imageCount, 0);
+      resources.clear();
+      for (std::uint32_t i = 0; i < 2 * imageCount + 3; ++i) {
+        resources.push_back(nextId);
+        live[nextId++];
+      }
+    };
+    auto destroy = [&](std::uint64_t id) {
+      Resource const& resource = live.at(id);
+      if (resource.frame > completed) ++destroyedInUse;
+      if (resource.presents > 0) ++destroyedPresenting;
+      live.erase(id);
+    };
+
+    // RecreateSwapchain.
+    auto recreate = [&](std::uint32_t imageCount) {
+      for (std::uint64_t const id : resources) {
+        deletionQueue.Retire(submitted, [&destroy, id] { destroy(id); });
+      }
+      presentDeletionQueue.Retire(submitted, [&destroy, id = swapchain] {
+        destroy(id);
+      });
+      // Where retiring on the frame fence alone would have destroyed it.
+      deletionQueue.Retire(submitted, [&, id = swapchain] {
+        if (live.count(id) > 0 && live.at(id).presents > 0) {
+          ++fenceOnlyPresenting;
+        }
+      });
+      create(imageCount);
+    };
+
+    create(3);
+    for (std::uint32_t i = 0; i < frameCount; ++i) {
+      std::uint64_t const frame = submitted + 1;
+      std::size_t const slot = (frame - 1) % framesInFlight;
+
+      // Draw: wait for the slot, then collect both queues.
+      if (frame > framesInFlight) {
+        completed = std::max(completed, frame - framesInFlight);
+      }
+      deletionQueue.Collect(completed);
+      presentedFrameDone =
+        std::max(presentedFrameDone, releasedPresent[slot]);
+      presentDeletionQueue.Collect(presentedFrameDone);
+
+      // Resize now and then, sometimes on consecutive frames.
+      if (frame % 13 == 0 || frame % 29 == 1) {
+        recreate(2 + static_cast<std::uint32_t>(frame % 3));
+      }
+
+      // Acquire blocks until a vblank frees an image.
+      auto image = std::find(images.begin(), images.end(), ImageState::kFree);
+      while (image == images.end()) {
+        vblank();
+        image = std::find(images.begin(), images.end(), ImageState::kFree);
+      }
+      *image = ImageState::kAcquired;
+      auto const imageIndex =
+        static_cast<std::uint32_t>(image - images.begin());
+      releasedPresent[slot] = imagePresentedFrame[imageIndex];
+
+      for (std::uint64_t const id : resources) live.at(id).frame = frame;
+      live.at(swapchain).frame = frame;
+      submitted = frame;
+
+      queued.push_back({swapchain, imageIndex});
+      live.at(swapchain).presents += 1;
+      *image = ImageState::kPresented;
+      imagePresentedFrame[imageIndex] = frame;
+
+      // The GPU runs ahead of the display every third frame.
+      if (frame % 3 != 0) vblank();
+
+      maxPending = std::max(maxPending, deletionQueue.Pending());
+      maxPresentPending =
+        std::max(maxPresentPending, presentDeletionQueue.Pending());
+    }
+
+    // Shutdown: the device idles and the display lets go of everything.
+    completed = submitted;
+    while (!queued.empty()) vblank();
+    if (shown) release(*shown);
+    deletionQueue.Flush();
+    presentDeletionQueue.Flush();
+
+    std::size_t const leaked = live.size() - 1 - resources.size();
+    bool const retired =
+      deletionQueue.RetiredCount() == deletionQueue.DeletedCount() &&
+      presentDeletionQueue.RetiredCount() ==
+        presentDeletionQueue.DeletedCount();
+    if (destroyedInUse > 0 || destroyedPresenting > 0 || leaked > 0 ||
+        !retired || maxPresentPending > 2) {
+      ++mismatches;
+    }
+
+    std::printf("%u frames in flight: %" PRIu64 " swapchains retired, "
+                "%zu leaked\n",
+                framesInFlight, presentDeletionQueue.RetiredCount(), leaked);
+    std::printf("  destroyed while in use: %d, while presenting: %d\n",
+                destroyedInUse, destroyedPresenting);
+    std::printf("  pending at most: %zu resources, %zu swapchains\n",
+                maxPending, maxPresentPending);
+    std::printf("  swapchains the frame fence alone would have destroyed "
+                "while presenting: %d\n",
+                fenceOnlyPresenting);
+  }
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Deletion
+
+int Memory() {
+  using Category = MemoryCategory;
+  int mismatches = 0;
+
+  // A stub device's allocations through 01_sphere's startup with a scene
+  // of kSphereCount spheres, a CPU BVH built over them, a resize from 1080p
+  // to 1440p that creates the new images before retiring the old, and
+  // shutdown.
+  constexpr std::uint64_t kSphereCount = 100'000;
+  constexpr std::uint64_t kSphereBytes = kSphereCount * sizeof(SceneSphere);
+  constexpr std::uint64_t kPixels = 1920 * 1080;
+  constexpr std::uint64_t kResizedPixels = 2560 * 1440;
+
+  SceneGeneratorParams params;
+  params.sphereCount = kSphereCount;
+  std::vector<SceneSphere> spheres(kSphereCount);
+  GenerateSpheres(params, 0, spheres);
+  BVH const bvh = BuildBVH(spheres, BVHBuildParams{});
+  if (bvh.Bytes() < bvh.nodes.size() * sizeof(BVHNode) +
+                      bvh.primitives.size() * sizeof(std::uint32_t)) {
+    ++mismatches;
+  }
+
+  struct Event {
+    bool allocate;
+    Category category;
+    std::uint64_t size;
+  }; // struct Event
+  std::vector<Event> events = {
+    {true, Category::kUniform, 256},
+    {true, Category::kOutputImage, kPixels * 4}, // tonemapped
+    {true, Category::kOutputImage, kPixels * 8}, // HDR
+    {true, Category::kHostScene, kSphereBytes},
+    {true, Category::kHostBVH, bvh.Bytes()},
+    {true, Category::kStaging, kSphereBytes},
+    {true, Category::kSpheres, kSphereBytes},
+    {false, Category::kStaging, kSphereBytes},
+    {true, Category::kAccelerationStructure, 8 << 20}, // BLAS
+    {true, Category::kScratch, 4 << 20},
+    {false, Category::kScratch, 4 << 20},
+    {true, Category::kAccelerationStructure, 64 << 10}, // slot 0 TLAS
+    {true, Category::kScratch, 64 << 10},               // and its scratch
+    {true, Category::kAccelerationStructure, 64 << 10}, // slot 1 TLAS
+    {true, Category::kScratch, 64 << 10},
+    {true, Category::kStaging, 64}, // TLAS instances
+    {false, Category::kStaging, 64},
+    {true, Category::kStaging, 4096}, // SBT staging
+    {true, Category::kShaderBindingTable, 4096},
+    {true, Category::kOutputImage, kResizedPixels * 4},
+    {true, Category::kOutputImage, kResizedPixels * 8},
+    {false, Category::kOutputImage, kPixels * 4},
+    {false, Category::kOutputImage, kPixels * 8},
+  };
+
+  // Shutdown frees what is left, newest first.
+  std::vector<Event> live;
+  for (auto&& event : events) {
+    if (event.allocate) {
+      live.push_back(event);
+    } else {
+      live.erase(std::find_if(live.begin(), live.end(), [&](Event const& e) {
+        return e.category == event.category && e.size == event.size;
+      }));
+    }
+  }
+  std::size_t const running = events.size();
+  for (auto iter = live.rbegin(); iter != live.rend(); ++iter) {
+    events.push_back({false, iter->category, iter->size});
+  }
+
+  // Replay the events through MemoryAccounting and through sums kept here,
+  // and check they agree after every event.
+  constexpr auto kCategoryCount = static_cast<std::size_t>(Category::kCount);
+  std::array<MemoryAccounting::CategoryStats, kCategoryCount> expected{};
+  MemoryAccounting::CategoryStats expectedDevice, expectedHost;
+  std::uint64_t sumOfDevicePeaks = 0;
+  auto same = [](MemoryAccounting::CategoryStats const& a,
+                 MemoryAccounting::CategoryStats const& b) {
+    return a.current == b.current && a.peak == b.peak &&
+           a.allocationCount == b.allocationCount;
+  };
+  auto apply = [](MemoryAccounting::CategoryStats& stats, bool allocate,
+                  std::uint64_t size) {
+    if (allocate) {
+      stats.current += size;
+      stats.allocationCount += 1;
+      stats.peak = std::max(stats.peak, stats.current);
+    } else {
+      stats.current -= size;
+      stats.allocationCount -= 1;
+    }
+  };
+
+  MemoryAccounting accounting;
+  std::string runningJson;
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    Event const& event = events[i];
+    if (event.allocate) {
+      accounting.Allocated(event.category, event.size);
+    } else {
+      accounting.Freed(event.category, event.size);
+    }
+    apply(expected[static_cast<std::size_t>(event.category)], event.allocate,
+          event.size);
+    apply(IsHostCategory(event.category) ? expectedHost : expectedDevice,
+          event.allocate, event.size);
+
+    if (!same(accounting.Stats(event.category),
+              expected[static_cast<std::size_t>(event.category)]) ||
+        !same(accounting.DeviceTotal(), expectedDevice) ||
+        !same(accounting.HostTotal(), expectedHost)) {
+      std::printf("  event %zu: %s differs\n", i, to_string(event.category));
+      ++mismatches;
+    }
+    if (i + 1 == running) runningJson = accounting.ToJson("{\"stub\": 1}");
+  }
+
+  std::printf("%-22s %12s %12s\n", "category", "peak", "running");
+  for (std::size_t i = 0; i < kCategoryCount; ++i) {
+    auto const category = static_cast<Category>(i);
+    MemoryAccounting::CategoryStats const stats = accounting.Stats(category);
+    if (stats.current != 0 || stats.allocationCount != 0) ++mismatches;
+    if (!IsHostCategory(category)) sumOfDevicePeaks += stats.peak;
+    std::uint64_t runningBytes = 0;
+    for (auto&& event : live) {
+      if (event.category == category) runningBytes += event.size;
+    }
+    std::printf("%-22s %12" PRIu64 " %12" PRIu64 "\n", to_string(category),
+                stats.peak, runningBytes);
+  }
+  MemoryAccounting::CategoryStats const device = accounting.DeviceTotal();
+  MemoryAccounting::CategoryStats const host = accounting.HostTotal();
+  std::printf("%-22s %12" PRIu64 "\n%-22s %12" PRIu64 "\n", "device total",
+              device.peak, "host total", host.peak);
+
+  // The total peak is the most ever allocated at once, less than the sum
+  // of the category peaks, which were not all reached together.
+  if (device.current != 0 || host.current != 0 ||
+      device.peak >= sumOfDevicePeaks ||
+      host.peak != kSphereBytes + bvh.Bytes()) {
+    ++mismatches;
+  }
+
+  // The report while running holds every category's and total's numbers
+  // and the allocator's JSON.
+  char buffer[256];
+  std::uint64_t runningDevice = 0, runningHost = 0;
+  for (std::size_t i = 0; i < kCategoryCount; ++i) {
+    auto const category = static_cast<Category>(i);
+    std::uint64_t bytes = 0, count = 0;
+    for (auto&& event : live) {
+      if (event.category != category) continue;
+      bytes += event.size;
+      count += 1;
+    }
+    (IsHostCategory(category) ? runningHost : runningDevice) += bytes;
+    std::snprintf(buffer, sizeof(buffer),
+                  "\"%s\": {\"Current\": %" PRIu64 ", \"Peak\": %" PRIu64
+                  ", \"Allocations\": %" PRIu64 "}",
+                  to_string(category), bytes, accounting.Stats(category).peak,
+                  count);
+    if (runningJson.find(buffer) == std::string::npos) {
+      std::printf("  report lacks %s\n", buffer);
+      ++mismatches;
+    }
+  }
+  for (auto&& [name, bytes] : {std::pair{"Device", runningDevice},
+                               std::pair{"Host", runningHost}}) {
+    std::snprintf(buffer, sizeof(buffer), "\"%s\": {\"Current\": %" PRIu64,
+                  name, bytes);
+    if (runningJson.find(buffer) == std::string::npos) {
+      std::printf("  report lacks %s\n", buffer);
+      ++mismatches;
+    }
+  }
+  if (runningJson.find("\"Allocator\": {\"stub\": 1}") == std::string::npos) {
+    std::printf("  report lacks the allocator's JSON\n");
+    ++mismatches;
+  }
+
+  // Threads allocating and freeing at once, as the loader threads and the
+  // render loop do, each holding at most one allocation at a time.
+  constexpr int kThreadCount = 4;
+  constexpr int kRepeatCount = 100'000;
+  MemoryAccounting shared;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([&shared, t] {
+      auto const size = static_cast<std::uint64_t>(t + 1);
+      Category const category =
+        t % 2 == 0 ? Category::kStaging : Category::kHostBVH;
+      for (int i = 0; i < kRepeatCount; ++i) {
+        shared.Allocated(category, size);
+        shared.Freed(category, size);
+      }
+    });
+  }
+  for (auto&& thread : threads) thread.join();
+
+  MemoryAccounting::CategoryStats const staging =
+    shared.Stats(Category::kStaging);
+  MemoryAccounting::CategoryStats const hostBVH =
+    shared.Stats(Category::kHostBVH);
+  // Threads 0 and 2 hold 1 and 3 bytes of staging, 2 and 4 of host BVH.
+  if (staging.current != 0 || staging.allocationCount != 0 ||
+      staging.peak < 3 || staging.peak > 1 + 3 || hostBVH.current != 0 ||
+      hostBVH.allocationCount != 0 || hostBVH.peak < 4 ||
+      hostBVH.peak > 2 + 4) {
+    ++mismatches;
+  }
+  std::printf("%d threads: staging peak %" PRIu64 ", host BVH peak %" PRIu64
+              ", both back to 0\n",
+              kThreadCount, staging.peak, hostBVH.peak);
+
+  std::printf("  mismatches: %d\n", mismatches);
+  return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // Memory
+
+} // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 2 && std::strcmp(argv[1], "barriers") == 0) return Barriers();
+  if (argc == 2 && std::strcmp(argv[1], "memory") == 0) return Memory();
+  if (argc == 2 && std::strcmp(argv[1], "queues") == 0) return Queues();
+  if (argc == 2 && std::strcmp(argv[1], "sbt") == 0) {
+    return ShaderBindingTables(100'000);
+  }
+  if (argc < 3) return Usage();
+  std::string const command = argv[1];
+
+  if (command == "convert" && argc == 4) return Convert(argv[2], argv[3]);
+  if (command == "info" && argc == 3) return Info(argv[2]);
+  if (command == "bvh" && argc == 3) return BVHCacheReport(argv[2]);
+  if (command == "chunk" && (argc == 4 || argc == 5)) {
+    std::uint64_t const spheresPerChunk =
+      argc == 5 ? std::strtoull(argv[4], nullptr, 10) : 1 << 16;
+    if (spheresPerChunk == 0) return Usage();
+    return Chunk(argv[2], argv[3], spheresPerChunk);
+  }
+  if (command == "stream" && argc <= 4) {
+    std::uint64_t const budgetMiB =
+      argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 256;
+    return Stream(argv[2], budgetMiB);
+  }
+  if (command == "bench" && argc <= 4) {
+    std::uint64_t const count =
+      argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 10'000'000;
+    return Bench(argv[2], count);
+  }
+  if (command == "generate" && argc >= 5 && argc <= 7) {
+    SceneGeneratorParams params;
+    if (!FromString(argv[2], params.distribution)) return Usage();
+    params.sphereCount = std::strtoull(argv[3], nullptr, 10);
+    if (params.sphereCount == 0) return Usage();
+    if (argc >= 6) params.seed = std::strtoull(argv[5], nullptr, 10);
+    if (argc == 7) {
+      params.threadCount =
+        static_cast<std::uint32_t>(std::strtoul(argv[6], nullptr, 10));
+    }
+    return Generate(params, argv[4]);
+  }
+  if (command == "cull" && argc <= 4) {
+    float const margin = argc == 4 ? std::strtof(argv[3], nullptr) : 0.f;
+    return Cull(argv[2], margin);
+  }
+  if (command == "mesh" && argc <= 5) {
+    std::uint64_t const rays =
+      argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 100'000;
+    auto const threads = static_cast<std::uint32_t>(
+      argc == 5 ? std::strtoul(argv[4], nullptr, 10) : 0);
+    return Mesh(argv[2], rays, threads);
+  }
+  if (command == "instance" && argc <= 5) {
+    std::uint64_t const instances =
+      argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 100'000;
+    VertexFormat format = VertexFormat::kSnorm16;
+    if (argc == 5 && !FromString(argv[4], format)) return Usage();
+    return Instance(argv[2], instances, format);
+  }
+  if (command == "trace" && argc <= 4) {
+    std::uint64_t const rays =
+      argc == 4 ? std::strtoull(argv[3], nullptr, 10) : 100'000;
+    return Trace(argv[2], rays);
+  }
+  if (command == "render" && argc >= 4 && argc <= 8 && argc != 5) {
+    std::uint32_t width = 1600, height = 1200;
+    if (argc >= 6) {
+      width = static_cast<std::uint32_t>(std::strtoul(argv[4], nullptr, 10));
+      height = static_cast<std::uint32_t>(std::strtoul(argv[5], nullptr, 10));
+    }
+    auto const workers = static_cast<std::uint32_t>(
+      argc >= 7 ? std::strtoul(argv[6], nullptr, 10)
+                : std::max(2u, std::thread::hardware_concurrency()));
+    if (width == 0 || height == 0 || workers == 0) return Usage();
+    return Render(argv[0], argv[2], argv[3], width, height, workers,
+                  argc == 8 ? argv[7] : nullptr);
+  }
+  if (command == "worker" && (argc == 4 || argc == 5)) {
+    double const slowdown = argc == 5 ? std::strtod(argv[4], nullptr) : 1.0;
+    return Worker(argv[2], argv[3], slowdown);
+  }
+  if (command == "serve" && (argc == 4 || argc == 5)) {
+    auto const maxBatch = static_cast<std::uint32_t>(
+      argc == 5 ? std::strtoul(argv[4], nullptr, 10) : 16);
+    if (maxBatch == 0) return Usage();
+    return Serve(argv[2], argv[3], maxBatch);
+  }
+  if (command == "load" && argc >= 4 && argc <= 9 && argc != 7) {
+    auto const clients = static_cast<std::uint32_t>(
+      argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 8);
+    auto const requests = static_cast<std::uint32_t>(
+      argc >= 6 ? std::strtoul(argv[5], nullptr, 10) : 32);
+    std::uint32_t width = 320, height = 240;
+    if (argc >= 8) {
+      width = static_cast<std::uint32_t>(std::strtoul(argv[6], nullptr, 10));
+      height = static_cast<std::uint32_t>(std::strtoul(argv[7], nullptr, 10));
+    }
+    ImageFormat format = ImageFormat::kQOI;
+    if (argc == 9 && !FromString(argv[8], format)) return Usage();
+    if (clients == 0 || requests == 0 || width == 0 || height == 0) {
+      return Usage();
+    }
+    return Load(argv[2], argv[3], clients, requests, width, height, format);
+  }
+  if (command == "stop" && argc == 3) return Stop(argv[2]);
+  if (command == "export" && argc >= 4 && argc <= 7 && argc != 6) {
+    auto const frames = static_cast<std::uint32_t>(
+      argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 120);
+    std::uint32_t width = 640, height = 360;
+    if (argc == 7) {
+      width = static_cast<std::uint32_t>(std::strtoul(argv[5], nullptr, 10));
+      height = static_cast<std::uint32_t>(std::strtoul(argv[6], nullptr, 10));
+    }
+    if (frames == 0 || width == 0 || height == 0) return Usage();
+    return Export(argv[2], argv[3], frames, width, height);
+  }
+  if (command == "capture" && argc >= 4 && argc <= 6) {
+    auto const frames = static_cast<std::uint32_t>(
+      argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : UINT32_MAX);
+    ImageFormat format = ImageFormat::kQOI;
+    if (argc == 6 && !FromString(argv[5], format)) return Usage();
+    if (frames == 0) return Usage();
+    return Capture(argv[2], argv[3], frames, format);
+  }
+  if (command == "video" && argc >= 4 && argc <= 8 && argc != 6) {
+    auto const frames = static_cast<std::uint32_t>(
+      argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 120);
+    std::uint32_t width = 640, height = 360;
+    if (argc >= 7) {
+      width = static_cast<std::uint32_t>(std::strtoul(argv[5], nullptr, 10));
+      height = static_cast<std::uint32_t>(std::strtoul(argv[6], nullptr, 10));
+    }
+    VideoFormat format = VideoFormat::kY4M;
+    if (argc == 8 && !FromString(argv[7], format)) return Usage();
+    if (frames == 0 || width == 0 || height == 0) return Usage();
+    return Video(argv[2], argv[3], frames, width, height, format);
+  }
+  if (command == "sampling" && argc <= 4) {
+    auto const size =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    auto const maxSamples = static_cast<std::uint32_t>(
+      argc == 4 ? std::strtoul(argv[3], nullptr, 10) : 256);
+    if (size == 0 || maxSamples == 0 || maxSamples > 65536) return Usage();
+    return Sampling(size, maxSamples);
+  }
+  if (command == "sbt" && argc == 3) {
+    auto const recordCount =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (recordCount == 0) return Usage();
+    return ShaderBindingTables(recordCount);
+  }
+  if (command == "deletion" && argc == 3) {
+    auto const frameCount =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (frameCount == 0) return Usage();
+    return Deletion(frameCount);
+  }
+  if (command == "tonemap" && argc == 3) {
+    auto const frameCount =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (frameCount == 0) return Usage();
+    return Tonemap(frameCount);
+  }
+  if (command == "ring" && argc == 3) {
+    auto const frames =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (frames == 0) return Usage();
+    return Ring(frames);
+  }
+  if (command == "submits" && argc == 3) {
+    auto const frames =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (frames < 2) return Usage();
+    return Submits(frames);
+  }
+  if (command == "resolution" && argc == 3) {
+    auto const frames =
+      static_cast<std::uint32_t>(std::strtoul(argv[2], nullptr, 10));
+    if (frames < 4) return Usage();
+    return Resolution(frames);
+  }
+  if (command == "updates" && argc <= 5) {
+    double const percent = argc >= 4 ? std::strtod(argv[3], nullptr) : 1.0;
+    auto const frames = static_cast<std::uint32_t>(
+      argc == 5 ? std::strtoul(argv[4], nullptr, 10) : 240);
+    if (!(percent >= 0.0 && percent <= 100.0) || frames == 0) return Usage();
+    return Updates(argv[2], percent, frames);
+  }
+  return Usage();
+} // main
@@ -6,43 +6,194 @@
 #define ROUND_UP(v, powerOf2Alignment) (((v) + (powerOf2Alignment)-1) & ~((powerOf2Alignment)-1))
 #endif
 
+namespace {
+
+// FNV-1a
+std::uint64_t HashBytes(std::uint64_t hash, void const* pData,
+                        std::size_t size) noexcept {
+  auto const* p = static_cast<unsigned char const*>(pData);
+  for (std::size_t i = 0; i < size; ++i) {
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+} // HashBytes
+
+} // namespace
+
+std::uint32_t ShaderBindingTableGenerator::AddHitGroups(
+  gsl::span<std::uint32_t const> groupIndices,
+  gsl::span<std::byte const> inlineData) {
+  Expects(!groupIndices.empty());
+
+  std::uint32_t const rayTypeCount =
+    gsl::narrow_cast<std::uint32_t>(groupIndices.size());
+  Expects(rayTypeCount_ == 0 || rayTypeCount_ == rayTypeCount);
+  rayTypeCount_ = rayTypeCount;
+
+  return AddRecords(Section::kHitGroup, groupIndices, inlineData);
+} // ShaderBindingTableGenerator::AddHitGroups
+
+void ShaderBindingTableGenerator::Reserve(std::size_t rayGenCount,
+                                          std::size_t missCount,
+                                          std::size_t hitGroupCount,
+                                          std::size_t callableCount,
+                                          std::size_t inlineDataSize) {
+  GetSection(Section::kRayGen).entries.reserve(rayGenCount);
+  GetSection(Section::kMiss).entries.reserve(missCount);
+  GetSection(Section::kHitGroup).entries.reserve(hitGroupCount);
+  GetSection(Section::kCallable).entries.reserve(callableCount);
+  inlineData_.reserve(inlineDataSize);
+  if (deduplicate_) recordBlocks_.reserve(hitGroupCount + callableCount);
+} // ShaderBindingTableGenerator::Reserve
+
+void ShaderBindingTableGenerator::Clear() noexcept {
+  for (auto& section : sections_) {
+    section.entries.clear();
+    section.maxInlineDataSize = 0;
+    section.offset = 0;
+    section.stride = 0;
+  }
+
+  inlineData_.clear();
+  dirtyRecords_.clear();
+  recordBlocks_.clear();
+
+  deduplicatedCount_ = 0;
+  rayTypeCount_ = 0;
+  groupCount_ = 0;
+  sbtSize_ = 0;
+} // ShaderBindingTableGenerator::Clear
+
 VkDeviceSize ShaderBindingTableGenerator::ComputeSize(
-  VkDeviceSize shaderGroupHandleSize) noexcept {
+  VkDeviceSize shaderGroupHandleSize,
+  VkDeviceSize shaderGroupBaseAlignment) noexcept {
   Expects(shaderGroupHandleSize > 0);
+  Expects(shaderGroupBaseAlignment > 0);
 
   shaderGroupHandleSize_ = shaderGroupHandleSize;
-  rayGenEntrySize_ = GetEntrySize(rayGenEntries_);
-  missEntrySize_ = GetEntrySize(missEntries_);
-  hitGroupEntrySize_ = GetEntrySize(hitGroupEntries_);
 
-  sbtSize_ = rayGenEntrySize_ * rayGenEntries_.size() +
-             missEntrySize_ * missEntries_.size() +
-             hitGroupEntrySize_ * hitGroupEntries_.size();
+  // Strides must be a multiple of the handle size; keep the historical 16
+  // byte minimum for inline data alignment.
+  VkDeviceSize const recordAlignment =
+    std::max<VkDeviceSize>(shaderGroupHandleSize_, 16);
+
+  // Empty sections are not padded so they add nothing to the table.
+  VkDeviceSize offset = 0;
+  for (auto& section : sections_) {
+    if (!section.entries.empty()) {
+      offset = ROUND_UP(offset, shaderGroupBaseAlignment);
+    }
+    section.offset = offset;
+    section.stride =
+      ROUND_UP(shaderGroupHandleSize_ + section.maxInlineDataSize,
+               recordAlignment);
+    offset += section.stride * section.entries.size();
+  }
+
+  sbtSize_ = offset;
 
   Ensures(shaderGroupHandleSize_ > 0);
-  Ensures(rayGenEntrySize_ >= 0);
-  Ensures(missEntrySize_ >= 0);
-  Ensures(hitGroupEntrySize_ >= 0);
   Ensures(sbtSize_ > 0);
 
   return sbtSize_;
 } // ShaderBindingTableGenerator::ComputeSize
 
+void ShaderBindingTableGenerator::UpdateInlineData(
+  Section section, std::size_t entryIndex,
+  gsl::span<std::byte const> inlineData) {
+  auto& entries = GetSection(section).entries;
+  Expects(entryIndex < entries.size());
+
+  auto& entry = entries[entryIndex];
+  Expects(static_cast<std::size_t>(inlineData.size()) == entry.inlineDataSize);
+
+  // Stale keys in recordBlocks_ are harmless: lookups compare the bytes.
+  std::memcpy(inlineData_.data() + entry.inlineDataOffset, inlineData.data(),
+              entry.inlineDataSize);
+
+  if (!entry.dirty) {
+    entry.dirty = true;
+    dirtyRecords_.push_back({section, entryIndex});
+  }
+} // ShaderBindingTableGenerator::UpdateInlineData
+
+ShaderBindingTableGenerator::UpdateStats
+ShaderBindingTableGenerator::WriteDirtyRecords(
+  gsl::not_null<std::byte*> pOutput, std::vector<VkBufferCopy>& regions) {
+  Expects(shaderGroupHandleSize_ > 0);
+  Expects(sbtSize_ > 0);
+
+  UpdateStats stats;
+  regions.clear();
+
+  for (auto&& record : dirtyRecords_) {
+    auto& section = GetSection(record.section);
+    auto& entry = section.entries[record.entryIndex];
+    entry.dirty = false;
+    if (entry.inlineDataSize == 0) continue;
+
+    VkDeviceSize const offset = section.offset +
+                                record.entryIndex * section.stride +
+                                shaderGroupHandleSize_;
+    std::memcpy(pOutput.get() + offset,
+                inlineData_.data() + entry.inlineDataOffset,
+                entry.inlineDataSize);
+
+    regions.push_back({offset, offset, entry.inlineDataSize});
+    stats.bytesWritten += entry.inlineDataSize;
+    stats.recordCount += 1;
+  }
+
+  dirtyRecords_.clear();
+  if (regions.empty()) return stats;
+
+  std::sort(std::begin(regions), std::end(regions),
+            [](VkBufferCopy const& a, VkBufferCopy const& b) {
+              return a.dstOffset < b.dstOffset;
+            });
+
+  // Records in neighbouring slots are only separated by a shader group handle
+  // and padding, which are already valid in pOutput, so copying across a gap
+  // shorter than one record is cheaper than issuing another region.
+  VkDeviceSize maxGap = 0;
+  for (auto&& section : sections_) maxGap = std::max(maxGap, section.stride);
+
+  std::size_t merged = 0;
+  for (std::size_t i = 1; i < regions.size(); ++i) {
+    auto& last = regions[merged];
+    if (regions[i].dstOffset <= last.dstOffset + last.size + maxGap) {
+      last.size = regions[i].dstOffset + regions[i].size - last.dstOffset;
+    } else {
+      regions[++merged] = regions[i];
+    }
+  }
+  regions.resize(merged + 1);
+
+  for (auto&& region : regions) stats.bytesCopied += region.size;
+  return stats;
+} // ShaderBindingTableGenerator::WriteDirtyRecords
+
 VkResult
 ShaderBindingTableGenerator::Generate(VkDevice device, VkPipeline pipeline,
                                       gsl::not_null<std::byte*> pOutput) {
   Expects(device != VK_NULL_HANDLE);
   Expects(pipeline != VK_NULL_HANDLE);
   Expects(shaderGroupHandleSize_ > 0);
-  Expects(rayGenEntrySize_ >= 0);
-  Expects(missEntrySize_ >= 0);
-  Expects(hitGroupEntrySize_ >= 0);
   Expects(sbtSize_ > 0);
 
-  std::uint32_t const groupCount = gsl::narrow_cast<std::uint32_t>(
-    rayGenEntries_.size() + missEntries_.size() + hitGroupEntries_.size());
+  shaderHandleStorage_.resize(groupCount_ * shaderGroupHandleSize_);
+  if (auto result = vkGetRayTracingShaderGroupHandlesNV(
+        device, pipeline, 0, groupCount_, shaderHandleStorage_.size(),
+        shaderHandleStorage_.data());
+      result != VK_SUCCESS) {
+    return result;
+  }
 
+  // The layout, traced once per table: tracing each record would swamp a
+  // debug build's timings of large tables.
 #ifndef NDEBUG
+  std::fprintf(stderr, "groupCount: %d shaderGroupHandleSize_: %zu\n",
+               groupCount_, shaderGroupHandleSize_);
   std::fprintf(stderr, "RayGenStride: %zu\n", RayGenStride());
   std::fprintf(stderr, "RayGenSize: %zu\n", RayGenSize());
   std::fprintf(stderr, "MissOffset: %zu\n", MissOffset());
@@ -51,65 +202,113 @@ ShaderBindingTableGenerator::Generate(VkDevice device, VkPipeline pipeline,
   std::fprintf(stderr, "HitGroupOffset: %zu\n", HitGroupOffset());
   std::fprintf(stderr, "HitGroupStride: %zu\n", HitGroupStride());
   std::fprintf(stderr, "HitGroupSize: %zu\n", HitGroupSize());
-
-  std::fprintf(stderr, "groupCount: %d shaderGroupHandleSize_: %zu\n",
-               groupCount, shaderGroupHandleSize_);
+  std::fprintf(stderr, "HitGroupRayTypeCount: %u\n", HitGroupRayTypeCount());
+  std::fprintf(stderr, "CallableOffset: %zu\n", CallableOffset());
+  std::fprintf(stderr, "CallableStride: %zu\n", CallableStride());
+  std::fprintf(stderr, "CallableSize: %zu\n", CallableSize());
+  std::fprintf(stderr, "DeduplicatedCount: %zu\n", DeduplicatedCount());
 #endif
 
-  std::vector<std::byte> shaderHandleStorage(groupCount *
-                                             shaderGroupHandleSize_);
-  if (auto result = vkGetRayTracingShaderGroupHandlesNV(
-        device, pipeline, 0, groupCount, shaderHandleStorage.size(),
-        shaderHandleStorage.data());
-      result != VK_SUCCESS) {
-    return result;
+  Generate(shaderHandleStorage_, pOutput);
+  return VK_SUCCESS;
+} // ShaderBindingTableGenerator::Generate
+
+void ShaderBindingTableGenerator::Generate(
+  gsl::span<std::byte const> shaderHandles,
+  gsl::not_null<std::byte*> pOutput) noexcept {
+  Expects(shaderGroupHandleSize_ > 0);
+  Expects(sbtSize_ > 0);
+  Expects(static_cast<VkDeviceSize>(shaderHandles.size()) >=
+          groupCount_ * shaderGroupHandleSize_);
+
+  for (auto&& section : sections_) {
+    CopyShaderData(pOutput.get() + section.offset, section.entries,
+                   section.stride, shaderHandles.data());
   }
+} // ShaderBindingTableGenerator::Generate
 
-  VkDeviceSize offset = 0;
-#ifndef NDEBUG
-  std::fprintf(stderr, "offset: %zu\n", offset);
-#endif
+void ShaderBindingTableGenerator::AddEntry(
+  Section section, std::uint32_t groupIndex,
+  gsl::span<std::byte const> inlineData) {
+  std::size_t const offset = inlineData_.size();
+  inlineData_.insert(std::end(inlineData_), std::begin(inlineData),
+                     std::end(inlineData));
 
-  offset +=
-    CopyShaderData(device, pipeline, pOutput.get() + offset, rayGenEntries_,
-                   rayGenEntrySize_, shaderHandleStorage.data());
-#ifndef NDEBUG
-  std::fprintf(stderr, "offset: %zu\n", offset);
-#endif
+  auto& info = GetSection(section);
+  info.entries.emplace_back(
+    groupIndex, gsl::narrow_cast<std::uint32_t>(inlineData.size()), offset);
 
-  offset +=
-    CopyShaderData(device, pipeline, pOutput.get() + offset, missEntries_,
-                   missEntrySize_, shaderHandleStorage.data());
-#ifndef NDEBUG
-  std::fprintf(stderr, "offset: %zu\n", offset);
-#endif
+  info.maxInlineDataSize = std::max(
+    info.maxInlineDataSize, static_cast<std::size_t>(inlineData.size()));
+  groupCount_ = std::max(groupCount_, groupIndex + 1);
+} // ShaderBindingTableGenerator::AddEntry
 
-  offset +=
-    CopyShaderData(device, pipeline, pOutput.get() + offset, hitGroupEntries_,
-                   hitGroupEntrySize_, shaderHandleStorage.data());
-#ifndef NDEBUG
-  std::fprintf(stderr, "offset: %zu\n", offset);
-#endif
+std::uint32_t ShaderBindingTableGenerator::AddRecords(
+  Section section, gsl::span<std::uint32_t const> groupIndices,
+  gsl::span<std::byte const> inlineData) {
+  auto& entries = GetSection(section).entries;
+  std::uint32_t const firstEntry =
+    gsl::narrow_cast<std::uint32_t>(entries.size());
 
-  return VK_SUCCESS;
-} // ShaderBindingTableGenerator::Generate
+  if (!deduplicate_) {
+    for (auto&& groupIndex : groupIndices) {
+      AddEntry(section, groupIndex, inlineData);
+    }
+    return firstEntry;
+  }
 
-VkDeviceSize ShaderBindingTableGenerator::GetEntrySize(
-  gsl::span<SBTEntry> const& entries) noexcept {
-  Expects(shaderGroupHandleSize_ > 0);
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = HashBytes(hash, &section, sizeof(section));
+  hash = HashBytes(hash, groupIndices.data(), groupIndices.size_bytes());
+  hash = HashBytes(hash, inlineData.data(), inlineData.size_bytes());
+
+  auto const [first, last] = recordBlocks_.equal_range(hash);
+  for (auto iter = first; iter != last; ++iter) {
+    if (Matches(iter->second, section, groupIndices, inlineData)) {
+      deduplicatedCount_ += groupIndices.size();
+      return iter->second.firstEntry;
+    }
+  }
+
+  for (auto&& groupIndex : groupIndices) {
+    AddEntry(section, groupIndex, inlineData);
+  }
 
-  auto maxArgIter =
-    std::max_element(std::begin(entries), std::end(entries),
-                     [](SBTEntry const& a, SBTEntry const& b) {
-                       return a.inlineData.size() < b.inlineData.size();
-                     });
+  recordBlocks_.emplace(
+    hash, RecordBlock{section, firstEntry,
+                      gsl::narrow_cast<std::uint32_t>(groupIndices.size())});
+  return firstEntry;
+} // ShaderBindingTableGenerator::AddRecords
 
-  return ROUND_UP(shaderGroupHandleSize_ + maxArgIter->inlineData.size(), 16);
-} // ShaderBindingTableGenerator::GetEntrySize
+bool ShaderBindingTableGenerator::Matches(
+  RecordBlock const& block, Section section,
+  gsl::span<std::uint32_t const> groupIndices,
+  gsl::span<std::byte const> inlineData) const noexcept {
+  if (block.section != section) return false;
+  if (block.count != static_cast<std::size_t>(groupIndices.size())) {
+    return false;
+  }
+
+  auto const& entries = GetSection(section).entries;
+  for (std::uint32_t i = 0; i < block.count; ++i) {
+    auto const& entry = entries[block.firstEntry + i];
+    if (entry.groupIndex != groupIndices[i]) return false;
+    if (entry.inlineDataSize != static_cast<std::size_t>(inlineData.size())) {
+      return false;
+    }
+    if (!inlineData.empty() &&
+        std::memcmp(inlineData_.data() + entry.inlineDataOffset,
+                    inlineData.data(), entry.inlineDataSize) != 0) {
+      return false;
+    }
+  }
+
+  return true;
+} // ShaderBindingTableGenerator::Matches
 
 VkDeviceSize ShaderBindingTableGenerator::CopyShaderData(
-  VkDevice device, VkPipeline pipeline, gsl::not_null<std::byte*> pOutput,
-  gsl::span<SBTEntry> shaders, VkDeviceSize entrySize,
+  gsl::not_null<std::byte*> pOutput, gsl::span<SBTEntry const> shaders,
+  VkDeviceSize entrySize,
   gsl::not_null<std::byte const*> pShaderHandleStorage) noexcept {
 
   std::byte* pData = pOutput;
@@ -119,17 +318,10 @@ VkDeviceSize ShaderBindingTableGenerator::CopyShaderData(
                   shader.groupIndex * shaderGroupHandleSize_,
                 shaderGroupHandleSize_);
 
-#ifndef NDEBUG
-    std::fprintf(stderr, "groupIndex: %d handle: 0x", shader.groupIndex);
-    for (int i = 0; i < shaderGroupHandleSize_; ++i) {
-      std::fprintf(stderr, "%0x", pData[i]);
-    }
-    std::fprintf(stderr, "\n");
-#endif
-
-    if (!shader.inlineData.empty()) {
-      std::memcpy(pData + shaderGroupHandleSize_, shader.inlineData.data(),
-                  shader.inlineData.size());
+    if (shader.inlineDataSize > 0) {
+      std::memcpy(pData + shaderGroupHandleSize_,
+                  inlineData_.data() + shader.inlineDataOffset,
+                  shader.inlineDataSize);
     }
 
     pData += entrySize;
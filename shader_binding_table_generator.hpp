@@ -32,80 +32,231 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "flextVk.h"
 #include "gsl/gsl-lite.hpp"
+#include <algorithm>
+#include <array>
+#include <unordered_map>
 #include <vector>
 
 class ShaderBindingTableGenerator {
 public:
+  enum class Section { kRayGen, kMiss, kHitGroup, kCallable };
+  static constexpr std::size_t kSectionCount = 4;
+
   void AddRayGen(std::uint32_t groupIndex,
-                 gsl::span<std::byte> inlineData = {}) {
-    rayGenEntries_.emplace_back(
-      groupIndex,
-      std::vector<std::byte>(std::begin(inlineData), std::end(inlineData)));
+                 gsl::span<std::byte const> inlineData = {}) {
+    AddEntry(Section::kRayGen, groupIndex, inlineData);
   }
 
-  void AddMiss(std::uint32_t groupIndex, gsl::span<std::byte> inlineData = {}) {
-    missEntries_.emplace_back(
-      groupIndex,
-      std::vector<std::byte>(std::begin(inlineData), std::end(inlineData)));
+  void AddMiss(std::uint32_t groupIndex,
+               gsl::span<std::byte const> inlineData = {}) {
+    AddEntry(Section::kMiss, groupIndex, inlineData);
   }
 
-  void AddHitGroup(std::uint32_t groupIndex,
-                   gsl::span<std::byte> inlineData = {}) {
-    hitGroupEntries_.emplace_back(
-      groupIndex,
-      std::vector<std::byte>(std::begin(inlineData), std::end(inlineData)));
+  // Returns the index of the hit record, which is the instanceOffset to use
+  // for the geometry. With deduplication enabled, an identical earlier record
+  // is returned instead of adding a new one.
+  std::uint32_t AddHitGroup(std::uint32_t groupIndex,
+                            gsl::span<std::byte const> inlineData = {}) {
+    return AddHitGroups(gsl::span<std::uint32_t const>(&groupIndex, 1),
+                        inlineData);
   }
 
-  VkDeviceSize ComputeSize(VkDeviceSize shaderGroupHandleSize) noexcept;
+  // Add one hit record per ray type for a single geometry, all sharing the
+  // same inline data. groupIndices[i] is the hit group for ray type i, which
+  // is the sbtRecordOffset passed to traceNV; the number of ray types is the
+  // sbtRecordStride. Returns the index of the first record.
+  std::uint32_t AddHitGroups(gsl::span<std::uint32_t const> groupIndices,
+                             gsl::span<std::byte const> inlineData = {});
+
+  // Returns the callable index to pass to executeCallableNV.
+  std::uint32_t AddCallable(std::uint32_t groupIndex,
+                            gsl::span<std::byte const> inlineData = {}) {
+    return AddRecords(Section::kCallable,
+                      gsl::span<std::uint32_t const>(&groupIndex, 1),
+                      inlineData);
+  }
 
-  VkDeviceSize RayGenStride() const noexcept { return rayGenEntrySize_; }
-  VkDeviceSize RayGenSize() const noexcept {
-    return RayGenStride() * rayGenEntries_.size();
+  // Share identical (group, inline data) hit and callable records instead of
+  // adding duplicates. Must be set before entries are added.
+  void SetDeduplicate(bool deduplicate) noexcept {
+    Expects(Empty());
+    deduplicate_ = deduplicate;
   }
 
-  VkDeviceSize MissOffset() const noexcept { return RayGenSize(); }
-  VkDeviceSize MissStride() const noexcept { return missEntrySize_; }
-  VkDeviceSize MissSize() const noexcept {
-    return MissStride() * missEntries_.size();
+  // Pre-size the entry lists and the inline data arena so a rebuild of a
+  // table with a known shape performs no allocations.
+  void Reserve(std::size_t rayGenCount, std::size_t missCount,
+               std::size_t hitGroupCount, std::size_t callableCount,
+               std::size_t inlineDataSize);
+
+  // Remove all entries but keep the allocated capacity for the next rebuild.
+  void Clear() noexcept;
+
+  bool Empty() const noexcept {
+    return std::all_of(
+      std::begin(sections_), std::end(sections_),
+      [](SectionInfo const& section) { return section.entries.empty(); });
   }
 
+  // Records are aligned to the shader group handle size and each section
+  // starts on a multiple of shaderGroupBaseAlignment.
+  VkDeviceSize ComputeSize(VkDeviceSize shaderGroupHandleSize,
+                           VkDeviceSize shaderGroupBaseAlignment = 16) noexcept;
+
+  // Replace the inline data of an existing entry and mark its record dirty.
+  // The new data must be the same size as the data the entry was added with.
+  // A deduplicated record is shared, so the update applies to all its users.
+  void UpdateInlineData(Section section, std::size_t entryIndex,
+                        gsl::span<std::byte const> inlineData);
+
+  bool HasDirtyRecords() const noexcept { return !dirtyRecords_.empty(); }
+
+  struct UpdateStats {
+    VkDeviceSize bytesWritten{0}; // inline data bytes written to pOutput
+    VkDeviceSize bytesCopied{0};  // bytes covered by the emitted regions
+    std::uint32_t recordCount{0};
+  }; // struct UpdateStats
+
+  // Rewrite only the inline data of the dirty records in a previously
+  // generated table at pOutput (e.g. a persistently mapped staging buffer)
+  // and replace regions with the sorted, merged copy regions needed to bring
+  // a device-local copy of the table up to date. Clears the dirty state.
+  UpdateStats WriteDirtyRecords(gsl::not_null<std::byte*> pOutput,
+                                std::vector<VkBufferCopy>& regions);
+
+  std::size_t RecordCount(Section section) const noexcept {
+    return GetSection(section).entries.size();
+  }
+  VkDeviceSize Offset(Section section) const noexcept {
+    return GetSection(section).offset;
+  }
+  VkDeviceSize Stride(Section section) const noexcept {
+    return GetSection(section).stride;
+  }
+  VkDeviceSize Size(Section section) const noexcept {
+    return Stride(section) * RecordCount(section);
+  }
+
+  VkDeviceSize RayGenStride() const noexcept {
+    return Stride(Section::kRayGen);
+  }
+  VkDeviceSize RayGenSize() const noexcept { return Size(Section::kRayGen); }
+
+  VkDeviceSize MissOffset() const noexcept { return Offset(Section::kMiss); }
+  VkDeviceSize MissStride() const noexcept { return Stride(Section::kMiss); }
+  VkDeviceSize MissSize() const noexcept { return Size(Section::kMiss); }
+
   VkDeviceSize HitGroupOffset() const noexcept {
-    return RayGenSize() + MissSize();
+    return Offset(Section::kHitGroup);
+  }
+  VkDeviceSize HitGroupStride() const noexcept {
+    return Stride(Section::kHitGroup);
   }
-  VkDeviceSize HitGroupStride() const noexcept { return hitGroupEntrySize_; }
   VkDeviceSize HitGroupSize() const noexcept {
-    return HitGroupStride() * hitGroupEntries_.size();
+    return Size(Section::kHitGroup);
   }
 
+  // The sbtRecordStride to pass to traceNV.
+  std::uint32_t HitGroupRayTypeCount() const noexcept { return rayTypeCount_; }
+
+  VkDeviceSize CallableOffset() const noexcept {
+    return Offset(Section::kCallable);
+  }
+  VkDeviceSize CallableStride() const noexcept {
+    return Stride(Section::kCallable);
+  }
+  VkDeviceSize CallableSize() const noexcept {
+    return Size(Section::kCallable);
+  }
+
+  // Number of shader groups referenced by the entries (highest index + 1).
+  std::uint32_t GroupCount() const noexcept { return groupCount_; }
+
+  // Number of hit and callable records that were shared instead of added.
+  std::size_t DeduplicatedCount() const noexcept { return deduplicatedCount_; }
+
+  // Query the shader group handles from the pipeline and write the table
+  // directly to pOutput, which must hold at least ComputeSize() bytes.
   VkResult Generate(VkDevice device, VkPipeline pipeline,
                     gsl::not_null<std::byte*> pOutput);
 
+  // Write the table directly to pOutput using already queried shader group
+  // handles (GroupCount() * shaderGroupHandleSize bytes). Does not touch the
+  // device, so it can be driven with host-side handle bytes.
+  void Generate(gsl::span<std::byte const> shaderHandles,
+                gsl::not_null<std::byte*> pOutput) noexcept;
+
   struct SBTEntry {
     std::uint32_t groupIndex;
-    std::vector<std::byte> inlineData;
+    std::uint32_t inlineDataSize;
+    std::size_t inlineDataOffset; // into the inline data arena
+    bool dirty{false};
 
-    SBTEntry(std::uint32_t index, std::vector<std::byte> data)
+    SBTEntry(std::uint32_t index, std::uint32_t size, std::size_t offset)
       : groupIndex(index)
-      , inlineData(std::move(data)) {}
+      , inlineDataSize(size)
+      , inlineDataOffset(offset) {}
   }; // struct SBTEntry
 
+  struct DirtyRecord {
+    Section section;
+    std::size_t entryIndex;
+  }; // struct DirtyRecord
+
 private:
-  std::vector<SBTEntry> rayGenEntries_{};
-  std::vector<SBTEntry> missEntries_{};
-  std::vector<SBTEntry> hitGroupEntries_{};
+  struct SectionInfo {
+    std::vector<SBTEntry> entries{};
+    std::size_t maxInlineDataSize{0};
+    VkDeviceSize offset{0};
+    VkDeviceSize stride{0};
+  }; // struct SectionInfo
+
+  // A run of records added together, used to find duplicates.
+  struct RecordBlock {
+    Section section;
+    std::uint32_t firstEntry;
+    std::uint32_t count;
+  }; // struct RecordBlock
+
+  std::array<SectionInfo, kSectionCount> sections_{};
+
+  // All entries' inline data, packed back to back.
+  std::vector<std::byte> inlineData_{};
+  // Reused across Generate calls; only grows when new groups are referenced.
+  std::vector<std::byte> shaderHandleStorage_{};
+  std::vector<DirtyRecord> dirtyRecords_{};
+
+  bool deduplicate_{false};
+  std::unordered_multimap<std::uint64_t, RecordBlock> recordBlocks_{};
+  std::size_t deduplicatedCount_{0};
+
+  std::uint32_t rayTypeCount_{0};
+  std::uint32_t groupCount_{0};
 
   VkDeviceSize shaderGroupHandleSize_{0};
-  VkDeviceSize rayGenEntrySize_{0};
-  VkDeviceSize missEntrySize_{0};
-  VkDeviceSize hitGroupEntrySize_{0};
   VkDeviceSize sbtSize_{0};
 
-  VkDeviceSize GetEntrySize(gsl::span<SBTEntry> const& entries) noexcept;
+  SectionInfo& GetSection(Section section) noexcept {
+    return sections_[static_cast<std::size_t>(section)];
+  }
+  SectionInfo const& GetSection(Section section) const noexcept {
+    return sections_[static_cast<std::size_t>(section)];
+  }
+
+  void AddEntry(Section section, std::uint32_t groupIndex,
+                gsl::span<std::byte const> inlineData);
+
+  std::uint32_t AddRecords(Section section,
+                           gsl::span<std::uint32_t const> groupIndices,
+                           gsl::span<std::byte const> inlineData);
+
+  bool Matches(RecordBlock const& block, Section section,
+               gsl::span<std::uint32_t const> groupIndices,
+               gsl::span<std::byte const> inlineData) const noexcept;
 
   VkDeviceSize
-  CopyShaderData(VkDevice device, VkPipeline pipeline,
-                 gsl::not_null<std::byte*> pOutput, gsl::span<SBTEntry> shaders,
-                 VkDeviceSize entrySize,
+  CopyShaderData(gsl::not_null<std::byte*> pOutput,
+                 gsl::span<SBTEntry const> shaders, VkDeviceSize entrySize,
                  gsl::not_null<std::byte const*> pShaderHandleStorage) noexcept;
 }; // class ShaderBindingTableGenerator
 
@@ -0,0 +1,225 @@
+#ifndef SHADER_BINDING_TABLE_LAYOUT_HPP_
+#define SHADER_BINDING_TABLE_LAYOUT_HPP_
+
+#include "flextVk.h"
+#include <array>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//
+// Compile-time counterpart of ShaderBindingTableGenerator for pipelines whose
+// shader binding table shape is fixed. Offsets, strides and the total size
+// are constants computed with the same rules as the generator, and Fill is
+// a flat sequence of memcpy calls.
+//
+//   using Layout = ShaderBindingTableLayout<
+//     16, 64, SBTSection<SBTRecord<0>>, SBTSection<SBTRecord<1>>,
+//     SBTSection<SBTRecord<2, Material, 2>>>;
+//   Layout::Fill(handles, pOutput, {}, {},
+//                std::make_tuple(std::array<Material, 2>{...}));
+//
+
+struct SBTNoInlineData {};
+
+// Count consecutive records of shader group GroupIndex, each followed by an
+// InlineData value.
+template <std::uint32_t GroupIndex, class InlineData = SBTNoInlineData,
+          std::size_t Count = 1>
+struct SBTRecord {
+  static_assert(std::is_trivially_copyable_v<InlineData>,
+                "SBT inline data must be trivially copyable");
+  static_assert(Count > 0, "SBTRecord must have at least one record");
+
+  static constexpr std::uint32_t kGroupIndex = GroupIndex;
+  static constexpr std::size_t kCount = Count;
+  static constexpr std::size_t kInlineDataSize =
+    std::is_empty_v<InlineData> ? 0 : sizeof(InlineData);
+  static constexpr std::size_t kInlineDataAlignment = alignof(InlineData);
+
+  using inline_type = InlineData;
+  // Argument type passed to Fill for this record.
+  using value_type = std::conditional_t<Count == 1, InlineData,
+                                        std::array<InlineData, Count>>;
+}; // struct SBTRecord
+
+template <class... Records>
+struct SBTSection {
+  static constexpr std::size_t kCount =
+    (std::size_t{0} + ... + Records::kCount);
+  static constexpr std::size_t kMaxInlineDataSize =
+    std::max({std::size_t{0}, Records::kInlineDataSize...});
+  static constexpr std::size_t kMaxInlineDataAlignment =
+    std::max({std::size_t{1}, Records::kInlineDataAlignment...});
+  static constexpr std::uint32_t kGroupCount =
+    std::max({std::uint32_t{0}, (Records::kGroupIndex + 1)...});
+
+  using values_type = std::tuple<typename Records::value_type...>;
+}; // struct SBTSection
+
+template <VkDeviceSize HandleSize, VkDeviceSize BaseAlignment, class RayGen,
+          class Miss, class HitGroup, class Callable = SBTSection<>>
+class ShaderBindingTableLayout;
+
+template <VkDeviceSize HandleSize, VkDeviceSize BaseAlignment,
+          class... RayGen, class... Miss, class... HitGroup, class... Callable>
+class ShaderBindingTableLayout<HandleSize, BaseAlignment, SBTSection<RayGen...>,
+                               SBTSection<Miss...>, SBTSection<HitGroup...>,
+                               SBTSection<Callable...>> {
+  using RayGenSection = SBTSection<RayGen...>;
+  using MissSection = SBTSection<Miss...>;
+  using HitGroupSection = SBTSection<HitGroup...>;
+  using CallableSection = SBTSection<Callable...>;
+
+  static constexpr bool IsPowerOf2(VkDeviceSize v) noexcept {
+    return v > 0 && (v & (v - 1)) == 0;
+  }
+
+  static constexpr VkDeviceSize RoundUp(VkDeviceSize v,
+                                        VkDeviceSize alignment) noexcept {
+    return (v + alignment - 1) & ~(alignment - 1);
+  }
+
+  static_assert(IsPowerOf2(HandleSize), "HandleSize must be a power of 2");
+  static_assert(IsPowerOf2(BaseAlignment),
+                "BaseAlignment must be a power of 2");
+
+  static constexpr VkDeviceSize kRecordAlignment =
+    HandleSize > 16 ? HandleSize : 16;
+
+  template <class Section>
+  static constexpr VkDeviceSize StrideOf() noexcept {
+    return RoundUp(HandleSize + Section::kMaxInlineDataSize, kRecordAlignment);
+  }
+
+  // Empty sections are not padded so they add nothing to the table.
+  template <class Section>
+  static constexpr VkDeviceSize OffsetOf(VkDeviceSize previousEnd) noexcept {
+    return Section::kCount > 0 ? RoundUp(previousEnd, BaseAlignment)
+                               : previousEnd;
+  }
+
+public:
+  static constexpr VkDeviceSize kHandleSize = HandleSize;
+  static constexpr VkDeviceSize kBaseAlignment = BaseAlignment;
+
+  static constexpr VkDeviceSize kRayGenOffset = 0;
+  static constexpr VkDeviceSize kRayGenStride = StrideOf<RayGenSection>();
+  static constexpr VkDeviceSize kRayGenSize =
+    kRayGenStride * RayGenSection::kCount;
+
+  static constexpr VkDeviceSize kMissOffset =
+    OffsetOf<MissSection>(kRayGenOffset + kRayGenSize);
+  static constexpr VkDeviceSize kMissStride = StrideOf<MissSection>();
+  static constexpr VkDeviceSize kMissSize = kMissStride * MissSection::kCount;
+
+  static constexpr VkDeviceSize kHitGroupOffset =
+    OffsetOf<HitGroupSection>(kMissOffset + kMissSize);
+  static constexpr VkDeviceSize kHitGroupStride = StrideOf<HitGroupSection>();
+  static constexpr VkDeviceSize kHitGroupSize =
+    kHitGroupStride * HitGroupSection::kCount;
+
+  static constexpr VkDeviceSize kCallableOffset =
+    OffsetOf<CallableSection>(kHitGroupOffset + kHitGroupSize);
+  static constexpr VkDeviceSize kCallableStride = StrideOf<CallableSection>();
+  static constexpr VkDeviceSize kCallableSize =
+    kCallableStride * CallableSection::kCount;
+
+  static constexpr VkDeviceSize kSize = kCallableOffset + kCallableSize;
+
+  static constexpr std::uint32_t kGroupCount =
+    std::max({RayGenSection::kGroupCount, MissSection::kGroupCount,
+              HitGroupSection::kGroupCount, CallableSection::kGroupCount});
+
+  static_assert(kSize > 0, "SBT layout is empty");
+  static_assert(RayGenSection::kCount > 0, "SBT layout needs a raygen record");
+  static_assert((MissSection::kCount == 0 ||
+                 kMissOffset % BaseAlignment == 0) &&
+                  (HitGroupSection::kCount == 0 ||
+                   kHitGroupOffset % BaseAlignment == 0) &&
+                  (CallableSection::kCount == 0 ||
+                   kCallableOffset % BaseAlignment == 0),
+                "SBT section offsets must honor shaderGroupBaseAlignment");
+  static_assert(kRayGenStride % HandleSize == 0 &&
+                  kMissStride % HandleSize == 0 &&
+                  kHitGroupStride % HandleSize == 0 &&
+                  kCallableStride % HandleSize == 0,
+                "SBT strides must be a multiple of shaderGroupHandleSize");
+  static_assert(HandleSize % RayGenSection::kMaxInlineDataAlignment == 0 &&
+                  HandleSize % MissSection::kMaxInlineDataAlignment == 0 &&
+                  HandleSize % HitGroupSection::kMaxInlineDataAlignment == 0 &&
+                  HandleSize % CallableSection::kMaxInlineDataAlignment == 0,
+                "SBT inline data would be misaligned after the group handle");
+
+  // Write the table to pOutput (kSize bytes) from the shader group handles
+  // queried for the pipeline (kGroupCount * kHandleSize bytes) and one
+  // inline data value per record type of each section.
+  static void Fill(
+    std::byte const* pShaderHandles, std::byte* pOutput,
+    typename RayGenSection::values_type const& rayGenData = {},
+    typename MissSection::values_type const& missData = {},
+    typename HitGroupSection::values_type const& hitGroupData = {},
+    typename CallableSection::values_type const& callableData = {}) noexcept {
+    FillSection<kRayGenOffset, kRayGenStride, RayGen...>(
+      pShaderHandles, pOutput, rayGenData,
+      std::index_sequence_for<RayGen...>{});
+    FillSection<kMissOffset, kMissStride, Miss...>(
+      pShaderHandles, pOutput, missData, std::index_sequence_for<Miss...>{});
+    FillSection<kHitGroupOffset, kHitGroupStride, HitGroup...>(
+      pShaderHandles, pOutput, hitGroupData,
+      std::index_sequence_for<HitGroup...>{});
+    FillSection<kCallableOffset, kCallableStride, Callable...>(
+      pShaderHandles, pOutput, callableData,
+      std::index_sequence_for<Callable...>{});
+  }
+
+private:
+  // Index of the first record of record type I within its section.
+  template <std::size_t I, class... Records>
+  static constexpr std::size_t FirstRecord() noexcept {
+    constexpr std::size_t counts[] = {Records::kCount..., 0};
+    std::size_t first = 0;
+    for (std::size_t i = 0; i < I; ++i) first += counts[i];
+    return first;
+  }
+
+  template <VkDeviceSize SectionOffset, VkDeviceSize Stride, class... Records,
+            std::size_t... I>
+  // An empty section expands to no records and uses none of its arguments.
+  static void FillSection(
+    [[maybe_unused]] std::byte const* pShaderHandles,
+    [[maybe_unused]] std::byte* pOutput,
+    [[maybe_unused]] std::tuple<typename Records::value_type...> const& data,
+    std::index_sequence<I...>) noexcept {
+    (FillRecords<SectionOffset + FirstRecord<I, Records...>() * Stride, Stride,
+                 Records>(pShaderHandles, pOutput, std::get<I>(data),
+                          std::make_index_sequence<Records::kCount>{}),
+     ...);
+  }
+
+  template <VkDeviceSize Offset, VkDeviceSize Stride, class Record,
+            std::size_t... J>
+  static void FillRecords(std::byte const* pShaderHandles, std::byte* pOutput,
+                          typename Record::value_type const& data,
+                          std::index_sequence<J...>) noexcept {
+    (std::memcpy(pOutput + Offset + J * Stride,
+                 pShaderHandles + Record::kGroupIndex * HandleSize, HandleSize),
+     ...);
+
+    if constexpr (Record::kInlineDataSize > 0) {
+      if constexpr (Record::kCount == 1) {
+        std::memcpy(pOutput + Offset + HandleSize, &data,
+                    Record::kInlineDataSize);
+      } else {
+        (std::memcpy(pOutput + Offset + J * Stride + HandleSize, &data[J],
+                     Record::kInlineDataSize),
+         ...);
+      }
+    }
+  }
+}; // class ShaderBindingTableLayout
+
+#endif // SHADER_BINDING_TABLE_LAYOUT_HPP_
@@ -0,0 +1,308 @@
+#include "shared_frame_ring.hpp"
+#include <cerrno>
+#include <new>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::system_error ErrnoError(char const* what) {
+  return std::system_error(std::error_code(errno, std::generic_category()),
+                           what);
+} // ErrnoError
+
+#ifdef _WIN32
+
+std::system_error NotSupported() {
+  return std::system_error(
+    std::make_error_code(std::errc::function_not_supported),
+    "shared memory");
+} // NotSupported
+
+#else
+
+// Slots start on a page so a frame's pixels do not share one with the
+// slot before it.
+constexpr std::uint64_t kSlotAlignment = 4096;
+
+std::uint64_t SlotStride(std::uint32_t maxWidth,
+                         std::uint32_t maxHeight) noexcept {
+  std::uint64_t const bytes = kSharedFrameSlotHeaderSize +
+                              std::uint64_t{4} * maxWidth * maxHeight;
+  return (bytes + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+} // SlotStride
+
+#endif // _WIN32
+
+} // namespace
+
+SharedFrameWriter&
+SharedFrameWriter::operator=(SharedFrameWriter&& other) noexcept {
+  if (this != &other) {
+    Close();
+    header_ = std::exchange(other.header_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+    name_ = std::move(other.name_);
+    published_ = std::exchange(other.published_, 0);
+    dropped_ = std::exchange(other.dropped_, 0);
+    writing_ = std::exchange(other.writing_, false);
+    other.name_.clear();
+  }
+  return *this;
+} // SharedFrameWriter::operator=
+
+SharedFrameReader&
+SharedFrameReader::operator=(SharedFrameReader&& other) noexcept {
+  if (this != &other) {
+    Close();
+    header_ = std::exchange(other.header_, nullptr);
+    size_ = std::exchange(other.size_, 0);
+  }
+  return *this;
+} // SharedFrameReader::operator=
+
+#ifdef _WIN32
+
+tl::expected<SharedFrameWriter, std::system_error>
+SharedFrameWriter::Create(gsl::czstring, std::uint32_t, std::uint32_t,
+                          std::uint32_t) noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+void SharedFrameWriter::Close() noexcept {}
+
+gsl::span<std::uint8_t> SharedFrameWriter::BeginFrame(std::uint32_t,
+                                                      std::uint32_t,
+                                                      double) noexcept {
+  return {};
+}
+
+void SharedFrameWriter::Publish() noexcept {}
+
+tl::expected<SharedFrameReader, std::system_error>
+SharedFrameReader::Open(gsl::czstring) noexcept {
+  return tl::unexpected(NotSupported());
+}
+
+void SharedFrameReader::Close() noexcept {}
+
+#else
+
+tl::expected<SharedFrameWriter, std::system_error>
+SharedFrameWriter::Create(gsl::czstring name, std::uint32_t slotCount,
+                          std::uint32_t maxWidth,
+                          std::uint32_t maxHeight) noexcept {
+  Expects(name != nullptr);
+  Expects(slotCount > 0);
+  Expects(maxWidth > 0 && maxHeight > 0);
+
+  std::uint64_t const stride = SlotStride(maxWidth, maxHeight);
+  std::uint64_t const size = kSharedFrameHeaderSize + stride * slotCount;
+
+  SharedFrameWriter writer;
+  try {
+    writer.name_ = name;
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "shm_open"));
+  }
+
+  ::shm_unlink(name);
+  int const fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) return tl::unexpected(ErrnoError("shm_open"));
+
+  if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+    auto error = ErrnoError("ftruncate");
+    ::close(fd);
+    ::shm_unlink(name);
+    return tl::unexpected(error);
+  }
+
+  void* const data = ::mmap(nullptr, static_cast<std::size_t>(size),
+                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    auto error = ErrnoError("mmap");
+    ::shm_unlink(name);
+    return tl::unexpected(error);
+  }
+
+  auto* const header = new (data) SharedFrameRingHeader;
+  header->slotCount = slotCount;
+  header->maxWidth = maxWidth;
+  header->maxHeight = maxHeight;
+  header->slotStride = stride;
+
+  auto* const slots = static_cast<std::byte*>(data) + kSharedFrameHeaderSize;
+  for (std::uint32_t i = 0; i < slotCount; ++i) {
+    new (slots + stride * i) SharedFrameSlotHeader;
+  }
+
+  writer.header_ = header;
+  writer.size_ = static_cast<std::size_t>(size);
+  return writer;
+} // SharedFrameWriter::Create
+
+void SharedFrameWriter::Close() noexcept {
+  if (header_ == nullptr) return;
+  header_->writerOpen.store(0, std::memory_order_release);
+  ::munmap(header_, size_);
+  ::shm_unlink(name_.c_str());
+  header_ = nullptr;
+  size_ = 0;
+} // SharedFrameWriter::Close
+
+gsl::span<std::uint8_t>
+SharedFrameWriter::BeginFrame(std::uint32_t width, std::uint32_t height,
+                              double seconds) noexcept {
+  Expects(header_ != nullptr);
+  Expects(!writing_);
+
+  if (width > header_->maxWidth || height > header_->maxHeight) {
+    ++dropped_;
+    return {};
+  }
+
+  std::uint64_t const serial = published_ + 1;
+  auto* const slotBytes = reinterpret_cast<std::byte*>(header_) +
+                          kSharedFrameHeaderSize +
+                          header_->slotStride * ((serial - 1) %
+                                                 header_->slotCount);
+  auto* const slot = reinterpret_cast<SharedFrameSlotHeader*>(slotBytes);
+
+  // Readers still on the frame this one replaces see the odd sequence, or a
+  // different one, when they check it again. The fence keeps the writes
+  // below from becoming visible before the sequence does.
+  slot->sequence.store(2 * serial - 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->width = width;
+  slot->height = height;
+  slot->seconds = seconds;
+  writing_ = true;
+
+  return {reinterpret_cast<std::uint8_t*>(slotBytes) +
+            kSharedFrameSlotHeaderSize,
+          static_cast<gsl::index>(std::uint64_t{4} * width * height)};
+} // SharedFrameWriter::BeginFrame
+
+void SharedFrameWriter::Publish() noexcept {
+  Expects(writing_);
+
+  std::uint64_t const serial = ++published_;
+  auto* const slot = reinterpret_cast<SharedFrameSlotHeader*>(
+    reinterpret_cast<std::byte*>(header_) + kSharedFrameHeaderSize +
+    header_->slotStride * ((serial - 1) % header_->slotCount));
+
+  slot->sequence.store(2 * serial, std::memory_order_release);
+  header_->published.store(serial, std::memory_order_release);
+  writing_ = false;
+} // SharedFrameWriter::Publish
+
+tl::expected<SharedFrameReader, std::system_error>
+SharedFrameReader::Open(gsl::czstring name) noexcept {
+  Expects(name != nullptr);
+
+  int const fd = ::shm_open(name, O_RDONLY, 0);
+  if (fd < 0) return tl::unexpected(ErrnoError("shm_open"));
+
+  struct stat status;
+  if (::fstat(fd, &status) != 0) {
+    auto error = ErrnoError("fstat");
+    ::close(fd);
+    return tl::unexpected(error);
+  }
+  auto const size = static_cast<std::size_t>(status.st_size);
+
+  auto invalid = [name] {
+    return std::system_error(std::make_error_code(std::errc::invalid_argument),
+                             std::string(name) + ": not a frame ring");
+  };
+  if (size < kSharedFrameHeaderSize) {
+    ::close(fd);
+    return tl::unexpected(invalid());
+  }
+
+  void* const data = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) return tl::unexpected(ErrnoError("mmap"));
+
+  SharedFrameReader reader;
+  reader.header_ = static_cast<SharedFrameRingHeader const*>(data);
+  reader.size_ = size;
+
+  SharedFrameRingHeader const& header = *reader.header_;
+  if (header.magic != kSharedFrameMagic ||
+      header.version != kSharedFrameVersion || header.slotCount == 0 ||
+      header.slotStride < SlotStride(header.maxWidth, header.maxHeight) ||
+      kSharedFrameHeaderSize + header.slotStride * header.slotCount > size) {
+    return tl::unexpected(invalid());
+  }
+  return reader;
+} // SharedFrameReader::Open
+
+void SharedFrameReader::Close() noexcept {
+  if (header_ == nullptr) return;
+  ::munmap(const_cast<SharedFrameRingHeader*>(header_), size_);
+  header_ = nullptr;
+  size_ = 0;
+} // SharedFrameReader::Close
+
+#endif // _WIN32
+
+std::uint64_t SharedFrameReader::Published() const noexcept {
+  Expects(header_ != nullptr);
+  return header_->published.load(std::memory_order_acquire);
+} // SharedFrameReader::Published
+
+bool SharedFrameReader::WriterOpen() const noexcept {
+  Expects(header_ != nullptr);
+  return header_->writerOpen.load(std::memory_order_acquire) != 0;
+} // SharedFrameReader::WriterOpen
+
+SharedFrameSlotHeader const*
+SharedFrameReader::Slot(std::uint64_t serial) const noexcept {
+  return reinterpret_cast<SharedFrameSlotHeader const*>(
+    reinterpret_cast<std::byte const*>(header_) + kSharedFrameHeaderSize +
+    header_->slotStride * ((serial - 1) % header_->slotCount));
+} // SharedFrameReader::Slot
+
+bool SharedFrameReader::Peek(std::uint64_t serial,
+                             SharedFrame& frame) const noexcept {
+  Expects(header_ != nullptr);
+  if (serial == 0) return false;
+
+  SharedFrameSlotHeader const* const slot = Slot(serial);
+  if (slot->sequence.load(std::memory_order_acquire) != 2 * serial) {
+    return false;
+  }
+
+  frame.serial = serial;
+  frame.data = reinterpret_cast<std::uint8_t const*>(slot) +
+               kSharedFrameSlotHeaderSize;
+  frame.width = slot->width;
+  frame.height = slot->height;
+  frame.seconds = slot->seconds;
+
+  // A writer that started over the slot meanwhile may have changed the size
+  // read above; StillValid catches it, but the caller must not read past
+  // the slot before then.
+  if (frame.width > header_->maxWidth || frame.height > header_->maxHeight) {
+    return false;
+  }
+  return true;
+} // SharedFrameReader::Peek
+
+bool SharedFrameReader::StillValid(SharedFrame const& frame) const noexcept {
+  Expects(header_ != nullptr);
+  // Keep the reads of the pixels before the sequence is read again.
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return Slot(frame.serial)->sequence.load(std::memory_order_relaxed) ==
+         2 * frame.serial;
+} // SharedFrameReader::StillValid
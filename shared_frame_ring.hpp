@@ -0,0 +1,170 @@
+#ifndef SHARED_FRAME_RING_HPP_
+#define SHARED_FRAME_RING_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+//
+// Frames handed to other processes through a ring of slots in a POSIX
+// shared memory object, for an encoder that records what the renderer
+// shows. One writer publishes frames; any number of readers map the ring
+// and read pixels in place, so a frame is written once and never copied
+// on its way out.
+//
+// Nothing blocks. The writer never waits for readers: it fills the slots in
+// turn and overwrites the oldest frame, so a reader that falls more than
+// the slot count behind loses frames instead of holding back the renderer.
+// Each slot is guarded by a sequence number, odd while the writer is
+// filling it and twice the frame's serial once the frame is complete. A
+// reader checks it before reading a frame and again after it is done, and
+// drops whatever it made from the frame if the writer got there in between.
+//
+// Frames are RGBA8 of any size up to the maximum the ring was created with,
+// with rows packed tightly. Serials start at 1. Both sides must share byte
+// order and struct layout, as with the scene file; the header's magic and
+// version catch a reader that does not.
+//
+// POSIX only: on Windows Create and Open fail with function_not_supported.
+//
+
+inline constexpr std::uint32_t kSharedFrameMagic = 0x4D52'4653; // "SFRM"
+inline constexpr std::uint32_t kSharedFrameVersion = 1;
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "the ring's sequence numbers are shared between processes");
+
+struct SharedFrameRingHeader {
+  std::uint32_t magic{kSharedFrameMagic};
+  std::uint32_t version{kSharedFrameVersion};
+  std::uint32_t slotCount{0};
+  std::uint32_t maxWidth{0};
+  std::uint32_t maxHeight{0};
+  std::uint32_t reserved{0};
+  std::uint64_t slotStride{0}; // bytes from one slot to the next
+  // Serial of the newest complete frame, 0 before the first.
+  alignas(64) std::atomic<std::uint64_t> published{0};
+  // Cleared when the writer closes the ring.
+  std::atomic<std::uint32_t> writerOpen{1};
+}; // struct SharedFrameRingHeader
+
+// At the start of each slot, followed by the pixels.
+struct SharedFrameSlotHeader {
+  std::atomic<std::uint64_t> sequence{0};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  double seconds{0.0}; // when the frame was produced, on the writer's clock
+}; // struct SharedFrameSlotHeader
+
+inline constexpr std::size_t kSharedFrameHeaderSize = 128;
+inline constexpr std::size_t kSharedFrameSlotHeaderSize = 64;
+static_assert(sizeof(SharedFrameRingHeader) <= kSharedFrameHeaderSize);
+static_assert(sizeof(SharedFrameSlotHeader) <= kSharedFrameSlotHeaderSize);
+
+class SharedFrameWriter {
+public:
+  // A new ring named name, as shm_open takes it ("/capture"). An object
+  // left under the name by an earlier writer is replaced, and the object is
+  // removed again when the writer closes.
+  [[nodiscard]] static tl::expected<SharedFrameWriter, std::system_error>
+  Create(gsl::czstring name, std::uint32_t slotCount, std::uint32_t maxWidth,
+         std::uint32_t maxHeight) noexcept;
+
+  SharedFrameWriter() noexcept = default;
+  SharedFrameWriter(SharedFrameWriter&& other) noexcept {
+    *this = std::move(other);
+  }
+  SharedFrameWriter& operator=(SharedFrameWriter&& other) noexcept;
+  SharedFrameWriter(SharedFrameWriter const&) = delete;
+  SharedFrameWriter& operator=(SharedFrameWriter const&) = delete;
+  ~SharedFrameWriter() noexcept { Close(); }
+
+  // Tell readers no more frames are coming and remove the ring.
+  void Close() noexcept;
+
+  [[nodiscard]] bool IsOpen() const noexcept { return header_ != nullptr; }
+
+  // The pixels of the next frame, width * height * 4 bytes in the slot it
+  // goes to, for the caller to fill and then Publish. Empty, and the frame
+  // counted as dropped, if it is larger than the ring's maximum.
+  [[nodiscard]] gsl::span<std::uint8_t>
+  BeginFrame(std::uint32_t width, std::uint32_t height,
+             double seconds) noexcept;
+
+  // Make the frame begun last visible to readers.
+  void Publish() noexcept;
+
+  [[nodiscard]] std::uint64_t Published() const noexcept {
+    return published_;
+  }
+  [[nodiscard]] std::uint64_t Dropped() const noexcept { return dropped_; }
+
+private:
+  SharedFrameRingHeader* header_{nullptr};
+  std::size_t size_{0};
+  std::string name_{};
+  std::uint64_t published_{0};
+  std::uint64_t dropped_{0};
+  bool writing_{false};
+}; // class SharedFrameWriter
+
+// A frame as it is in the ring. The pixels are valid to read until the
+// writer gets round to the slot again; see SharedFrameReader::StillValid.
+struct SharedFrame {
+  std::uint64_t serial{0};
+  std::uint8_t const* data{nullptr};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  double seconds{0.0};
+}; // struct SharedFrame
+
+class SharedFrameReader {
+public:
+  // Map the ring a writer created under name, read only.
+  [[nodiscard]] static tl::expected<SharedFrameReader, std::system_error>
+  Open(gsl::czstring name) noexcept;
+
+  SharedFrameReader() noexcept = default;
+  SharedFrameReader(SharedFrameReader&& other) noexcept {
+    *this = std::move(other);
+  }
+  SharedFrameReader& operator=(SharedFrameReader&& other) noexcept;
+  SharedFrameReader(SharedFrameReader const&) = delete;
+  SharedFrameReader& operator=(SharedFrameReader const&) = delete;
+  ~SharedFrameReader() noexcept { Close(); }
+
+  void Close() noexcept;
+
+  [[nodiscard]] std::uint32_t SlotCount() const noexcept {
+    return header_->slotCount;
+  }
+
+  // Serial of the newest complete frame, 0 before the first.
+  [[nodiscard]] std::uint64_t Published() const noexcept;
+
+  // False once the writer has closed the ring; frames published before it
+  // did can still be read.
+  [[nodiscard]] bool WriterOpen() const noexcept;
+
+  // Frame serial if it is complete and still in the ring; false if it has
+  // not been published yet or has already been overwritten.
+  [[nodiscard]] bool Peek(std::uint64_t serial,
+                          SharedFrame& frame) const noexcept;
+
+  // Whether the writer has left frame alone since Peek returned it. Call it
+  // after reading the pixels and discard what was made from them if not.
+  [[nodiscard]] bool StillValid(SharedFrame const& frame) const noexcept;
+
+private:
+  [[nodiscard]] SharedFrameSlotHeader const*
+  Slot(std::uint64_t serial) const noexcept;
+
+  SharedFrameRingHeader const* header_{nullptr};
+  std::size_t size_{0};
+}; // class SharedFrameReader
+
+#endif // SHARED_FRAME_RING_HPP_
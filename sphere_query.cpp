@@ -0,0 +1,60 @@
+#include "sphere_query.hpp"
+#include "sphere_shader.hpp"
+#include <cstring>
+
+static_assert(sizeof(shader::Sphere) == sizeof(SceneSphere));
+
+namespace {
+
+bool IntersectSphere(gsl::span<SceneSphere const> spheres,
+                     std::uint32_t index, SphereRay const& ray, float tMax,
+                     SphereHit& hit) noexcept {
+  SceneSphere const& scene = spheres[static_cast<gsl::index>(index)];
+  shader::Sphere sphere;
+  std::memcpy(&sphere, &scene, sizeof(sphere));
+
+  float t;
+  glm::vec3 normal;
+  if (!shader::IntersectSphere(
+        sphere, glm::vec3(ray.origin[0], ray.origin[1], ray.origin[2]),
+        glm::vec3(ray.direction[0], ray.direction[1], ray.direction[2]),
+        ray.tMin, tMax, t, normal)) {
+    return false;
+  }
+
+  hit.t = t;
+  hit.normal[0] = normal.x;
+  hit.normal[1] = normal.y;
+  hit.normal[2] = normal.z;
+  hit.sphere = index;
+  return true;
+} // IntersectSphere
+
+} // namespace
+
+bool IntersectSpheres(gsl::span<SceneSphere const> spheres, BVHView bvh,
+                      SphereRay const& ray, SphereHit& hit) noexcept {
+  return TraverseBVH(bvh, ray.origin, ray.direction, ray.tMin, ray.tMax,
+                     [&](std::uint32_t sphere, float& tMax) {
+                       if (!IntersectSphere(spheres, sphere, ray, tMax, hit)) {
+                         return false;
+                       }
+                       tMax = hit.t;
+                       return true;
+                     });
+} // IntersectSpheres
+
+bool IntersectSpheresBruteForce(gsl::span<SceneSphere const> spheres,
+                                SphereRay const& ray,
+                                SphereHit& hit) noexcept {
+  float tMax = ray.tMax;
+  bool found = false;
+  auto const count = static_cast<std::uint32_t>(spheres.size());
+  for (std::uint32_t s = 0; s < count; ++s) {
+    if (IntersectSphere(spheres, s, ray, tMax, hit)) {
+      tMax = hit.t;
+      found = true;
+    }
+  }
+  return found;
+} // IntersectSpheresBruteForce
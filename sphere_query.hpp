@@ -0,0 +1,38 @@
+#ifndef SPHERE_QUERY_HPP_
+#define SPHERE_QUERY_HPP_
+
+#include "bvh.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "scene_file.hpp"
+#include <cstdint>
+
+//
+// CPU ray queries against the scene's spheres: the CPU BVH for traversal
+// and, for each sphere, shader::IntersectSphere, the code the intersection
+// shader runs, so what the host finds is what the GPU would.
+//
+
+struct SphereRay {
+  float origin[3];
+  float direction[3];
+  float tMin{0.f};
+  float tMax{1e30f};
+}; // struct SphereRay
+
+struct SphereHit {
+  float t{0.f};
+  float normal[3]{0.f, 0.f, 0.f};
+  std::uint32_t sphere{0};
+}; // struct SphereHit
+
+// Closest hit along ray; bvh is built over spheres.
+[[nodiscard]] bool IntersectSpheres(gsl::span<SceneSphere const> spheres,
+                                    BVHView bvh, SphereRay const& ray,
+                                    SphereHit& hit) noexcept;
+
+// The same without the hierarchy: every sphere is tested.
+[[nodiscard]] bool
+IntersectSpheresBruteForce(gsl::span<SceneSphere const> spheres,
+                           SphereRay const& ray, SphereHit& hit) noexcept;
+
+#endif // SPHERE_QUERY_HPP_
@@ -0,0 +1,166 @@
+#ifndef SPHERE_SHADER_HPP_
+#define SPHERE_SHADER_HPP_
+
+//
+// The sphere layout, primary rays, ray-sphere intersection and shading,
+// written once in the common subset of GLSL and C++ with glm. The shaders
+// include it with GL_GOOGLE_include_directive; C++ includes it like any
+// other header and finds it in namespace shader, so the CPU runs exactly
+// the code the GPU does for ray queries, CPU rendering, fuzzing and
+// benchmarks.
+//
+// Keep to that subset: functions declared SHADER_INLINE, out parameters
+// through SHADER_OUT, no constructors or member functions, float literals
+// with an f suffix, and only the GLSL built-ins brought into the namespace
+// below.
+//
+
+#ifdef __cplusplus
+#include "glm/common.hpp"
+#include "glm/geometric.hpp"
+#include "glm/vec3.hpp"
+#include <cmath>
+
+#define SHADER_INLINE inline
+#define SHADER_OUT(type) type&
+
+namespace shader {
+
+using glm::dot;
+using glm::max;
+using glm::min;
+using glm::mix;
+using glm::normalize;
+using glm::vec3;
+using std::sqrt;
+
+#else
+
+#define SHADER_INLINE
+#define SHADER_OUT(type) out type
+
+#endif
+
+// An element of the sphere buffer, which is also the AABB the BLAS is
+// built from: float arrays so std430 and C++ lay it out the same, 24
+// bytes, which vec3 members would not.
+struct Sphere {
+  float aabbMin[3];
+  float aabbMax[3];
+};
+
+SHADER_INLINE Sphere MakeSphere(vec3 center, float radius) {
+  Sphere sphere;
+  sphere.aabbMin[0] = center.x - radius;
+  sphere.aabbMin[1] = center.y - radius;
+  sphere.aabbMin[2] = center.z - radius;
+  sphere.aabbMax[0] = center.x + radius;
+  sphere.aabbMax[1] = center.y + radius;
+  sphere.aabbMax[2] = center.z + radius;
+  return sphere;
+}
+
+SHADER_INLINE vec3 SphereCenter(Sphere sphere) {
+  return vec3(sphere.aabbMax[0] + sphere.aabbMin[0],
+              sphere.aabbMax[1] + sphere.aabbMin[1],
+              sphere.aabbMax[2] + sphere.aabbMin[2]) /
+         vec3(2.f);
+}
+
+SHADER_INLINE float SphereRadius(Sphere sphere) {
+  return (sphere.aabbMax[0] - sphere.aabbMin[0]) / 2.f;
+}
+
+// The most views one ray generation launch renders, one per layer of its
+// depth, each with its own camera frame.
+const int kMaxLaunchViews = 16;
+
+// Direction of the primary ray through the point (x, y) of a width by
+// height image, in pixels from its top left corner, for the camera frame
+// the ray generation shader takes: w from the eye to the image center, u
+// and v from there to its right and top edges.
+SHADER_INLINE vec3 PrimaryRayDirectionAt(float x, float y, float width,
+                                         float height, vec3 u, vec3 v,
+                                         vec3 w) {
+  const float ndcX = 2.f * (x / width) - 1.f;
+  const float ndcY = -2.f * (y / height) + 1.f;
+  return normalize(u * ndcX + v * ndcY + w);
+}
+
+// The same through the center of pixel (x, y).
+SHADER_INLINE vec3 PrimaryRayDirection(float x, float y, float width,
+                                       float height, vec3 u, vec3 v,
+                                       vec3 w) {
+  return PrimaryRayDirectionAt(x + .5f, y + .5f, width, height, u, v, w);
+}
+
+// The nearer intersection of origin + t * direction with sphere for t in
+// (tMin, tMax), and the unit normal there. direction need not be unit
+// length; t is in its units.
+SHADER_INLINE bool IntersectSphere(Sphere sphere, vec3 origin,
+                                   vec3 direction, float tMin, float tMax,
+                                   SHADER_OUT(float) t,
+                                   SHADER_OUT(vec3) normal) {
+  const vec3 center = SphereCenter(sphere);
+  const float radius = SphereRadius(sphere);
+
+  const vec3 oc = origin - center;
+  const float a = dot(direction, direction);
+  const float b = dot(oc, direction);
+  const float c = dot(oc, oc) - (radius * radius);
+
+  // b * b - a * c loses most of its digits to cancellation when the sphere
+  // is small against its distance, enough to hit spheres outside their
+  // boxes. The same discriminant from the offset of the point nearest the
+  // center along the ray keeps them (Ray Tracing Gems, chapter 7).
+  const vec3 l = oc - direction * (b / a);
+  const float d = a * (radius * radius - dot(l, l));
+
+  if (d > 0.f) {
+    // q has the sign of -b, so neither root subtracts nearly equal values.
+    const float q = -b - (b < 0.f ? -sqrt(d) : sqrt(d));
+    const float t1 = min(q / a, c / q);
+    const float t2 = max(q / a, c / q);
+
+    if (tMin < t1 && t1 < tMax) {
+      t = t1;
+    } else if (tMin < t2 && t2 < tMax) {
+      t = t2;
+    } else {
+      return false;
+    }
+
+    normal = normalize((origin + direction * t - center) / radius);
+    return true;
+  }
+  return false;
+}
+
+// The sky seen by rays that hit nothing.
+SHADER_INLINE vec3 ShadeMiss(vec3 direction) {
+  const float t = .5f * (normalize(direction).y + 1.f);
+  return mix(vec3(1.f, 1.f, 1.f), vec3(.5f, .7f, 1.f), t);
+}
+
+// Surfaces are colored by their normal.
+SHADER_INLINE vec3 ShadeNormal(vec3 normal) {
+  return vec3(.5f) * (normalize(normal) + vec3(1.f));
+}
+
+// The inline data of the sphere hit group's shader binding table record,
+// which 01_sphere patches in place to retint the spheres. A white tint
+// shades exactly as ShadeNormal, which the CPU renderer uses.
+struct SphereMaterial {
+  float tint[3];
+};
+
+SHADER_INLINE vec3 ShadeSphere(vec3 normal, SphereMaterial material) {
+  return ShadeNormal(normal) *
+         vec3(material.tint[0], material.tint[1], material.tint[2]);
+}
+
+#ifdef __cplusplus
+} // namespace shader
+#endif
+
+#endif // SPHERE_SHADER_HPP_
@@ -0,0 +1,176 @@
+#include "sphere_store.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+// SplitMix64, as the scene generator uses.
+std::uint64_t NextRandom(std::uint64_t& state) noexcept {
+  std::uint64_t z = (state += 0x9E37'79B9'7F4A'7C15);
+  z = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+  z = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+  return z ^ (z >> 31);
+} // NextRandom
+
+int CountTrailingZeros(std::uint64_t bits) noexcept {
+  Expects(bits != 0);
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(bits);
+#endif
+} // CountTrailingZeros
+
+// Radians the bobbing of AnimateSpheres advances per frame.
+constexpr double kBobRate = .05;
+
+} // namespace
+
+DirtyRangeTracker::DirtyRangeTracker(std::uint64_t size,
+                                     std::uint64_t maxGap)
+  : words_(static_cast<std::size_t>((size + 63) / 64), 0), size_(size),
+    maxGap_(maxGap) {}
+
+void DirtyRangeTracker::Mark(std::uint64_t first,
+                             std::uint64_t count) noexcept {
+  Expects(count > 0 && first < size_ && count <= size_ - first);
+  std::uint64_t const last = first + count - 1;
+  auto const firstWord = static_cast<std::size_t>(first / 64);
+  auto const lastWord = static_cast<std::size_t>(last / 64);
+  std::uint64_t const firstMask = ~std::uint64_t{0} << (first % 64);
+  std::uint64_t const lastMask = ~std::uint64_t{0} >> (63 - last % 64);
+
+  if (firstWord == lastWord) {
+    words_[firstWord] |= firstMask & lastMask;
+  } else {
+    words_[firstWord] |= firstMask;
+    std::fill(words_.begin() + firstWord + 1, words_.begin() + lastWord,
+              ~std::uint64_t{0});
+    words_[lastWord] |= lastMask;
+  }
+  firstWord_ = std::min(firstWord_, firstWord);
+  lastWord_ = std::max(lastWord_, lastWord);
+} // DirtyRangeTracker::Mark
+
+void DirtyRangeTracker::Take(std::vector<DirtyRange>& ranges) {
+  ranges.clear();
+  if (Empty()) return;
+
+  // The first bit from pos on, below end, that is set, or clear, or end.
+  std::uint64_t const end = std::uint64_t{lastWord_ + 1} * 64;
+  auto find = [this, end](std::uint64_t pos, bool set) noexcept {
+    // A range ending with the last word ends at end.
+    if (pos >= end) return end;
+    auto word = static_cast<std::size_t>(pos / 64);
+    std::uint64_t bits = (set ? words_[word] : ~words_[word]) &
+                         (~std::uint64_t{0} << (pos % 64));
+    while (bits == 0) {
+      if (++word > lastWord_) return end;
+      bits = set ? words_[word] : ~words_[word];
+    }
+    return std::uint64_t{word} * 64 + CountTrailingZeros(bits);
+  };
+
+  for (std::uint64_t pos = std::uint64_t{firstWord_} * 64;;) {
+    std::uint64_t const first = find(pos, true);
+    if (first == end) break;
+    pos = find(first, false);
+
+    if (!ranges.empty() &&
+        first <= ranges.back().first + ranges.back().count + maxGap_) {
+      ranges.back().count = pos - ranges.back().first;
+    } else {
+      ranges.push_back({first, pos - first});
+    }
+  }
+
+  std::fill(words_.begin() + firstWord_, words_.begin() + lastWord_ + 1, 0);
+  firstWord_ = SIZE_MAX;
+  lastWord_ = 0;
+} // DirtyRangeTracker::Take
+
+void SphereStore::Assign(gsl::span<SceneSphere const> spheres,
+                         std::uint64_t maxGap) {
+  spheres_.assign(spheres.begin(), spheres.end());
+  dirty_ = DirtyRangeTracker(spheres_.size(), maxGap);
+  stats_ = {};
+
+  std::fill_n(bounds_.aabbMin, 3, std::numeric_limits<float>::max());
+  std::fill_n(bounds_.aabbMax, 3, std::numeric_limits<float>::lowest());
+  for (auto&& sphere : spheres_) {
+    for (int c = 0; c < 3; ++c) {
+      bounds_.aabbMin[c] = std::min(bounds_.aabbMin[c], sphere.aabbMin[c]);
+      bounds_.aabbMax[c] = std::max(bounds_.aabbMax[c], sphere.aabbMax[c]);
+    }
+  }
+} // SphereStore::Assign
+
+bool SphereStore::Set(std::uint64_t index,
+                      SceneSphere const& sphere) noexcept {
+  Expects(index < spheres_.size());
+  stats_.written += 1;
+
+  SceneSphere& stored = spheres_[static_cast<std::size_t>(index)];
+  if (std::memcmp(&stored, &sphere, sizeof(SceneSphere)) == 0) return false;
+
+  dirty_.Mark(index);
+  stored = sphere;
+  stats_.changed += 1;
+
+  for (int c = 0; c < 3; ++c) {
+    if (sphere.aabbMin[c] < bounds_.aabbMin[c]) {
+      bounds_.aabbMin[c] = sphere.aabbMin[c];
+      stats_.boundsGrew = true;
+    }
+    if (sphere.aabbMax[c] > bounds_.aabbMax[c]) {
+      bounds_.aabbMax[c] = sphere.aabbMax[c];
+      stats_.boundsGrew = true;
+    }
+  }
+  return true;
+} // SphereStore::Set
+
+SphereUpdateStats SphereStore::TakeChanges(std::vector<DirtyRange>& ranges) {
+  dirty_.Take(ranges);
+
+  SphereUpdateStats stats = stats_;
+  stats.ranges = ranges.size();
+  for (auto&& range : ranges) stats.copied += range.count;
+
+  stats_ = {};
+  return stats;
+} // SphereStore::TakeChanges
+
+void AnimateSpheres(gsl::span<SceneSphere const> rest, double fraction,
+                    std::uint64_t frame, SphereStore& store) {
+  Expects(rest.size() == store.Spheres().size());
+  Expects(fraction >= 0.0 && fraction <= 1.0);
+  if (rest.empty()) return;
+
+  auto const sphereCount = static_cast<std::uint64_t>(rest.size());
+  auto const count =
+    static_cast<std::uint64_t>(std::llround(fraction * sphereCount));
+
+  std::uint64_t state = frame;
+  for (std::uint64_t i = 0; i < count; ++i) {
+    std::uint64_t const index = NextRandom(state) % sphereCount;
+    SceneSphere sphere = rest[static_cast<gsl::index>(index)];
+
+    // Each sphere bobs with its own phase.
+    float const radius = .5f * (sphere.aabbMax[0] - sphere.aabbMin[0]);
+    auto const offset = static_cast<float>(
+      .5 * radius * std::sin(kBobRate * frame + static_cast<double>(index)));
+    sphere.aabbMin[1] += offset;
+    sphere.aabbMax[1] += offset;
+
+    store.Set(index, sphere);
+  }
+} // AnimateSpheres
@@ -0,0 +1,107 @@
+#ifndef SPHERE_STORE_HPP_
+#define SPHERE_STORE_HPP_
+
+#include "gsl/gsl-lite.hpp"
+#include "scene_file.hpp"
+#include <cstdint>
+#include <vector>
+
+// count elements of an array, starting at first.
+struct DirtyRange {
+  std::uint64_t first;
+  std::uint64_t count;
+}; // struct DirtyRange
+
+//
+// The elements of an array of size elements written since the ranges were
+// last taken, as few ranges as cover them. Ranges that overlap or touch are
+// merged, and so are ranges with at most maxGap clean elements between
+// them: copying a few unchanged elements costs less than another copy
+// region.
+//
+// Marks set bits in a bitmap of the array, so they cost the same in any
+// order, and taking the ranges scans the words between the first and last
+// marked, skipping clean words whole. With marks scattered at random that
+// is several times faster than sorting a list of them.
+//
+class DirtyRangeTracker {
+public:
+  DirtyRangeTracker() = default;
+  // Throws std::bad_alloc.
+  DirtyRangeTracker(std::uint64_t size, std::uint64_t maxGap);
+
+  void Mark(std::uint64_t first, std::uint64_t count = 1) noexcept;
+
+  [[nodiscard]] bool Empty() const noexcept {
+    return firstWord_ > lastWord_;
+  }
+  [[nodiscard]] std::uint64_t Size() const noexcept { return size_; }
+  [[nodiscard]] std::uint64_t MaxGap() const noexcept { return maxGap_; }
+
+  // Replace ranges with the merged ranges, ascending, and start over.
+  // Throws std::bad_alloc, leaving the marks in place.
+  void Take(std::vector<DirtyRange>& ranges);
+
+private:
+  std::vector<std::uint64_t> words_{};
+  std::uint64_t size_{0};
+  std::uint64_t maxGap_{0};
+  // The span of words_ holding marks.
+  std::size_t firstWord_{SIZE_MAX};
+  std::size_t lastWord_{0};
+}; // class DirtyRangeTracker
+
+struct SphereUpdateStats {
+  std::uint64_t written{0}; // Set calls
+  std::uint64_t changed{0}; // of those, storing new bounds
+  std::uint64_t copied{0};  // spheres the ranges cover, gaps included
+  std::uint64_t ranges{0};
+  bool boundsGrew{false};   // Bounds() grew
+}; // struct SphereUpdateStats
+
+//
+// The host copy of a scene's spheres that a simulation writes between
+// frames, tracking which ranges of them to upload. A sphere is nothing but
+// its bounds, so a write storing the bounds already there is dropped: it
+// neither uploads the sphere nor calls for the BLAS to be refit, which
+// TakeChanges returning no ranges tells the renderer.
+//
+// The scene's bounds only grow, staying conservative as spheres move, so
+// the TLAS instance of the spheres keeps bounding them.
+//
+class SphereStore {
+public:
+  // The ranges to copy have at most maxGap unchanged spheres between them.
+  // Throws std::bad_alloc.
+  void Assign(gsl::span<SceneSphere const> spheres, std::uint64_t maxGap);
+
+  [[nodiscard]] gsl::span<SceneSphere const> Spheres() const noexcept {
+    return spheres_;
+  }
+  [[nodiscard]] SceneSphere const& Bounds() const noexcept { return bounds_; }
+
+  // Store sphere at index, returning whether its bounds changed.
+  bool Set(std::uint64_t index, SceneSphere const& sphere) noexcept;
+
+  [[nodiscard]] bool HasChanges() const noexcept { return !dirty_.Empty(); }
+
+  // Replace ranges with the ranges of spheres to copy, ascending, and the
+  // stats of the writes since the last call, and start over. Throws
+  // std::bad_alloc.
+  SphereUpdateStats TakeChanges(std::vector<DirtyRange>& ranges);
+
+private:
+  std::vector<SceneSphere> spheres_{};
+  SceneSphere bounds_{};
+  DirtyRangeTracker dirty_{};
+  SphereUpdateStats stats_{};
+}; // class SphereStore
+
+// The motion of 01_sphere --animate and scene_tool updates: each frame
+// round(fraction * spheres) spheres, picked at random, are placed up to
+// half their radius above or below where rest has them, depending on the
+// frame. Only the picked spheres are written, in the order picked.
+void AnimateSpheres(gsl::span<SceneSphere const> rest, double fraction,
+                    std::uint64_t frame, SphereStore& store);
+
+#endif // SPHERE_STORE_HPP_
@@ -0,0 +1,149 @@
+#include "submit_graph.hpp"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+char const* to_string(QueueRole role) noexcept {
+  switch (role) {
+  case QueueRole::kGraphics: return "graphics";
+  case QueueRole::kCompute: return "compute";
+  }
+  return "unknown";
+} // to_string
+
+static std::string Format(char const* format, std::string const& name,
+                          std::uint64_t id) {
+  char buffer[256];
+  std::snprintf(buffer, sizeof(buffer), format, name.c_str(), id);
+  return buffer;
+} // Format
+
+std::string SubmitGraph::Record(Submit submit) {
+  std::uint64_t const serial = ++serial_;
+  std::string error;
+  auto fail = [&error](std::string message) {
+    if (error.empty()) error = std::move(message);
+  };
+
+  // Latest signal serial on the other queue among this submit's waits, used
+  // to order ownership acquires after their releases.
+  std::uint64_t otherQueueSerial = 0;
+
+  for (auto&& wait : submit.waits) {
+    auto&& state = semaphores_[wait.semaphore];
+    if (!state.pending) {
+      fail(Format("%s: waits on semaphore 0x%" PRIx64
+                  " without a pending signal",
+                  submit.name, wait.semaphore));
+      continue;
+    }
+
+    if (state.signaledByQueue && state.signaledBy != submit.queue) {
+      otherQueueSerial = std::max(otherQueueSerial, state.signalSerial);
+    }
+    state.pending = false;
+  }
+
+  for (auto&& resource : submit.acquires) {
+    auto release = releases_.find(resource);
+    if (release == releases_.end() || release->second.from == submit.queue) {
+      fail(Format("%s: acquires resource 0x%" PRIx64
+                  " that was not released by the other queue",
+                  submit.name, resource));
+      continue;
+    }
+
+    auto const from = static_cast<std::size_t>(release->second.from);
+    if (otherQueueSerial < release->second.serial &&
+        hostWaitSerial_[from] < release->second.serial) {
+      fail(Format("%s: acquire of resource 0x%" PRIx64
+                  " is not ordered after its release",
+                  submit.name, resource));
+    }
+    releases_.erase(release);
+  }
+
+  for (auto&& resource : submit.releases) {
+    releases_[resource] = {submit.queue, serial};
+  }
+
+  for (auto&& semaphore : submit.signals) {
+    auto&& state = semaphores_[semaphore];
+    if (state.pending) {
+      fail(Format("%s: signals semaphore 0x%" PRIx64
+                  " that already has a pending signal",
+                  submit.name, semaphore));
+    }
+    state = {true, submit.queue, serial, true};
+  }
+
+  submits_.push_back(std::move(submit));
+  return error;
+} // SubmitGraph::Record
+
+std::string SubmitGraph::RecordSignal(std::uint64_t semaphore,
+                                      char const* name) {
+  auto&& state = semaphores_[semaphore];
+  std::string error;
+  if (state.pending) {
+    error = Format("%s: signals semaphore 0x%" PRIx64
+                   " that already has a pending signal",
+                   name, semaphore);
+  }
+  state = {true, QueueRole::kGraphics, 0, false};
+  return error;
+} // SubmitGraph::RecordSignal
+
+std::string SubmitGraph::RecordWait(std::uint64_t semaphore,
+                                    char const* name) {
+  auto&& state = semaphores_[semaphore];
+  std::string error;
+  if (!state.pending) {
+    error = Format("%s: waits on semaphore 0x%" PRIx64
+                   " without a pending signal",
+                   name, semaphore);
+  }
+  state.pending = false;
+  return error;
+} // SubmitGraph::RecordWait
+
+void SubmitGraph::RecordHostWait(QueueRole queue) noexcept {
+  hostWaitSerial_[static_cast<std::size_t>(queue)] = serial_;
+} // SubmitGraph::RecordHostWait
+
+std::string SubmitGraph::Describe() const {
+  std::string description;
+  char buffer[64];
+
+  auto appendIds = [&](char const* label,
+                       std::vector<std::uint64_t> const& ids) {
+    if (ids.empty()) return;
+    description += label;
+    for (auto&& id : ids) {
+      std::snprintf(buffer, sizeof(buffer), " 0x%" PRIx64, id);
+      description += buffer;
+    }
+  };
+
+  for (auto&& submit : submits_) {
+    description += to_string(submit.queue);
+    description += ": ";
+    description += submit.name;
+
+    if (!submit.waits.empty()) {
+      description += " waits";
+      for (auto&& wait : submit.waits) {
+        std::snprintf(buffer, sizeof(buffer), " 0x%" PRIx64 "@0x%x",
+                      wait.semaphore, static_cast<unsigned>(wait.stages));
+        description += buffer;
+      }
+    }
+
+    appendIds(" signals", submit.signals);
+    appendIds(" releases", submit.releases);
+    appendIds(" acquires", submit.acquires);
+    description += '\n';
+  }
+
+  return description;
+} // SubmitGraph::Describe
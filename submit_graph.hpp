@@ -0,0 +1,87 @@
+#ifndef SUBMIT_GRAPH_HPP_
+#define SUBMIT_GRAPH_HPP_
+
+#include "flextVk.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class QueueRole : std::uint8_t { kGraphics, kCompute };
+
+[[nodiscard]] char const* to_string(QueueRole role) noexcept;
+
+//
+// Records queue submissions with their binary semaphore waits and signals and
+// queue family ownership transfers, and checks each one as it is recorded:
+//
+//  - a wait must have a pending signal and consumes it;
+//  - a semaphore must not be signaled again while a signal is pending;
+//  - an ownership acquire must match a release of the resource from the
+//    other queue, and the acquiring submit must be ordered after the release
+//    by waiting on a semaphore signaled by the releasing submit or a later
+//    one on that queue, or by a host wait on that queue.
+//
+// Semaphores and resources are opaque 64-bit ids, normally Vulkan handles,
+// so the graph can be driven by the real submit path or by a stub.
+//
+class SubmitGraph {
+public:
+  struct Wait {
+    std::uint64_t semaphore;
+    VkPipelineStageFlags stages;
+  }; // struct Wait
+
+  struct Submit {
+    QueueRole queue;
+    std::string name;
+    std::vector<Wait> waits{};
+    std::vector<std::uint64_t> signals{};
+    std::vector<std::uint64_t> releases{};
+    std::vector<std::uint64_t> acquires{};
+  }; // struct Submit
+
+  // Returns an empty string if submit is valid; otherwise a description of
+  // the first violation. The submit is recorded either way.
+  std::string Record(Submit submit);
+
+  // A semaphore signaled outside a queue submit (vkAcquireNextImageKHR) or
+  // waited on by a present.
+  std::string RecordSignal(std::uint64_t semaphore, char const* name);
+  std::string RecordWait(std::uint64_t semaphore, char const* name);
+
+  // The host waited for everything submitted to queue so far.
+  void RecordHostWait(QueueRole queue) noexcept;
+
+  // Drop the recorded submits but keep the semaphore and ownership state, so
+  // a long-running program can validate frame by frame.
+  void ClearLog() noexcept { submits_.clear(); }
+
+  [[nodiscard]] std::vector<Submit> const& Submits() const noexcept {
+    return submits_;
+  }
+
+  // One line per recorded submit.
+  [[nodiscard]] std::string Describe() const;
+
+private:
+  struct SemaphoreState {
+    bool pending{false};
+    QueueRole signaledBy{QueueRole::kGraphics};
+    std::uint64_t signalSerial{0}; // serial of the signaling submit
+    bool signaledByQueue{false};
+  }; // struct SemaphoreState
+
+  struct Release {
+    QueueRole from;
+    std::uint64_t serial;
+  }; // struct Release
+
+  std::vector<Submit> submits_{};
+  std::unordered_map<std::uint64_t, SemaphoreState> semaphores_{};
+  std::unordered_map<std::uint64_t, Release> releases_{};
+  std::uint64_t serial_{0};
+  std::uint64_t hostWaitSerial_[2]{0, 0};
+}; // class SubmitGraph
+
+#endif // SUBMIT_GRAPH_HPP_
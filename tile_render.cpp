@@ -0,0 +1,539 @@
+#include "tile_render.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <thread>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+inline constexpr std::uint32_t kTileProtocolVersion = 1;
+
+enum class TileMessage : std::uint32_t {
+  kHello = 1,      // worker: TileHello
+  kFrame = 2,      // coordinator: TileFrame
+  kTile = 3,       // coordinator: TileRequest
+  kTileResult = 4, // worker: TileResult, then the tile's RGBA32F pixels
+  kShutdown = 5,   // coordinator: no payload
+};
+
+struct TileHello {
+  std::uint32_t version;
+  std::uint32_t pid;
+  std::uint64_t sceneHash;
+}; // struct TileHello
+
+struct TileFrame {
+  std::uint64_t frame;
+  RenderCamera camera;
+  std::uint32_t width;
+  std::uint32_t height;
+}; // struct TileFrame
+
+struct TileRequest {
+  std::uint64_t frame;
+  std::uint32_t tile;
+  std::uint32_t reserved;
+  ImageRect rect;
+}; // struct TileRequest
+
+struct TileResult {
+  std::uint64_t frame;
+  std::uint32_t tile;
+  std::uint32_t reserved;
+  ImageRect rect;
+  double renderMs;
+}; // struct TileResult
+
+static_assert(sizeof(TileHello) == 16);
+static_assert(sizeof(TileFrame) == 64);
+static_assert(sizeof(TileRequest) == 32);
+static_assert(sizeof(TileResult) == 40);
+
+constexpr std::uint32_t Type(TileMessage message) noexcept {
+  return static_cast<std::uint32_t>(message);
+} // Type
+
+double MillisecondsSince(Clock::time_point start) noexcept {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+    .count();
+} // MillisecondsSince
+
+std::system_error ErrnoError(char const* what) {
+  return std::system_error(std::error_code(errno, std::generic_category()),
+                           what);
+} // ErrnoError
+
+std::system_error ProtocolError(char const* what) {
+  return std::system_error(std::make_error_code(std::errc::bad_message),
+                           what);
+} // ProtocolError
+
+std::uint32_t ProcessId() noexcept {
+#ifdef _WIN32
+  return static_cast<std::uint32_t>(_getpid());
+#else
+  return static_cast<std::uint32_t>(::getpid());
+#endif
+} // ProcessId
+
+bool SameRect(ImageRect const& a, ImageRect const& b) noexcept {
+  return a.x == b.x && a.y == b.y && a.width == b.width &&
+         a.height == b.height;
+} // SameRect
+
+} // namespace
+
+tl::expected<void, std::system_error>
+RunTileWorker(SocketAddress const& address, RenderScene const& scene,
+              std::uint64_t sceneHash,
+              TileWorkerParams const& params) noexcept {
+  auto socket = MessageSocket::Connect(address);
+  if (!socket) return tl::unexpected(socket.error());
+
+  TileHello const hello = {kTileProtocolVersion, ProcessId(), sceneHash};
+  if (auto result = socket->Send(Type(TileMessage::kHello), hello); !result) {
+    return result;
+  }
+
+  try {
+    TileFrame frame{};
+    bool haveFrame = false;
+    MessageHeader header;
+    std::vector<std::byte> payload;
+    std::vector<float> pixels;
+    std::vector<std::byte> reply;
+
+    for (;;) {
+      if (auto result = socket->Receive(header, payload); !result) {
+        return result;
+      }
+
+      switch (static_cast<TileMessage>(header.type)) {
+      case TileMessage::kFrame: {
+        auto next = MessagePayload<TileFrame>(header, payload, header.type);
+        if (!next) return tl::unexpected(next.error());
+        frame = *next;
+        haveFrame = true;
+        break;
+      }
+
+      case TileMessage::kTile: {
+        auto request =
+          MessagePayload<TileRequest>(header, payload, header.type);
+        if (!request) return tl::unexpected(request.error());
+        ImageRect const& rect = request->rect;
+        if (!haveFrame || request->frame != frame.frame ||
+            rect.width == 0 || rect.height == 0 ||
+            rect.x + rect.width > frame.width ||
+            rect.y + rect.height > frame.height) {
+          return tl::unexpected(ProtocolError("tile request"));
+        }
+
+        auto const start = Clock::now();
+        pixels.resize(static_cast<std::size_t>(4 * rect.PixelCount()));
+        RenderRect(scene, frame.camera, frame.width, frame.height, rect,
+                   pixels);
+        double const renderMs = MillisecondsSince(start);
+        if (params.slowdown > 1.0) {
+          std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(
+            renderMs * (params.slowdown - 1.0)));
+        }
+
+        TileResult const result = {request->frame, request->tile, 0, rect,
+                                   renderMs};
+        std::size_t const pixelBytes = pixels.size() * sizeof(float);
+        reply.resize(sizeof(result) + pixelBytes);
+        std::memcpy(reply.data(), &result, sizeof(result));
+        std::memcpy(reply.data() + sizeof(result), pixels.data(), pixelBytes);
+        if (auto sent = socket->Send(Type(TileMessage::kTileResult), reply);
+            !sent) {
+          return sent;
+        }
+        break;
+      }
+
+      case TileMessage::kShutdown: return {};
+
+      default: return tl::unexpected(ProtocolError("unknown message"));
+      }
+    }
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "tile worker"));
+  }
+} // RunTileWorker
+
+tl::expected<TileCoordinator, std::system_error>
+TileCoordinator::Listen(SocketAddress const& address,
+                        std::uint64_t sceneHash) noexcept {
+  auto listener = MessageSocket::Listen(address);
+  if (!listener) return tl::unexpected(listener.error());
+
+  TileCoordinator coordinator;
+  coordinator.listener_ = std::move(*listener);
+  coordinator.sceneHash_ = sceneHash;
+  return coordinator;
+} // TileCoordinator::Listen
+
+tl::expected<void, std::system_error>
+TileCoordinator::AcceptWorkers(std::uint32_t workerCount,
+                               double timeoutSeconds) noexcept {
+  Expects(listener_.IsOpen());
+
+  auto const deadline =
+    Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                     std::chrono::duration<double>(timeoutSeconds));
+  int const listenerFd = listener_.Descriptor();
+
+  try {
+    for (std::uint32_t joined = 0; joined < workerCount;) {
+      auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+      char ready = 0;
+      if (left.count() > 0) {
+        auto waited = WaitReadable(gsl::make_span(&listenerFd, 1),
+                                   gsl::make_span(&ready, 1),
+                                   static_cast<int>(std::min<long long>(
+                                     left.count(),
+                                     std::numeric_limits<int>::max())));
+        if (!waited) return tl::unexpected(waited.error());
+      }
+      if (!ready) {
+        return tl::unexpected(std::system_error(
+          std::make_error_code(std::errc::timed_out), "tile workers"));
+      }
+
+      auto socket = listener_.Accept();
+      if (!socket) return tl::unexpected(socket.error());
+
+      MessageHeader header;
+      std::vector<std::byte> payload;
+      if (!socket->Receive(header, payload)) continue;
+      auto hello = MessagePayload<TileHello>(header, payload,
+                                             Type(TileMessage::kHello));
+      if (!hello || hello->version != kTileProtocolVersion ||
+          hello->sceneHash != sceneHash_) {
+        continue;
+      }
+
+      Worker worker;
+      worker.socket = std::move(*socket);
+      worker.pid = hello->pid;
+      workers_.push_back(std::move(worker));
+      ++joined;
+    }
+    return {};
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "tile workers"));
+  }
+} // TileCoordinator::AcceptWorkers
+
+tl::expected<void, std::system_error>
+TileCoordinator::Render(TileRenderParams const& params, gsl::span<float> rgba,
+                        TileRenderStats* stats) noexcept {
+  Expects(params.width > 0 && params.height > 0 && params.tileSize > 0);
+  Expects(params.tilesInFlight > 0);
+  Expects(static_cast<std::uint64_t>(rgba.size()) ==
+          std::uint64_t{4} * params.width * params.height);
+
+  auto const start = Clock::now();
+  std::uint64_t const frame = ++frame_;
+
+  // Workers lost by a render that failed part way.
+  workers_.erase(std::remove_if(workers_.begin(), workers_.end(),
+                                [](Worker const& worker) {
+                                  return !worker.socket.IsOpen();
+                                }),
+                 workers_.end());
+
+  try {
+    std::vector<ImageRect> tiles;
+    for (std::uint32_t y = 0; y < params.height; y += params.tileSize) {
+      for (std::uint32_t x = 0; x < params.width; x += params.tileSize) {
+        tiles.push_back({x, y, std::min(params.tileSize, params.width - x),
+                         std::min(params.tileSize, params.height - y)});
+      }
+    }
+    auto const tileCount = static_cast<std::uint32_t>(tiles.size());
+
+    std::vector<char> done(tileCount, 0);
+    std::vector<std::uint32_t> copies(tileCount, 0);
+    std::vector<Clock::time_point> firstSent(tileCount);
+    std::deque<std::uint32_t> pending;
+    for (std::uint32_t tile = 0; tile < tileCount; ++tile) {
+      pending.push_back(tile);
+    }
+    std::uint32_t remaining = tileCount;
+
+    std::vector<TileWorkerStats> workerStats(workers_.size());
+    std::vector<char> lost(workers_.size(), 0);
+    std::uint64_t speculativeTiles = 0;
+    std::uint64_t requeuedTiles = 0;
+
+    // Give the worker's tiles of this frame that no one else has back to
+    // the queue, to be handed out first.
+    auto lose = [&](std::size_t w) {
+      Worker& worker = workers_[w];
+      for (auto const& out : worker.outstanding) {
+        if (out.frame != frame) continue;
+        if (--copies[out.tile] == 0 && !done[out.tile]) {
+          pending.push_front(out.tile);
+          ++requeuedTiles;
+        }
+      }
+      worker.outstanding.clear();
+      worker.socket.Close();
+      lost[w] = 1;
+    };
+
+    // Composite a result, or drop it if it is for a tile already done or an
+    // earlier frame.
+    auto receive = [&](std::size_t w, MessageHeader const& header,
+                       gsl::span<std::byte const> payload) -> bool {
+      Worker& worker = workers_[w];
+      auto result = MessagePayload<TileResult>(header, payload,
+                                               Type(TileMessage::kTileResult));
+      if (!result) return false;
+
+      auto const out = std::find_if(
+        worker.outstanding.begin(), worker.outstanding.end(),
+        [&](Outstanding const& o) {
+          return o.frame == result->frame && o.tile == result->tile;
+        });
+      if (out == worker.outstanding.end()) return false;
+      worker.outstanding.erase(out);
+      if (result->frame != frame) return true;
+
+      std::uint32_t const tile = result->tile;
+      ImageRect const& rect = tiles[tile];
+      if (!SameRect(result->rect, rect) ||
+          static_cast<std::uint64_t>(payload.size()) !=
+            sizeof(TileResult) + 4 * sizeof(float) * rect.PixelCount()) {
+        return false;
+      }
+
+      --copies[tile];
+      workerStats[w].renderMs += result->renderMs;
+      if (done[tile]) {
+        ++workerStats[w].tilesDiscarded;
+        return true;
+      }
+
+      std::byte const* source = payload.data() + sizeof(TileResult);
+      std::size_t const rowBytes = 4 * sizeof(float) * rect.width;
+      for (std::uint32_t row = 0; row < rect.height; ++row) {
+        std::memcpy(rgba.data() +
+                      4 * (std::size_t{rect.y + row} * params.width + rect.x),
+                    source, rowBytes);
+        source += rowBytes;
+      }
+      done[tile] = 1;
+      --remaining;
+      ++workerStats[w].tilesRendered;
+      return true;
+    };
+
+    for (std::size_t w = 0; w < workers_.size(); ++w) {
+      workerStats[w].pid = workers_[w].pid;
+      TileFrame const message = {frame, params.camera, params.width,
+                                 params.height};
+      if (!workers_[w].socket.Send(Type(TileMessage::kFrame), message)) {
+        lose(w);
+      }
+    }
+
+    std::vector<int> fds;
+    std::vector<std::size_t> polled;
+    std::vector<char> readable;
+    MessageHeader header;
+    std::vector<std::byte> payload;
+
+    while (remaining > 0) {
+      // Top every worker up to tilesInFlight, from the queue or, for an
+      // idle worker once the queue is empty, with a copy of the tile out
+      // longest.
+      for (std::size_t w = 0; w < workers_.size(); ++w) {
+        Worker& worker = workers_[w];
+        while (!lost[w] && worker.outstanding.size() < params.tilesInFlight) {
+          std::uint32_t tile;
+          if (!pending.empty()) {
+            tile = pending.front();
+            pending.pop_front();
+          } else if (params.speculate && worker.outstanding.empty()) {
+            tile = tileCount;
+            for (std::uint32_t t = 0; t < tileCount; ++t) {
+              if (!done[t] && copies[t] == 1 &&
+                  (tile == tileCount || firstSent[t] < firstSent[tile])) {
+                tile = t;
+              }
+            }
+            if (tile == tileCount) break;
+            ++speculativeTiles;
+          } else {
+            break;
+          }
+
+          if (copies[tile]++ == 0) firstSent[tile] = Clock::now();
+          worker.outstanding.push_back({frame, tile});
+          TileRequest const request = {frame, tile, 0, tiles[tile]};
+          if (!worker.socket.Send(Type(TileMessage::kTile), request)) {
+            lose(w);
+          }
+        }
+      }
+
+      fds.clear();
+      polled.clear();
+      for (std::size_t w = 0; w < workers_.size(); ++w) {
+        if (lost[w]) continue;
+        fds.push_back(workers_[w].socket.Descriptor());
+        polled.push_back(w);
+      }
+      if (fds.empty()) {
+        return tl::unexpected(std::system_error(
+          std::make_error_code(std::errc::connection_aborted),
+          "every tile worker was lost"));
+      }
+
+      readable.assign(fds.size(), 0);
+      if (auto waited = WaitReadable(fds, readable, -1); !waited) {
+        return tl::unexpected(waited.error());
+      }
+
+      for (std::size_t i = 0; i < polled.size(); ++i) {
+        if (!readable[i]) continue;
+        std::size_t const w = polled[i];
+        Worker& worker = workers_[w];
+
+        auto open = worker.socket.ReadAvailable();
+        for (;;) {
+          auto taken = worker.socket.TakeMessage(header, payload);
+          if (!taken || !*taken) {
+            if (!taken) open = false;
+            break;
+          }
+          if (!receive(w, header, payload)) {
+            open = false;
+            break;
+          }
+        }
+        if (!open || !*open) lose(w);
+      }
+    }
+
+    double const renderMs = MillisecondsSince(start);
+
+    // Drop lost workers, keeping the stats in the order they joined.
+    std::size_t kept = 0;
+    for (std::size_t w = 0; w < workers_.size(); ++w) {
+      workerStats[w].lost = lost[w] != 0;
+      if (!lost[w]) workers_[kept++] = std::move(workers_[w]);
+    }
+    workers_.resize(kept);
+
+    if (stats != nullptr) {
+      stats->tileCount = tileCount;
+      stats->speculativeTiles = speculativeTiles;
+      stats->requeuedTiles = requeuedTiles;
+      stats->renderMs = renderMs;
+      stats->workers = std::move(workerStats);
+    }
+    return {};
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "tile render"));
+  }
+} // TileCoordinator::Render
+
+void TileCoordinator::Shutdown() noexcept {
+  for (auto&& worker : workers_) {
+    if (!worker.socket.IsOpen()) continue;
+    (void)worker.socket.Send(Type(TileMessage::kShutdown),
+                             gsl::span<std::byte const>());
+  }
+
+  // Each worker returns its outstanding results and then disconnects;
+  // Receive fails once it has.
+  MessageHeader header;
+  std::vector<std::byte> payload;
+  for (auto&& worker : workers_) {
+    if (!worker.socket.IsOpen()) continue;
+    while (worker.socket.Receive(header, payload)) {
+    }
+  }
+
+  workers_.clear();
+  listener_.Close();
+} // TileCoordinator::Shutdown
+
+#ifdef _WIN32
+
+tl::expected<int, std::system_error>
+SpawnProcess(std::vector<std::string> const&) noexcept {
+  return tl::unexpected(std::system_error(
+    std::make_error_code(std::errc::function_not_supported), "spawn"));
+} // SpawnProcess
+
+tl::expected<int, std::system_error> WaitProcess(int) noexcept {
+  return tl::unexpected(std::system_error(
+    std::make_error_code(std::errc::function_not_supported), "wait"));
+} // WaitProcess
+
+#else
+
+tl::expected<int, std::system_error>
+SpawnProcess(std::vector<std::string> const& argv) noexcept {
+  Expects(!argv.empty());
+
+  try {
+    std::vector<char*> arguments;
+    for (auto&& argument : argv) {
+      arguments.push_back(const_cast<char*>(argument.c_str()));
+    }
+    arguments.push_back(nullptr);
+
+    pid_t pid;
+    bool const search = argv[0].find('/') == std::string::npos;
+    int const error =
+      search ? ::posix_spawnp(&pid, arguments[0], nullptr, nullptr,
+                              arguments.data(), environ)
+             : ::posix_spawn(&pid, arguments[0], nullptr, nullptr,
+                             arguments.data(), environ);
+    if (error != 0) {
+      return tl::unexpected(std::system_error(
+        std::error_code(error, std::generic_category()), argv[0]));
+    }
+    return static_cast<int>(pid);
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "spawn"));
+  }
+} // SpawnProcess
+
+tl::expected<int, std::system_error> WaitProcess(int pid) noexcept {
+  int status;
+  pid_t result;
+  do {
+    result = ::waitpid(static_cast<pid_t>(pid), &status, 0);
+  } while (result < 0 && errno == EINTR);
+  if (result < 0) return tl::unexpected(ErrnoError("waitpid"));
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+} // WaitProcess
+
+#endif // _WIN32
@@ -0,0 +1,129 @@
+#ifndef TILE_RENDER_HPP_
+#define TILE_RENDER_HPP_
+
+#include "cpu_renderer.hpp"
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "message_socket.hpp"
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <vector>
+
+//
+// Frames rendered by several processes, possibly on several machines. A
+// TileCoordinator listens on a MessageSocket address; workers, each with
+// its own copy of the scene and BVH, connect and say which scene they have.
+// For each frame the coordinator splits the image into square tiles and
+// hands them out, and composites the RGBA32F tiles that come back.
+//
+// Tiles are pulled rather than split up front: each worker has at most
+// tilesInFlight tiles outstanding and is sent the next one as each result
+// arrives, so a slow worker ends up with fewer tiles instead of holding up
+// the frame. Once every tile has been handed out, an idle worker is sent a
+// copy of the tile that has been out longest on another worker, and the
+// first result back is kept. A worker that disconnects loses its
+// outstanding tiles to the others.
+//
+// Every worker renders with RenderRect, so the composited frame is the
+// same, bit for bit, as one RenderRect over the whole image.
+//
+
+// A worker that needs longer than the others, for testing rebalancing.
+struct TileWorkerParams {
+  // Every tile takes this many times as long as it took to render.
+  double slowdown{1.0};
+}; // struct TileWorkerParams
+
+// Connect to the coordinator at address and render the tiles it sends until
+// it shuts the worker down. sceneHash identifies the scene the worker has,
+// HashBytes of its sphere section.
+[[nodiscard]] tl::expected<void, std::system_error>
+RunTileWorker(SocketAddress const& address, RenderScene const& scene,
+              std::uint64_t sceneHash,
+              TileWorkerParams const& params = {}) noexcept;
+
+struct TileRenderParams {
+  std::uint32_t width{1600};
+  std::uint32_t height{1200};
+  std::uint32_t tileSize{64};
+  // Tiles a worker has queued, so it starts the next one without waiting
+  // for the round trip.
+  std::uint32_t tilesInFlight{2};
+  // Send idle workers copies of other workers' outstanding tiles.
+  bool speculate{true};
+  RenderCamera camera{};
+}; // struct TileRenderParams
+
+struct TileWorkerStats {
+  std::uint32_t pid{0};
+  std::uint64_t tilesRendered{0};  // results composited
+  std::uint64_t tilesDiscarded{0}; // results for tiles already composited
+  double renderMs{0.0};            // as reported by the worker
+  bool lost{false};
+}; // struct TileWorkerStats
+
+struct TileRenderStats {
+  std::uint64_t tileCount{0};
+  std::uint64_t speculativeTiles{0}; // copies sent to idle workers
+  std::uint64_t requeuedTiles{0};    // taken back from lost workers
+  double renderMs{0.0};
+  std::vector<TileWorkerStats> workers{};
+}; // struct TileRenderStats
+
+class TileCoordinator {
+public:
+  // sceneHash is the scene workers must have to join.
+  [[nodiscard]] static tl::expected<TileCoordinator, std::system_error>
+  Listen(SocketAddress const& address, std::uint64_t sceneHash) noexcept;
+
+  // Accept connections until workerCount more workers with the scene have
+  // joined. Workers with another scene are disconnected. Fails with
+  // timed_out if they have not joined after timeoutSeconds.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  AcceptWorkers(std::uint32_t workerCount, double timeoutSeconds) noexcept;
+
+  [[nodiscard]] std::size_t WorkerCount() const noexcept {
+    return workers_.size();
+  }
+
+  // Render a frame into rgba, RGBA32F and params.width pixels per row.
+  // Workers lost along the way are dropped; fails if every worker is lost.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Render(TileRenderParams const& params, gsl::span<float> rgba,
+         TileRenderStats* stats = nullptr) noexcept;
+
+  // Tell every worker to exit and wait until each has disconnected, after
+  // returning the results still outstanding.
+  void Shutdown() noexcept;
+
+private:
+  struct Outstanding {
+    std::uint64_t frame;
+    std::uint32_t tile;
+  }; // struct Outstanding
+
+  struct Worker {
+    MessageSocket socket{};
+    std::uint32_t pid{0};
+    // In the order sent, which is the order results return in.
+    std::vector<Outstanding> outstanding{};
+  }; // struct Worker
+
+  MessageSocket listener_{};
+  std::uint64_t sceneHash_{0};
+  std::uint64_t frame_{0};
+  std::vector<Worker> workers_{};
+}; // class TileCoordinator
+
+// Start a process running argv[0] with the arguments argv[1...], searching
+// PATH if argv[0] has no slash, and return its process id.
+[[nodiscard]] tl::expected<int, std::system_error>
+SpawnProcess(std::vector<std::string> const& argv) noexcept;
+
+// Wait for a process started by SpawnProcess to exit and return its exit
+// status, or -1 if it was killed.
+[[nodiscard]] tl::expected<int, std::system_error>
+WaitProcess(int pid) noexcept;
+
+#endif // TILE_RENDER_HPP_
@@ -0,0 +1,236 @@
+#include "tonemap.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TONEMAP_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+char const* to_string(UpscaleFilter filter) noexcept {
+  switch (filter) {
+  case UpscaleFilter::kBilinear: return "bilinear";
+  case UpscaleFilter::kBicubic: return "bicubic";
+  }
+  return "unknown";
+} // to_string
+
+namespace {
+
+// Source texels and weights that reconstruct one output row or column.
+struct Taps {
+  std::int32_t index[4];
+  float weight[4];
+}; // struct Taps
+
+// Same mapping and Catmull-Rom weights as 01_sphere_tonemap.comp. Indices are
+// clamped to the source so edges repeat instead of reading outside it.
+Taps ComputeTaps(std::uint32_t i, std::uint32_t srcSize, std::uint32_t dstSize,
+                 UpscaleFilter filter) noexcept {
+  float const scale = static_cast<float>(srcSize) / static_cast<float>(dstSize);
+  float const s = (static_cast<float>(i) + .5f) * scale - .5f;
+  float const base = std::floor(s);
+  float const t = s - base;
+  std::int32_t const i0 = static_cast<std::int32_t>(base);
+  std::int32_t const last = static_cast<std::int32_t>(srcSize) - 1;
+
+  Taps taps;
+  if (filter == UpscaleFilter::kBilinear) {
+    taps.index[0] = std::clamp(i0, 0, last);
+    taps.index[1] = std::clamp(i0 + 1, 0, last);
+    taps.index[2] = taps.index[3] = taps.index[1];
+    taps.weight[0] = 1.f - t;
+    taps.weight[1] = t;
+    taps.weight[2] = taps.weight[3] = 0.f;
+  } else {
+    for (std::int32_t k = 0; k < 4; ++k) {
+      taps.index[k] = std::clamp(i0 - 1 + k, 0, last);
+    }
+    taps.weight[0] = t * (t * (-.5f * t + 1.f) - .5f);
+    taps.weight[1] = t * t * (1.5f * t - 2.5f) + 1.f;
+    taps.weight[2] = t * (t * (-1.5f * t + 2.f) + .5f);
+    taps.weight[3] = t * t * (.5f * t - .5f);
+  }
+  return taps;
+} // ComputeTaps
+
+// Output columns are processed in blocks of this many, their taps computed
+// once per block on the stack and reused for every row.
+constexpr std::uint32_t kColumnBlock = 256;
+
+std::uint32_t ComputeColumnTaps(HDRImageView const& src,
+                                LDRImageView const& dst, UpscaleFilter filter,
+                                std::uint32_t firstColumn,
+                                Taps (&columns)[kColumnBlock]) noexcept {
+  std::uint32_t const count = std::min(kColumnBlock, dst.width - firstColumn);
+  for (std::uint32_t x = 0; x < count; ++x) {
+    columns[x] = ComputeTaps(firstColumn + x, src.width, dst.width, filter);
+  }
+  return count;
+} // ComputeColumnTaps
+
+// maxps and minps: b when either is NaN.
+inline float Max(float a, float b) noexcept { return a > b ? a : b; }
+inline float Min(float a, float b) noexcept { return a < b ? a : b; }
+
+// NaN sums come out 0 and infinite ones, or a NaN from 0 * inf exposure,
+// 255, the same in both kernels.
+inline std::uint8_t Tonemap(float c, float exposure) noexcept {
+  c = Min(Max(c, 0.f) * exposure, std::numeric_limits<float>::max());
+  c = c / (1.f + c);
+  c = std::sqrt(c);
+  return static_cast<std::uint8_t>(c * 255.f + .5f);
+} // Tonemap
+
+template <int TapCount>
+void TonemapRowsScalar(HDRImageView const& src, LDRImageView const& dst,
+                       TonemapParams const& params, std::uint32_t firstRow,
+                       std::uint32_t lastRow) noexcept {
+  Taps columns[kColumnBlock];
+  for (std::uint32_t firstColumn = 0; firstColumn < dst.width;
+       firstColumn += kColumnBlock) {
+    std::uint32_t const columnCount =
+      ComputeColumnTaps(src, dst, params.filter, firstColumn, columns);
+
+    for (std::uint32_t y = firstRow; y < lastRow; ++y) {
+      Taps const rows = ComputeTaps(y, src.height, dst.height, params.filter);
+      std::uint8_t* out =
+        dst.data + (std::size_t{y} * dst.rowPitch + firstColumn) * 4;
+
+      for (std::uint32_t x = 0; x < columnCount; ++x) {
+        Taps const& cols = columns[x];
+        float sum[3] = {0.f, 0.f, 0.f};
+
+        for (int j = 0; j < TapCount; ++j) {
+          float const* row =
+            src.data + std::size_t(rows.index[j]) * src.rowPitch * 4;
+          float rowSum[3] = {0.f, 0.f, 0.f};
+
+          for (int i = 0; i < TapCount; ++i) {
+            float const* texel = row + std::size_t(cols.index[i]) * 4;
+            for (int c = 0; c < 3; ++c) rowSum[c] += cols.weight[i] * texel[c];
+          }
+
+          for (int c = 0; c < 3; ++c) sum[c] += rows.weight[j] * rowSum[c];
+        }
+
+        for (int c = 0; c < 3; ++c) out[c] = Tonemap(sum[c], params.exposure);
+        out[3] = 255;
+        out += 4;
+      }
+    }
+  }
+} // TonemapRowsScalar
+
+#ifdef TONEMAP_USE_SSE2
+
+// One RGBA pixel per register: every filter tap is a 4-wide multiply-add
+// and the tonemap runs on all channels at once.
+template <int TapCount>
+void TonemapRowsSSE2(HDRImageView const& src, LDRImageView const& dst,
+                     TonemapParams const& params, std::uint32_t firstRow,
+                     std::uint32_t lastRow) noexcept {
+  __m128 const zero = _mm_setzero_ps();
+  __m128 const one = _mm_set1_ps(1.f);
+  __m128 const exposure = _mm_set1_ps(params.exposure);
+  __m128 const largest = _mm_set1_ps(std::numeric_limits<float>::max());
+  __m128 const scale = _mm_set1_ps(255.f);
+  __m128 const half = _mm_set1_ps(.5f);
+  __m128i const opaque = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+
+  Taps columns[kColumnBlock];
+  for (std::uint32_t firstColumn = 0; firstColumn < dst.width;
+       firstColumn += kColumnBlock) {
+    std::uint32_t const columnCount =
+      ComputeColumnTaps(src, dst, params.filter, firstColumn, columns);
+
+    for (std::uint32_t y = firstRow; y < lastRow; ++y) {
+      Taps const rows = ComputeTaps(y, src.height, dst.height, params.filter);
+      std::uint8_t* out =
+        dst.data + (std::size_t{y} * dst.rowPitch + firstColumn) * 4;
+
+      float const* rowData[TapCount];
+      for (int j = 0; j < TapCount; ++j) {
+        rowData[j] = src.data + std::size_t(rows.index[j]) * src.rowPitch * 4;
+      }
+
+      for (std::uint32_t x = 0; x < columnCount; ++x) {
+        Taps const& cols = columns[x];
+        __m128 sum = zero;
+
+        for (int j = 0; j < TapCount; ++j) {
+          __m128 rowSum = zero;
+          for (int i = 0; i < TapCount; ++i) {
+            __m128 const texel =
+              _mm_loadu_ps(rowData[j] + std::size_t(cols.index[i]) * 4);
+            rowSum = _mm_add_ps(rowSum,
+                                _mm_mul_ps(_mm_set1_ps(cols.weight[i]), texel));
+          }
+          sum =
+            _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(rows.weight[j]), rowSum));
+        }
+
+        __m128 c = _mm_min_ps(_mm_mul_ps(_mm_max_ps(sum, zero), exposure),
+                              largest);
+        c = _mm_div_ps(c, _mm_add_ps(one, c));
+        c = _mm_sqrt_ps(c);
+
+        __m128i q = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, scale), half));
+        q = _mm_packs_epi32(q, q);
+        q = _mm_packus_epi16(q, q);
+        q = _mm_or_si128(q, opaque);
+
+        std::int32_t const rgba = _mm_cvtsi128_si32(q);
+        std::memcpy(out, &rgba, sizeof(rgba));
+        out += 4;
+      }
+    }
+  }
+} // TonemapRowsSSE2
+
+#endif // TONEMAP_USE_SSE2
+
+bool ClampRows(HDRImageView const& src, LDRImageView const& dst,
+               std::uint32_t firstRow, std::uint32_t& rowCount) noexcept {
+  Expects(src.data != nullptr && dst.data != nullptr);
+  Expects(src.width > 0 && src.height > 0);
+  Expects(src.rowPitch >= src.width && dst.rowPitch >= dst.width);
+
+  if (firstRow >= dst.height) return false;
+  rowCount = std::min(rowCount, dst.height - firstRow);
+  return true;
+} // ClampRows
+
+} // namespace
+
+void TonemapUpscale(HDRImageView const& src, LDRImageView const& dst,
+                    TonemapParams const& params, std::uint32_t firstRow,
+                    std::uint32_t rowCount) noexcept {
+#ifdef TONEMAP_USE_SSE2
+  if (!ClampRows(src, dst, firstRow, rowCount)) return;
+
+  if (params.filter == UpscaleFilter::kBilinear) {
+    TonemapRowsSSE2<2>(src, dst, params, firstRow, firstRow + rowCount);
+  } else {
+    TonemapRowsSSE2<4>(src, dst, params, firstRow, firstRow + rowCount);
+  }
+#else
+  TonemapUpscaleScalar(src, dst, params, firstRow, rowCount);
+#endif
+} // TonemapUpscale
+
+void TonemapUpscaleScalar(HDRImageView const& src, LDRImageView const& dst,
+                          TonemapParams const& params, std::uint32_t firstRow,
+                          std::uint32_t rowCount) noexcept {
+  if (!ClampRows(src, dst, firstRow, rowCount)) return;
+
+  if (params.filter == UpscaleFilter::kBilinear) {
+    TonemapRowsScalar<2>(src, dst, params, firstRow, firstRow + rowCount);
+  } else {
+    TonemapRowsScalar<4>(src, dst, params, firstRow, firstRow + rowCount);
+  }
+} // TonemapUpscaleScalar
@@ -0,0 +1,54 @@
+#ifndef TONEMAP_HPP_
+#define TONEMAP_HPP_
+
+#include <cstdint>
+
+//
+// CPU implementation of the tonemap/upscale pass in 01_sphere_tonemap.comp.
+// The HDR source is traced at a fraction of the output resolution; each
+// output pixel is reconstructed from it with a bilinear or Catmull-Rom
+// bicubic filter, exposed, Reinhard tonemapped and gamma 2 encoded to RGBA8.
+//
+// TonemapUpscale uses SSE2 where available and TonemapUpscaleScalar is the
+// reference it is validated against. Both follow the shader arithmetic step
+// for step so results agree to within one LSB, and both map a NaN channel to
+// 0 and an infinite one to 255. Neither allocates.
+//
+
+enum class UpscaleFilter : std::uint32_t { kBilinear = 0, kBicubic = 1 };
+
+[[nodiscard]] char const* to_string(UpscaleFilter filter) noexcept;
+
+struct TonemapParams {
+  float exposure{1.f};
+  UpscaleFilter filter{UpscaleFilter::kBilinear};
+}; // struct TonemapParams
+
+// RGBA32F pixels; rowPitch is in pixels.
+struct HDRImageView {
+  float const* data{nullptr};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  std::uint32_t rowPitch{0};
+}; // struct HDRImageView
+
+// RGBA8 pixels; rowPitch is in pixels.
+struct LDRImageView {
+  std::uint8_t* data{nullptr};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  std::uint32_t rowPitch{0};
+}; // struct LDRImageView
+
+// Writes rows [firstRow, firstRow + rowCount) of dst so callers can split an
+// image across threads. rowCount is clamped to dst.height.
+void TonemapUpscale(HDRImageView const& src, LDRImageView const& dst,
+                    TonemapParams const& params, std::uint32_t firstRow = 0,
+                    std::uint32_t rowCount = UINT32_MAX) noexcept;
+
+void TonemapUpscaleScalar(HDRImageView const& src, LDRImageView const& dst,
+                          TonemapParams const& params,
+                          std::uint32_t firstRow = 0,
+                          std::uint32_t rowCount = UINT32_MAX) noexcept;
+
+#endif // TONEMAP_HPP_
@@ -0,0 +1,332 @@
+#include "triangle_mesh.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+void Sub(float const* a, float const* b, float (&out)[3]) noexcept {
+  for (int i = 0; i < 3; ++i) out[i] = a[i] - b[i];
+}
+
+void Cross(float const (&a)[3], float const (&b)[3], float (&out)[3]) noexcept {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+float Dot(float const (&a)[3], float const (&b)[3]) noexcept {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+std::int16_t EncodeSnorm16(float value) noexcept {
+  return static_cast<std::int16_t>(
+    std::lround(std::clamp(value, -1.f, 1.f) * 32767.f));
+}
+
+float DecodeSnorm16(std::int16_t value) noexcept {
+  return std::max(static_cast<float>(value) / 32767.f, -1.f);
+}
+
+// Octahedral encoding of a unit vector as two snorm16s, x in the low half.
+std::uint32_t EncodeOctahedral(float (&n)[3]) noexcept {
+  float const l1 = std::abs(n[0]) + std::abs(n[1]) + std::abs(n[2]);
+  float x = n[0] / l1;
+  float y = n[1] / l1;
+  if (n[2] < 0.f) {
+    float const fx = (1.f - std::abs(y)) * (x >= 0.f ? 1.f : -1.f);
+    float const fy = (1.f - std::abs(x)) * (y >= 0.f ? 1.f : -1.f);
+    x = fx;
+    y = fy;
+  }
+  return static_cast<std::uint16_t>(EncodeSnorm16(x)) |
+         static_cast<std::uint32_t>(
+           static_cast<std::uint16_t>(EncodeSnorm16(y)))
+           << 16;
+}
+
+bool IntersectTriangle(TriangleMesh const& mesh, std::uint32_t triangle,
+                       TriangleRay const& ray, float tMax,
+                       TriangleHit& hit) noexcept {
+  std::uint32_t const* index = &mesh.indices[3 * std::size_t{triangle}];
+  float const* v0 = &mesh.positions[3 * std::size_t{index[0]}];
+  float const* v1 = &mesh.positions[3 * std::size_t{index[1]}];
+  float const* v2 = &mesh.positions[3 * std::size_t{index[2]}];
+
+  float e1[3], e2[3], p[3], s[3], q[3];
+  Sub(v1, v0, e1);
+  Sub(v2, v0, e2);
+  Cross(ray.direction, e2, p);
+
+  float const det = Dot(e1, p);
+  if (det == 0.f) return false;
+  float const inverseDet = 1.f / det;
+
+  Sub(ray.origin, v0, s);
+  float const u = Dot(s, p) * inverseDet;
+  if (u < 0.f || u > 1.f) return false;
+
+  Cross(s, e1, q);
+  float const v = Dot(ray.direction, q) * inverseDet;
+  if (v < 0.f || u + v > 1.f) return false;
+
+  float const t = Dot(e2, q) * inverseDet;
+  if (!(t > ray.tMin && t < tMax)) return false;
+
+  hit = {t, u, v, triangle};
+  return true;
+} // IntersectTriangle
+
+} // namespace
+
+void TriangleMesh::Bounds(float (&boundsMin)[3],
+                          float (&boundsMax)[3]) const noexcept {
+  std::fill_n(boundsMin, 3, std::numeric_limits<float>::max());
+  std::fill_n(boundsMax, 3, std::numeric_limits<float>::lowest());
+  for (std::size_t i = 0; i < positions.size(); i += 3) {
+    for (int c = 0; c < 3; ++c) {
+      boundsMin[c] = std::min(boundsMin[c], positions[i + c]);
+      boundsMax[c] = std::max(boundsMax[c], positions[i + c]);
+    }
+  }
+} // TriangleMesh::Bounds
+
+gsl::czstring to_string(VertexFormat format) noexcept {
+  switch (format) {
+  case VertexFormat::kFloat32: return "float32";
+  case VertexFormat::kFloat16: return "float16";
+  case VertexFormat::kSnorm16: return "snorm16";
+  }
+  return "unknown";
+} // to_string
+
+bool FromString(gsl::czstring name, VertexFormat& format) noexcept {
+  for (auto candidate : {VertexFormat::kFloat32, VertexFormat::kFloat16,
+                         VertexFormat::kSnorm16}) {
+    if (std::strcmp(name, to_string(candidate)) == 0) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+} // FromString
+
+std::uint32_t VertexStride(VertexFormat format) noexcept {
+  return format == VertexFormat::kFloat32 ? 3 * sizeof(float)
+                                          : 3 * sizeof(std::uint16_t);
+} // VertexStride
+
+std::uint16_t FloatToHalf(float value) noexcept {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  auto const sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+  std::uint32_t const magnitude = bits & 0x7FFF'FFFF;
+
+  if (magnitude >= 0x7F80'0000) { // inf or NaN
+    return sign | 0x7C00 | (magnitude > 0x7F80'0000 ? 0x200 : 0);
+  }
+  if (magnitude >= 0x477F'F000) return sign | 0x7C00; // rounds past 65504
+
+  std::uint32_t half, remainder, halfway;
+  if (magnitude < 0x3880'0000) { // below 2^-14: subnormal or zero
+    if (magnitude < 0x3300'0000) return sign; // below 2^-25
+    std::uint32_t const exponent = magnitude >> 23;
+    std::uint32_t const mantissa = (magnitude & 0x7F'FFFF) | 0x80'0000;
+    std::uint32_t const shift = 126 - exponent;
+    half = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    half = (magnitude - (112u << 23)) >> 13;
+    remainder = magnitude & 0x1FFF;
+    halfway = 0x1000;
+  }
+
+  // Round to nearest even; a carry out of the mantissa correctly bumps the
+  // exponent.
+  if (remainder > halfway || (remainder == halfway && (half & 1) != 0)) {
+    ++half;
+  }
+  return static_cast<std::uint16_t>(sign | half);
+} // FloatToHalf
+
+float HalfToFloat(std::uint16_t value) noexcept {
+  std::uint32_t const sign = static_cast<std::uint32_t>(value & 0x8000) << 16;
+  std::uint32_t const exponent = (value >> 10) & 0x1F;
+  std::uint32_t const mantissa = value & 0x3FF;
+
+  if (exponent == 0) {
+    float const magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign != 0 ? -magnitude : magnitude;
+  }
+
+  std::uint32_t const bits =
+    exponent == 0x1F ? sign | 0x7F80'0000 | (mantissa << 13)
+                     : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+} // HalfToFloat
+
+void EncodedMesh::Transform(float (&transform)[3][4]) const noexcept {
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) transform[r][c] = r == c ? scale[r] : 0.f;
+    transform[r][3] = offset[r];
+  }
+} // EncodedMesh::Transform
+
+EncodedMesh EncodeMesh(TriangleMesh const& mesh, VertexFormat format) {
+  Expects(mesh.indices.size() % 3 == 0);
+
+  EncodedMesh encoded;
+  encoded.format = format;
+  encoded.vertexStride = VertexStride(format);
+  encoded.vertexCount = mesh.VertexCount();
+  encoded.triangleCount = mesh.TriangleCount();
+  encoded.index16 = encoded.vertexCount <= 0x10000;
+
+  if (encoded.vertexCount > 0) {
+    mesh.Bounds(encoded.boundsMin, encoded.boundsMax);
+  }
+
+  if (format != VertexFormat::kFloat32 && encoded.vertexCount > 0) {
+    for (int c = 0; c < 3; ++c) {
+      encoded.offset[c] = .5f * (encoded.boundsMin[c] + encoded.boundsMax[c]);
+      float const halfExtent =
+        .5f * (encoded.boundsMax[c] - encoded.boundsMin[c]);
+      encoded.scale[c] = halfExtent > 0.f ? halfExtent : 1.f;
+    }
+  }
+
+  encoded.vertices.resize(encoded.vertexCount * encoded.vertexStride);
+  std::byte* vertex = encoded.vertices.data();
+  for (std::size_t i = 0; i < mesh.positions.size(); i += 3) {
+    if (format == VertexFormat::kFloat32) {
+      std::memcpy(vertex, &mesh.positions[i], 3 * sizeof(float));
+    } else {
+      std::uint16_t stored[3];
+      for (int c = 0; c < 3; ++c) {
+        float const normalized =
+          (mesh.positions[i + c] - encoded.offset[c]) / encoded.scale[c];
+        stored[c] = format == VertexFormat::kFloat16
+                      ? FloatToHalf(normalized)
+                      : static_cast<std::uint16_t>(EncodeSnorm16(normalized));
+      }
+      std::memcpy(vertex, stored, sizeof(stored));
+    }
+    vertex += encoded.vertexStride;
+  }
+
+  if (encoded.index16) {
+    std::vector<std::uint16_t> const indices(mesh.indices.begin(),
+                                             mesh.indices.end());
+    auto const bytes = gsl::as_bytes(gsl::make_span(indices));
+    encoded.indices.assign(bytes.begin(), bytes.end());
+  } else {
+    auto const bytes = gsl::as_bytes(gsl::make_span(mesh.indices));
+    encoded.indices.assign(bytes.begin(), bytes.end());
+  }
+
+  // Normals transform by the inverse transpose of the normalization, which
+  // is the per-axis scale itself.
+  encoded.normals.resize(encoded.triangleCount);
+  for (std::size_t t = 0; t < encoded.triangleCount; ++t) {
+    std::uint32_t const* index = &mesh.indices[3 * t];
+    float e1[3], e2[3], n[3];
+    Sub(&mesh.positions[3 * std::size_t{index[1]}],
+        &mesh.positions[3 * std::size_t{index[0]}], e1);
+    Sub(&mesh.positions[3 * std::size_t{index[2]}],
+        &mesh.positions[3 * std::size_t{index[0]}], e2);
+    Cross(e1, e2, n);
+    for (int c = 0; c < 3; ++c) n[c] *= encoded.scale[c];
+    if (n[0] == 0.f && n[1] == 0.f && n[2] == 0.f) n[2] = 1.f; // degenerate
+    encoded.normals[t] = EncodeOctahedral(n);
+  }
+
+  return encoded;
+} // EncodeMesh
+
+TriangleMesh DecodeMesh(EncodedMesh const& encoded) {
+  TriangleMesh mesh;
+  mesh.positions.resize(3 * encoded.vertexCount);
+
+  std::byte const* vertex = encoded.vertices.data();
+  for (std::size_t i = 0; i < mesh.positions.size(); i += 3) {
+    float stored[3];
+    if (encoded.format == VertexFormat::kFloat32) {
+      std::memcpy(stored, vertex, sizeof(stored));
+    } else {
+      std::uint16_t raw[3];
+      std::memcpy(raw, vertex, sizeof(raw));
+      for (int c = 0; c < 3; ++c) {
+        stored[c] = encoded.format == VertexFormat::kFloat16
+                      ? HalfToFloat(raw[c])
+                      : DecodeSnorm16(static_cast<std::int16_t>(raw[c]));
+      }
+    }
+    for (int c = 0; c < 3; ++c) {
+      mesh.positions[i + c] = encoded.scale[c] * stored[c] + encoded.offset[c];
+    }
+    vertex += encoded.vertexStride;
+  }
+
+  mesh.indices.resize(3 * encoded.triangleCount);
+  if (encoded.index16) {
+    for (std::size_t i = 0; i < mesh.indices.size(); ++i) {
+      std::uint16_t index;
+      std::memcpy(&index, &encoded.indices[i * sizeof(index)], sizeof(index));
+      mesh.indices[i] = index;
+    }
+  } else {
+    std::memcpy(mesh.indices.data(), encoded.indices.data(),
+                encoded.indices.size());
+  }
+
+  return mesh;
+} // DecodeMesh
+
+BVH BuildTriangleBVH(TriangleMesh const& mesh, BVHBuildParams const& params) {
+  std::vector<SceneSphere> boxes(mesh.TriangleCount());
+  for (std::size_t t = 0; t < boxes.size(); ++t) {
+    SceneSphere& box = boxes[t];
+    std::fill_n(box.aabbMin, 3, std::numeric_limits<float>::max());
+    std::fill_n(box.aabbMax, 3, std::numeric_limits<float>::lowest());
+    for (std::size_t k = 0; k < 3; ++k) {
+      std::size_t const vertex = mesh.indices[3 * t + k];
+      float const* p = &mesh.positions[3 * vertex];
+      for (int c = 0; c < 3; ++c) {
+        box.aabbMin[c] = std::min(box.aabbMin[c], p[c]);
+        box.aabbMax[c] = std::max(box.aabbMax[c], p[c]);
+      }
+    }
+  }
+  return BuildBVH(boxes, params);
+} // BuildTriangleBVH
+
+bool Intersect(TriangleMesh const& mesh, BVHView bvh, TriangleRay const& ray,
+               TriangleHit& hit) noexcept {
+  return TraverseBVH(bvh, ray.origin, ray.direction, ray.tMin, ray.tMax,
+                     [&](std::uint32_t triangle, float& tMax) {
+                       if (!IntersectTriangle(mesh, triangle, ray, tMax, hit)) {
+                         return false;
+                       }
+                       tMax = hit.t;
+                       return true;
+                     });
+} // Intersect
+
+bool IntersectBruteForce(TriangleMesh const& mesh, TriangleRay const& ray,
+                         TriangleHit& hit) noexcept {
+  float tMax = ray.tMax;
+  bool found = false;
+  auto const count = static_cast<std::uint32_t>(mesh.TriangleCount());
+  for (std::uint32_t t = 0; t < count; ++t) {
+    if (IntersectTriangle(mesh, t, ray, tMax, hit)) {
+      tMax = hit.t;
+      found = true;
+    }
+  }
+  return found;
+} // IntersectBruteForce
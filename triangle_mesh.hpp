@@ -0,0 +1,140 @@
+#ifndef TRIANGLE_MESH_HPP_
+#define TRIANGLE_MESH_HPP_
+
+#include "bvh.hpp"
+#include "gsl/gsl-lite.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// Indexed triangle meshes: positions as xyz floats and three vertex indices
+// per triangle, as loaded from OBJ files and built into triangle BLASes.
+//
+struct TriangleMesh {
+  std::vector<float> positions{};
+  std::vector<std::uint32_t> indices{};
+
+  [[nodiscard]] std::size_t VertexCount() const noexcept {
+    return positions.size() / 3;
+  }
+
+  [[nodiscard]] std::size_t TriangleCount() const noexcept {
+    return indices.size() / 3;
+  }
+
+  // Bounds of the positions; min > max if there are none.
+  void Bounds(float (&boundsMin)[3], float (&boundsMax)[3]) const noexcept;
+}; // struct TriangleMesh
+
+//
+// Vertex formats for the GPU copy of a mesh, matching the VkFormats a
+// VkGeometryTrianglesNV accepts:
+//
+//   kFloat32  R32G32B32_SFLOAT, positions as loaded, 12 bytes.
+//   kFloat16  R16G16B16_SFLOAT, 6 bytes.
+//   kSnorm16  R16G16B16_SNORM, 6 bytes.
+//
+// The 16-bit formats store positions normalized to [-1, 1] over the mesh
+// bounds, per axis. The instance transform scales them back (see
+// EncodedMesh::scale and offset), so the BLAS is built in normalized space
+// and the world is unchanged. Normalizing spends the half floats' exponent
+// range on the mesh instead of on the origin; snorm16 spreads its 65535
+// steps evenly over the bounds and is the more accurate of the two.
+//
+enum class VertexFormat : std::uint32_t {
+  kFloat32 = 0,
+  kFloat16 = 1,
+  kSnorm16 = 2,
+};
+
+[[nodiscard]] gsl::czstring to_string(VertexFormat format) noexcept;
+
+// Inverse of to_string; false if name is not a format.
+[[nodiscard]] bool FromString(gsl::czstring name,
+                              VertexFormat& format) noexcept;
+
+[[nodiscard]] std::uint32_t VertexStride(VertexFormat format) noexcept;
+
+// A mesh in the layout uploaded to the GPU. Indices are 16-bit when every
+// vertex can be addressed with 16 bits. normals holds one octahedral
+// encoded face normal per triangle in the normalized space, two snorm16s
+// packed the way GLSL's unpackSnorm2x16 reads them, since hit shaders have
+// no other way to shade a triangle without decoding its vertices.
+struct EncodedMesh {
+  VertexFormat format{VertexFormat::kFloat32};
+  std::uint32_t vertexStride{0};
+  std::uint64_t vertexCount{0};
+  std::uint64_t triangleCount{0};
+  bool index16{false};
+  std::vector<std::byte> vertices{};
+  std::vector<std::byte> indices{};
+  std::vector<std::uint32_t> normals{};
+
+  // Loaded position = scale * stored position + offset, per axis.
+  float scale[3]{1.f, 1.f, 1.f};
+  float offset[3]{0.f, 0.f, 0.f};
+
+  // Bounds of the loaded positions.
+  float boundsMin[3]{0.f, 0.f, 0.f};
+  float boundsMax[3]{0.f, 0.f, 0.f};
+
+  [[nodiscard]] std::uint64_t SizeBytes() const noexcept {
+    return vertices.size() + indices.size() +
+           normals.size() * sizeof(std::uint32_t);
+  }
+
+  [[nodiscard]] double BytesPerTriangle() const noexcept {
+    return triangleCount > 0 ? static_cast<double>(SizeBytes()) / triangleCount
+                             : 0.0;
+  }
+
+  // The scale and offset as a 3x4 row-major instance transform.
+  void Transform(float (&transform)[3][4]) const noexcept;
+}; // struct EncodedMesh
+
+[[nodiscard]] EncodedMesh EncodeMesh(TriangleMesh const& mesh,
+                                     VertexFormat format);
+
+// The mesh the GPU sees: positions decoded and transformed back to loaded
+// space. Used to measure and validate the precision lost by a format.
+[[nodiscard]] TriangleMesh DecodeMesh(EncodedMesh const& encoded);
+
+[[nodiscard]] std::uint16_t FloatToHalf(float value) noexcept;
+[[nodiscard]] float HalfToFloat(std::uint16_t value) noexcept;
+
+//
+// CPU ray casting against a mesh, to validate loaded and encoded meshes
+// without a GPU. The hierarchy is the sphere BVH built over triangle
+// bounds; primitives are triangle indices.
+//
+
+struct TriangleRay {
+  float origin[3];
+  float direction[3];
+  float tMin{0.f};
+  float tMax{1e30f};
+}; // struct TriangleRay
+
+struct TriangleHit {
+  float t{0.f};
+  float u{0.f};
+  float v{0.f};
+  std::uint32_t triangle{0};
+}; // struct TriangleHit
+
+[[nodiscard]] BVH BuildTriangleBVH(TriangleMesh const& mesh,
+                                   BVHBuildParams const& params);
+
+// Closest hit along ray, Moller-Trumbore, both sides of every triangle.
+[[nodiscard]] bool Intersect(TriangleMesh const& mesh, BVHView bvh,
+                             TriangleRay const& ray,
+                             TriangleHit& hit) noexcept;
+
+// The same without the hierarchy: every triangle is tested. The reference
+// Intersect is validated against.
+[[nodiscard]] bool IntersectBruteForce(TriangleMesh const& mesh,
+                                       TriangleRay const& ray,
+                                       TriangleHit& hit) noexcept;
+
+#endif // TRIANGLE_MESH_HPP_
@@ -0,0 +1,590 @@
+#include "video_stream.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+  (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VIDEO_USE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double SecondsSince(Clock::time_point start) noexcept {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+} // SecondsSince
+
+// BT.601 limited range in 8-bit fixed point, as most encoders assume for
+// y4m that does not say otherwise.
+inline std::uint8_t Luma(int r, int g, int b) noexcept {
+  return static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) +
+                                   16);
+} // Luma
+
+inline std::uint8_t ChromaU(int r, int g, int b) noexcept {
+  return static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) +
+                                   128);
+} // ChromaU
+
+inline std::uint8_t ChromaV(int r, int g, int b) noexcept {
+  return static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) +
+                                   128);
+} // ChromaV
+
+void LumaRowScalar(std::uint8_t const* rgba, std::uint8_t* y,
+                   std::uint32_t first, std::uint32_t last) noexcept {
+  for (std::uint32_t x = first; x < last; ++x) {
+    std::uint8_t const* p = rgba + std::size_t{x} * 4;
+    y[x] = Luma(p[0], p[1], p[2]);
+  }
+} // LumaRowScalar
+
+// Chroma samples [first, last) from the 2x2 blocks of rows top and bottom,
+// repeating the last column of an odd width.
+void ChromaRowScalar(std::uint8_t const* top, std::uint8_t const* bottom,
+                     std::uint32_t width, std::uint8_t* u, std::uint8_t* v,
+                     std::uint32_t first, std::uint32_t last) noexcept {
+  for (std::uint32_t cx = first; cx < last; ++cx) {
+    std::size_t const x0 = std::size_t{2} * cx * 4;
+    std::size_t const x1 = std::size_t{std::min(2 * cx + 1, width - 1)} * 4;
+    int rgb[3];
+    for (int c = 0; c < 3; ++c) {
+      rgb[c] = (top[x0 + c] + top[x1 + c] + bottom[x0 + c] + bottom[x1 + c] +
+                2) >>
+               2;
+    }
+    u[cx] = ChromaU(rgb[0], rgb[1], rgb[2]);
+    v[cx] = ChromaV(rgb[0], rgb[1], rgb[2]);
+  }
+} // ChromaRowScalar
+
+#ifdef VIDEO_USE_SSE2
+
+// The sums of adjacent 32-bit lanes of a then b: madd leaves each pixel's
+// dot product split over two lanes.
+inline __m128i AddPairs(__m128i a, __m128i b) noexcept {
+  __m128 const af = _mm_castsi128_ps(a);
+  __m128 const bf = _mm_castsi128_ps(b);
+  __m128i const even =
+    _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(2, 0, 2, 0)));
+  __m128i const odd =
+    _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(3, 1, 3, 1)));
+  return _mm_add_epi32(even, odd);
+} // AddPairs
+
+// ((dot + 128) >> 8) + offset of four dot products.
+inline __m128i Scale(__m128i dot, __m128i offset) noexcept {
+  return _mm_add_epi32(
+    _mm_srai_epi32(_mm_add_epi32(dot, _mm_set1_epi32(128)), 8), offset);
+} // Scale
+
+// Eight pixels per iteration: each RGBA pixel widened to four 16-bit lanes
+// and multiplied with the coefficients in one madd.
+std::uint32_t LumaRowSSE2(std::uint8_t const* rgba, std::uint8_t* y,
+                          std::uint32_t width) noexcept {
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const coefficients = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+  __m128i const offset = _mm_set1_epi32(16);
+
+  std::uint32_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    __m128i luma[2];
+    for (int half = 0; half < 2; ++half) {
+      __m128i const pixels = _mm_loadu_si128(
+        reinterpret_cast<__m128i const*>(rgba + std::size_t{x + 4 * half} * 4));
+      __m128i const lo =
+        _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), coefficients);
+      __m128i const hi =
+        _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), coefficients);
+      luma[half] = Scale(AddPairs(lo, hi), offset);
+    }
+    __m128i packed = _mm_packs_epi32(luma[0], luma[1]);
+    packed = _mm_packus_epi16(packed, packed);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(y + x), packed);
+  }
+  return x;
+} // LumaRowSSE2
+
+// Four 2x2 blocks per iteration. The vertical pairs are summed in 16-bit
+// lanes, then the horizontal ones by folding each register's upper pixel
+// onto its lower, which leaves one block's RGBA sums per 64 bits.
+std::uint32_t ChromaRowSSE2(std::uint8_t const* top,
+                            std::uint8_t const* bottom, std::uint32_t width,
+                            std::uint8_t* u, std::uint8_t* v) noexcept {
+  __m128i const zero = _mm_setzero_si128();
+  __m128i const two = _mm_set1_epi16(2);
+  __m128i const uCoefficients =
+    _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+  __m128i const vCoefficients =
+    _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+  __m128i const offset = _mm_set1_epi32(128);
+
+  std::uint32_t cx = 0;
+  for (; 2 * cx + 8 <= width; cx += 4) {
+    __m128i average[2];
+    for (int half = 0; half < 2; ++half) {
+      std::size_t const offsetBytes = (std::size_t{2} * cx + 4 * half) * 4;
+      __m128i const t =
+        _mm_loadu_si128(reinterpret_cast<__m128i const*>(top + offsetBytes));
+      __m128i const b = _mm_loadu_si128(
+        reinterpret_cast<__m128i const*>(bottom + offsetBytes));
+      __m128i const lo = _mm_add_epi16(_mm_unpacklo_epi8(t, zero),
+                                       _mm_unpacklo_epi8(b, zero));
+      __m128i const hi = _mm_add_epi16(_mm_unpackhi_epi8(t, zero),
+                                       _mm_unpackhi_epi8(b, zero));
+      __m128i const block0 = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+      __m128i const block1 = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+      average[half] = _mm_srli_epi16(
+        _mm_add_epi16(_mm_unpacklo_epi64(block0, block1), two), 2);
+    }
+
+    __m128i const uDots =
+      AddPairs(_mm_madd_epi16(average[0], uCoefficients),
+               _mm_madd_epi16(average[1], uCoefficients));
+    __m128i const vDots =
+      AddPairs(_mm_madd_epi16(average[0], vCoefficients),
+               _mm_madd_epi16(average[1], vCoefficients));
+
+    __m128i packed = _mm_packs_epi32(Scale(uDots, offset),
+                                     Scale(vDots, offset));
+    packed = _mm_packus_epi16(packed, packed);
+    std::uint64_t uv;
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(&uv), packed);
+    std::memcpy(u + cx, &uv, 4);
+    std::memcpy(v + cx, reinterpret_cast<std::uint8_t const*>(&uv) + 4, 4);
+  }
+  return cx;
+} // ChromaRowSSE2
+
+#endif // VIDEO_USE_SSE2
+
+bool ClampRows(LDRImageView const& src, YUV420ImageView const& dst,
+               std::uint32_t firstRow, std::uint32_t& rowCount) noexcept {
+  Expects(src.data != nullptr && dst.y != nullptr);
+  Expects(src.width == dst.width && src.height == dst.height);
+  Expects(src.rowPitch >= src.width);
+  Expects(firstRow % 2 == 0);
+
+  if (firstRow >= dst.height) return false;
+  rowCount = std::min(rowCount, dst.height - firstRow);
+  return true;
+} // ClampRows
+
+template <bool UseSIMD>
+void ConvertRows(LDRImageView const& src, YUV420ImageView const& dst,
+                 std::uint32_t firstRow, std::uint32_t lastRow) noexcept {
+  std::uint32_t const chromaWidth = dst.ChromaWidth();
+
+  for (std::uint32_t y = firstRow; y < lastRow; y += 2) {
+    std::uint8_t const* top = src.data + std::size_t{y} * src.rowPitch * 4;
+    std::uint8_t const* bottom =
+      src.data + std::size_t{std::min(y + 1, dst.height - 1)} * src.rowPitch *
+                   4;
+    std::uint8_t* const u = dst.u + std::size_t{y / 2} * chromaWidth;
+    std::uint8_t* const v = dst.v + std::size_t{y / 2} * chromaWidth;
+
+    for (std::uint32_t row = y; row < std::min(y + 2, lastRow); ++row) {
+      std::uint8_t const* rgba = row == y ? top : bottom;
+      std::uint8_t* const luma = dst.y + std::size_t{row} * dst.width;
+      std::uint32_t done = 0;
+#ifdef VIDEO_USE_SSE2
+      if constexpr (UseSIMD) done = LumaRowSSE2(rgba, luma, dst.width);
+#endif
+      LumaRowScalar(rgba, luma, done, dst.width);
+    }
+
+    std::uint32_t done = 0;
+#ifdef VIDEO_USE_SSE2
+    if constexpr (UseSIMD) done = ChromaRowSSE2(top, bottom, dst.width, u, v);
+#endif
+    ChromaRowScalar(top, bottom, dst.width, u, v, done, chromaWidth);
+  }
+} // ConvertRows
+
+// The frame's bytes in format, rows [firstRow, lastRow) of them.
+void ConvertFrameRows(VideoFormat format, LDRImageView const& src,
+                      std::uint8_t* frame, std::uint32_t firstRow,
+                      std::uint32_t lastRow) noexcept {
+  if (format == VideoFormat::kRGB24) {
+    for (std::uint32_t y = firstRow; y < lastRow; ++y) {
+      std::uint8_t const* in = src.data + std::size_t{y} * src.rowPitch * 4;
+      std::uint8_t* out = frame + std::size_t{y} * src.width * 3;
+      for (std::uint32_t x = 0; x < src.width; ++x, in += 4, out += 3) {
+        out[0] = in[0];
+        out[1] = in[1];
+        out[2] = in[2];
+      }
+    }
+    return;
+  }
+
+  std::size_t const lumaSize = std::size_t{src.width} * src.height;
+  std::size_t const chromaSize = std::size_t{(src.width + 1) / 2} *
+                                 ((src.height + 1) / 2);
+  YUV420ImageView const dst = {frame, frame + lumaSize,
+                               frame + lumaSize + chromaSize, src.width,
+                               src.height};
+  ConvertToYUV420(src, dst, firstRow, lastRow - firstRow);
+} // ConvertFrameRows
+
+// Write shares a frame out in bands of an even number of rows, like
+// RenderLayers' rows.
+constexpr std::uint32_t kBandRows = 16;
+
+} // namespace
+
+gsl::czstring to_string(VideoFormat format) noexcept {
+  switch (format) {
+  case VideoFormat::kY4M: return "y4m";
+  case VideoFormat::kRGB24: return "rgb24";
+  }
+  return "unknown";
+} // to_string
+
+bool FromString(gsl::czstring name, VideoFormat& format) noexcept {
+  for (auto candidate : {VideoFormat::kY4M, VideoFormat::kRGB24}) {
+    if (std::strcmp(name, to_string(candidate)) == 0) {
+      format = candidate;
+      return true;
+    }
+  }
+  return false;
+} // FromString
+
+std::uint64_t VideoFrameSize(VideoFormat format, std::uint32_t width,
+                             std::uint32_t height) noexcept {
+  if (format == VideoFormat::kRGB24) return std::uint64_t{3} * width * height;
+  return std::uint64_t{width} * height +
+         std::uint64_t{2} * ((width + 1) / 2) * ((height + 1) / 2);
+} // VideoFrameSize
+
+void ConvertToYUV420(LDRImageView const& src, YUV420ImageView const& dst,
+                     std::uint32_t firstRow, std::uint32_t rowCount) noexcept {
+  if (!ClampRows(src, dst, firstRow, rowCount)) return;
+  ConvertRows<true>(src, dst, firstRow, firstRow + rowCount);
+} // ConvertToYUV420
+
+void ConvertToYUV420Scalar(LDRImageView const& src,
+                           YUV420ImageView const& dst, std::uint32_t firstRow,
+                           std::uint32_t rowCount) noexcept {
+  if (!ClampRows(src, dst, firstRow, rowCount)) return;
+  ConvertRows<false>(src, dst, firstRow, firstRow + rowCount);
+} // ConvertToYUV420Scalar
+
+struct VideoStream::State {
+  VideoStreamParams params{};
+  std::FILE* file{nullptr};
+  bool ownsFile{false};
+  std::size_t frameSize{0};
+  std::array<std::vector<std::uint8_t>, 2> buffers{};
+  Clock::time_point start{};
+
+  // Frame n goes to buffers[n % 2]; the writer thread takes them in order.
+  std::mutex mutex{};
+  std::condition_variable changed{};
+  std::uint64_t submitted{0};
+  std::uint64_t written{0};
+  bool closing{false};
+  std::error_code error{};
+  std::string errorWhat{};
+  VideoStreamStats stats{};
+  std::thread writer{};
+
+  // Threads that convert bands of the frame Write hands them, together with
+  // Write's own thread, started by Open and kept until Close. Write waits
+  // for converting to drop to 0 before it returns.
+  std::vector<std::thread> converters{};
+  std::mutex convertMutex{};
+  std::condition_variable convertChanged{};
+  LDRImageView convertFrame{};
+  std::uint8_t* convertBuffer{nullptr};
+  std::uint32_t bandCount{0};
+  std::atomic<std::uint32_t> nextBand{0};
+  std::uint64_t converted{0}; // frames handed to the converters
+  std::size_t converting{0};  // converters not done with the last of them
+  bool stopping{false};
+
+  void WriteFrames() noexcept;
+  void ConvertFrames() noexcept;
+  void ConvertBands() noexcept;
+}; // struct VideoStream::State
+
+void VideoStream::State::WriteFrames() noexcept {
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    changed.wait(lock, [this] { return written < submitted || closing; });
+    if (written == submitted) break;
+
+    std::vector<std::uint8_t> const& buffer = buffers[written % 2];
+    bool const failed = static_cast<bool>(error);
+    lock.unlock();
+
+    // A stream that failed keeps taking frames, so Write never waits on
+    // it, and reports the error instead.
+    bool ok = true;
+    std::size_t bytes = 0;
+    if (!failed) {
+      static char const kFrameHeader[] = "FRAME\n";
+      if (params.format == VideoFormat::kY4M) {
+        ok = std::fwrite(kFrameHeader, 1, sizeof(kFrameHeader) - 1, file) ==
+             sizeof(kFrameHeader) - 1;
+        bytes += sizeof(kFrameHeader) - 1;
+      }
+      ok = ok && std::fwrite(buffer.data(), 1, buffer.size(), file) ==
+                   buffer.size();
+      bytes += buffer.size();
+    }
+    int const writeErrno = errno;
+
+    lock.lock();
+    if (!failed && !ok) {
+      error = std::error_code(writeErrno != 0 ? writeErrno : EIO,
+                              std::generic_category());
+      errorWhat = "fwrite";
+    } else if (!failed) {
+      stats.frames += 1;
+      stats.bytes += bytes;
+      stats.seconds = SecondsSince(start);
+    }
+    written += 1;
+    changed.notify_all();
+  }
+} // VideoStream::State::WriteFrames
+
+void VideoStream::State::ConvertFrames() noexcept {
+  std::uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(convertMutex);
+  for (;;) {
+    convertChanged.wait(lock,
+                        [this, seen] { return converted > seen || stopping; });
+    if (stopping) break;
+    seen = converted;
+    lock.unlock();
+
+    ConvertBands();
+
+    lock.lock();
+    if (--converting == 0) convertChanged.notify_all();
+  }
+} // VideoStream::State::ConvertFrames
+
+void VideoStream::State::ConvertBands() noexcept {
+  for (std::uint32_t band; (band = nextBand.fetch_add(1)) < bandCount;) {
+    std::uint32_t const first = band * kBandRows;
+    ConvertFrameRows(params.format, convertFrame, convertBuffer, first,
+                     std::min(first + kBandRows, convertFrame.height));
+  }
+} // VideoStream::State::ConvertBands
+
+VideoStream::VideoStream() noexcept = default;
+VideoStream::VideoStream(VideoStream&& other) noexcept = default;
+
+VideoStream& VideoStream::operator=(VideoStream&& other) noexcept {
+  if (this != &other) {
+    if (state_) (void)Close();
+    state_ = std::move(other.state_);
+  }
+  return *this;
+} // VideoStream::operator=
+
+VideoStream::~VideoStream() noexcept {
+  if (state_) (void)Close();
+} // VideoStream::~VideoStream
+
+tl::expected<VideoStream, std::system_error>
+VideoStream::Open(gsl::czstring path,
+                  VideoStreamParams const& params) noexcept {
+  Expects(path != nullptr);
+  Expects(params.width > 0 && params.height > 0);
+  Expects(params.framesPerSecond > 0);
+
+  VideoStream stream;
+  try {
+    stream.state_ = std::make_unique<State>();
+    State& state = *stream.state_;
+    state.params = params;
+    state.frameSize = static_cast<std::size_t>(
+      VideoFrameSize(params.format, params.width, params.height));
+    for (auto&& buffer : state.buffers) buffer.resize(state.frameSize);
+  } catch (std::bad_alloc const&) {
+    return tl::unexpected(std::system_error(
+      std::make_error_code(std::errc::not_enough_memory), "VideoStream"));
+  }
+  State& state = *stream.state_;
+
+  if (std::strcmp(path, "-") == 0) {
+    state.file = stdout;
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+  } else {
+    state.file = std::fopen(path, "wb");
+    if (state.file == nullptr) {
+      return tl::unexpected(std::system_error(
+        std::error_code(errno, std::generic_category()), path));
+    }
+    state.ownsFile = true;
+  }
+
+  if (params.format == VideoFormat::kY4M) {
+    // C420jpeg: chroma sited between the four luma samples it averages.
+    char header[128];
+    int const length = std::snprintf(
+      header, sizeof(header),
+      "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n",
+      params.width, params.height, params.framesPerSecond);
+    if (std::fwrite(header, 1, static_cast<std::size_t>(length),
+                    state.file) != static_cast<std::size_t>(length)) {
+      auto error = std::system_error(
+        std::error_code(errno, std::generic_category()), "fwrite");
+      if (state.ownsFile) std::fclose(state.file);
+      state.file = nullptr;
+      return tl::unexpected(error);
+    }
+    state.stats.bytes += static_cast<std::uint64_t>(length);
+  }
+
+  state.start = Clock::now();
+  try {
+    state.writer = std::thread([&state] { state.WriteFrames(); });
+  } catch (std::system_error const& error) {
+    if (state.ownsFile) std::fclose(state.file);
+    state.file = nullptr;
+    return tl::unexpected(error);
+  }
+
+  // No more threads than bands; Write's thread is one of them.
+  state.bandCount = (params.height + kBandRows - 1) / kBandRows;
+  std::uint32_t threadCount = params.threadCount;
+  if (threadCount == 0) {
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threadCount = std::min(threadCount, state.bandCount);
+  try {
+    state.converters.reserve(threadCount - 1);
+    for (std::uint32_t t = 1; t < threadCount; ++t) {
+      state.converters.emplace_back([&state] { state.ConvertFrames(); });
+    }
+  } catch (std::system_error const&) {
+    // Out of threads: the ones started and Write's share the bands.
+  } catch (std::bad_alloc const&) {
+  }
+  return stream;
+} // VideoStream::Open
+
+bool VideoStream::IsOpen() const noexcept {
+  return state_ != nullptr && state_->writer.joinable();
+} // VideoStream::IsOpen
+
+std::uint32_t VideoStream::Width() const noexcept {
+  Expects(state_ != nullptr);
+  return state_->params.width;
+} // VideoStream::Width
+
+std::uint32_t VideoStream::Height() const noexcept {
+  Expects(state_ != nullptr);
+  return state_->params.height;
+} // VideoStream::Height
+
+tl::expected<void, std::system_error>
+VideoStream::Write(LDRImageView const& frame) noexcept {
+  Expects(IsOpen());
+  State& state = *state_;
+  Expects(frame.width == state.params.width &&
+          frame.height == state.params.height);
+
+  // The buffer this frame goes to is free once the frame before the last
+  // has been written.
+  auto const waitStart = Clock::now();
+  std::uint64_t serial;
+  {
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.changed.wait(
+      lock, [&state] { return state.submitted < state.written + 2; });
+    if (state.error) {
+      return tl::unexpected(std::system_error(state.error, state.errorWhat));
+    }
+    serial = state.submitted;
+  }
+  double const waitSeconds = SecondsSince(waitStart);
+
+  auto const convertStart = Clock::now();
+  {
+    std::lock_guard<std::mutex> lock(state.convertMutex);
+    state.convertFrame = frame;
+    state.convertBuffer = state.buffers[serial % 2].data();
+    state.nextBand = 0;
+    state.converting = state.converters.size();
+    state.converted += 1;
+  }
+  state.convertChanged.notify_all();
+  state.ConvertBands();
+  {
+    std::unique_lock<std::mutex> lock(state.convertMutex);
+    state.convertChanged.wait(lock,
+                              [&state] { return state.converting == 0; });
+  }
+
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.stats.waitSeconds += waitSeconds;
+  state.stats.convertSeconds += SecondsSince(convertStart);
+  state.submitted += 1;
+  state.changed.notify_all();
+  return {};
+} // VideoStream::Write
+
+tl::expected<void, std::system_error> VideoStream::Close() noexcept {
+  if (!IsOpen()) return {};
+  State& state = *state_;
+
+  {
+    std::lock_guard<std::mutex> lock(state.convertMutex);
+    state.stopping = true;
+    state.convertChanged.notify_all();
+  }
+  for (auto&& converter : state.converters) converter.join();
+  state.converters.clear();
+
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.closing = true;
+    state.changed.notify_all();
+  }
+  state.writer.join();
+
+  bool flushed = std::fflush(state.file) == 0;
+  if (state.ownsFile) flushed = std::fclose(state.file) == 0 && flushed;
+  state.file = nullptr;
+
+  if (state.error) {
+    return tl::unexpected(std::system_error(state.error, state.errorWhat));
+  }
+  if (!flushed) {
+    return tl::unexpected(std::system_error(
+      std::error_code(errno, std::generic_category()), "fclose"));
+  }
+  return {};
+} // VideoStream::Close
+
+VideoStreamStats VideoStream::Stats() const noexcept {
+  if (!state_) return {};
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->stats;
+} // VideoStream::Stats
@@ -0,0 +1,129 @@
+#ifndef VIDEO_STREAM_HPP_
+#define VIDEO_STREAM_HPP_
+
+#include "expected.hpp"
+#include "gsl/gsl-lite.hpp"
+#include "tonemap.hpp"
+#include <cstdint>
+#include <memory>
+#include <system_error>
+
+//
+// Uncompressed video written as frames are rendered, to a file or to
+// stdout for an external encoder to read from a pipe:
+//
+//   scene_tool video scene.bin - | ffmpeg -i - turntable.mp4
+//
+// y4m is YUV 4:2:0 with BT.601 limited range coefficients, each chroma
+// sample the average of a 2x2 block, which every encoder reads without
+// being told the frame size. rgb24 is the frames' RGB bytes with nothing in
+// between, for tools that take -f rawvideo -pix_fmt rgb24 -s WxH.
+//
+// ConvertToYUV420 uses SSE2 where available and ConvertToYUV420Scalar is
+// the reference it is checked against; both compute in integers, so they
+// agree exactly.
+//
+// A VideoStream converts each frame on the calling thread, split by rows
+// over a few threads it keeps from Open to Close, into one of two buffers,
+// and writes the other on a thread of its own, so rendering the next frame
+// overlaps writing this one and only waits when the output falls more than
+// a frame behind.
+//
+
+enum class VideoFormat : std::uint32_t {
+  kY4M = 0,
+  kRGB24 = 1,
+};
+
+[[nodiscard]] gsl::czstring to_string(VideoFormat format) noexcept;
+
+// Inverse of to_string; false if name is not a format.
+[[nodiscard]] bool FromString(gsl::czstring name,
+                              VideoFormat& format) noexcept;
+
+// Planar YUV 4:2:0: a width by height luma plane and two chroma planes of
+// (width + 1) / 2 by (height + 1) / 2, each with rows packed tightly.
+struct YUV420ImageView {
+  std::uint8_t* y{nullptr};
+  std::uint8_t* u{nullptr};
+  std::uint8_t* v{nullptr};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+
+  [[nodiscard]] std::uint32_t ChromaWidth() const noexcept {
+    return (width + 1) / 2;
+  }
+  [[nodiscard]] std::uint32_t ChromaHeight() const noexcept {
+    return (height + 1) / 2;
+  }
+}; // struct YUV420ImageView
+
+// Bytes one frame takes in format.
+[[nodiscard]] std::uint64_t VideoFrameSize(VideoFormat format,
+                                           std::uint32_t width,
+                                           std::uint32_t height) noexcept;
+
+// Converts rows [firstRow, firstRow + rowCount) of src, which is the same
+// size as dst, so callers can split an image across threads. firstRow must
+// be even, as each chroma row comes from two luma rows; rowCount is clamped
+// to dst.height.
+void ConvertToYUV420(LDRImageView const& src, YUV420ImageView const& dst,
+                     std::uint32_t firstRow = 0,
+                     std::uint32_t rowCount = UINT32_MAX) noexcept;
+
+void ConvertToYUV420Scalar(LDRImageView const& src,
+                           YUV420ImageView const& dst,
+                           std::uint32_t firstRow = 0,
+                           std::uint32_t rowCount = UINT32_MAX) noexcept;
+
+struct VideoStreamParams {
+  VideoFormat format{VideoFormat::kY4M};
+  std::uint32_t width{0};
+  std::uint32_t height{0};
+  std::uint32_t framesPerSecond{30}; // recorded in the y4m header
+  std::uint32_t threadCount{0};      // for conversion, 0 for all
+}; // struct VideoStreamParams
+
+struct VideoStreamStats {
+  std::uint64_t frames{0};       // written
+  std::uint64_t bytes{0};        // written, headers included
+  double seconds{0.0};           // from Open to the last write
+  double convertSeconds{0.0};    // spent in conversion
+  double waitSeconds{0.0};       // Write spent waiting for a free buffer
+}; // struct VideoStreamStats
+
+class VideoStream {
+public:
+  // Write to path, or to stdout if path is "-".
+  [[nodiscard]] static tl::expected<VideoStream, std::system_error>
+  Open(gsl::czstring path, VideoStreamParams const& params) noexcept;
+
+  VideoStream() noexcept;
+  VideoStream(VideoStream&& other) noexcept;
+  VideoStream& operator=(VideoStream&& other) noexcept;
+  VideoStream(VideoStream const&) = delete;
+  VideoStream& operator=(VideoStream const&) = delete;
+  ~VideoStream() noexcept;
+
+  // Between Open and Close.
+  [[nodiscard]] bool IsOpen() const noexcept;
+
+  [[nodiscard]] std::uint32_t Width() const noexcept;
+  [[nodiscard]] std::uint32_t Height() const noexcept;
+
+  // Convert frame, which must be the stream's size, and queue it. Fails
+  // with the error of an earlier write if there was one.
+  [[nodiscard]] tl::expected<void, std::system_error>
+  Write(LDRImageView const& frame) noexcept;
+
+  // Write the queued frames and close the output.
+  [[nodiscard]] tl::expected<void, std::system_error> Close() noexcept;
+
+  [[nodiscard]] VideoStreamStats Stats() const noexcept;
+
+private:
+  struct State;
+  std::unique_ptr<State> state_;
+}; // class VideoStream
+
+#endif // VIDEO_STREAM_HPP_